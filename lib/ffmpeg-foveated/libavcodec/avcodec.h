@@ -1410,6 +1410,17 @@ enum AVPacketSideDataType {
      */
     AV_PKT_DATA_AFD,
 
+    /**
+     * Foveation descriptor of the frame this packet was encoded from: four
+     * floats (x, y, sigma, delta) of the primary fixation, same layout as
+     * AV_FRAME_DATA_FOVEATION_DESCRIPTOR. With temporal foveation a fifth
+     * float holds the period, negated if the periphery of this frame was
+     * kept from the previous one. Exported by foveated encoders so
+     * that muxers can tell foveal from peripheral parts of the bitstream,
+     * and exported again by decoders as frame side data.
+     */
+    AV_PKT_DATA_FOVEATION_DESCRIPTOR,
+
     /**
      * The number of side data types.
      * This is not part of the public API/ABI in the sense that it may
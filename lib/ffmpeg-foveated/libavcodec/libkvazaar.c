@@ -21,13 +21,17 @@
  */
 
 #include <kvazaar.h>
+#include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "libavutil/attributes.h"
 #include "libavutil/avassert.h"
+#include "libavutil/common.h"
 #include "libavutil/dict.h"
 #include "libavutil/error.h"
+#include "libavutil/frame.h"
 #include "libavutil/imgutils.h"
 #include "libavutil/internal.h"
 #include "libavutil/log.h"
@@ -38,6 +42,17 @@
 #include "avcodec.h"
 #include "internal.h"
 
+/* kvazaar codes 64x64 CTUs, its ROI map holds one delta QP per CTU */
+#define CTU_SIZE 64
+#define FOVEA_CACHE_SIZE 64
+
+typedef struct FoveaRoi {
+    float *key;     /* per fixation: CTU column and row, sigma, delta */
+    int key_len;
+    int8_t *dqp;    /* delta QP per CTU in raster scan order */
+    unsigned last_use;
+} FoveaRoi;
+
 typedef struct LibkvazaarContext {
     const AVClass *class;
 
@@ -46,6 +61,15 @@ typedef struct LibkvazaarContext {
     kvz_config *config;
 
     char *kvz_params;
+    int tile_cols;
+    int tile_rows;
+
+    /* maps of recently seen fixation buckets, least recently used evicted */
+    FoveaRoi fovea_cache[FOVEA_CACHE_SIZE];
+    unsigned fovea_uses;
+    float *fovea_key;
+    unsigned fovea_key_size;
+    int fovea_warned;
 } LibkvazaarContext;
 
 static av_cold int libkvazaar_init(AVCodecContext *avctx)
@@ -54,6 +78,7 @@ static av_cold int libkvazaar_init(AVCodecContext *avctx)
     const kvz_api *const api = ctx->api = kvz_api_get(8);
     kvz_config *cfg = NULL;
     kvz_encoder *enc = NULL;
+    char buf[32];
 
     /* Kvazaar requires width and height to be multiples of eight. */
     if (avctx->width % 8 || avctx->height % 8) {
@@ -100,6 +125,27 @@ static av_cold int libkvazaar_init(AVCodecContext *avctx)
     cfg->vui.sar_width  = avctx->sample_aspect_ratio.num;
     cfg->vui.sar_height = avctx->sample_aspect_ratio.den;
 
+    /*
+     * Tiles of about 1080p each, with wavefronts inside them, so that 8K
+     * frames keep all cores busy: wavefronts alone ramp up and down over
+     * every frame, each row waiting on the one above.
+     */
+    if (!ctx->tile_cols || !ctx->tile_rows) {
+        ctx->tile_cols = FFMAX(1, (avctx->width  + 1920 / 2) / 1920);
+        ctx->tile_rows = FFMAX(1, (avctx->height + 1080 / 2) / 1080);
+    }
+    if (ctx->tile_cols > 1 || ctx->tile_rows > 1) {
+        snprintf(buf, sizeof(buf), "%dx%d", ctx->tile_cols, ctx->tile_rows);
+        if (!api->config_parse(cfg, "tiles", buf))
+            av_log(avctx, AV_LOG_WARNING, "Invalid tiles %s.\n", buf);
+    }
+    api->config_parse(cfg, "wpp", "1");
+    /* 0 leaves kvazaar at one thread per core */
+    if (avctx->thread_count > 0) {
+        snprintf(buf, sizeof(buf), "%d", avctx->thread_count);
+        api->config_parse(cfg, "threads", buf);
+    }
+
     if (ctx->kvz_params) {
         AVDictionary *dict = NULL;
         if (!av_dict_parse_string(&dict, ctx->kvz_params, "=", ",", 0)) {
@@ -151,18 +197,128 @@ static av_cold int libkvazaar_init(AVCodecContext *avctx)
 static av_cold int libkvazaar_close(AVCodecContext *avctx)
 {
     LibkvazaarContext *ctx = avctx->priv_data;
+    int i;
 
     if (ctx->api) {
         ctx->api->encoder_close(ctx->encoder);
         ctx->api->config_destroy(ctx->config);
     }
 
+    for (i = 0; i < FOVEA_CACHE_SIZE; i++) {
+        av_freep(&ctx->fovea_cache[i].key);
+        av_freep(&ctx->fovea_cache[i].dqp);
+    }
+    av_freep(&ctx->fovea_key);
+
     if (avctx->extradata)
         av_freep(&avctx->extradata);
 
     return 0;
 }
 
+/**
+ * Delta QP per CTU for a foveation descriptor, the offsets of all fixations
+ * combined by their minimum. Fixations are snapped to the CTU they fall
+ * into, the map resolution, and the maps of recent buckets are cached, a
+ * steady gaze costs no recomputation.
+ *
+ * @param d foveation descriptor, nb_fix sets of x, y, sigma, delta
+ * @return map owned by the cache, valid until the next call, NULL on error
+ */
+static const int8_t *fovea_roi(LibkvazaarContext *ctx, const float *d, int nb_fix)
+{
+    int cols = (ctx->config->width  + CTU_SIZE - 1) / CTU_SIZE;
+    int rows = (ctx->config->height + CTU_SIZE - 1) / CTU_SIZE;
+    float diag = sqrtf(cols * cols + rows * rows);
+    int key_len = 4 * nb_fix;
+    FoveaRoi *e, *lru = &ctx->fovea_cache[0];
+    float *key;
+    int i, f, x, y;
+
+    av_fast_malloc(&ctx->fovea_key, &ctx->fovea_key_size, key_len * sizeof(*key));
+    key = ctx->fovea_key;
+    if (!key)
+        return NULL;
+    for (f = 0; f < key_len; f += 4) {
+        key[f]     = av_clip(floorf(d[f]     * cols), 0, cols - 1);
+        key[f + 1] = av_clip(floorf(d[f + 1] * rows), 0, rows - 1);
+        key[f + 2] = d[f + 2];
+        key[f + 3] = d[f + 3];
+    }
+
+    ctx->fovea_uses++;
+    for (i = 0; i < FOVEA_CACHE_SIZE; i++) {
+        e = &ctx->fovea_cache[i];
+        if (e->key_len == key_len && !memcmp(e->key, key, key_len * sizeof(*key))) {
+            e->last_use = ctx->fovea_uses;
+            return e->dqp;
+        }
+        if (e->last_use < lru->last_use)
+            lru = e;
+    }
+
+    e = lru;
+    av_freep(&e->key);
+    e->key_len = 0;
+    e->key = av_memdup(key, key_len * sizeof(*key));
+    if (!e->dqp)
+        e->dqp = av_malloc(cols * rows);
+    if (!e->key || !e->dqp)
+        return NULL;
+    e->key_len  = key_len;
+    e->last_use = ctx->fovea_uses;
+
+    for (y = 0; y < rows; y++) {
+        for (x = 0; x < cols; x++) {
+            float offset = INFINITY;
+
+            for (f = 0; f < key_len; f += 4) {
+                float sigma = key[f + 2] * diag;
+                float dist2 = (x - key[f]) * (x - key[f]) +
+                              (y - key[f + 1]) * (y - key[f + 1]);
+
+                offset = FFMIN(offset, key[f + 3] * (1 - expf(-dist2 / (sigma * sigma))));
+            }
+            e->dqp[x + y * cols] = av_clip(lrintf(offset), -51, 51);
+        }
+    }
+    return e->dqp;
+}
+
+static int libkvazaar_set_fovea(AVCodecContext *avctx, const AVFrameSideData *sd,
+                                kvz_picture *pic)
+{
+    LibkvazaarContext *ctx = avctx->priv_data;
+    int nb_fix = sd->size / (4 * sizeof(float));
+#if HAVE_STRUCT_KVZ_PICTURE_ROI
+    int cols = (ctx->config->width  + CTU_SIZE - 1) / CTU_SIZE;
+    int rows = (ctx->config->height + CTU_SIZE - 1) / CTU_SIZE;
+    const int8_t *dqp;
+
+    if (!nb_fix)
+        return 0;
+    av_log(avctx, AV_LOG_DEBUG, "Setting foveated delta QPs.\n");
+    dqp = fovea_roi(ctx, (const float *)sd->data, nb_fix);
+    if (!dqp)
+        return AVERROR(ENOMEM);
+
+    /* kvazaar frees the map along with the picture */
+    pic->roi.roi_array = malloc(cols * rows);
+    if (!pic->roi.roi_array)
+        return AVERROR(ENOMEM);
+    memcpy(pic->roi.roi_array, dqp, cols * rows);
+    pic->roi.width  = cols;
+    pic->roi.height = rows;
+#else
+    if (nb_fix && !ctx->fovea_warned) {
+        ctx->fovea_warned = 1;
+        av_log(avctx, AV_LOG_WARNING, "This kvazaar has no per-picture ROI maps, "
+               "skipping foveation.\n");
+    }
+#endif
+    return 0;
+}
+
 static int libkvazaar_encode(AVCodecContext *avctx,
                              AVPacket *avpkt,
                              const AVFrame *frame,
@@ -172,6 +328,7 @@ static int libkvazaar_encode(AVCodecContext *avctx,
     kvz_picture *input_pic = NULL;
     kvz_picture *recon_pic = NULL;
     kvz_frame_info frame_info;
+    AVFrameSideData *sd;
     kvz_data_chunk *data_out = NULL;
     uint32_t len_out = 0;
     int retval = 0;
@@ -222,6 +379,13 @@ static int libkvazaar_encode(AVCodecContext *avctx,
         }
 
         input_pic->pts = frame->pts;
+
+        sd = av_frame_get_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+        if (sd) {
+            retval = libkvazaar_set_fovea(avctx, sd, input_pic);
+            if (retval < 0)
+                goto done;
+        }
     }
 
     retval = ctx->api->encoder_encode(ctx->encoder,
@@ -282,6 +446,8 @@ static const enum AVPixelFormat pix_fmts[] = {
 static const AVOption options[] = {
     { "kvazaar-params", "Set kvazaar parameters as a comma-separated list of key=value pairs.",
         OFFSET(kvz_params), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, VE },
+    { "tiles", "Set a uniform grid of colsxrows tiles, by default of about 1080p each.",
+        OFFSET(tile_cols), AV_OPT_TYPE_IMAGE_SIZE, { .str = NULL }, 0, 0, VE },
     { NULL },
 };
 
@@ -294,6 +460,7 @@ static const AVClass class = {
 
 static const AVCodecDefault defaults[] = {
     { "b", "0" },
+    { "threads", "0" },
     { NULL },
 };
 
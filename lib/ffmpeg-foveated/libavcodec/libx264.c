@@ -52,6 +52,7 @@ typedef struct X264Context {
     uint8_t        *sei;
     int             sei_size;
     char *preset;
+    char *open_preset; ///< preset the analysis settings are from, to reconfigure on change
     char *tune;
     char *profile;
     char *level;
@@ -94,11 +95,23 @@ typedef struct X264Context {
     int chroma_offset;
     int scenechange_threshold;
     int noise_reduction;
+    int udu_sei;
 
     AVDictionary *x264_params;
 
     int nb_reordered_opaque, next_reordered_opaque;
     int64_t *reordered_opaque;
+    /* foveation descriptor per reordered_opaque slot as exported: primary
+     * fixation and signed temporal period, sigma 0 if none */
+    float (*foveation)[5];
+    /* frames since the periphery was last updated */
+    int fovea_frames;
+    int fovea_skip;
+    /* temporally filtered foveation offsets of the last frame */
+    float *fovea_map;
+    int fovea_map_blocks;
+    float fovea_attack;
+    float fovea_release;
 
     /**
      * If the encoder does not support ROI then warn the first time we
@@ -183,6 +196,98 @@ static int avfmt2_num_planes(int avfmt)
     }
 }
 
+/**
+ * Apply the analysis options and the x264opts and x264-params overrides,
+ * over a preset and after the rate control and frame structure they depend
+ * on, on open and on a runtime preset switch alike.
+ */
+static int apply_user_options(AVCodecContext *ctx, x264_param_t *params)
+{
+    X264Context *x4 = ctx->priv_data;
+    AVDictionaryEntry *en = NULL;
+
+#define PARSE_USER_OPT(name, var)\
+    if (x4->var && x264_param_parse(params, name, x4->var) < 0) {\
+        av_log(ctx, AV_LOG_ERROR, "Error parsing option '%s' with value '%s'.\n", name, x4->var);\
+        return AVERROR(EINVAL);\
+    }
+
+    if (x4->chroma_offset >= 0)
+        params->analyse.i_chroma_qp_offset = x4->chroma_offset;
+    if (ctx->trellis >= 0)
+        params->analyse.i_trellis          = ctx->trellis;
+    if (ctx->me_range >= 0)
+        params->analyse.i_me_range         = ctx->me_range;
+    if (x4->noise_reduction >= 0)
+        params->analyse.i_noise_reduction  = x4->noise_reduction;
+    if (ctx->me_subpel_quality >= 0)
+        params->analyse.i_subpel_refine    = ctx->me_subpel_quality;
+    if (ctx->me_cmp >= 0)
+        params->analyse.b_chroma_me        = ctx->me_cmp & FF_CMP_CHROMA;
+    PARSE_USER_OPT("psy-rd", psy_rd);
+    PARSE_USER_OPT("deblock", deblock);
+    PARSE_USER_OPT("partitions", partitions);
+    if (x4->psy >= 0)
+        params->analyse.b_psy              = x4->psy;
+    if (x4->weightb >= 0)
+        params->analyse.b_weighted_bipred  = x4->weightb;
+    if (x4->mixed_refs >= 0)
+        params->analyse.b_mixed_references = x4->mixed_refs;
+    if (x4->dct8x8 >= 0)
+        params->analyse.b_transform_8x8    = x4->dct8x8;
+    if (x4->fast_pskip >= 0)
+        params->analyse.b_fast_pskip       = x4->fast_pskip;
+    if (x4->direct_pred >= 0)
+        params->analyse.i_direct_mv_pred   = x4->direct_pred;
+
+    if (x4->fastfirstpass)
+        x264_param_apply_fastfirstpass(params);
+
+    if (x4->motion_est >= 0)
+        params->analyse.i_me_method = x4->motion_est;
+
+    if (x4->profile)
+        if (x264_param_apply_profile(params, x4->profile) < 0) {
+            int i;
+            av_log(ctx, AV_LOG_ERROR, "Error setting profile %s.\n", x4->profile);
+            av_log(ctx, AV_LOG_INFO, "Possible profiles:");
+            for (i = 0; x264_profile_names[i]; i++)
+                av_log(ctx, AV_LOG_INFO, " %s", x264_profile_names[i]);
+            av_log(ctx, AV_LOG_INFO, "\n");
+            return AVERROR(EINVAL);
+        }
+
+    if(x4->x264opts){
+        const char *p= x4->x264opts;
+        while(p){
+            char param[4096]={0}, val[4096]={0};
+            const char *v = val;
+            int ret;
+            if(sscanf(p, "%4095[^:=]=%4095[^:]", param, val) == 1)
+                v = "1";
+            if ((ret = x264_param_parse(params, param, v)) < 0) {
+                if(ret == X264_PARAM_BAD_NAME)
+                    av_log(ctx, AV_LOG_ERROR,
+                            "bad option '%s': '%s'\n", param, v);
+                else
+                    av_log(ctx, AV_LOG_ERROR,
+                            "bad value for '%s': '%s'\n", param, v);
+                return AVERROR(EINVAL);
+            }
+            p= strchr(p, ':');
+            p+=!!p;
+        }
+    }
+
+    while (en = av_dict_get(x4->x264_params, "", en, AV_DICT_IGNORE_SUFFIX)) {
+       if (x264_param_parse(params, en->key, en->value) < 0)
+           av_log(ctx, AV_LOG_WARNING,
+                  "Error parsing option '%s = %s'.\n",
+                   en->key, en->value);
+    }
+    return 0;
+}
+
 static void reconfig_encoder(AVCodecContext *ctx, const AVFrame *frame)
 {
     X264Context *x4 = ctx->priv_data;
@@ -233,6 +338,59 @@ static void reconfig_encoder(AVCodecContext *ctx, const AVFrame *frame)
         x4->params.rc.f_rf_constant_max = x4->crf_max;
         x264_encoder_reconfig(x4->enc, &x4->params);
     }
+
+    /* a preset set at runtime only changes the analysis, rate control and
+     * the frame structure stay as opened, options set explicitly stay too */
+    if (x4->preset && x4->open_preset && strcmp(x4->preset, x4->open_preset)) {
+        x264_param_t params = x4->params;
+        x264_param_t preset;
+        int ret;
+
+        x264_param_default(&preset);
+        ret = x264_param_default_preset(&preset, x4->preset, x4->tune);
+        if (ret >= 0) {
+            /* what the profile and first pass settings depend on */
+            preset.rc           = x4->params.rc;
+            preset.i_csp        = x4->params.i_csp;
+#if X264_BUILD >= 153
+            preset.i_bitdepth   = x4->params.i_bitdepth;
+#endif
+            preset.i_bframe     = x4->params.i_bframe;
+            preset.b_interlaced = x4->params.b_interlaced;
+            if (ctx->refs >= 0)
+                preset.i_frame_reference = ctx->refs;
+            ret = apply_user_options(ctx, &preset);
+        }
+        if (ret < 0) {
+            av_log(ctx, AV_LOG_ERROR, "Unknown preset %s, keeping %s.\n",
+                   x4->preset, x4->open_preset);
+        } else {
+            params.analyse                     = preset.analyse;
+            params.analyse.b_psnr              = x4->params.analyse.b_psnr;
+            params.analyse.b_ssim              = x4->params.analyse.b_ssim;
+            params.analyse.i_weighted_pred     = x4->params.analyse.i_weighted_pred;
+#ifdef X264_MBINFO_CONSTANT
+            params.analyse.b_mb_info           = x4->params.analyse.b_mb_info;
+#endif
+            params.b_deblocking_filter         = preset.b_deblocking_filter;
+            params.i_deblocking_filter_alphac0 = preset.i_deblocking_filter_alphac0;
+            params.i_deblocking_filter_beta    = preset.i_deblocking_filter_beta;
+            params.i_frame_reference           = FFMIN(preset.i_frame_reference,
+                                                       x4->params.i_frame_reference);
+            if (x264_encoder_reconfig(x4->enc, &params) < 0) {
+                av_log(ctx, AV_LOG_ERROR, "Cannot switch to preset %s, keeping %s.\n",
+                       x4->preset, x4->open_preset);
+            } else {
+                x4->params = params;
+                av_free(x4->open_preset);
+                x4->open_preset = av_strdup(x4->preset);
+            }
+        }
+        if (x4->open_preset && strcmp(x4->preset, x4->open_preset)) {
+            av_free(x4->preset);
+            x4->preset = av_strdup(x4->open_preset);
+        }
+    }
   }
 
     side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_STEREO3D);
@@ -326,6 +484,29 @@ static float *foveation_qp_offset_map(float x_fix, float y_fix, float sigma, flo
     return qomap;
 }
 
+/* QP offset of peripheral blocks that keep the previous frame */
+#define FOVEA_HOLD_QP 51
+
+/**
+ * Low-pass filter a quantization offset map over time
+ *
+ * Offsets dropping toward better quality, e.g. around a new fixation, follow
+ * with the attack factor, rising ones with the release factor. A slow release
+ * keeps peripheral blocks from flickering with every gaze movement.
+ *
+ * @param state filtered offsets of the previous frame, updated in place
+ * @param map offsets of the current frame, replaced by the filtered ones
+ * @param n number of blocks
+ */
+static void foveation_smooth(float *state, float *map, int n, float attack, float release)
+{
+    for (int i = 0; i < n; i++) {
+        float k = map[i] < state[i] ? attack : release;
+        state[i] += k * (map[i] - state[i]);
+        map[i] = state[i];
+    }
+}
+
 static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
                       int *got_packet)
 {
@@ -337,6 +518,7 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
     int bit_depth;
     int64_t *out_opaque;
     AVFrameSideData *sd;
+    int fovea_held = 0;
 
     x264_picture_init( &x4->pic );
     x4->pic.img.i_csp   = x4->params.i_csp;
@@ -358,6 +540,24 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
         x4->pic.i_pts  = frame->pts;
 
         x4->reordered_opaque[x4->next_reordered_opaque] = frame->reordered_opaque;
+        sd = av_frame_get_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+        memset(x4->foveation[x4->next_reordered_opaque], 0, sizeof(*x4->foveation));
+        if (sd && sd->size >= 4 * sizeof(float)) {
+            const float *d = (const float *)sd->data;
+            float *fov = x4->foveation[x4->next_reordered_opaque];
+            int period = 0;
+
+            /* the first float after the fixations is the temporal period,
+             * x264 has no per-MB chroma offsets for the chroma falloff */
+            if (sd->size / sizeof(*d) % 4 >= 1)
+                period = lrintf(d[sd->size / sizeof(*d) / 4 * 4]);
+            if (frame->pict_type == AV_PICTURE_TYPE_I || period <= 1)
+                x4->fovea_frames = 0;
+            fovea_held = x4->fovea_frames++ % FFMAX(period, 1) != 0;
+
+            memcpy(fov, d, 4 * sizeof(*d));
+            fov[4] = fovea_held ? -period : period;
+        }
         x4->pic.opaque = &x4->reordered_opaque[x4->next_reordered_opaque];
         x4->next_reordered_opaque++;
         x4->next_reordered_opaque %= x4->nb_reordered_opaque;
@@ -374,7 +574,8 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
             x4->pic.i_type = X264_TYPE_B;
             break;
         default:
-            x4->pic.i_type = X264_TYPE_AUTO;
+            /* an I-frame would have to code the held periphery */
+            x4->pic.i_type = fovea_held ? X264_TYPE_P : X264_TYPE_AUTO;
             break;
         }
         reconfig_encoder(ctx, frame);
@@ -402,6 +603,33 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
             }
         }
 
+        for (i = 0; x4->udu_sei && i < frame->nb_side_data; i++) {
+            x264_sei_t *sei = &x4->pic.extra_sei;
+            x264_sei_payload_t *payloads;
+            uint8_t *data;
+
+            sd = frame->side_data[i];
+            if (sd->type != AV_FRAME_DATA_SEI_UNREGISTERED)
+                continue;
+            /* x264 frees each payload and the array with sei_free */
+            payloads = av_realloc_array(sei->payloads, sei->num_payloads + 1,
+                                        sizeof(*payloads));
+            data = av_memdup(sd->data, sd->size);
+            if (!payloads || !data) {
+                av_log(ctx, AV_LOG_ERROR, "Not enough memory for user data SEI, skipping\n");
+                if (payloads)
+                    sei->payloads = payloads;
+                av_free(data);
+                break;
+            }
+            sei->payloads = payloads;
+            sei->sei_free = av_free;
+            sei->payloads[sei->num_payloads].payload_size = sd->size;
+            sei->payloads[sei->num_payloads].payload      = data;
+            sei->payloads[sei->num_payloads].payload_type = 5;
+            sei->num_payloads++;
+        }
+
         sd = av_frame_get_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
         if (sd) {
             if (x4->params.rc.i_aq_mode == X264_AQ_NONE) {
@@ -477,15 +705,70 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
                     av_log(ctx, AV_LOG_WARNING, "Adaptive quantization must be enabled to use foveated encoding, skipping foveation.\n");
                 }
             } else {
-                float *d;
+                int blocks = ((x4->params.i_width  + MB_SIZE - 1) / MB_SIZE) *
+                             ((x4->params.i_height + MB_SIZE - 1) / MB_SIZE);
+                float *d, *map;
+                uint8_t *mb_info = NULL;
 
                 av_log(ctx, AV_LOG_DEBUG, "Setting foveated qp offsets.\n");
 
                 d = (float*) sd->data;
-                x4->pic.prop.quant_offsets = foveation_qp_offset_map(d[0], d[1], d[2], d[3],
+                map = foveation_qp_offset_map(d[0], d[1], d[2], d[3],
                     x4->params.i_width,
                     x4->params.i_height,
                     MB_SIZE);
+                /* predicted fixations add a fovea each, the best quality wins */
+                for (int f = 4; f + 4 <= sd->size / sizeof(*d); f += 4) {
+                    float *m = foveation_qp_offset_map(d[f], d[f + 1], d[f + 2], d[f + 3],
+                        x4->params.i_width,
+                        x4->params.i_height,
+                        MB_SIZE);
+                    for (int j = 0; j < blocks; j++)
+                        map[j] = FFMIN(map[j], m[j]);
+                    free(m);
+                }
+                if (x4->fovea_map_blocks != blocks) {
+                    av_freep(&x4->fovea_map);
+                    x4->fovea_map = av_memdup(map, blocks * sizeof(*map));
+                    if (!x4->fovea_map) {
+                        free(map);
+                        return AVERROR(ENOMEM);
+                    }
+                    x4->fovea_map_blocks = blocks;
+                }
+                if (fovea_held) {
+                    mb_info = av_mallocz(blocks);
+                    if (!mb_info) {
+                        free(map);
+                        return AVERROR(ENOMEM);
+                    }
+                    /* the periphery of the descriptor, the smoothed map
+                     * lags behind, e.g. a suppression raising it at once */
+                    for (int j = 0; j < blocks; j++)
+                        mb_info[j] = map[j] > d[3] / 2;
+                }
+                foveation_smooth(x4->fovea_map, map, blocks,
+                                 x4->fovea_attack, x4->fovea_release);
+                if (mb_info) {
+                    /* temporal foveation: the periphery keeps the last
+                     * frame, marked unchanged so that x264 skips it */
+                    for (int j = 0; j < blocks; j++) {
+                        if (mb_info[j]) {
+                            map[j] = FOVEA_HOLD_QP;
+#ifdef X264_MBINFO_CONSTANT
+                            mb_info[j] = X264_MBINFO_CONSTANT;
+#endif
+                        }
+                    }
+#ifdef X264_MBINFO_CONSTANT
+                    if (x4->fovea_skip) {
+                        x4->pic.prop.mb_info = mb_info;
+                        x4->pic.prop.mb_info_free = av_free;
+                    } else
+#endif
+                        av_free(mb_info);
+                }
+                x4->pic.prop.quant_offsets = map;
                 x4->pic.prop.quant_offsets_free = free;
             }
         }
@@ -506,7 +789,16 @@ static int X264_frame(AVCodecContext *ctx, AVPacket *pkt, const AVFrame *frame,
     out_opaque = pic_out.opaque;
     if (out_opaque >= x4->reordered_opaque &&
         out_opaque < &x4->reordered_opaque[x4->nb_reordered_opaque]) {
+        const float *fov = x4->foveation[out_opaque - x4->reordered_opaque];
+
         ctx->reordered_opaque = *out_opaque;
+        if (ret && fov[2] > 0) {
+            int size = (fabsf(fov[4]) > 1 ? 5 : 4) * sizeof(*fov);
+            uint8_t *fd = av_packet_new_side_data(pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR, size);
+            if (!fd)
+                return AVERROR(ENOMEM);
+            memcpy(fd, fov, size);
+        }
     } else {
         // Unexpected opaque pointer on picture output
         ctx->reordered_opaque = 0;
@@ -555,6 +847,9 @@ static av_cold int X264_close(AVCodecContext *avctx)
     av_freep(&avctx->extradata);
     av_freep(&x4->sei);
     av_freep(&x4->reordered_opaque);
+    av_freep(&x4->foveation);
+    av_freep(&x4->fovea_map);
+    av_freep(&x4->open_preset);
 
     if (x4->enc) {
         x264_encoder_close(x4->enc);
@@ -564,20 +859,6 @@ static av_cold int X264_close(AVCodecContext *avctx)
     return 0;
 }
 
-#define OPT_STR(opt, param)                                                   \
-    do {                                                                      \
-        int ret;                                                              \
-        if ((ret = x264_param_parse(&x4->params, opt, param)) < 0) { \
-            if(ret == X264_PARAM_BAD_NAME)                                    \
-                av_log(avctx, AV_LOG_ERROR,                                   \
-                        "bad option '%s': '%s'\n", opt, param);               \
-            else                                                              \
-                av_log(avctx, AV_LOG_ERROR,                                   \
-                        "bad value for '%s': '%s'\n", opt, param);            \
-            return -1;                                                        \
-        }                                                                     \
-    } while (0)
-
 static int convert_pix_fmt(enum AVPixelFormat pix_fmt)
 {
     switch (pix_fmt) {
@@ -626,6 +907,7 @@ static av_cold int X264_init(AVCodecContext *avctx)
     X264Context *x4 = avctx->priv_data;
     AVCPBProperties *cpb_props;
     int sw,sh;
+    int ret;
 
     if (avctx->global_quality > 0)
         av_log(avctx, AV_LOG_WARNING, "-qscale is ignored, -crf is recommended.\n");
@@ -713,8 +995,6 @@ FF_DISABLE_DEPRECATION_WARNINGS
         x4->chroma_offset = avctx->chromaoffset;
 FF_ENABLE_DEPRECATION_WARNINGS
 #endif
-    if (x4->chroma_offset >= 0)
-        x4->params.analyse.i_chroma_qp_offset = x4->chroma_offset;
 
     if (avctx->gop_size >= 0)
         x4->params.i_keyint_max         = avctx->gop_size;
@@ -764,20 +1044,15 @@ FF_ENABLE_DEPRECATION_WARNINGS
                 x4->params.i_frame_reference = av_clip(x264_levels[i].dpb / mbn / scale, 1, x4->params.i_frame_reference);
     }
 
-    if (avctx->trellis >= 0)
-        x4->params.analyse.i_trellis    = avctx->trellis;
-    if (avctx->me_range >= 0)
-        x4->params.analyse.i_me_range   = avctx->me_range;
 #if FF_API_PRIVATE_OPT
     FF_DISABLE_DEPRECATION_WARNINGS
     if (avctx->noise_reduction >= 0)
         x4->noise_reduction = avctx->noise_reduction;
     FF_ENABLE_DEPRECATION_WARNINGS
 #endif
-    if (x4->noise_reduction >= 0)
-        x4->params.analyse.i_noise_reduction = x4->noise_reduction;
-    if (avctx->me_subpel_quality >= 0)
-        x4->params.analyse.i_subpel_refine   = avctx->me_subpel_quality;
+#ifdef X264_MBINFO_CONSTANT
+    x4->params.analyse.b_mb_info = x4->fovea_skip;
+#endif
 #if FF_API_PRIVATE_OPT
 FF_DISABLE_DEPRECATION_WARNINGS
     if (avctx->b_frame_strategy >= 0)
@@ -792,25 +1067,16 @@ FF_DISABLE_DEPRECATION_WARNINGS
         x4->coder = avctx->coder_type == FF_CODER_TYPE_AC;
 FF_ENABLE_DEPRECATION_WARNINGS
 #endif
-    if (avctx->me_cmp >= 0)
-        x4->params.analyse.b_chroma_me = avctx->me_cmp & FF_CMP_CHROMA;
 
     if (x4->aq_mode >= 0)
         x4->params.rc.i_aq_mode = x4->aq_mode;
     if (x4->aq_strength >= 0)
         x4->params.rc.f_aq_strength = x4->aq_strength;
-    PARSE_X264_OPT("psy-rd", psy_rd);
-    PARSE_X264_OPT("deblock", deblock);
-    PARSE_X264_OPT("partitions", partitions);
     PARSE_X264_OPT("stats", stats);
-    if (x4->psy >= 0)
-        x4->params.analyse.b_psy  = x4->psy;
     if (x4->rc_lookahead >= 0)
         x4->params.rc.i_lookahead = x4->rc_lookahead;
     if (x4->weightp >= 0)
         x4->params.analyse.i_weighted_pred = x4->weightp;
-    if (x4->weightb >= 0)
-        x4->params.analyse.b_weighted_bipred = x4->weightb;
     if (x4->cplxblur >= 0)
         x4->params.rc.f_complexity_blur = x4->cplxblur;
 
@@ -833,25 +1099,14 @@ FF_ENABLE_DEPRECATION_WARNINGS
         x4->params.i_bframe_bias              = x4->b_bias;
     if (x4->b_pyramid >= 0)
         x4->params.i_bframe_pyramid = x4->b_pyramid;
-    if (x4->mixed_refs >= 0)
-        x4->params.analyse.b_mixed_references = x4->mixed_refs;
-    if (x4->dct8x8 >= 0)
-        x4->params.analyse.b_transform_8x8    = x4->dct8x8;
-    if (x4->fast_pskip >= 0)
-        x4->params.analyse.b_fast_pskip       = x4->fast_pskip;
     if (x4->aud >= 0)
         x4->params.b_aud                      = x4->aud;
     if (x4->mbtree >= 0)
         x4->params.rc.b_mb_tree               = x4->mbtree;
-    if (x4->direct_pred >= 0)
-        x4->params.analyse.i_direct_mv_pred   = x4->direct_pred;
 
     if (x4->slice_max_size >= 0)
         x4->params.i_slice_max_size =  x4->slice_max_size;
 
-    if (x4->fastfirstpass)
-        x264_param_apply_fastfirstpass(&x4->params);
-
     /* Allow specifying the x264 profile through AVCodecContext. */
     if (!x4->profile)
         switch (avctx->profile) {
@@ -880,26 +1135,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
     if (x4->nal_hrd >= 0)
         x4->params.i_nal_hrd = x4->nal_hrd;
 
-    if (x4->motion_est >= 0)
-        x4->params.analyse.i_me_method = x4->motion_est;
-
     if (x4->coder >= 0)
         x4->params.b_cabac = x4->coder;
 
     if (x4->b_frame_strategy >= 0)
         x4->params.i_bframe_adaptive = x4->b_frame_strategy;
 
-    if (x4->profile)
-        if (x264_param_apply_profile(&x4->params, x4->profile) < 0) {
-            int i;
-            av_log(avctx, AV_LOG_ERROR, "Error setting profile %s.\n", x4->profile);
-            av_log(avctx, AV_LOG_INFO, "Possible profiles:");
-            for (i = 0; x264_profile_names[i]; i++)
-                av_log(avctx, AV_LOG_INFO, " %s", x264_profile_names[i]);
-            av_log(avctx, AV_LOG_INFO, "\n");
-            return AVERROR(EINVAL);
-        }
-
     x4->params.i_width          = avctx->width;
     x4->params.i_height         = avctx->height;
     av_reduce(&sw, &sh, avctx->sample_aspect_ratio.num, avctx->sample_aspect_ratio.den, 4096);
@@ -942,29 +1183,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
     if (avctx->flags & AV_CODEC_FLAG_GLOBAL_HEADER)
         x4->params.b_repeat_headers = 0;
 
-    if(x4->x264opts){
-        const char *p= x4->x264opts;
-        while(p){
-            char param[4096]={0}, val[4096]={0};
-            if(sscanf(p, "%4095[^:=]=%4095[^:]", param, val) == 1){
-                OPT_STR(param, "1");
-            }else
-                OPT_STR(param, val);
-            p= strchr(p, ':');
-            p+=!!p;
-        }
-    }
-
-
-    {
-        AVDictionaryEntry *en = NULL;
-        while (en = av_dict_get(x4->x264_params, "", en, AV_DICT_IGNORE_SUFFIX)) {
-           if (x264_param_parse(&x4->params, en->key, en->value) < 0)
-               av_log(avctx, AV_LOG_WARNING,
-                      "Error parsing option '%s = %s'.\n",
-                       en->key, en->value);
-        }
-    }
+    /* the profile restricts what the options before it set */
+    if ((ret = apply_user_options(avctx, &x4->params)) < 0)
+        return ret;
 
     // update AVCodecContext with x264 parameters
     avctx->has_b_frames = x4->params.i_bframe ?
@@ -978,6 +1199,12 @@ FF_ENABLE_DEPRECATION_WARNINGS
     if (!x4->enc)
         return AVERROR_EXTERNAL;
 
+    if (x4->preset) {
+        x4->open_preset = av_strdup(x4->preset);
+        if (!x4->open_preset)
+            return AVERROR(ENOMEM);
+    }
+
     if (avctx->flags & AV_CODEC_FLAG_GLOBAL_HEADER) {
         x264_nal_t *nal;
         uint8_t *p;
@@ -1017,7 +1244,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
     x4->nb_reordered_opaque = x264_encoder_maximum_delayed_frames(x4->enc) + 17;
     x4->reordered_opaque    = av_malloc_array(x4->nb_reordered_opaque,
                                               sizeof(*x4->reordered_opaque));
-    if (!x4->reordered_opaque)
+    x4->foveation           = av_mallocz_array(x4->nb_reordered_opaque,
+                                               sizeof(*x4->foveation));
+    if (!x4->reordered_opaque || !x4->foveation)
         return AVERROR(ENOMEM);
 
     return 0;
@@ -1173,7 +1402,11 @@ static const AVOption options[] = {
     { "chromaoffset", "QP difference between chroma and luma",            OFFSET(chroma_offset), AV_OPT_TYPE_INT, { .i64 = -1 }, INT_MIN, INT_MAX, VE },
     { "sc_threshold", "Scene change threshold",                           OFFSET(scenechange_threshold), AV_OPT_TYPE_INT, { .i64 = -1 }, INT_MIN, INT_MAX, VE },
     { "noise_reduction", "Noise reduction",                               OFFSET(noise_reduction), AV_OPT_TYPE_INT, { .i64 = -1 }, INT_MIN, INT_MAX, VE },
+    { "udu_sei",      "Use user data unregistered SEI if available",      OFFSET(udu_sei),  AV_OPT_TYPE_BOOL,   { .i64 = 0 }, 0, 1, VE },
 
+    { "fovea_attack", "Share of a drop in foveation QP offsets applied per frame", OFFSET(fovea_attack), AV_OPT_TYPE_FLOAT, { .dbl = 1 }, 0.001, 1, VE },
+    { "fovea_release", "Share of a rise in foveation QP offsets applied per frame", OFFSET(fovea_release), AV_OPT_TYPE_FLOAT, { .dbl = 0.1 }, 0.001, 1, VE },
+    { "fovea_skip",    "Skip the held periphery of temporally foveated frames", OFFSET(fovea_skip), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, VE },
     { "x264-params",  "Override the x264 configuration using a :-separated list of key=value parameters", OFFSET(x264_params), AV_OPT_TYPE_DICT, { 0 }, 0, 0, VE },
     { NULL },
 };
@@ -49,6 +49,12 @@ typedef struct libx265Context {
     char *profile;
     AVDictionary *x265_opts;
 
+    /* temporally filtered foveation offsets of the last frame */
+    float *fovea_map;
+    int fovea_map_blocks;
+    float fovea_attack;
+    float fovea_release;
+
     /**
      * If the encoder does not support ROI then warn the first time we
      * encounter a frame with ROI side data.
@@ -76,6 +82,7 @@ static av_cold int libx265_encode_close(AVCodecContext *avctx)
     libx265Context *ctx = avctx->priv_data;
 
     ctx->api->param_free(ctx->params);
+    av_freep(&ctx->fovea_map);
 
     if (ctx->encoder)
         ctx->api->encoder_close(ctx->encoder);
@@ -447,6 +454,26 @@ static float *foveation_qp_offset_map(float x_fix, float y_fix, float sigma, flo
     return qomap;
 }
 
+/**
+ * Low-pass filter a quantization offset map over time
+ *
+ * Offsets dropping toward better quality, e.g. around a new fixation, follow
+ * with the attack factor, rising ones with the release factor. A slow release
+ * keeps peripheral blocks from flickering with every gaze movement.
+ *
+ * @param state filtered offsets of the previous frame, updated in place
+ * @param map offsets of the current frame, replaced by the filtered ones
+ * @param n number of blocks
+ */
+static void foveation_smooth(float *state, float *map, int n, float attack, float release)
+{
+    for (int i = 0; i < n; i++) {
+        float k = map[i] < state[i] ? attack : release;
+        state[i] += k * (map[i] - state[i]);
+        map[i] = state[i];
+    }
+}
+
 static av_cold int libx265_encode_set_roi(libx265Context *ctx, const AVFrame *frame, x265_picture* pic)
 {
     AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
@@ -516,13 +543,38 @@ static av_cold int libx265_encode_set_roi(libx265Context *ctx, const AVFrame *fr
                     av_log(ctx, AV_LOG_WARNING, "Adaptive quantization must be enabled to use foveated encoding, skipping foveation.\n");
                 }
             } else {
-                float *d;
+                int qg = ctx->params->rc.qgSize;
+                int blocks = ((ctx->params->sourceWidth  + qg - 1) / qg) *
+                             ((ctx->params->sourceHeight + qg - 1) / qg);
+                float *d, *map;
                 av_log(ctx, AV_LOG_DEBUG, "Setting foveated qp offsets\n");
                 d = (float*) sd->data;
-                pic->quantOffsets = foveation_qp_offset_map(d[0], d[1], d[2], d[3],
+                map = foveation_qp_offset_map(d[0], d[1], d[2], d[3],
                     ctx->params->sourceWidth,
                     ctx->params->sourceHeight,
-                    ctx->params->rc.qgSize);
+                    qg);
+                /* predicted fixations add a fovea each, the best quality wins */
+                for (int f = 4; f + 4 <= sd->size / sizeof(*d); f += 4) {
+                    float *m = foveation_qp_offset_map(d[f], d[f + 1], d[f + 2], d[f + 3],
+                        ctx->params->sourceWidth,
+                        ctx->params->sourceHeight,
+                        qg);
+                    for (int j = 0; j < blocks; j++)
+                        map[j] = FFMIN(map[j], m[j]);
+                    free(m);
+                }
+                if (ctx->fovea_map_blocks != blocks) {
+                    av_freep(&ctx->fovea_map);
+                    ctx->fovea_map = av_memdup(map, blocks * sizeof(*map));
+                    if (!ctx->fovea_map) {
+                        free(map);
+                        return AVERROR(ENOMEM);
+                    }
+                    ctx->fovea_map_blocks = blocks;
+                }
+                foveation_smooth(ctx->fovea_map, map, blocks,
+                                 ctx->fovea_attack, ctx->fovea_release);
+                pic->quantOffsets = map;
             }
         }
 
@@ -700,6 +752,8 @@ static const AVOption options[] = {
     { "preset",      "set the x265 preset",                                                         OFFSET(preset),    AV_OPT_TYPE_STRING, { 0 }, 0, 0, VE },
     { "tune",        "set the x265 tune parameter",                                                 OFFSET(tune),      AV_OPT_TYPE_STRING, { 0 }, 0, 0, VE },
     { "profile",     "set the x265 profile",                                                        OFFSET(profile),   AV_OPT_TYPE_STRING, { 0 }, 0, 0, VE },
+    { "fovea_attack", "share of a drop in foveation QP offsets applied per frame",                  OFFSET(fovea_attack), AV_OPT_TYPE_FLOAT, { .dbl = 1 }, 0.001, 1, VE },
+    { "fovea_release", "share of a rise in foveation QP offsets applied per frame",                 OFFSET(fovea_release), AV_OPT_TYPE_FLOAT, { .dbl = 0.1 }, 0.001, 1, VE },
     { "x265-params", "set the x265 configuration using a :-separated list of key=value parameters", OFFSET(x265_opts), AV_OPT_TYPE_DICT,   { 0 }, 0, 0, VE },
     { NULL }
 };
@@ -44,7 +44,7 @@ static int add_mb(AVMotionVector *mb, uint32_t mb_type,
     mb->src_x = dst_x + motion_x / motion_scale;
     mb->src_y = dst_y + motion_y / motion_scale;
     mb->source = direction ? 1 : -1;
-    mb->flags = 0; // XXX: does mb_type contain extra information that could be exported here?
+    mb->flags = IS_SKIP(mb_type) ? AV_MOTION_VECTOR_FLAG_SKIP : 0;
     return 1;
 }
 
@@ -552,6 +552,16 @@ typedef struct MpegEncContext {
     float rc_buffer_aggressivity;
     float border_masking;
     int lmin, lmax;
+
+    /* foveation */
+    int foveation;              ///< apply the foveation descriptor of the input frames
+    float *fovea_qp;            ///< QP offset of each MB of the current picture
+    float *fovea_cqp;           ///< additional chroma QP offset of each MB
+    uint8_t *fovea_hold;        ///< peripheral MBs, kept from the reference if fovea_held
+    int fovea_held;             ///< the periphery of the current picture is not updated
+    int fovea_frames;           ///< pictures since the periphery was last updated
+    float fovea_descr[5];       ///< primary fixation and period, exported with the packet
+    int fovea_descr_size;
     int vbv_ignore_qmax;
 
     char *rc_eq;
@@ -641,6 +651,7 @@ FF_MPV_OPT_CMP_FUNC, \
 {"rc_init_cplx", "initial complexity for 1-pass encoding",          FF_MPV_OFFSET(rc_initial_cplx), AV_OPT_TYPE_FLOAT, {.dbl = 0 }, -FLT_MAX, FLT_MAX, FF_MPV_OPT_FLAGS},       \
 {"rc_buf_aggressivity", "currently useless",                        FF_MPV_OFFSET(rc_buffer_aggressivity), AV_OPT_TYPE_FLOAT, {.dbl = 1.0 }, -FLT_MAX, FLT_MAX, FF_MPV_OPT_FLAGS}, \
 {"border_mask", "increase the quantizer for macroblocks close to borders", FF_MPV_OFFSET(border_masking), AV_OPT_TYPE_FLOAT, {.dbl = 0 }, -FLT_MAX, FLT_MAX, FF_MPV_OPT_FLAGS},    \
+{"fovea", "apply the foveation descriptor of input frames",          FF_MPV_OFFSET(foveation), AV_OPT_TYPE_BOOL, {.i64 = 0 }, 0, 1, FF_MPV_OPT_FLAGS },                        \
 {"lmin", "minimum Lagrange factor (VBR)",                           FF_MPV_OFFSET(lmin), AV_OPT_TYPE_INT, {.i64 =  2*FF_QP2LAMBDA }, 0, INT_MAX, FF_MPV_OPT_FLAGS },            \
 {"lmax", "maximum Lagrange factor (VBR)",                           FF_MPV_OFFSET(lmax), AV_OPT_TYPE_INT, {.i64 = 31*FF_QP2LAMBDA }, 0, INT_MAX, FF_MPV_OPT_FLAGS },            \
 {"ibias", "intra quant bias",                                       FF_MPV_OFFSET(intra_quant_bias), AV_OPT_TYPE_INT, {.i64 = FF_DEFAULT_QUANT_BIAS }, INT_MIN, INT_MAX, FF_MPV_OPT_FLAGS },   \
@@ -418,14 +418,14 @@ FF_ENABLE_DEPRECATION_WARNINGS
     /* Fixed QSCALE */
     s->fixed_qscale = !!(avctx->flags & AV_CODEC_FLAG_QSCALE);
 
-    s->adaptive_quant = (s->avctx->lumi_masking ||
-                         s->avctx->dark_masking ||
-                         s->avctx->temporal_cplx_masking ||
-                         s->avctx->spatial_cplx_masking  ||
-                         s->avctx->p_masking      ||
-                         s->border_masking ||
-                         (s->mpv_flags & FF_MPV_FLAG_QP_RD)) &&
-                        !s->fixed_qscale;
+    s->adaptive_quant = ((s->avctx->lumi_masking ||
+                          s->avctx->dark_masking ||
+                          s->avctx->temporal_cplx_masking ||
+                          s->avctx->spatial_cplx_masking  ||
+                          s->avctx->p_masking      ||
+                          s->border_masking ||
+                          (s->mpv_flags & FF_MPV_FLAG_QP_RD)) &&
+                         !s->fixed_qscale) || s->foveation;
 
     s->loop_filter = !!(s->avctx->flags & AV_CODEC_FLAG_LOOP_FILTER);
 
@@ -941,6 +941,15 @@ FF_ENABLE_DEPRECATION_WARNINGS
     FF_ALLOCZ_OR_GOTO(s->avctx, s->reordered_input_picture,
                       MAX_PICTURE_COUNT * sizeof(Picture *), fail);
 
+    if (s->foveation) {
+        FF_ALLOCZ_OR_GOTO(s->avctx, s->fovea_qp,
+                          s->mb_stride * s->mb_height * sizeof(float), fail);
+        FF_ALLOCZ_OR_GOTO(s->avctx, s->fovea_hold,
+                          s->mb_stride * s->mb_height, fail);
+        FF_ALLOCZ_OR_GOTO(s->avctx, s->fovea_cqp,
+                          s->mb_stride * s->mb_height * sizeof(float), fail);
+    }
+
 
     if (s->noise_reduction) {
         FF_ALLOCZ_OR_GOTO(s->avctx, s->dct_offset,
@@ -1098,6 +1107,9 @@ av_cold int ff_mpv_encode_end(AVCodecContext *avctx)
     av_freep(&s->input_picture);
     av_freep(&s->reordered_input_picture);
     av_freep(&s->dct_offset);
+    av_freep(&s->fovea_qp);
+    av_freep(&s->fovea_hold);
+    av_freep(&s->fovea_cqp);
 
     return 0;
 }
@@ -1816,6 +1828,82 @@ static int frame_start(MpegEncContext *s)
     return 0;
 }
 
+/* the union of the gaussians of all fixations, sigmas scaled by scale */
+static float fovea_offset(MpegEncContext *s, const float *d, int nb,
+                          int x, int y, float scale)
+{
+    const float diag = sqrtf(s->mb_width * s->mb_width + s->mb_height * s->mb_height);
+    float qp = d[3];
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        const float *f = d + 4 * i;
+        float dx = x + 0.5f - f[0] * s->mb_width;
+        float dy = y + 0.5f - f[1] * s->mb_height;
+        float sigma = f[2] * diag * scale;
+
+        if (sigma > 0)
+            qp = FFMIN(qp, f[3] * (1 - expf(-(dx * dx + dy * dy) / (sigma * sigma))));
+    }
+    return qp;
+}
+
+/**
+ * Build the QP offset map of the current picture from its foveation
+ * descriptor, the same gaussians the foveated x264 and x265 wrappers use.
+ * With temporal foveation every period-th P-picture updates the periphery,
+ * the others hold it: MBs whose offset exceeds half the maximal one are
+ * coded as zero motion without residual, i.e. skipped. A chroma falloff
+ * narrows the gaussians for chroma and raises their maximal offset by its
+ * inverse, the excess over the luma offset is kept in fovea_cqp.
+ */
+static void foveate_picture(MpegEncContext *s)
+{
+    AVFrameSideData *sd = av_frame_get_side_data(s->new_picture.f,
+                                                 AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+    const float *d;
+    float chroma = 0;
+    int nb, tail, period = 0, x, y;
+
+    s->fovea_held = 0;
+    s->fovea_descr_size = 0;
+    if (!sd || sd->size < 4 * sizeof(*d) || ((float *)sd->data)[2] <= 0) {
+        memset(s->fovea_qp,  0, s->mb_stride * s->mb_height * sizeof(*s->fovea_qp));
+        memset(s->fovea_cqp, 0, s->mb_stride * s->mb_height * sizeof(*s->fovea_cqp));
+        s->fovea_frames = 0;
+        return;
+    }
+    d    = (const float *)sd->data;
+    nb   = sd->size / (4 * sizeof(*d));
+    tail = sd->size / sizeof(*d) % 4;
+    if (tail >= 1)
+        period = lrintf(d[4 * nb]);
+    if (tail >= 2 && d[4 * nb + 1] > 0 && d[4 * nb + 1] < 1)
+        chroma = d[4 * nb + 1];
+
+    for (y = 0; y < s->mb_height; y++) {
+        for (x = 0; x < s->mb_width; x++) {
+            float qp = fovea_offset(s, d, nb, x, y, 1);
+
+            s->fovea_qp[y * s->mb_stride + x]   = qp;
+            s->fovea_hold[y * s->mb_stride + x] = qp > d[3] / 2;
+            s->fovea_cqp[y * s->mb_stride + x]  =
+                chroma ? fovea_offset(s, d, nb, x, y, chroma) / chroma - qp : 0;
+        }
+    }
+
+    if (s->pict_type == AV_PICTURE_TYPE_I || period <= 1)
+        s->fovea_frames = 0;
+    if (s->pict_type == AV_PICTURE_TYPE_P)
+        s->fovea_held = s->fovea_frames % FFMAX(period, 1) != 0;
+    if (s->pict_type != AV_PICTURE_TYPE_B)
+        s->fovea_frames++;
+
+    memcpy(s->fovea_descr, d, 4 * sizeof(*d));
+    s->fovea_descr[4] = period;
+    s->fovea_descr_size = (period > 1 ? 5 : 4) * sizeof(*d);
+}
+
 int ff_mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
                           const AVFrame *pic_arg, int *got_packet)
 {
@@ -1860,6 +1948,8 @@ int ff_mpv_encode_picture(AVCodecContext *avctx, AVPacket *pkt,
         }
 
         s->pict_type = s->new_picture.f->pict_type;
+        if (s->foveation)
+            foveate_picture(s);
         //emms_c();
         ret = frame_start(s);
         if (ret < 0)
@@ -2060,6 +2150,16 @@ FF_ENABLE_DEPRECATION_WARNINGS
             pkt->flags |= AV_PKT_FLAG_KEY;
         if (s->mb_info)
             av_packet_shrink_side_data(pkt, AV_PKT_DATA_H263_MB_INFO, s->mb_info_size);
+        if (s->fovea_descr_size) {
+            uint8_t *fd = av_packet_new_side_data(pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR,
+                                                  s->fovea_descr_size);
+            if (!fd)
+                return AVERROR(ENOMEM);
+            memcpy(fd, s->fovea_descr, s->fovea_descr_size);
+            /* a scene change may have turned a held picture into an I one */
+            if (s->fovea_held && s->pict_type == AV_PICTURE_TYPE_P)
+                ((float *)fd)[4] *= -1;
+        }
     } else {
         s->frame_bits = 0;
     }
@@ -2133,6 +2233,31 @@ static inline void dct_single_coeff_elimination(MpegEncContext *s,
         s->block_last_index[n] = -1;
 }
 
+/**
+ * MPEG-4 and H.263 derive the chroma quantizer from the luma one, so a
+ * chroma QP offset is emulated by zeroing the levels a quantizer that much
+ * coarser would round to zero. The intra DC is kept.
+ */
+static void fovea_chroma_elimination(MpegEncContext *s, int n, float offset)
+{
+    const float step = exp2f(offset / 6);
+    int16_t *block = s->block[n];
+    const int last_index = s->block_last_index[n];
+    int last = s->mb_intra ? 0 : -1;
+    int i;
+
+    for (i = s->mb_intra; i <= last_index; i++) {
+        const int j = s->intra_scantable.permutated[i];
+
+        if (2 * FFABS(block[j]) < step)
+            block[j] = 0;
+        else if (block[j])
+            last = i;
+    }
+    if (last_index >= s->mb_intra)
+        s->block_last_index[n] = last;
+}
+
 static inline void clip_coeffs(MpegEncContext *s, int16_t *block,
                                int last_index)
 {
@@ -2210,6 +2335,9 @@ static av_always_inline void encode_mb_internal(MpegEncContext *s,
 
     for (i = 0; i < mb_block_count; i++)
         skip_dct[i] = s->skipdct;
+    if (s->fovea_held && s->fovea_hold[mb_x + mb_y * s->mb_stride])
+        for (i = 0; i < mb_block_count; i++)
+            skip_dct[i] = 1;
 
     if (s->adaptive_quant) {
         const int last_qp = s->qscale;
@@ -2492,6 +2620,9 @@ static av_always_inline void encode_mb_internal(MpegEncContext *s,
         if (s->chroma_elim_threshold && !s->mb_intra)
             for (i = 4; i < mb_block_count; i++)
                 dct_single_coeff_elimination(s, i, s->chroma_elim_threshold);
+        if (s->foveation && s->fovea_cqp[mb_x + mb_y * s->mb_stride] >= 6)
+            for (i = 4; i < mb_block_count; i++)
+                fovea_chroma_elimination(s, i, s->fovea_cqp[mb_x + mb_y * s->mb_stride]);
 
         if (s->mpv_flags & FF_MPV_FLAG_CBP_RD) {
             for (i = 0; i < mb_block_count; i++) {
@@ -2759,6 +2890,19 @@ static int pre_estimate_motion_thread(AVCodecContext *c, void *arg){
     return 0;
 }
 
+/* held peripheral MBs skip motion estimation and copy the reference */
+static void fovea_hold_mb(MpegEncContext *s, int mb_x, int mb_y)
+{
+    const int xy = mb_x + mb_y * s->mb_stride;
+
+    s->p_mv_table[xy][0] = 0;
+    s->p_mv_table[xy][1] = 0;
+    s->mb_type[xy] = CANDIDATE_MB_TYPE_INTER;
+    s->current_picture.mb_var[xy]    = 0;
+    s->current_picture.mc_mb_var[xy] = 0;
+    s->current_picture.mb_mean[xy]   = 128;
+}
+
 static int estimate_motion_thread(AVCodecContext *c, void *arg){
     MpegEncContext *s= *(void**)arg;
 
@@ -2778,6 +2922,8 @@ static int estimate_motion_thread(AVCodecContext *c, void *arg){
             /* compute motion vector & mb_type and store in context */
             if(s->pict_type==AV_PICTURE_TYPE_B)
                 ff_estimate_b_frame_motion(s, s->mb_x, s->mb_y);
+            else if (s->fovea_held && s->fovea_hold[s->mb_x + s->mb_y * s->mb_stride])
+                fovea_hold_mb(s, s->mb_x, s->mb_y);
             else
                 ff_estimate_p_frame_motion(s, s->mb_x, s->mb_y);
         }
@@ -3598,7 +3744,29 @@ static void merge_context_after_encode(MpegEncContext *dst, MpegEncContext *src)
     flush_put_bits(&dst->pb);
 }
 
+/**
+ * Scale the lambda of each MB by the foveation QP offset, the quantizer step
+ * doubling every 6 QP.
+ *
+ * @param rc the lambda table was just filled by rate control, otherwise it
+ *           starts from the picture quality
+ */
+static void foveate_lambda(MpegEncContext *s, int rc)
+{
+    const int lmax = s->avctx->qmax * FF_QP2LAMBDA;
+    int i;
+
+    for (i = 0; i < s->mb_num; i++) {
+        const int xy = s->mb_index2xy[i];
+        int lambda = rc ? s->lambda_table[xy] : s->current_picture.f->quality;
+
+        s->lambda_table[xy] = FFMIN(lambda * exp2f(s->fovea_qp[xy] / 6), lmax);
+    }
+}
+
 static int estimate_qp(MpegEncContext *s, int dry_run){
+    int rc = 0;
+
     if (s->next_lambda){
         s->current_picture_ptr->f->quality =
         s->current_picture.f->quality = s->next_lambda;
@@ -3609,8 +3777,12 @@ static int estimate_qp(MpegEncContext *s, int dry_run){
         s->current_picture.f->quality = quality;
         if (s->current_picture.f->quality < 0)
             return -1;
+        rc = 1;
     }
 
+    if (s->foveation)
+        foveate_lambda(s, rc);
+
     if(s->adaptive_quant){
         switch(s->codec_id){
         case AV_CODEC_ID_MPEG4:
@@ -234,6 +234,10 @@ extern AVFilter ff_vf_fillborders;
 extern AVFilter ff_vf_find_rect;
 extern AVFilter ff_vf_floodfill;
 extern AVFilter ff_vf_format;
+extern AVFilter ff_vf_fovchroma;
+extern AVFilter ff_vf_fovdeblock;
+extern AVFilter ff_vf_fovsaliency;
+extern AVFilter ff_vf_fovupconv;
 extern AVFilter ff_vf_fps;
 extern AVFilter ff_vf_framepack;
 extern AVFilter ff_vf_framerate;
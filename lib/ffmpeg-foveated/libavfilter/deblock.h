@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018 Paul B Mahol
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Block edge filters shared by the deblock and fovdeblock filters.
+ * Based on paper: A Simple and Efficient Deblocking Algorithm for Low Bit-Rate Video Coding.
+ */
+
+#ifndef AVFILTER_DEBLOCK_H
+#define AVFILTER_DEBLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libavutil/common.h"
+
+enum FilterType { WEAK, STRONG, NB_FILTER };
+
+typedef void (*deblock_fn)(uint8_t *dst, ptrdiff_t dst_linesize, int block,
+                           int ath, int bth, int gth, int dth, int max);
+
+#define WEAK_HFILTER(name, type, ldiv)                                              \
+static void deblockh##name##_weak(uint8_t *dstp, ptrdiff_t dst_linesize, int block, \
+                                  int ath, int bth, int gth, int dth, int max)      \
+{                                                                                   \
+    type *dst;                                                                      \
+    int x;                                                                          \
+                                                                                    \
+    dst = (type *)dstp;                                                             \
+    dst_linesize /= ldiv;                                                           \
+                                                                                    \
+    for (x = 0; x < block; x++) {                                                   \
+        int delta = dst[x] - dst[x - dst_linesize];                                 \
+        int A, B, C, D, a, b, c, d;                                                 \
+                                                                                    \
+        if (FFABS(delta) >= ath ||                                                  \
+            FFABS(dst[x - 1 * dst_linesize] - dst[x - 2 * dst_linesize]) >= bth ||  \
+            FFABS(dst[x + 0 * dst_linesize] - dst[x + 1 * dst_linesize]) >= gth)    \
+            continue;                                                               \
+                                                                                    \
+        A = dst[x - 2 * dst_linesize];                                              \
+        B = dst[x - 1 * dst_linesize];                                              \
+        C = dst[x + 0 * dst_linesize];                                              \
+        D = dst[x + 1 * dst_linesize];                                              \
+                                                                                    \
+        a = A + delta / 8;                                                          \
+        b = B + delta / 2;                                                          \
+        c = C - delta / 2;                                                          \
+        d = D - delta / 8;                                                          \
+                                                                                    \
+        dst[x - 2 * dst_linesize] = av_clip(a, 0, max);                             \
+        dst[x - 1 * dst_linesize] = av_clip(b, 0, max);                             \
+        dst[x + 0 * dst_linesize] = av_clip(c, 0, max);                             \
+        dst[x + 1 * dst_linesize] = av_clip(d, 0, max);                             \
+    }                                                                               \
+}
+
+WEAK_HFILTER(8, uint8_t, 1)
+WEAK_HFILTER(16, uint16_t, 2)
+
+#define WEAK_VFILTER(name, type, ldiv)                                              \
+static void deblockv##name##_weak(uint8_t *dstp, ptrdiff_t dst_linesize, int block, \
+                                  int ath, int bth, int gth, int dth, int max)      \
+{                                                                                   \
+    type *dst;                                                                      \
+    int y;                                                                          \
+                                                                                    \
+    dst = (type *)dstp;                                                             \
+    dst_linesize /= ldiv;                                                           \
+                                                                                    \
+    for (y = 0; y < block; y++, dst += dst_linesize) {                              \
+        int delta = dst[0] - dst[-1];                                               \
+        int A, B, C, D, a, b, c, d;                                                 \
+                                                                                    \
+        if (FFABS(delta) >= ath ||                                                  \
+            FFABS(dst[-1] - dst[-2]) >= bth ||                                      \
+            FFABS(dst[0] - dst[1]) >= gth)                                          \
+            continue;                                                               \
+                                                                                    \
+        A = dst[-2];                                                                \
+        B = dst[-1];                                                                \
+        C = dst[+0];                                                                \
+        D = dst[+1];                                                                \
+                                                                                    \
+        a = A + delta / 8;                                                          \
+        b = B + delta / 2;                                                          \
+        c = C - delta / 2;                                                          \
+        d = D - delta / 8;                                                          \
+                                                                                    \
+        dst[-2] = av_clip(a, 0, max);                                               \
+        dst[-1] = av_clip(b, 0, max);                                               \
+        dst[+0] = av_clip(c, 0, max);                                               \
+        dst[+1] = av_clip(d, 0, max);                                               \
+    }                                                                               \
+}
+
+WEAK_VFILTER(8, uint8_t, 1)
+WEAK_VFILTER(16, uint16_t, 2)
+
+#define STRONG_HFILTER(name, type, ldiv)                                           \
+static void deblockh##name##_strong(uint8_t *dstp, ptrdiff_t dst_linesize, int block,\
+                                    int ath, int bth, int gth, int dth, int max)   \
+{                                                                                  \
+    type *dst;                                                                     \
+    int x;                                                                         \
+                                                                                   \
+    dst = (type *)dstp;                                                            \
+    dst_linesize /= ldiv;                                                          \
+                                                                                   \
+    for (x = 0; x < block; x++) {                                                  \
+        int A, B, C, D, E, F, a, b, c, d, e, f;                                    \
+        int delta = dst[x] - dst[x - dst_linesize];                                \
+                                                                                   \
+        if (FFABS(delta) >= ath ||                                                 \
+            FFABS(dst[x - 1 * dst_linesize] - dst[x - 2 * dst_linesize]) >= bth || \
+            FFABS(dst[x + 1 * dst_linesize] - dst[x + 2 * dst_linesize]) >= gth || \
+            FFABS(dst[x + 0 * dst_linesize] - dst[x + 1 * dst_linesize]) >= dth)   \
+            continue;                                                              \
+                                                                                   \
+        A = dst[x - 3 * dst_linesize];                                             \
+        B = dst[x - 2 * dst_linesize];                                             \
+        C = dst[x - 1 * dst_linesize];                                             \
+        D = dst[x + 0 * dst_linesize];                                             \
+        E = dst[x + 1 * dst_linesize];                                             \
+        F = dst[x + 2 * dst_linesize];                                             \
+                                                                                   \
+        a = A + delta / 8;                                                         \
+        b = B + delta / 4;                                                         \
+        c = C + delta / 2;                                                         \
+        d = D - delta / 2;                                                         \
+        e = E - delta / 4;                                                         \
+        f = F - delta / 8;                                                         \
+                                                                                   \
+        dst[x - 3 * dst_linesize] = av_clip(a, 0, max);                            \
+        dst[x - 2 * dst_linesize] = av_clip(b, 0, max);                            \
+        dst[x - 1 * dst_linesize] = av_clip(c, 0, max);                            \
+        dst[x + 0 * dst_linesize] = av_clip(d, 0, max);                            \
+        dst[x + 1 * dst_linesize] = av_clip(e, 0, max);                            \
+        dst[x + 2 * dst_linesize] = av_clip(f, 0, max);                            \
+    }                                                                              \
+}
+
+STRONG_HFILTER(8, uint8_t, 1)
+STRONG_HFILTER(16, uint16_t, 2)
+
+#define STRONG_VFILTER(name, type, ldiv)                                           \
+static void deblockv##name##_strong(uint8_t *dstp, ptrdiff_t dst_linesize, int block,\
+                                    int ath, int bth, int gth, int dth, int max)   \
+{                                                                                  \
+    type *dst;                                                                     \
+    int y;                                                                         \
+                                                                                   \
+    dst = (type *)dstp;                                                            \
+    dst_linesize /= ldiv;                                                          \
+                                                                                   \
+    for (y = 0; y < block; y++, dst += dst_linesize) {                             \
+        int A, B, C, D, E, F, a, b, c, d, e, f;                                    \
+        int delta = dst[0] - dst[-1];                                              \
+                                                                                   \
+        if (FFABS(delta) >= ath ||                                                 \
+            FFABS(dst[-1] - dst[-2]) >= bth ||                                     \
+            FFABS(dst[+1] - dst[+2]) >= gth ||                                     \
+            FFABS(dst[+0] - dst[+1]) >= dth)                                       \
+            continue;                                                              \
+                                                                                   \
+        A = dst[-3];                                                               \
+        B = dst[-2];                                                               \
+        C = dst[-1];                                                               \
+        D = dst[+0];                                                               \
+        E = dst[+1];                                                               \
+        F = dst[+2];                                                               \
+                                                                                   \
+        a = A + delta / 8;                                                         \
+        b = B + delta / 4;                                                         \
+        c = C + delta / 2;                                                         \
+        d = D - delta / 2;                                                         \
+        e = E - delta / 4;                                                         \
+        f = F - delta / 8;                                                         \
+                                                                                   \
+        dst[-3] = av_clip(a, 0, max);                                              \
+        dst[-2] = av_clip(b, 0, max);                                              \
+        dst[-1] = av_clip(c, 0, max);                                              \
+        dst[+0] = av_clip(d, 0, max);                                              \
+        dst[+1] = av_clip(e, 0, max);                                              \
+        dst[+2] = av_clip(f, 0, max);                                              \
+    }                                                                              \
+}
+
+STRONG_VFILTER(8, uint8_t, 1)
+STRONG_VFILTER(16, uint16_t, 2)
+
+#endif /* AVFILTER_DEBLOCK_H */
@@ -0,0 +1,49 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_FOVDEBLOCK_H
+#define AVFILTER_FOVDEBLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Edge filters of fovdeblock for 8-bit planes and 8x8 blocks, indexed by
+ * the FilterType of deblock.h. Each block edge i has its own thresholds:
+ * th[i] holds ath, bth, gth and dth 8 times each, NULL leaves the edge
+ * alone.
+ */
+typedef struct FovDeblockDSPContext {
+    /**
+     * Filter the horizontal edge above dst over width pixels, a multiple
+     * of 8, with th[i] for the pixels from 8 * i.
+     */
+    void (*edgeh[2])(uint8_t *dst, ptrdiff_t linesize, int width,
+                     const int16_t *const *th);
+    /**
+     * Filter the vertical edges left of dst + 8 * i over 8 rows, for the
+     * width / 8 values of i, width a multiple of 16.
+     */
+    void (*edgev[2])(uint8_t *dst, ptrdiff_t linesize, int width,
+                     const int16_t *const *th);
+} FovDeblockDSPContext;
+
+void ff_fovdeblock_dsp_init(FovDeblockDSPContext *dsp);
+void ff_fovdeblock_dsp_init_x86(FovDeblockDSPContext *dsp);
+
+#endif /* AVFILTER_FOVDEBLOCK_H */
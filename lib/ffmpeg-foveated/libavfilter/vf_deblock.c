@@ -27,12 +27,11 @@
 #include "libavutil/pixdesc.h"
 
 #include "avfilter.h"
+#include "deblock.h"
 #include "formats.h"
 #include "internal.h"
 #include "video.h"
 
-enum FilterType { WEAK, STRONG, NB_FILTER };
-
 typedef struct DeblockContext {
     const AVClass *class;
     const AVPixFmtDescriptor *desc;
@@ -55,10 +54,8 @@ typedef struct DeblockContext {
     int planewidth[4];
     int planeheight[4];
 
-    void (*deblockh)(uint8_t *dst, ptrdiff_t dst_linesize, int block,
-                     int ath, int bth, int gth, int dth, int max);
-    void (*deblockv)(uint8_t *dst, ptrdiff_t dst_linesize, int block,
-                     int ath, int bth, int gth, int dth, int max);
+    deblock_fn deblockh;
+    deblock_fn deblockv;
 } DeblockContext;
 
 static int query_formats(AVFilterContext *ctx)
@@ -90,180 +87,6 @@ static int query_formats(AVFilterContext *ctx)
     return ff_set_common_formats(ctx, formats);
 }
 
-#define WEAK_HFILTER(name, type, ldiv)                                              \
-static void deblockh##name##_weak(uint8_t *dstp, ptrdiff_t dst_linesize, int block, \
-                                  int ath, int bth, int gth, int dth, int max)      \
-{                                                                                   \
-    type *dst;                                                                      \
-    int x;                                                                          \
-                                                                                    \
-    dst = (type *)dstp;                                                             \
-    dst_linesize /= ldiv;                                                           \
-                                                                                    \
-    for (x = 0; x < block; x++) {                                                   \
-        int delta = dst[x] - dst[x - dst_linesize];                                 \
-        int A, B, C, D, a, b, c, d;                                                 \
-                                                                                    \
-        if (FFABS(delta) >= ath ||                                                  \
-            FFABS(dst[x - 1 * dst_linesize] - dst[x - 2 * dst_linesize]) >= bth ||  \
-            FFABS(dst[x + 0 * dst_linesize] - dst[x + 1 * dst_linesize]) >= gth)    \
-            continue;                                                               \
-                                                                                    \
-        A = dst[x - 2 * dst_linesize];                                              \
-        B = dst[x - 1 * dst_linesize];                                              \
-        C = dst[x + 0 * dst_linesize];                                              \
-        D = dst[x + 1 * dst_linesize];                                              \
-                                                                                    \
-        a = A + delta / 8;                                                          \
-        b = B + delta / 2;                                                          \
-        c = C - delta / 2;                                                          \
-        d = D - delta / 8;                                                          \
-                                                                                    \
-        dst[x - 2 * dst_linesize] = av_clip(a, 0, max);                             \
-        dst[x - 1 * dst_linesize] = av_clip(b, 0, max);                             \
-        dst[x + 0 * dst_linesize] = av_clip(c, 0, max);                             \
-        dst[x + 1 * dst_linesize] = av_clip(d, 0, max);                             \
-    }                                                                               \
-}
-
-WEAK_HFILTER(8, uint8_t, 1)
-WEAK_HFILTER(16, uint16_t, 2)
-
-#define WEAK_VFILTER(name, type, ldiv)                                              \
-static void deblockv##name##_weak(uint8_t *dstp, ptrdiff_t dst_linesize, int block, \
-                                  int ath, int bth, int gth, int dth, int max)      \
-{                                                                                   \
-    type *dst;                                                                      \
-    int y;                                                                          \
-                                                                                    \
-    dst = (type *)dstp;                                                             \
-    dst_linesize /= ldiv;                                                           \
-                                                                                    \
-    for (y = 0; y < block; y++) {                                                   \
-        int delta = dst[0] - dst[-1];                                               \
-        int A, B, C, D, a, b, c, d;                                                 \
-                                                                                    \
-        if (FFABS(delta) >= ath ||                                                  \
-            FFABS(dst[-1] - dst[-2]) >= bth ||                                      \
-            FFABS(dst[0] - dst[1]) >= gth)                                          \
-            continue;                                                               \
-                                                                                    \
-        A = dst[-2];                                                                \
-        B = dst[-1];                                                                \
-        C = dst[+0];                                                                \
-        D = dst[+1];                                                                \
-                                                                                    \
-        a = A + delta / 8;                                                          \
-        b = B + delta / 2;                                                          \
-        c = C - delta / 2;                                                          \
-        d = D - delta / 8;                                                          \
-                                                                                    \
-        dst[-2] = av_clip(a, 0, max);                                               \
-        dst[-1] = av_clip(b, 0, max);                                               \
-        dst[+0] = av_clip(c, 0, max);                                               \
-        dst[+1] = av_clip(d, 0, max);                                               \
-                                                                                    \
-        dst += dst_linesize;                                                        \
-    }                                                                               \
-}
-
-WEAK_VFILTER(8, uint8_t, 1)
-WEAK_VFILTER(16, uint16_t, 2)
-
-#define STRONG_HFILTER(name, type, ldiv)                                           \
-static void deblockh##name##_strong(uint8_t *dstp, ptrdiff_t dst_linesize, int block,\
-                                    int ath, int bth, int gth, int dth, int max)   \
-{                                                                                  \
-    type *dst;                                                                     \
-    int x;                                                                         \
-                                                                                   \
-    dst = (type *)dstp;                                                            \
-    dst_linesize /= ldiv;                                                          \
-                                                                                   \
-    for (x = 0; x < block; x++) {                                                  \
-        int A, B, C, D, E, F, a, b, c, d, e, f;                                    \
-        int delta = dst[x] - dst[x - dst_linesize];                                \
-                                                                                   \
-        if (FFABS(delta) >= ath ||                                                 \
-            FFABS(dst[x - 1 * dst_linesize] - dst[x - 2 * dst_linesize]) >= bth || \
-            FFABS(dst[x + 1 * dst_linesize] - dst[x + 2 * dst_linesize]) >= gth || \
-            FFABS(dst[x + 0 * dst_linesize] - dst[x + 1 * dst_linesize]) >= dth)   \
-            continue;                                                              \
-                                                                                   \
-        A = dst[x - 3 * dst_linesize];                                             \
-        B = dst[x - 2 * dst_linesize];                                             \
-        C = dst[x - 1 * dst_linesize];                                             \
-        D = dst[x + 0 * dst_linesize];                                             \
-        E = dst[x + 1 * dst_linesize];                                             \
-        F = dst[x + 2 * dst_linesize];                                             \
-                                                                                   \
-        a = A + delta / 8;                                                         \
-        b = B + delta / 4;                                                         \
-        c = C + delta / 2;                                                         \
-        d = D - delta / 2;                                                         \
-        e = E - delta / 4;                                                         \
-        f = F - delta / 8;                                                         \
-                                                                                   \
-        dst[x - 3 * dst_linesize] = av_clip(a, 0, max);                            \
-        dst[x - 2 * dst_linesize] = av_clip(b, 0, max);                            \
-        dst[x - 1 * dst_linesize] = av_clip(c, 0, max);                            \
-        dst[x + 0 * dst_linesize] = av_clip(d, 0, max);                            \
-        dst[x + 1 * dst_linesize] = av_clip(e, 0, max);                            \
-        dst[x + 2 * dst_linesize] = av_clip(f, 0, max);                            \
-    }                                                                              \
-}
-
-STRONG_HFILTER(8, uint8_t, 1)
-STRONG_HFILTER(16, uint16_t, 2)
-
-#define STRONG_VFILTER(name, type, ldiv)                                           \
-static void deblockv##name##_strong(uint8_t *dstp, ptrdiff_t dst_linesize, int block,\
-                                    int ath, int bth, int gth, int dth, int max)   \
-{                                                                                  \
-    type *dst;                                                                     \
-    int y;                                                                         \
-                                                                                   \
-    dst = (type *)dstp;                                                            \
-    dst_linesize /= ldiv;                                                          \
-                                                                                   \
-    for (y = 0; y < block; y++) {                                                  \
-        int A, B, C, D, E, F, a, b, c, d, e, f;                                    \
-        int delta = dst[0] - dst[-1];                                              \
-                                                                                   \
-        if (FFABS(delta) >= ath ||                                                 \
-            FFABS(dst[-1] - dst[-2]) >= bth ||                                     \
-            FFABS(dst[+1] - dst[+2]) >= gth ||                                     \
-            FFABS(dst[+0] - dst[+1]) >= dth)                                       \
-            continue;                                                              \
-                                                                                   \
-        A = dst[-3];                                                               \
-        B = dst[-2];                                                               \
-        C = dst[-1];                                                               \
-        D = dst[+0];                                                               \
-        E = dst[+1];                                                               \
-        F = dst[+2];                                                               \
-                                                                                   \
-        a = A + delta / 8;                                                         \
-        b = B + delta / 4;                                                         \
-        c = C + delta / 2;                                                         \
-        d = D - delta / 2;                                                         \
-        e = E - delta / 4;                                                         \
-        f = F - delta / 8;                                                         \
-                                                                                   \
-        dst[-3] = av_clip(a, 0, max);                                              \
-        dst[-2] = av_clip(b, 0, max);                                              \
-        dst[-1] = av_clip(c, 0, max);                                              \
-        dst[+0] = av_clip(d, 0, max);                                              \
-        dst[+1] = av_clip(e, 0, max);                                              \
-        dst[+2] = av_clip(f, 0, max);                                              \
-                                                                                   \
-        dst += dst_linesize;                                                       \
-    }                                                                              \
-}
-
-STRONG_VFILTER(8, uint8_t, 1)
-STRONG_VFILTER(16, uint16_t, 2)
-
 static int config_output(AVFilterLink *outlink)
 {
     AVFilterContext *ctx = outlink->src;
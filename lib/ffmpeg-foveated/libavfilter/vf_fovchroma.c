@@ -0,0 +1,335 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Peripheral chroma low-pass ahead of foveated encoding.
+ *
+ * Color acuity falls off faster with eccentricity than luma acuity. The
+ * chroma falloff of the foveation descriptor narrows its gaussians for
+ * chroma and raises their maximal QP offset by its inverse; where the
+ * chroma offset exceeds the luma one, the chroma planes
+ * are box filtered with a radius that doubles every 6 QP of the excess,
+ * as the quantizer step does. Detail the viewer cannot see is removed
+ * before the encoder spends bits on it, for any encoder. Luma and the
+ * fovea are left alone.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+
+#include "avfilter.h"
+#include "formats.h"
+#include "internal.h"
+#include "video.h"
+
+#define MB_SIZE 16
+
+typedef struct FovChromaContext {
+    const AVClass *class;
+    float falloff;
+    int max_radius;
+
+    int nb_planes;
+    int hsub, vsub;
+    int planewidth[4];
+    int planeheight[4];
+
+    int mb_w, mb_h;
+    uint8_t *radius;    ///< box radius in chroma pixels per MB
+    uint16_t *tmp;      ///< horizontal means of the current plane, 4 fractional bits
+    int tmp_stride;
+    float map_descr[5]; ///< descriptor and falloff the radii were computed for
+} FovChromaContext;
+
+typedef struct ThreadData {
+    AVFrame *in, *out;
+    int plane;
+} ThreadData;
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pixel_fmts[] = {
+        AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV440P, AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_YUVJ440P,
+        AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ420P,
+        AV_PIX_FMT_YUVA444P, AV_PIX_FMT_YUVA422P, AV_PIX_FMT_YUVA420P,
+        AV_PIX_FMT_NONE
+    };
+    AVFilterFormats *formats = ff_make_format_list(pixel_fmts);
+    if (!formats)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, formats);
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    FovChromaContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(outlink->format);
+
+    if (!desc)
+        return AVERROR_BUG;
+    s->nb_planes = av_pix_fmt_count_planes(outlink->format);
+    s->hsub = desc->log2_chroma_w;
+    s->vsub = desc->log2_chroma_h;
+    s->planewidth[1] = s->planewidth[2] = AV_CEIL_RSHIFT(inlink->w, s->hsub);
+    s->planewidth[0] = s->planewidth[3] = inlink->w;
+    s->planeheight[1] = s->planeheight[2] = AV_CEIL_RSHIFT(inlink->h, s->vsub);
+    s->planeheight[0] = s->planeheight[3] = inlink->h;
+
+    s->mb_w = (inlink->w + MB_SIZE - 1) / MB_SIZE;
+    s->mb_h = (inlink->h + MB_SIZE - 1) / MB_SIZE;
+    av_freep(&s->radius);
+    av_freep(&s->tmp);
+    s->radius     = av_malloc(s->mb_w * s->mb_h);
+    s->tmp_stride = FFALIGN(s->planewidth[1], 16);
+    s->tmp        = av_malloc_array(s->tmp_stride * s->planeheight[1], sizeof(*s->tmp));
+    if (!s->radius || !s->tmp)
+        return AVERROR(ENOMEM);
+    s->map_descr[2] = -1;
+
+    return 0;
+}
+
+/*
+ * Same gaussians as the QP offset map of the foveated encoders, the chroma
+ * ones narrowed and raised by the falloff. Returns the largest radius.
+ */
+static int update_radius(FovChromaContext *s, const float *d, int nb, float falloff)
+{
+    const float diag = sqrtf(s->mb_w * s->mb_w + s->mb_h * s->mb_h);
+    int x, y, i, max = 0;
+
+    for (y = 0; y < s->mb_h; y++) {
+        for (x = 0; x < s->mb_w; x++) {
+            float qp = d[3], cqp = d[3] / falloff;
+            int r;
+
+            for (i = 0; i < nb; i++) {
+                const float *f = d + 4 * i;
+                float dx = x + 0.5f - f[0] * s->mb_w, dy = y + 0.5f - f[1] * s->mb_h;
+                float e2 = (dx * dx + dy * dy) / (f[2] * f[2] * diag * diag);
+
+                if (f[2] <= 0)
+                    continue;
+                qp  = FFMIN(qp,  f[3] * (1 - expf(-e2)));
+                cqp = FFMIN(cqp, f[3] / falloff * (1 - expf(-e2 / (falloff * falloff))));
+            }
+            r = FFMIN(exp2f((cqp - qp) / 6) / 2, s->max_radius);
+            s->radius[y * s->mb_w + x] = r;
+            max = FFMAX(max, r);
+        }
+    }
+    return max;
+}
+
+/* 1 / (2r + 1) in 16 fractional bits */
+static const unsigned box_scale[9] = {
+    65536, 21845, 13107, 9362, 7282, 5958, 5041, 4369, 3855,
+};
+
+static int blurh_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovChromaContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int w = s->planewidth[td->plane], h = s->planeheight[td->plane];
+    const int start = (h * jobnr) / nb_jobs, end = (h * (jobnr + 1)) / nb_jobs;
+    const int mbw = MB_SIZE >> s->hsub, mbh = MB_SIZE >> s->vsub;
+    int x, y, i, bx;
+
+    for (y = start; y < end; y++) {
+        const uint8_t *src = td->in->data[td->plane] + y * td->in->linesize[td->plane];
+        const uint8_t *radius = s->radius + (y / mbh) * s->mb_w;
+        uint16_t *dst = s->tmp + y * s->tmp_stride;
+
+        for (bx = 0; bx * mbw < w; bx++) {
+            const int r = radius[bx], x1 = FFMIN((bx + 1) * mbw, w);
+            const unsigned scale = box_scale[r] << 4;
+            unsigned sum = 0;
+
+            x = bx * mbw;
+            if (!r) {
+                for (; x < x1; x++)
+                    dst[x] = src[x] << 4;
+                continue;
+            }
+            for (i = x - r; i <= x + r; i++)
+                sum += src[av_clip(i, 0, w - 1)];
+            for (; x < x1; x++) {
+                dst[x] = (sum * scale + (1 << 15)) >> 16;
+                sum += src[FFMIN(x + r + 1, w - 1)] - src[FFMAX(x - r, 0)];
+            }
+        }
+    }
+    return 0;
+}
+
+/* also copies luma and alpha if not filtering in place */
+static int blurv_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovChromaContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int w = s->planewidth[td->plane], h = s->planeheight[td->plane];
+    const int start = (h * jobnr) / nb_jobs, end = (h * (jobnr + 1)) / nb_jobs;
+    const int mbw = MB_SIZE >> s->hsub, mbh = MB_SIZE >> s->vsub;
+    unsigned sum[MB_SIZE];
+    int x, y, i, p, bx;
+
+    for (p = 0; p < s->nb_planes && td->plane == 1 && td->in != td->out; p++) {
+        const int y0 = (s->planeheight[p] * jobnr) / nb_jobs;
+        const int y1 = (s->planeheight[p] * (jobnr + 1)) / nb_jobs;
+
+        if (p == 1 || p == 2)
+            continue;
+        av_image_copy_plane(td->out->data[p] + y0 * td->out->linesize[p], td->out->linesize[p],
+                            td->in->data[p] + y0 * td->in->linesize[p], td->in->linesize[p],
+                            s->planewidth[p], y1 - y0);
+    }
+
+    for (y = start; y < end; y++) {
+        const uint8_t *radius = s->radius + (y / mbh) * s->mb_w;
+        uint8_t *dst = td->out->data[td->plane] + y * td->out->linesize[td->plane];
+
+        for (bx = 0; bx * mbw < w; bx++) {
+            const int r = radius[bx], x0 = bx * mbw, n = FFMIN(mbw, w - x0);
+            const uint16_t *tmp = s->tmp + x0;
+
+            memset(sum, 0, n * sizeof(*sum));
+            for (i = y - r; i <= y + r; i++) {
+                const uint16_t *row = tmp + av_clip(i, 0, h - 1) * s->tmp_stride;
+
+                for (x = 0; x < n; x++)
+                    sum[x] += row[x];
+            }
+            for (x = 0; x < n; x++)
+                dst[x0 + x] = (sum[x] * box_scale[r] + (1 << 19)) >> 20;
+        }
+    }
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    FovChromaContext *s = ctx->priv;
+    const int nb_jobs = FFMIN(s->planeheight[1], ff_filter_get_nb_threads(ctx));
+    AVFrameSideData *sd;
+    const float *d;
+    float falloff = s->falloff;
+    int nb, tail;
+    ThreadData td;
+    AVFrame *out;
+
+    sd = av_frame_get_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+    if (!sd || sd->size < 4 * sizeof(*d) || s->nb_planes < 3)
+        return ff_filter_frame(outlink, in);
+    d    = (const float *)sd->data;
+    nb   = sd->size / (4 * sizeof(*d));
+    tail = sd->size / sizeof(*d) % 4;
+    if (tail >= 2 && d[4 * nb + 1] > 0)
+        falloff = d[4 * nb + 1];
+    if (d[2] <= 0 || d[3] <= 0 || falloff >= 1)
+        return ff_filter_frame(outlink, in);
+
+    /* fixations last a few hundred ms, keep the radii until the gaze moves */
+    if (nb > 1 || memcmp(d, s->map_descr, 4 * sizeof(*d)) || falloff != s->map_descr[4]) {
+        memcpy(s->map_descr, d, 4 * sizeof(*d));
+        s->map_descr[4] = falloff;
+        if (!update_radius(s, d, nb, falloff))
+            s->map_descr[2] = -1;
+    }
+    if (s->map_descr[2] < 0)
+        return ff_filter_frame(outlink, in);
+
+    if (av_frame_is_writable(in)) {
+        out = in;
+    } else {
+        out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+        if (!out) {
+            av_frame_free(&in);
+            return AVERROR(ENOMEM);
+        }
+        av_frame_copy_props(out, in);
+    }
+
+    td.in  = in;
+    td.out = out;
+    for (td.plane = 1; td.plane < 3; td.plane++) {
+        ctx->internal->execute(ctx, blurh_slice, &td, NULL, nb_jobs);
+        ctx->internal->execute(ctx, blurv_slice, &td, NULL, nb_jobs);
+    }
+
+    if (in != out)
+        av_frame_free(&in);
+    return ff_filter_frame(outlink, out);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    FovChromaContext *s = ctx->priv;
+
+    av_freep(&s->radius);
+    av_freep(&s->tmp);
+}
+
+#define OFFSET(x) offsetof(FovChromaContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption fovchroma_options[] = {
+    { "falloff", "set chroma sigma relative to luma sigma", OFFSET(falloff),    AV_OPT_TYPE_FLOAT, {.dbl=0.6}, 0.01, 1, FLAGS },
+    { "max",     "set maximal radius in chroma pixels",     OFFSET(max_radius), AV_OPT_TYPE_INT,   {.i64=4},   1,    8, FLAGS },
+    { NULL },
+};
+
+static const AVFilterPad inputs[] = {
+    {
+        .name           = "default",
+        .type           = AVMEDIA_TYPE_VIDEO,
+        .filter_frame   = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+        .config_props  = config_output,
+    },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(fovchroma);
+
+AVFilter ff_vf_fovchroma = {
+    .name          = "fovchroma",
+    .description   = NULL_IF_CONFIG_SMALL("Low-pass the peripheral chroma of foveated video."),
+    .priv_size     = sizeof(FovChromaContext),
+    .priv_class    = &fovchroma_class,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = inputs,
+    .outputs       = outputs,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+};
@@ -0,0 +1,505 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Eccentricity-weighted deblocking of foveated video.
+ *
+ * The foveation descriptor of a frame (x, y, sigma, delta) tells which QP
+ * offset the encoder added to each 16x16 macroblock, further fixations
+ * add a fovea each and the smallest offset wins. Block edges get the
+ * deblock filter with thresholds that grow with the quantizer step size
+ * implied by that offset, so the periphery is smoothed hard and the fovea
+ * is left alone.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+
+#include "avfilter.h"
+#include "deblock.h"
+#include "fovdeblock.h"
+#include "formats.h"
+#include "internal.h"
+#include "video.h"
+
+#define MB_SIZE 16
+#define EDGE_BLOCKS 32
+
+typedef struct FovBlock {
+    float qp;           ///< QP offset, negative inside the fovea
+    int ath, bth, gth, dth;
+    int filter;
+    int16_t th[4][8];   ///< thresholds for the edge filters of dsp
+} FovBlock;
+
+typedef struct FovDeblockContext {
+    const AVClass *class;
+    int block;
+    int planes;
+    float alpha;
+    float beta;
+    float gamma;
+    float delta;
+    float radius;
+    float strength;
+    float strong_qp;
+    float fx, fy, sigma, qp;
+
+    int max;
+    int depth;
+    int bpc;
+    int nb_planes;
+    int hsub[4], vsub[4];
+    int planewidth[4];
+    int planeheight[4];
+
+    int mb_w, mb_h;
+    FovBlock *map;
+    float *map_descr;   ///< fixations the map was computed for
+    unsigned map_descr_size;
+    int map_nb_fix;
+
+    deblock_fn deblockh[NB_FILTER];
+    deblock_fn deblockv[NB_FILTER];
+    FovDeblockDSPContext dsp;
+    int use_dsp;
+} FovDeblockContext;
+
+typedef struct ThreadData {
+    AVFrame *in, *out;
+    int update_map;
+    const float *fix;   ///< fixations (x, y, sigma, qp)
+    int nb_fix;
+} ThreadData;
+
+#define EDGE_C(dir, type)                                                          \
+static void edge##dir##_##type##_c(uint8_t *dst, ptrdiff_t linesize, int width,   \
+                                   const int16_t *const *th)                      \
+{                                                                                 \
+    int i;                                                                        \
+                                                                                  \
+    for (i = 0; i < width / 8; i++)                                               \
+        if (th[i])                                                                \
+            deblock##dir##8_##type(dst + 8 * i, linesize, 8, th[i][0], th[i][8],  \
+                                   th[i][16], th[i][24], 255);                    \
+}
+
+EDGE_C(h, weak)
+EDGE_C(h, strong)
+EDGE_C(v, weak)
+EDGE_C(v, strong)
+
+av_cold void ff_fovdeblock_dsp_init(FovDeblockDSPContext *dsp)
+{
+    dsp->edgeh[WEAK]   = edgeh_weak_c;
+    dsp->edgeh[STRONG] = edgeh_strong_c;
+    dsp->edgev[WEAK]   = edgev_weak_c;
+    dsp->edgev[STRONG] = edgev_strong_c;
+
+    if (ARCH_X86)
+        ff_fovdeblock_dsp_init_x86(dsp);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pixel_fmts[] = {
+        AV_PIX_FMT_YUVA444P, AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV440P,
+        AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_YUVJ440P,
+        AV_PIX_FMT_YUVA422P, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUVA420P, AV_PIX_FMT_YUV420P,
+        AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ420P,
+        AV_PIX_FMT_YUV420P9, AV_PIX_FMT_YUV422P9, AV_PIX_FMT_YUV444P9,
+        AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV444P10,
+        AV_PIX_FMT_YUV420P12, AV_PIX_FMT_YUV422P12, AV_PIX_FMT_YUV444P12,
+        AV_PIX_FMT_GRAY8, AV_PIX_FMT_GRAY9, AV_PIX_FMT_GRAY10, AV_PIX_FMT_GRAY12,
+        AV_PIX_FMT_NONE
+    };
+    AVFilterFormats *formats = ff_make_format_list(pixel_fmts);
+    if (!formats)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, formats);
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    FovDeblockContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(outlink->format);
+
+    if (!desc)
+        return AVERROR_BUG;
+    s->nb_planes = av_pix_fmt_count_planes(outlink->format);
+    s->depth = desc->comp[0].depth;
+    s->bpc = (s->depth + 7) / 8;
+    s->max = (1 << s->depth) - 1;
+
+    s->deblockh[WEAK]   = s->depth <= 8 ? deblockh8_weak   : deblockh16_weak;
+    s->deblockv[WEAK]   = s->depth <= 8 ? deblockv8_weak   : deblockv16_weak;
+    s->deblockh[STRONG] = s->depth <= 8 ? deblockh8_strong : deblockh16_strong;
+    s->deblockv[STRONG] = s->depth <= 8 ? deblockv8_strong : deblockv16_strong;
+    ff_fovdeblock_dsp_init(&s->dsp);
+    s->use_dsp = s->depth == 8 && s->block == 8;
+
+    s->hsub[1] = s->hsub[2] = desc->log2_chroma_w;
+    s->vsub[1] = s->vsub[2] = desc->log2_chroma_h;
+    s->planewidth[1] = s->planewidth[2] = AV_CEIL_RSHIFT(inlink->w, desc->log2_chroma_w);
+    s->planewidth[0] = s->planewidth[3] = inlink->w;
+    s->planeheight[1] = s->planeheight[2] = AV_CEIL_RSHIFT(inlink->h, desc->log2_chroma_h);
+    s->planeheight[0] = s->planeheight[3] = inlink->h;
+
+    s->mb_w = (inlink->w + MB_SIZE - 1) / MB_SIZE;
+    s->mb_h = (inlink->h + MB_SIZE - 1) / MB_SIZE;
+    av_freep(&s->map);
+    s->map = av_malloc_array(s->mb_w * s->mb_h, sizeof(*s->map));
+    if (!s->map)
+        return AVERROR(ENOMEM);
+    s->map_nb_fix = 0;
+
+    return 0;
+}
+
+/*
+ * Same gaussians as the QP offset map of the foveated encoders. The quantizer
+ * step doubles every 6 QP, so the edge threshold is scaled by the step size
+ * the offset added, the flatness thresholds by its square root.
+ */
+static int map_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovDeblockContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int start = (s->mb_h * jobnr) / nb_jobs;
+    const int end = (s->mb_h * (jobnr + 1)) / nb_jobs;
+    const float r2 = s->radius * s->radius;
+    const float diag = sqrtf(s->mb_w * s->mb_w + s->mb_h * s->mb_h);
+    int plane, x, y, f, i;
+
+    for (y = start; y < end && td->update_map; y++) {
+        for (x = 0; x < s->mb_w; x++) {
+            FovBlock *b = &s->map[y * s->mb_w + x];
+            float k, k2;
+
+            b->qp = FLT_MAX;
+            for (f = 0; f < td->nb_fix; f++) {
+                const float *d = td->fix + 4 * f;
+                const float dx = x - d[0] * s->mb_w;
+                const float dy = y - d[1] * s->mb_h;
+                const float sigma = d[2] * diag;
+                float e2;
+
+                if (d[2] <= 0 || d[3] <= 0)
+                    continue;
+                e2 = (dx * dx + dy * dy) / (sigma * sigma);
+                if (e2 <= r2) {
+                    b->qp = -1;
+                    break;
+                }
+                b->qp = FFMIN(b->qp, d[3] * (1 - expf(-e2)));
+            }
+            if (b->qp < 0)
+                continue;
+            k  = s->strength * (exp2f(b->qp / 6) - 1);
+            k2 = sqrtf(k);
+            b->ath = FFMIN(s->alpha * s->max * k,  s->max);
+            b->bth = FFMIN(s->beta  * s->max * k2, s->max);
+            b->gth = FFMIN(s->gamma * s->max * k2, s->max);
+            b->dth = FFMIN(s->delta * s->max * k2, s->max);
+            b->filter = b->qp >= s->strong_qp ? STRONG : WEAK;
+            for (i = 0; i < 8; i++) {
+                b->th[0][i] = b->ath;
+                b->th[1][i] = b->bth;
+                b->th[2][i] = b->gth;
+                b->th[3][i] = b->dth;
+            }
+        }
+    }
+
+    if (td->in == td->out)
+        return 0;
+
+    for (plane = 0; plane < s->nb_planes; plane++) {
+        const int height = s->planeheight[plane];
+        const int y0 = (height * jobnr) / nb_jobs;
+        const int y1 = (height * (jobnr + 1)) / nb_jobs;
+
+        av_image_copy_plane(td->out->data[plane] + y0 * td->out->linesize[plane],
+                            td->out->linesize[plane],
+                            td->in->data[plane] + y0 * td->in->linesize[plane],
+                            td->in->linesize[plane],
+                            s->planewidth[plane] * s->bpc, y1 - y0);
+    }
+
+    return 0;
+}
+
+/* an edge is filtered as weakly as its less quantized side, if at all */
+static const FovBlock *edge_block(const FovDeblockContext *s, int plane,
+                                  int x0, int y0, int x1, int y1)
+{
+    const FovBlock *a = &s->map[((y0 << s->vsub[plane]) / MB_SIZE) * s->mb_w +
+                                 (x0 << s->hsub[plane]) / MB_SIZE];
+    const FovBlock *b = &s->map[((y1 << s->vsub[plane]) / MB_SIZE) * s->mb_w +
+                                 (x1 << s->hsub[plane]) / MB_SIZE];
+    const FovBlock *m = a->qp < b->qp ? a : b;
+
+    return m->qp < 0 || !m->ath ? NULL : m;
+}
+
+/*
+ * Up to EDGE_BLOCKS horizontal or vertical edges in a row of an 8-bit plane,
+ * from x0 on, one call per filter type with the edges of the other left alone.
+ */
+static void edge_row(const FovDeblockContext *s, int plane, int vertical,
+                     uint8_t *dst, ptrdiff_t linesize, int x0, int y, int width)
+{
+    const int16_t *th[NB_FILTER][EDGE_BLOCKS];
+    int used[NB_FILTER] = { 0 };
+    int filter, i;
+
+    for (i = 0; i < width / 8; i++) {
+        const int x = x0 + 8 * i;
+        const FovBlock *b = vertical ? edge_block(s, plane, x - 1, y, x, y)
+                                     : edge_block(s, plane, x, y - 1, x, y);
+
+        th[WEAK][i] = th[STRONG][i] = NULL;
+        if (b) {
+            th[b->filter][i] = b->th[0];
+            used[b->filter] = 1;
+        }
+    }
+    for (filter = 0; filter < NB_FILTER; filter++) {
+        if (!used[filter])
+            continue;
+        if (vertical)
+            s->dsp.edgev[filter](dst, linesize, width, th[filter]);
+        else
+            s->dsp.edgeh[filter](dst, linesize, width, th[filter]);
+    }
+}
+
+/* vertical edges only touch their own rows */
+static int deblockv_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovDeblockContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int block = s->block;
+    int plane, x, y;
+
+    for (plane = 0; plane < s->nb_planes; plane++) {
+        const int width = s->planewidth[plane];
+        const int height = s->planeheight[plane];
+        const int rows = (height + block - 1) / block;
+        const int start = (rows * jobnr) / nb_jobs * block;
+        const int end = FFMIN((rows * (jobnr + 1)) / nb_jobs * block, height);
+        const ptrdiff_t linesize = td->out->linesize[plane];
+        uint8_t *dst = td->out->data[plane];
+
+        if (!((1 << plane) & s->planes))
+            continue;
+
+        for (y = start; y < end; y += block) {
+            /* pairs of edges up to 4 pixels short of the right border */
+            const int width16 = s->use_dsp && y + 8 <= height ? FFMAX(width - 4, 0) & ~15 : 0;
+
+            for (x = 0; x < width16; x += 8 * EDGE_BLOCKS)
+                edge_row(s, plane, 1, dst + y * linesize + x + 8, linesize, x + 8, y,
+                         FFMIN(width16 - x, 8 * EDGE_BLOCKS));
+            for (x = width16 + block; x < width; x += block) {
+                const FovBlock *b = edge_block(s, plane, x - 1, y, x, y);
+
+                if (b)
+                    s->deblockv[b->filter](dst + y * linesize + x * s->bpc, linesize,
+                                           FFMIN(block, height - y),
+                                           b->ath, b->bth, b->gth, b->dth, s->max);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Horizontal edges modify up to 3 rows on either side, so edges at least
+ * 8 rows apart can be filtered concurrently.
+ */
+static int deblockh_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovDeblockContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const int block = s->block;
+    int plane, x, y;
+
+    for (plane = 0; plane < s->nb_planes; plane++) {
+        const int width = s->planewidth[plane];
+        const int height = s->planeheight[plane];
+        const int rows = (height + block - 1) / block;
+        const int start = FFMAX((rows * jobnr) / nb_jobs, 1) * block;
+        const int end = FFMIN((rows * (jobnr + 1)) / nb_jobs * block, height);
+        const ptrdiff_t linesize = td->out->linesize[plane];
+        uint8_t *dst = td->out->data[plane];
+
+        if (!((1 << plane) & s->planes))
+            continue;
+
+        for (y = start; y < end; y += block) {
+            const int width8 = s->use_dsp ? width & ~7 : 0;
+
+            for (x = 0; x < width8; x += 8 * EDGE_BLOCKS)
+                edge_row(s, plane, 0, dst + y * linesize + x, linesize, x, y,
+                         FFMIN(width8 - x, 8 * EDGE_BLOCKS));
+            for (x = width8; x < width; x += block) {
+                const FovBlock *b = edge_block(s, plane, x, y - 1, x, y);
+
+                if (b)
+                    s->deblockh[b->filter](dst + y * linesize + x * s->bpc, linesize,
+                                           FFMIN(block, width - x),
+                                           b->ath, b->bth, b->gth, b->dth, s->max);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    FovDeblockContext *s = ctx->priv;
+    AVFrameSideData *sd;
+    const float defaults[4] = { s->fx, s->fy, s->sigma, s->qp };
+    const float *descr = defaults;
+    const int nb_jobs = FFMIN(s->mb_h, ff_filter_get_nb_threads(ctx));
+    int nb_fix = 1;
+    ThreadData td;
+    AVFrame *out;
+
+    /* a trailing period and chroma falloff make up less than a fixation */
+    sd = av_frame_get_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+    if (sd && sd->size >= sizeof(defaults)) {
+        descr  = (const float *)sd->data;
+        nb_fix = sd->size / sizeof(defaults);
+    }
+    if (descr[2] <= 0 || descr[3] <= 0)
+        return ff_filter_frame(outlink, in);
+
+    if (av_frame_is_writable(in)) {
+        out = in;
+    } else {
+        out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+        if (!out) {
+            av_frame_free(&in);
+            return AVERROR(ENOMEM);
+        }
+        av_frame_copy_props(out, in);
+    }
+
+    /* fixations last a few hundred ms, keep the map until the gaze moves */
+    td.update_map = nb_fix != s->map_nb_fix ||
+                    memcmp(descr, s->map_descr, nb_fix * sizeof(defaults));
+    if (td.update_map) {
+        av_fast_malloc(&s->map_descr, &s->map_descr_size, nb_fix * sizeof(defaults));
+        if (!s->map_descr) {
+            s->map_nb_fix = 0;
+            if (in != out)
+                av_frame_free(&in);
+            av_frame_free(&out);
+            return AVERROR(ENOMEM);
+        }
+        memcpy(s->map_descr, descr, nb_fix * sizeof(defaults));
+        s->map_nb_fix = nb_fix;
+    }
+
+    td.in     = in;
+    td.out    = out;
+    td.fix    = s->map_descr;
+    td.nb_fix = nb_fix;
+
+    ctx->internal->execute(ctx, map_slice, &td, NULL, nb_jobs);
+    ctx->internal->execute(ctx, deblockv_slice, &td, NULL, nb_jobs);
+    ctx->internal->execute(ctx, deblockh_slice, &td, NULL, nb_jobs);
+
+    if (in != out)
+        av_frame_free(&in);
+    return ff_filter_frame(outlink, out);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    FovDeblockContext *s = ctx->priv;
+
+    av_freep(&s->map);
+    av_freep(&s->map_descr);
+}
+
+#define OFFSET(x) offsetof(FovDeblockContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption fovdeblock_options[] = {
+    { "block",     "set size of block",           OFFSET(block),     AV_OPT_TYPE_INT,   {.i64=8},    8, 512, FLAGS },
+    { "alpha",     "set 1st detection threshold", OFFSET(alpha),     AV_OPT_TYPE_FLOAT, {.dbl=.098}, 0,  1,  FLAGS },
+    { "beta",      "set 2nd detection threshold", OFFSET(beta),      AV_OPT_TYPE_FLOAT, {.dbl=.03},  0,  1,  FLAGS },
+    { "gamma",     "set 3rd detection threshold", OFFSET(gamma),     AV_OPT_TYPE_FLOAT, {.dbl=.03},  0,  1,  FLAGS },
+    { "delta",     "set 4th detection threshold", OFFSET(delta),     AV_OPT_TYPE_FLOAT, {.dbl=.03},  0,  1,  FLAGS },
+    { "planes",    "set planes to filter",        OFFSET(planes),    AV_OPT_TYPE_INT,   {.i64=15},   0, 15,  FLAGS },
+    { "radius",    "set fovea radius in sigmas",  OFFSET(radius),    AV_OPT_TYPE_FLOAT, {.dbl=0.5},  0, 100, FLAGS },
+    { "strength",  "set threshold scale",         OFFSET(strength),  AV_OPT_TYPE_FLOAT, {.dbl=1},    0, 16,  FLAGS },
+    { "strong",    "set QP offset of strong filter", OFFSET(strong_qp), AV_OPT_TYPE_FLOAT, {.dbl=12}, 0, 100, FLAGS },
+    { "fx",        "set default fixation x",      OFFSET(fx),        AV_OPT_TYPE_FLOAT, {.dbl=0.5},  0,  1,  FLAGS },
+    { "fy",        "set default fixation y",      OFFSET(fy),        AV_OPT_TYPE_FLOAT, {.dbl=0.5},  0,  1,  FLAGS },
+    { "sigma",     "set default sigma",           OFFSET(sigma),     AV_OPT_TYPE_FLOAT, {.dbl=0},    0, 10,  FLAGS },
+    { "qp",        "set default QP offset",       OFFSET(qp),        AV_OPT_TYPE_FLOAT, {.dbl=0},    0, 51,  FLAGS },
+    { NULL },
+};
+
+static const AVFilterPad inputs[] = {
+    {
+        .name           = "default",
+        .type           = AVMEDIA_TYPE_VIDEO,
+        .filter_frame   = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+        .config_props  = config_output,
+    },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(fovdeblock);
+
+AVFilter ff_vf_fovdeblock = {
+    .name          = "fovdeblock",
+    .description   = NULL_IF_CONFIG_SMALL("Deblock the periphery of foveated video."),
+    .priv_size     = sizeof(FovDeblockContext),
+    .priv_class    = &fovdeblock_class,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = inputs,
+    .outputs       = outputs,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+};
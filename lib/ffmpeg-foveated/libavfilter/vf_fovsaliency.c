@@ -0,0 +1,543 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Content-based fixation prediction for viewers without an eye tracker.
+ *
+ * A saliency map is estimated on a grid of 16x16 blocks of a proxy of at
+ * most 1280x720 pixels, from the motion vectors exported by the decoder
+ * relative to the dominant (camera) motion and from the local luma
+ * contrast, weighted by a center bias and smoothed over time. Its strongest
+ * peaks become the fixations of the foveation descriptor attached to the
+ * frame. The proxy is point sampled, so the work per frame does not depend
+ * on the input resolution.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/motion_vector.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+
+#include "avfilter.h"
+#include "dnn_interface.h"
+#include "formats.h"
+#include "internal.h"
+#include "video.h"
+
+#define PROXY_W 1280
+#define PROXY_H 720
+#define CELL    16  ///< grid cell size in proxy pixels
+#define MAX_FIXATIONS 8
+
+/* residual motion in proxy pixels per frame that counts as half salient */
+#define MOTION_REF 2.0f
+
+typedef struct FovSaliencyContext {
+    const AVClass *class;
+    int nb_fixations;
+    float spacing;
+    float threshold;
+    float motion_weight;
+    float contrast_weight;
+    float center;
+    float decay;
+    float sigma;
+    float delta;
+    int period;
+    float falloff;
+
+    char *model_filename;
+    DNNBackendType backend_type;
+    char *model_inputname;
+    char *model_outputname;
+    float mix;
+    DNNModule *dnn_module;
+    DNNModel *model;
+    DNNData input;
+    DNNData output;
+
+    int step;           ///< input pixels per proxy pixel
+    int cell;           ///< grid cell size in input pixels
+    int gw, gh;
+    int mv_budget;      ///< motion vectors looked at per frame
+    int have_map;
+
+    float *buf;
+    float *motion;      ///< normalized residual motion of the last P/B frame
+    float *contrast;
+    float *prior;       ///< center bias
+    float *saliency;    ///< temporally smoothed map
+    float *peak;        ///< scratch map for the peak search
+    float *acc, *weight;
+} FovSaliencyContext;
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    FovSaliencyContext *s = ctx->priv;
+
+    if (!s->model_filename)
+        return 0;
+
+    if (!s->model_inputname || !s->model_outputname) {
+        av_log(ctx, AV_LOG_ERROR, "input and output names of the model are required\n");
+        return AVERROR(EINVAL);
+    }
+    s->dnn_module = ff_get_dnn_module(s->backend_type);
+    if (!s->dnn_module) {
+        av_log(ctx, AV_LOG_ERROR, "could not create DNN module for requested backend\n");
+        return AVERROR(ENOMEM);
+    }
+    if (!s->dnn_module->load_model) {
+        av_log(ctx, AV_LOG_ERROR, "load_model for network is not specified\n");
+        return AVERROR(EINVAL);
+    }
+    s->model = s->dnn_module->load_model(s->model_filename);
+    if (!s->model) {
+        av_log(ctx, AV_LOG_ERROR, "could not load DNN model\n");
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pixel_fmts[] = {
+        AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P,
+        AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ444P,
+        AV_PIX_FMT_YUVA420P, AV_PIX_FMT_NV12, AV_PIX_FMT_NV21,
+        AV_PIX_FMT_GRAY8,
+        AV_PIX_FMT_NONE
+    };
+    AVFilterFormats *formats = ff_make_format_list(pixel_fmts);
+    if (!formats)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, formats);
+}
+
+/* the model maps (motion, contrast, prior) to one saliency value per cell */
+static int config_model(AVFilterContext *ctx)
+{
+    FovSaliencyContext *s = ctx->priv;
+    DNNData model_input;
+
+    if (s->model->get_input(s->model->model, &model_input, s->model_inputname) != DNN_SUCCESS) {
+        av_log(ctx, AV_LOG_ERROR, "could not get input from the model\n");
+        return AVERROR(EIO);
+    }
+    if (model_input.channels != 3 || model_input.dt != DNN_FLOAT ||
+        (model_input.width  != -1 && model_input.width  != s->gw) ||
+        (model_input.height != -1 && model_input.height != s->gh)) {
+        av_log(ctx, AV_LOG_ERROR, "the model needs a %dx%d float input with 3 channels\n",
+               s->gw, s->gh);
+        return AVERROR(EIO);
+    }
+
+    s->input.width    = s->gw;
+    s->input.height   = s->gh;
+    s->input.channels = 3;
+    s->input.dt       = DNN_FLOAT;
+    if (s->model->set_input_output(s->model->model, &s->input, s->model_inputname,
+                                   (const char **)&s->model_outputname, 1) != DNN_SUCCESS) {
+        av_log(ctx, AV_LOG_ERROR, "could not set input and output for the model\n");
+        return AVERROR(EIO);
+    }
+
+    memset(s->input.data, 0, s->gw * s->gh * 3 * sizeof(float));
+    if (s->dnn_module->execute_model(s->model, &s->output, 1) != DNN_SUCCESS) {
+        av_log(ctx, AV_LOG_ERROR, "failed to execute model\n");
+        return AVERROR(EIO);
+    }
+    if (s->output.width != s->gw || s->output.height != s->gh ||
+        s->output.channels != 1 || s->output.dt != DNN_FLOAT) {
+        av_log(ctx, AV_LOG_ERROR, "the model has to output one float per input cell\n");
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+static int config_input(AVFilterLink *inlink)
+{
+    AVFilterContext *ctx = inlink->dst;
+    FovSaliencyContext *s = ctx->priv;
+    int n, x, y;
+
+    s->step = FFMAX3(1, (inlink->w + PROXY_W - 1) / PROXY_W,
+                        (inlink->h + PROXY_H - 1) / PROXY_H);
+    s->cell = CELL * s->step;
+    s->gw = (inlink->w + s->cell - 1) / s->cell;
+    s->gh = (inlink->h + s->cell - 1) / s->cell;
+    /* one vector per 8x8 proxy pixels, the smallest inter partition of
+     * most codecs at proxy scale */
+    s->mv_budget = s->gw * s->gh * 4;
+    s->have_map = 0;
+    n = s->gw * s->gh;
+
+    av_freep(&s->buf);
+    s->buf = av_calloc(n, 7 * sizeof(*s->buf));
+    if (!s->buf)
+        return AVERROR(ENOMEM);
+    s->motion   = s->buf;
+    s->contrast = s->buf + n;
+    s->prior    = s->buf + n * 2;
+    s->saliency = s->buf + n * 3;
+    s->peak     = s->buf + n * 4;
+    s->acc      = s->buf + n * 5;
+    s->weight   = s->buf + n * 6;
+
+    /* viewers look at the center of the screen far more often than at the
+     * borders, whatever the content */
+    for (y = 0; y < s->gh; y++) {
+        for (x = 0; x < s->gw; x++) {
+            float dx = ((x + 0.5f) * s->cell / inlink->w - 0.5f) / 0.3f;
+            float dy = ((y + 0.5f) * s->cell / inlink->h - 0.5f) / 0.3f;
+
+            s->prior[y * s->gw + x] = 1 - s->center +
+                                      s->center * expf(-0.5f * (dx * dx + dy * dy));
+        }
+    }
+
+    av_log(ctx, AV_LOG_VERBOSE, "proxy 1/%d, grid %dx%d\n", s->step, s->gw, s->gh);
+
+    return s->model ? config_model(ctx) : 0;
+}
+
+static void motion_vector(const AVMotionVector *mv, float *dx, float *dy)
+{
+    /* the block moved from src to dst, reversed for future references */
+    float k = (mv->source > 0 ? 1.0f : -1.0f) / mv->motion_scale;
+
+    *dx = mv->motion_x * k;
+    *dy = mv->motion_y * k;
+}
+
+static int hist_median(const int *hist, int n)
+{
+    int i, sum = 0;
+
+    for (i = 0; i < 255; i++) {
+        sum += hist[i];
+        if (2 * sum >= n)
+            break;
+    }
+    return i - 128;
+}
+
+/*
+ * Residual motion per cell after removing the median vector of the frame,
+ * which is the camera motion in most shots. Looks at no more than
+ * mv_budget vectors, evenly spread over the list.
+ */
+static int motion_map(FovSaliencyContext *s, const AVFrameSideData *sd, int w, int h)
+{
+    const AVMotionVector *mvs = (const AVMotionVector *)sd->data;
+    const int nb_mvs = sd->size / sizeof(*mvs);
+    const int stride = FFMAX(1, (nb_mvs + s->mv_budget - 1) / s->mv_budget);
+    const int n = s->gw * s->gh;
+    int hist_x[256] = { 0 }, hist_y[256] = { 0 };
+    int i, nb = 0;
+    float gx, gy;
+
+    for (i = 0; i < nb_mvs; i += stride) {
+        float dx, dy;
+
+        if (!mvs[i].motion_scale)
+            continue;
+        motion_vector(&mvs[i], &dx, &dy);
+        hist_x[av_clip(lrintf(dx), -128, 127) + 128]++;
+        hist_y[av_clip(lrintf(dy), -128, 127) + 128]++;
+        nb++;
+    }
+    if (!nb)
+        return 0;
+    gx = hist_median(hist_x, nb);
+    gy = hist_median(hist_y, nb);
+
+    memset(s->acc, 0, n * sizeof(*s->acc));
+    memset(s->weight, 0, n * sizeof(*s->weight));
+    for (i = 0; i < nb_mvs; i += stride) {
+        const AVMotionVector *mv = &mvs[i];
+        float dx, dy, area = mv->w * mv->h;
+        int c;
+
+        if (!mv->motion_scale || mv->dst_x < 0 || mv->dst_y < 0 ||
+            mv->dst_x >= w || mv->dst_y >= h)
+            continue;
+        motion_vector(mv, &dx, &dy);
+        c = mv->dst_y / s->cell * s->gw + mv->dst_x / s->cell;
+        s->acc[c]    += hypotf(dx - gx, dy - gy) / s->step * area;
+        s->weight[c] += area;
+    }
+
+    for (i = 0; i < n; i++) {
+        float m = s->weight[i] ? s->acc[i] / s->weight[i] : 0;
+
+        s->motion[i] = m / (m + MOTION_REF);
+    }
+    return 1;
+}
+
+/* luma standard deviation per cell, from every other proxy pixel */
+static void contrast_map(FovSaliencyContext *s, const AVFrame *in)
+{
+    const int sample = 2 * s->step;
+    const ptrdiff_t linesize = in->linesize[0];
+    float max = 0;
+    int gx, gy, x, y, i;
+
+    for (gy = 0; gy < s->gh; gy++) {
+        const int ye = FFMIN(s->cell, in->height - gy * s->cell);
+
+        for (gx = 0; gx < s->gw; gx++) {
+            const int xe = FFMIN(s->cell, in->width - gx * s->cell);
+            const uint8_t *p = in->data[0] + gy * s->cell * linesize + gx * s->cell;
+            unsigned sum = 0, sum2 = 0, nb = 0;
+            float mean;
+
+            for (y = 0; y < ye; y += sample) {
+                for (x = 0; x < xe; x += sample) {
+                    unsigned v = p[y * linesize + x];
+
+                    sum  += v;
+                    sum2 += v * v;
+                }
+                nb += (xe + sample - 1) / sample;
+            }
+            mean = (float)sum / nb;
+            i = gy * s->gw + gx;
+            s->contrast[i] = sqrtf(FFMAX((float)sum2 / nb - mean * mean, 0));
+            max = FFMAX(max, s->contrast[i]);
+        }
+    }
+
+    /* relative to the frame, so that flat scenes still get a fixation */
+    if (max > 0)
+        for (i = 0; i < s->gw * s->gh; i++)
+            s->contrast[i] /= max;
+}
+
+static int refine(AVFilterContext *ctx, float *map)
+{
+    FovSaliencyContext *s = ctx->priv;
+    const int n = s->gw * s->gh;
+    float *in = s->input.data;
+    const float *out;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        in[3 * i + 0] = s->motion[i];
+        in[3 * i + 1] = s->contrast[i];
+        in[3 * i + 2] = s->prior[i];
+    }
+    if (s->dnn_module->execute_model(s->model, &s->output, 1) != DNN_SUCCESS) {
+        av_log(ctx, AV_LOG_ERROR, "failed to execute model\n");
+        return AVERROR(EIO);
+    }
+    out = s->output.data;
+    for (i = 0; i < n; i++)
+        map[i] = (1 - s->mix) * map[i] + s->mix * FFMAX(out[i], 0);
+    return 0;
+}
+
+/*
+ * Greedy peak search: take the maximum, refine it to the weighted centroid
+ * of its 3x3 neighbourhood, clear everything within spacing and repeat.
+ */
+static int find_fixations(FovSaliencyContext *s, int w, int h, float *fix)
+{
+    const int n = s->gw * s->gh;
+    const float r = s->spacing * hypotf(s->gw, s->gh);
+    float top = 0;
+    int nb, i, x, y;
+
+    memcpy(s->peak, s->saliency, n * sizeof(*s->peak));
+
+    for (nb = 0; nb < s->nb_fixations; nb++) {
+        float v = 0, cx = 0, cy = 0, sum = 0;
+        int best = -1, bx, by;
+
+        for (i = 0; i < n; i++) {
+            if (s->peak[i] > v) {
+                v = s->peak[i];
+                best = i;
+            }
+        }
+        if (best < 0 || v < s->threshold * top)
+            break;
+        if (!nb)
+            top = v;
+        bx = best % s->gw;
+        by = best / s->gw;
+
+        for (y = FFMAX(by - 1, 0); y <= FFMIN(by + 1, s->gh - 1); y++) {
+            for (x = FFMAX(bx - 1, 0); x <= FFMIN(bx + 1, s->gw - 1); x++) {
+                float p = FFMAX(s->peak[y * s->gw + x], 0);
+
+                cx  += p * (x + 0.5f);
+                cy  += p * (y + 0.5f);
+                sum += p;
+            }
+        }
+        fix[2 * nb + 0] = av_clipf(cx / sum * s->cell / w, 0, 1);
+        fix[2 * nb + 1] = av_clipf(cy / sum * s->cell / h, 0, 1);
+
+        for (y = 0; y < s->gh; y++)
+            for (x = 0; x < s->gw; x++)
+                if ((x - bx) * (x - bx) + (y - by) * (y - by) < r * r)
+                    s->peak[y * s->gw + x] = -1;
+    }
+
+    if (!nb) {
+        fix[0] = fix[1] = 0.5f;
+        nb = 1;
+    }
+    return nb;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    FovSaliencyContext *s = ctx->priv;
+    const int n = s->gw * s->gh;
+    AVFrameSideData *sd;
+    float fix[2 * MAX_FIXATIONS];
+    float *descr, *map = s->peak;
+    int i, nb, ret;
+
+    /* a measured gaze always wins */
+    if (av_frame_get_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR))
+        return ff_filter_frame(outlink, in);
+
+    /* intra frames carry no vectors, keep the motion of the last one */
+    sd = av_frame_get_side_data(in, AV_FRAME_DATA_MOTION_VECTORS);
+    if (sd)
+        motion_map(s, sd, inlink->w, inlink->h);
+    contrast_map(s, in);
+
+    for (i = 0; i < n; i++)
+        map[i] = (s->motion_weight * s->motion[i] +
+                  s->contrast_weight * s->contrast[i]) * s->prior[i];
+    if (s->model) {
+        ret = refine(ctx, map);
+        if (ret < 0) {
+            av_frame_free(&in);
+            return ret;
+        }
+    }
+    for (i = 0; i < n; i++)
+        s->saliency[i] = s->have_map ? s->decay * s->saliency[i] + (1 - s->decay) * map[i]
+                                     : map[i];
+    s->have_map = 1;
+
+    nb = find_fixations(s, inlink->w, inlink->h, fix);
+
+    /* the full layout: fixations, temporal period and chroma falloff */
+    sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+                                (nb * 4 + 2) * sizeof(*descr));
+    if (!sd) {
+        av_frame_free(&in);
+        return AVERROR(ENOMEM);
+    }
+    descr = (float *)sd->data;
+    for (i = 0; i < nb; i++) {
+        descr[4 * i + 0] = fix[2 * i + 0];
+        descr[4 * i + 1] = fix[2 * i + 1];
+        descr[4 * i + 2] = s->sigma;
+        descr[4 * i + 3] = s->delta;
+        av_log(ctx, AV_LOG_DEBUG, "pts %"PRId64" fixation %d: %.3f %.3f\n",
+               in->pts, i, fix[2 * i], fix[2 * i + 1]);
+    }
+    descr[4 * nb + 0] = s->period;
+    descr[4 * nb + 1] = s->falloff;
+
+    return ff_filter_frame(outlink, in);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    FovSaliencyContext *s = ctx->priv;
+
+    if (s->dnn_module)
+        s->dnn_module->free_model(&s->model);
+    av_freep(&s->dnn_module);
+    av_freep(&s->buf);
+}
+
+#define OFFSET(x) offsetof(FovSaliencyContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption fovsaliency_options[] = {
+    { "fixations", "set maximum number of fixations", OFFSET(nb_fixations), AV_OPT_TYPE_INT, {.i64=1}, 1, MAX_FIXATIONS, FLAGS },
+    { "spacing",   "set minimum distance of fixations", OFFSET(spacing), AV_OPT_TYPE_FLOAT, {.dbl=0.2},  0, 1,  FLAGS },
+    { "threshold", "set minimum saliency of further fixations", OFFSET(threshold), AV_OPT_TYPE_FLOAT, {.dbl=0.6}, 0, 1, FLAGS },
+    { "motion",    "set weight of motion",        OFFSET(motion_weight), AV_OPT_TYPE_FLOAT, {.dbl=1},   0, 10, FLAGS },
+    { "contrast",  "set weight of contrast",      OFFSET(contrast_weight), AV_OPT_TYPE_FLOAT, {.dbl=0.5}, 0, 10, FLAGS },
+    { "center",    "set strength of center bias", OFFSET(center),    AV_OPT_TYPE_FLOAT, {.dbl=0.5},  0, 1,  FLAGS },
+    { "decay",     "set temporal smoothing",      OFFSET(decay),     AV_OPT_TYPE_FLOAT, {.dbl=0.8},  0, 0.99, FLAGS },
+    { "sigma",     "set sigma of the descriptor", OFFSET(sigma),     AV_OPT_TYPE_FLOAT, {.dbl=0.07}, 0, 10, FLAGS },
+    { "delta",     "set QP offset of the descriptor", OFFSET(delta), AV_OPT_TYPE_FLOAT, {.dbl=10},   0, 51, FLAGS },
+    { "period",    "set temporal period of the descriptor", OFFSET(period), AV_OPT_TYPE_INT, {.i64=0}, 0, 60, FLAGS },
+    { "falloff",   "set chroma falloff of the descriptor", OFFSET(falloff), AV_OPT_TYPE_FLOAT, {.dbl=0}, 0, 1, FLAGS },
+    { "dnn_backend", "DNN backend",               OFFSET(backend_type), AV_OPT_TYPE_INT, {.i64=0},  0, 1,  FLAGS, "backend" },
+    { "native",    "native backend flag",         0,                 AV_OPT_TYPE_CONST, {.i64=0},    0, 0,  FLAGS, "backend" },
+#if (CONFIG_LIBTENSORFLOW == 1)
+    { "tensorflow", "tensorflow backend flag",    0,                 AV_OPT_TYPE_CONST, {.i64=1},    0, 0,  FLAGS, "backend" },
+#endif
+    { "model",     "path to refinement model file", OFFSET(model_filename), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
+    { "input",     "input name of the model",     OFFSET(model_inputname), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
+    { "output",    "output name of the model",    OFFSET(model_outputname), AV_OPT_TYPE_STRING, {.str=NULL}, 0, 0, FLAGS },
+    { "mix",       "set share of the model output", OFFSET(mix),     AV_OPT_TYPE_FLOAT, {.dbl=1},    0, 1,  FLAGS },
+    { NULL },
+};
+
+static const AVFilterPad inputs[] = {
+    {
+        .name           = "default",
+        .type           = AVMEDIA_TYPE_VIDEO,
+        .filter_frame   = filter_frame,
+        .config_props   = config_input,
+    },
+    { NULL }
+};
+
+static const AVFilterPad outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+    },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(fovsaliency);
+
+AVFilter ff_vf_fovsaliency = {
+    .name          = "fovsaliency",
+    .description   = NULL_IF_CONFIG_SMALL("Predict fixations and attach them as foveation descriptor."),
+    .priv_size     = sizeof(FovSaliencyContext),
+    .priv_class    = &fovsaliency_class,
+    .init          = init,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = inputs,
+    .outputs       = outputs,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC,
+};
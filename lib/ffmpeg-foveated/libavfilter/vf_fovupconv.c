@@ -0,0 +1,547 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Frame-rate upconversion of the held periphery of temporally foveated video.
+ *
+ * With temporal foveation the encoder updates the periphery only every
+ * period-th frame and the frames in between repeat it. Their foveation
+ * descriptor carries the period negated. For those frames each held 16x16
+ * block is extrapolated from the last update frame along its motion, as
+ * exported by the decoder for the update frame. Blocks without a usable
+ * vector, intra coded or far off their neighbours, get the block matching
+ * of minterpolate between the last two update frames, as far as the time
+ * budget of the frame allows, and the median vector of their neighbours
+ * until then. Blocks of the fovea are never written.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "libavutil/imgutils.h"
+#include "libavutil/motion_vector.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/time.h"
+
+#include "avfilter.h"
+#include "formats.h"
+#include "internal.h"
+#include "motion_estimation.h"
+#include "video.h"
+
+#define MB_SIZE 16
+
+enum BlockState {
+    STATE_MV,       ///< motion from the decoder
+    STATE_ME,       ///< motion from block matching
+    STATE_GUESS,    ///< neighbour median, block matching pending
+};
+
+typedef struct FovBlock {
+    float dx, dy;   ///< displacement per frame into the update frame, pixels
+    int state;
+    int hold;       ///< held in the current frame
+} FovBlock;
+
+typedef struct FovUpconvContext {
+    const AVClass *class;
+    float budget;
+    int range;
+    float threshold;
+
+    int nb_planes;
+    int hsub[4], vsub[4];
+    int planewidth[4];
+    int planeheight[4];
+
+    int mb_w, mb_h;
+    FovBlock *blocks;
+    int *pending;
+    int nb_pending;
+    AVMotionEstContext me_ctx;
+
+    AVFrame *key, *prev_key;    ///< last two frames that updated the periphery
+    int period;
+    int held;                   ///< frames since the key
+    int64_t fill_time;          ///< running estimate of the fill cost, us
+
+    int64_t nb_filled, nb_late, total_time;
+    int64_t nb_mv, nb_me, nb_guess;
+} FovUpconvContext;
+
+typedef struct ThreadData {
+    AVFrame *in, *out;
+} ThreadData;
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pixel_fmts[] = {
+        AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV440P, AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_YUVJ440P,
+        AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ420P,
+        AV_PIX_FMT_GRAY8,
+        AV_PIX_FMT_NONE
+    };
+    AVFilterFormats *formats = ff_make_format_list(pixel_fmts);
+    if (!formats)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, formats);
+}
+
+static int config_output(AVFilterLink *outlink)
+{
+    AVFilterContext *ctx = outlink->src;
+    FovUpconvContext *s = ctx->priv;
+    AVFilterLink *inlink = ctx->inputs[0];
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(outlink->format);
+
+    if (!desc)
+        return AVERROR_BUG;
+    s->nb_planes = av_pix_fmt_count_planes(outlink->format);
+    s->hsub[1] = s->hsub[2] = desc->log2_chroma_w;
+    s->vsub[1] = s->vsub[2] = desc->log2_chroma_h;
+    s->planewidth[1] = s->planewidth[2] = AV_CEIL_RSHIFT(inlink->w, desc->log2_chroma_w);
+    s->planewidth[0] = s->planewidth[3] = inlink->w;
+    s->planeheight[1] = s->planeheight[2] = AV_CEIL_RSHIFT(inlink->h, desc->log2_chroma_h);
+    s->planeheight[0] = s->planeheight[3] = inlink->h;
+
+    s->mb_w = (inlink->w + MB_SIZE - 1) / MB_SIZE;
+    s->mb_h = (inlink->h + MB_SIZE - 1) / MB_SIZE;
+    av_freep(&s->blocks);
+    av_freep(&s->pending);
+    s->blocks  = av_calloc(s->mb_w * s->mb_h, sizeof(*s->blocks));
+    s->pending = av_malloc_array(s->mb_w * s->mb_h, sizeof(*s->pending));
+    if (!s->blocks || !s->pending)
+        return AVERROR(ENOMEM);
+    s->nb_pending = 0;
+
+    ff_me_init_context(&s->me_ctx, MB_SIZE, s->range, inlink->w, inlink->h,
+                       0, inlink->w - MB_SIZE, 0, inlink->h - MB_SIZE);
+
+    return 0;
+}
+
+static void reset(FovUpconvContext *s)
+{
+    av_frame_free(&s->key);
+    av_frame_free(&s->prev_key);
+    s->nb_guess  += s->nb_pending;
+    s->nb_pending = 0;
+}
+
+static void sort2(float *a, float *b)
+{
+    if (*a > *b)
+        FFSWAP(float, *a, *b);
+}
+
+/* component-wise median of the vectors of the neighbours that have one */
+static int neighbour_median(const FovUpconvContext *s, const uint8_t *known,
+                            int x, int y, float *dx, float *dy)
+{
+    float vx[8], vy[8];
+    int n = 0, i, j, u, v;
+
+    for (v = FFMAX(y - 1, 0); v <= FFMIN(y + 1, s->mb_h - 1); v++) {
+        for (u = FFMAX(x - 1, 0); u <= FFMIN(x + 1, s->mb_w - 1); u++) {
+            const FovBlock *b = &s->blocks[v * s->mb_w + u];
+
+            if ((u == x && v == y) || !known[v * s->mb_w + u])
+                continue;
+            vx[n]   = b->dx;
+            vy[n++] = b->dy;
+        }
+    }
+    if (!n)
+        return 0;
+    for (i = 1; i < n; i++)
+        for (j = i; j > 0; j--) {
+            sort2(&vx[j - 1], &vx[j]);
+            sort2(&vy[j - 1], &vy[j]);
+        }
+    *dx = n & 1 ? vx[n / 2] : (vx[n / 2 - 1] + vx[n / 2]) / 2;
+    *dy = n & 1 ? vy[n / 2] : (vy[n / 2 - 1] + vy[n / 2]) / 2;
+    return 1;
+}
+
+/*
+ * The vectors of an update frame point from its periphery to the previous
+ * update, period frames back, since everything in between held it.
+ */
+static int update_motion(FovUpconvContext *s, const AVFrame *frame)
+{
+    AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    const int nb_blocks = s->mb_w * s->mb_h;
+    float *sum;
+    uint8_t *known;
+    int i, x, y;
+
+    sum   = av_calloc(nb_blocks, 3 * sizeof(*sum));
+    known = av_mallocz(nb_blocks);
+    if (!sum || !known) {
+        av_free(sum);
+        av_free(known);
+        return AVERROR(ENOMEM);
+    }
+
+    if (sd) {
+        const AVMotionVector *mvs = (const AVMotionVector *)sd->data;
+
+        for (i = 0; i < sd->size / sizeof(*mvs); i++) {
+            const AVMotionVector *mv = &mvs[i];
+            int bx = mv->dst_x / MB_SIZE, by = mv->dst_y / MB_SIZE;
+            float *b;
+
+            if (mv->source >= 0 || !mv->motion_scale ||
+                bx < 0 || by < 0 || bx >= s->mb_w || by >= s->mb_h)
+                continue;
+            b = &sum[3 * (by * s->mb_w + bx)];
+            b[0] += (float)mv->motion_x / mv->motion_scale * mv->w * mv->h;
+            b[1] += (float)mv->motion_y / mv->motion_scale * mv->w * mv->h;
+            b[2] += mv->w * mv->h;
+        }
+    }
+    for (i = 0; i < nb_blocks; i++) {
+        if (sum[3 * i + 2] > 0) {
+            s->blocks[i].dx = sum[3 * i]     / sum[3 * i + 2] / s->period;
+            s->blocks[i].dy = sum[3 * i + 1] / sum[3 * i + 2] / s->period;
+            known[i] = 1;
+        }
+    }
+
+    /* outliers are usually a bad match rather than a small moving object */
+    s->nb_pending = 0;
+    for (y = 0; y < s->mb_h; y++) {
+        for (x = 0; x < s->mb_w; x++) {
+            FovBlock *b = &s->blocks[y * s->mb_w + x];
+            float mx = 0, my = 0;
+            int have = neighbour_median(s, known, x, y, &mx, &my);
+
+            if (known[y * s->mb_w + x] &&
+                (!have || hypotf(b->dx - mx, b->dy - my) * s->period <= s->threshold)) {
+                b->state = STATE_MV;
+                continue;
+            }
+            b->dx    = mx;
+            b->dy    = my;
+            b->state = STATE_GUESS;
+            s->pending[s->nb_pending++] = y * s->mb_w + x;
+        }
+    }
+
+    av_free(sum);
+    av_free(known);
+    return 0;
+}
+
+#define ADD_PRED(preds, px, py)                 \
+    do {                                        \
+        preds.mvs[preds.nb][0] = px;            \
+        preds.mvs[preds.nb][1] = py;            \
+        preds.nb++;                             \
+    } while (0)
+
+/* EPZS, seeded with the guess, as minterpolate does with its neighbours */
+static void search_block(FovUpconvContext *s, int i)
+{
+    AVMotionEstContext *me_ctx = &s->me_ctx;
+    FovBlock *b = &s->blocks[i];
+    const int x_mb = FFMIN(i % s->mb_w * MB_SIZE, me_ctx->x_max);
+    const int y_mb = FFMIN(i / s->mb_w * MB_SIZE, me_ctx->y_max);
+    int mv[2] = { x_mb, y_mb };
+
+    me_ctx->preds[0].nb = 0;
+    me_ctx->preds[1].nb = 0;
+    me_ctx->pred_x = lrintf(b->dx * s->period);
+    me_ctx->pred_y = lrintf(b->dy * s->period);
+    ADD_PRED(me_ctx->preds[0], 0, 0);
+    if (i % s->mb_w && s->blocks[i - 1].state != STATE_GUESS)
+        ADD_PRED(me_ctx->preds[0], lrintf(s->blocks[i - 1].dx * s->period),
+                                   lrintf(s->blocks[i - 1].dy * s->period));
+    if (i >= s->mb_w && s->blocks[i - s->mb_w].state != STATE_GUESS)
+        ADD_PRED(me_ctx->preds[0], lrintf(s->blocks[i - s->mb_w].dx * s->period),
+                                   lrintf(s->blocks[i - s->mb_w].dy * s->period));
+
+    ff_me_search_epzs(me_ctx, x_mb, y_mb, mv);
+
+    b->dx    = (float)(mv[0] - x_mb) / s->period;
+    b->dy    = (float)(mv[1] - y_mb) / s->period;
+    b->state = STATE_ME;
+}
+
+/* copy the rows of the job, then the extrapolated blocks into them */
+static int fill_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FovUpconvContext *s = ctx->priv;
+    ThreadData *td = arg;
+    const AVFrame *key = s->key;
+    const int start = (s->mb_h * jobnr) / nb_jobs;
+    const int end = (s->mb_h * (jobnr + 1)) / nb_jobs;
+    int plane, x, y, i;
+
+    for (plane = 0; plane < s->nb_planes && td->in != td->out; plane++) {
+        const int y0 = FFMIN((start * MB_SIZE) >> s->vsub[plane], s->planeheight[plane]);
+        const int y1 = FFMIN((end * MB_SIZE) >> s->vsub[plane], s->planeheight[plane]);
+
+        av_image_copy_plane(td->out->data[plane] + y0 * td->out->linesize[plane],
+                            td->out->linesize[plane],
+                            td->in->data[plane] + y0 * td->in->linesize[plane],
+                            td->in->linesize[plane], s->planewidth[plane], y1 - y0);
+    }
+
+    for (y = start; y < end; y++) {
+        for (x = 0; x < s->mb_w; x++) {
+            const FovBlock *b = &s->blocks[y * s->mb_w + x];
+
+            if (!b->hold)
+                continue;
+            for (plane = 0; plane < s->nb_planes; plane++) {
+                const int hsub = s->hsub[plane], vsub = s->vsub[plane];
+                const int pw = s->planewidth[plane], ph = s->planeheight[plane];
+                const int x0 = (x * MB_SIZE) >> hsub, y0 = (y * MB_SIZE) >> vsub;
+                const int bw = FFMIN(MB_SIZE >> hsub, pw - x0);
+                const int bh = FFMIN(MB_SIZE >> vsub, ph - y0);
+                const int ox = lrintf(b->dx * s->held / (1 << hsub));
+                const int oy = lrintf(b->dy * s->held / (1 << vsub));
+                const ptrdiff_t dst_stride = td->out->linesize[plane];
+                const ptrdiff_t src_stride = key->linesize[plane];
+                uint8_t *dst = td->out->data[plane] + y0 * dst_stride + x0;
+                int j;
+
+                for (j = 0; j < bh; j++, dst += dst_stride) {
+                    const uint8_t *src = key->data[plane] +
+                                         av_clip(y0 + j + oy, 0, ph - 1) * src_stride;
+
+                    if (x0 + ox >= 0 && x0 + ox + bw <= pw) {
+                        memcpy(dst, src + x0 + ox, bw);
+                    } else {
+                        for (i = 0; i < bw; i++)
+                            dst[i] = src[av_clip(x0 + ox + i, 0, pw - 1)];
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Blocks are held where the encoder held them, beyond half the maximal QP
+ * offset of the primary fixation, unless the frame coded them with motion or
+ * as intra, e.g. around a further fixation.
+ */
+static int mark_held(FovUpconvContext *s, const AVFrame *frame, const float *d)
+{
+    AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    const float sigma = d[2] * sqrtf(s->mb_w * s->mb_w + s->mb_h * s->mb_h);
+    int i, x, y, nb = 0;
+
+    for (y = 0; y < s->mb_h; y++) {
+        for (x = 0; x < s->mb_w; x++) {
+            float dx = x + 0.5f - d[0] * s->mb_w, dy = y + 0.5f - d[1] * s->mb_h;
+
+            s->blocks[y * s->mb_w + x].hold =
+                1 - expf(-(dx * dx + dy * dy) / (sigma * sigma)) > 0.5f;
+        }
+    }
+
+    if (sd) {
+        const AVMotionVector *mvs = (const AVMotionVector *)sd->data;
+        uint8_t *skipped = av_mallocz(s->mb_w * s->mb_h);
+
+        if (!skipped)
+            return AVERROR(ENOMEM);
+        for (i = 0; i < sd->size / sizeof(*mvs); i++) {
+            int bx = mvs[i].dst_x / MB_SIZE, by = mvs[i].dst_y / MB_SIZE;
+
+            if (bx < 0 || by < 0 || bx >= s->mb_w || by >= s->mb_h)
+                continue;
+            /* skipped blocks carry the predicted vector, which is not zero
+             * next to moving ones */
+            if (mvs[i].flags & AV_MOTION_VECTOR_FLAG_SKIP)
+                skipped[by * s->mb_w + bx] |= 1;
+            else
+                skipped[by * s->mb_w + bx] |= 2;
+        }
+        for (i = 0; i < s->mb_w * s->mb_h; i++)
+            s->blocks[i].hold &= skipped[i] == 1;
+        av_free(skipped);
+    }
+
+    for (i = 0; i < s->mb_w * s->mb_h; i++)
+        nb += s->blocks[i].hold;
+    return nb;
+}
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    AVFilterLink *outlink = ctx->outputs[0];
+    FovUpconvContext *s = ctx->priv;
+    const int nb_jobs = FFMIN(s->mb_h, ff_filter_get_nb_threads(ctx));
+    const int64_t t0 = av_gettime_relative();
+    const int64_t budget = s->budget * 1000;
+    AVFrameSideData *sd;
+    const float *d;
+    ThreadData td;
+    AVFrame *out;
+    int ret, i;
+
+    sd = av_frame_get_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+    if (!sd || sd->size < 5 * sizeof(*d) || ((const float *)sd->data)[2] <= 0 ||
+        fabsf(((const float *)sd->data)[4]) <= 1) {
+        reset(s);
+        return ff_filter_frame(outlink, in);
+    }
+    d = (const float *)sd->data;
+
+    if (d[4] > 0) {
+        av_frame_free(&s->prev_key);
+        s->prev_key = s->key;
+        s->key      = av_frame_clone(in);
+        if (!s->key) {
+            av_frame_free(&in);
+            return AVERROR(ENOMEM);
+        }
+        s->period    = lrintf(d[4]);
+        s->held      = 0;
+        s->nb_guess += s->nb_pending;
+        if ((ret = update_motion(s, in)) < 0) {
+            av_frame_free(&in);
+            return ret;
+        }
+        /* block matching needs the previous update in the same layout */
+        if (!s->prev_key || s->prev_key->linesize[0] != s->key->linesize[0]) {
+            s->nb_guess  += s->nb_pending;
+            s->nb_pending = 0;
+        }
+        return ff_filter_frame(outlink, in);
+    }
+
+    if (!s->key || s->key->width != in->width || s->key->height != in->height)
+        return ff_filter_frame(outlink, in);
+    s->held++;
+    if ((ret = mark_held(s, in, d)) <= 0) {
+        if (ret < 0)
+            av_frame_free(&in);
+        return ret < 0 ? ret : ff_filter_frame(outlink, in);
+    }
+
+    /* refine pending blocks while the budget leaves room for the fill */
+    s->me_ctx.data_cur = s->key->data[0];
+    s->me_ctx.data_ref = s->prev_key ? s->prev_key->data[0] : NULL;
+    s->me_ctx.linesize = s->key->linesize[0];
+    for (i = 0; i < s->nb_pending &&
+                av_gettime_relative() - t0 + s->fill_time < budget; i++)
+        search_block(s, s->pending[i]);
+    s->nb_me      += i;
+    s->nb_pending -= i;
+    memmove(s->pending, s->pending + i, s->nb_pending * sizeof(*s->pending));
+
+    if (av_frame_is_writable(in)) {
+        out = in;
+    } else {
+        out = ff_get_video_buffer(outlink, outlink->w, outlink->h);
+        if (!out) {
+            av_frame_free(&in);
+            return AVERROR(ENOMEM);
+        }
+        av_frame_copy_props(out, in);
+    }
+
+    {
+        int64_t t1 = av_gettime_relative(), t2;
+
+        td.in  = in;
+        td.out = out;
+        ctx->internal->execute(ctx, fill_slice, &td, NULL, nb_jobs);
+
+        t2 = av_gettime_relative();
+        s->fill_time = s->fill_time ? (3 * s->fill_time + t2 - t1) / 4 : t2 - t1;
+        s->total_time += t2 - t0;
+        s->nb_late    += t2 - t0 > budget;
+        s->nb_filled++;
+    }
+    if (s->held == 1)
+        for (i = 0; i < s->mb_w * s->mb_h; i++)
+            s->nb_mv += s->blocks[i].state == STATE_MV;
+
+    if (in != out)
+        av_frame_free(&in);
+    return ff_filter_frame(outlink, out);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    FovUpconvContext *s = ctx->priv;
+
+    if (s->nb_filled)
+        av_log(ctx, AV_LOG_VERBOSE, "%"PRId64" frames filled in %.2f ms on average, "
+               "%"PRId64" over budget; blocks from decoder vectors %"PRId64", "
+               "block matching %"PRId64", guessed %"PRId64"\n",
+               s->nb_filled, s->total_time / 1000.0 / s->nb_filled, s->nb_late,
+               s->nb_mv, s->nb_me, s->nb_guess + s->nb_pending);
+    av_frame_free(&s->key);
+    av_frame_free(&s->prev_key);
+    av_freep(&s->blocks);
+    av_freep(&s->pending);
+}
+
+#define OFFSET(x) offsetof(FovUpconvContext, x)
+#define FLAGS AV_OPT_FLAG_VIDEO_PARAM | AV_OPT_FLAG_FILTERING_PARAM
+
+static const AVOption fovupconv_options[] = {
+    { "budget",    "set time budget per frame in ms",        OFFSET(budget),    AV_OPT_TYPE_FLOAT, {.dbl=2}, 0, 1000, FLAGS },
+    { "range",     "set block matching range in pixels",     OFFSET(range),     AV_OPT_TYPE_INT,   {.i64=32}, 4, 256, FLAGS },
+    { "threshold", "set vector deviation to re-match in pixels", OFFSET(threshold), AV_OPT_TYPE_FLOAT, {.dbl=4}, 0, 1000, FLAGS },
+    { NULL },
+};
+
+static const AVFilterPad inputs[] = {
+    {
+        .name           = "default",
+        .type           = AVMEDIA_TYPE_VIDEO,
+        .filter_frame   = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad outputs[] = {
+    {
+        .name          = "default",
+        .type          = AVMEDIA_TYPE_VIDEO,
+        .config_props  = config_output,
+    },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(fovupconv);
+
+AVFilter ff_vf_fovupconv = {
+    .name          = "fovupconv",
+    .description   = NULL_IF_CONFIG_SMALL("Extrapolate the held periphery of temporally foveated video."),
+    .priv_size     = sizeof(FovUpconvContext),
+    .priv_class    = &fovupconv_class,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = inputs,
+    .outputs       = outputs,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+};
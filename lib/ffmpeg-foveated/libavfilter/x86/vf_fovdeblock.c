@@ -0,0 +1,418 @@
+/*
+ * AVX2 edge filters of the fovdeblock filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/x86/asm.h"
+#include "libavutil/x86/cpu.h"
+#include "libavfilter/fovdeblock.h"
+
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+
+/* thresholds of the edges left alone */
+DECLARE_ASM_ALIGNED(16, static const int16_t, no_edge)[32];
+
+/* interleave the bytes of the two qwords within each 16-byte lane */
+DECLARE_ASM_ALIGNED(32, static const uint8_t, interleave)[32] = {
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+    0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+};
+
+/*
+ * The pixels across an edge are words in ymm0-5, p2 p1 p0 | q0 q1 q2, and
+ * ath, bth, gth, dth are in ymm12-15. Pixels failing a threshold get a delta
+ * of 0. The deltas are divided by shifting their magnitude, which truncates
+ * toward zero like the C version, and clipping is left to vpackuswb.
+ */
+#define WEAK                                                            \
+        "vpsubw     %%ymm2, %%ymm3, %%ymm6                  \n\t"       \
+        "vpabsw     %%ymm6, %%ymm7                          \n\t"       \
+        "vpcmpgtw   %%ymm7, %%ymm12, %%ymm8                 \n\t"       \
+        "vpsubw     %%ymm1, %%ymm2, %%ymm9                  \n\t"       \
+        "vpabsw     %%ymm9, %%ymm9                          \n\t"       \
+        "vpcmpgtw   %%ymm9, %%ymm13, %%ymm9                 \n\t"       \
+        "vpand      %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpsubw     %%ymm4, %%ymm3, %%ymm9                  \n\t"       \
+        "vpabsw     %%ymm9, %%ymm9                          \n\t"       \
+        "vpcmpgtw   %%ymm9, %%ymm14, %%ymm9                 \n\t"       \
+        "vpand      %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpand      %%ymm8, %%ymm6, %%ymm6                  \n\t"       \
+        "vpsrlw     $3, %%ymm7, %%ymm8                      \n\t"       \
+        "vpsrlw     $1, %%ymm7, %%ymm7                      \n\t"       \
+        "vpsignw    %%ymm6, %%ymm8, %%ymm8                  \n\t"       \
+        "vpsignw    %%ymm6, %%ymm7, %%ymm7                  \n\t"       \
+        "vpaddw     %%ymm8, %%ymm1, %%ymm1                  \n\t"       \
+        "vpaddw     %%ymm7, %%ymm2, %%ymm2                  \n\t"       \
+        "vpsubw     %%ymm7, %%ymm3, %%ymm3                  \n\t"       \
+        "vpsubw     %%ymm8, %%ymm4, %%ymm4                  \n\t"
+
+#define STRONG                                                          \
+        "vpsubw     %%ymm2, %%ymm3, %%ymm6                  \n\t"       \
+        "vpabsw     %%ymm6, %%ymm7                          \n\t"       \
+        "vpcmpgtw   %%ymm7, %%ymm12, %%ymm8                 \n\t"       \
+        "vpsubw     %%ymm1, %%ymm2, %%ymm9                  \n\t"       \
+        "vpabsw     %%ymm9, %%ymm9                          \n\t"       \
+        "vpcmpgtw   %%ymm9, %%ymm13, %%ymm9                 \n\t"       \
+        "vpand      %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpsubw     %%ymm5, %%ymm4, %%ymm9                  \n\t"       \
+        "vpabsw     %%ymm9, %%ymm9                          \n\t"       \
+        "vpcmpgtw   %%ymm9, %%ymm14, %%ymm9                 \n\t"       \
+        "vpand      %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpsubw     %%ymm4, %%ymm3, %%ymm9                  \n\t"       \
+        "vpabsw     %%ymm9, %%ymm9                          \n\t"       \
+        "vpcmpgtw   %%ymm9, %%ymm15, %%ymm9                 \n\t"       \
+        "vpand      %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpand      %%ymm8, %%ymm6, %%ymm6                  \n\t"       \
+        "vpsrlw     $3, %%ymm7, %%ymm8                      \n\t"       \
+        "vpsrlw     $2, %%ymm7, %%ymm9                      \n\t"       \
+        "vpsrlw     $1, %%ymm7, %%ymm7                      \n\t"       \
+        "vpsignw    %%ymm6, %%ymm8, %%ymm8                  \n\t"       \
+        "vpsignw    %%ymm6, %%ymm9, %%ymm9                  \n\t"       \
+        "vpsignw    %%ymm6, %%ymm7, %%ymm7                  \n\t"       \
+        "vpaddw     %%ymm8, %%ymm0, %%ymm0                  \n\t"       \
+        "vpaddw     %%ymm9, %%ymm1, %%ymm1                  \n\t"       \
+        "vpaddw     %%ymm7, %%ymm2, %%ymm2                  \n\t"       \
+        "vpsubw     %%ymm7, %%ymm3, %%ymm3                  \n\t"       \
+        "vpsubw     %%ymm9, %%ymm4, %%ymm4                  \n\t"       \
+        "vpsubw     %%ymm8, %%ymm5, %%ymm5                  \n\t"
+
+/*
+ * Point %3 and %4 at the thresholds th[0] and th[1] of the next two blocks
+ * or edges, those left alone at no_edge in %8. Skip to the label if both
+ * are.
+ */
+#define LOAD_PAIR(skip)                                                 \
+        "mov          (%2), %3                              \n\t"       \
+        "mov         8(%2), %4                              \n\t"       \
+        "test       %3, %3                                  \n\t"       \
+        "jnz        6f                                      \n\t"       \
+        "test       %4, %4                                  \n\t"       \
+        "jz         "skip"                                  \n\t"       \
+        "6:                                                 \n\t"       \
+        "test       %3, %3                                  \n\t"       \
+        "cmovz      %8, %3                                  \n\t"       \
+        "test       %4, %4                                  \n\t"       \
+        "cmovz      %8, %4                                  \n\t"
+
+/* the thresholds of the pair, the first one in the low lanes */
+#define LOAD_THRESHOLDS                                                 \
+        "vmovdqu      (%3), %%xmm12                         \n\t"       \
+        "vinserti128 $1,   (%4), %%ymm12, %%ymm12           \n\t"       \
+        "vmovdqu    16(%3), %%xmm13                         \n\t"       \
+        "vinserti128 $1, 16(%4), %%ymm13, %%ymm13           \n\t"       \
+        "vmovdqu    32(%3), %%xmm14                         \n\t"       \
+        "vinserti128 $1, 32(%4), %%ymm14, %%ymm14           \n\t"       \
+        "vmovdqu    48(%3), %%xmm15                         \n\t"       \
+        "vinserti128 $1, 48(%4), %%ymm15, %%ymm15           \n\t"
+
+/*
+ * 16 columns from two blocks per iteration, an 8-column tail in the low
+ * lane. Rows are addressed from dst with %5 = linesize, %6 = -linesize and
+ * %7 = -3 * linesize. vpackuswb leaves two rows interleaved by qword per
+ * lane, vpermq puts each row into a lane of its own.
+ */
+static void edgeh_weak_avx2(uint8_t *dst, ptrdiff_t linesize, int width,
+                            const int16_t *const *th)
+{
+    const int16_t *th0, *th1;
+    x86_reg n = width;
+
+    __asm__ volatile(
+        "sub        $16, %1                     \n\t"
+        "jl         4f                          \n\t"
+        "1:                                     \n\t"
+        LOAD_PAIR("3f")
+        LOAD_THRESHOLDS
+        "vpmovzxbw  (%0, %6, 2), %%ymm1         \n\t"
+        "vpmovzxbw  (%0, %6), %%ymm2            \n\t"
+        "vpmovzxbw  (%0), %%ymm3                \n\t"
+        "vpmovzxbw  (%0, %5), %%ymm4            \n\t"
+        WEAK
+        "vpackuswb  %%ymm2, %%ymm1, %%ymm1      \n\t"
+        "vpackuswb  %%ymm4, %%ymm3, %%ymm3      \n\t"
+        "vpermq     $0xd8, %%ymm1, %%ymm1       \n\t"
+        "vpermq     $0xd8, %%ymm3, %%ymm3       \n\t"
+        "vmovdqu    %%xmm1, (%0, %6, 2)         \n\t"
+        "vextracti128 $1, %%ymm1, (%0, %6)      \n\t"
+        "vmovdqu    %%xmm3, (%0)                \n\t"
+        "vextracti128 $1, %%ymm3, (%0, %5)      \n\t"
+        "3:                                     \n\t"
+        "add        $16, %0                     \n\t"
+        "add        $16, %2                     \n\t"
+        "sub        $16, %1                     \n\t"
+        "jge        1b                          \n\t"
+        "4:                                     \n\t"
+        "add        $16, %1                     \n\t"
+        "jz         5f                          \n\t"
+        "mov        (%2), %3                    \n\t"
+        "test       %3, %3                      \n\t"
+        "jz         5f                          \n\t"
+        "vmovdqu      (%3), %%xmm12             \n\t"
+        "vmovdqu    16(%3), %%xmm13             \n\t"
+        "vmovdqu    32(%3), %%xmm14             \n\t"
+        "vmovdqu    48(%3), %%xmm15             \n\t"
+        "vpmovzxbw  (%0, %6, 2), %%xmm1         \n\t"
+        "vpmovzxbw  (%0, %6), %%xmm2            \n\t"
+        "vpmovzxbw  (%0), %%xmm3                \n\t"
+        "vpmovzxbw  (%0, %5), %%xmm4            \n\t"
+        WEAK
+        "vpackuswb  %%ymm2, %%ymm1, %%ymm1      \n\t"
+        "vpackuswb  %%ymm4, %%ymm3, %%ymm3      \n\t"
+        "vmovq      %%xmm1, (%0, %6, 2)         \n\t"
+        "vmovhps    %%xmm1, (%0, %6)            \n\t"
+        "vmovq      %%xmm3, (%0)                \n\t"
+        "vmovhps    %%xmm3, (%0, %5)            \n\t"
+        "5:                                     \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(dst), "+r"(n), "+r"(th), "=&r"(th0), "=&r"(th1)
+        : "r"((x86_reg)linesize), "r"(-(x86_reg)linesize),
+          "r"(-3 * (x86_reg)linesize), "r"(no_edge)
+        : XMM_CLOBBERS("%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm6", "%xmm7",
+                       "%xmm8", "%xmm9", "%xmm12", "%xmm13", "%xmm14", "%xmm15",)
+          "memory", "cc"
+    );
+}
+
+static void edgeh_strong_avx2(uint8_t *dst, ptrdiff_t linesize, int width,
+                              const int16_t *const *th)
+{
+    const int16_t *th0, *th1;
+    x86_reg n = width;
+
+    __asm__ volatile(
+        "sub        $16, %1                     \n\t"
+        "jl         4f                          \n\t"
+        "1:                                     \n\t"
+        LOAD_PAIR("3f")
+        LOAD_THRESHOLDS
+        "vpmovzxbw  (%0, %7), %%ymm0            \n\t"
+        "vpmovzxbw  (%0, %6, 2), %%ymm1         \n\t"
+        "vpmovzxbw  (%0, %6), %%ymm2            \n\t"
+        "vpmovzxbw  (%0), %%ymm3                \n\t"
+        "vpmovzxbw  (%0, %5), %%ymm4            \n\t"
+        "vpmovzxbw  (%0, %5, 2), %%ymm5         \n\t"
+        STRONG
+        "vpackuswb  %%ymm1, %%ymm0, %%ymm0      \n\t"
+        "vpackuswb  %%ymm3, %%ymm2, %%ymm2      \n\t"
+        "vpackuswb  %%ymm5, %%ymm4, %%ymm4      \n\t"
+        "vpermq     $0xd8, %%ymm0, %%ymm0       \n\t"
+        "vpermq     $0xd8, %%ymm2, %%ymm2       \n\t"
+        "vpermq     $0xd8, %%ymm4, %%ymm4       \n\t"
+        "vmovdqu    %%xmm0, (%0, %7)            \n\t"
+        "vextracti128 $1, %%ymm0, (%0, %6, 2)   \n\t"
+        "vmovdqu    %%xmm2, (%0, %6)            \n\t"
+        "vextracti128 $1, %%ymm2, (%0)          \n\t"
+        "vmovdqu    %%xmm4, (%0, %5)            \n\t"
+        "vextracti128 $1, %%ymm4, (%0, %5, 2)   \n\t"
+        "3:                                     \n\t"
+        "add        $16, %0                     \n\t"
+        "add        $16, %2                     \n\t"
+        "sub        $16, %1                     \n\t"
+        "jge        1b                          \n\t"
+        "4:                                     \n\t"
+        "add        $16, %1                     \n\t"
+        "jz         5f                          \n\t"
+        "mov        (%2), %3                    \n\t"
+        "test       %3, %3                      \n\t"
+        "jz         5f                          \n\t"
+        "vmovdqu      (%3), %%xmm12             \n\t"
+        "vmovdqu    16(%3), %%xmm13             \n\t"
+        "vmovdqu    32(%3), %%xmm14             \n\t"
+        "vmovdqu    48(%3), %%xmm15             \n\t"
+        "vpmovzxbw  (%0, %7), %%xmm0            \n\t"
+        "vpmovzxbw  (%0, %6, 2), %%xmm1         \n\t"
+        "vpmovzxbw  (%0, %6), %%xmm2            \n\t"
+        "vpmovzxbw  (%0), %%xmm3                \n\t"
+        "vpmovzxbw  (%0, %5), %%xmm4            \n\t"
+        "vpmovzxbw  (%0, %5, 2), %%xmm5         \n\t"
+        STRONG
+        "vpackuswb  %%ymm1, %%ymm0, %%ymm0      \n\t"
+        "vpackuswb  %%ymm3, %%ymm2, %%ymm2      \n\t"
+        "vpackuswb  %%ymm5, %%ymm4, %%ymm4      \n\t"
+        "vmovq      %%xmm0, (%0, %7)            \n\t"
+        "vmovhps    %%xmm0, (%0, %6, 2)         \n\t"
+        "vmovq      %%xmm2, (%0, %6)            \n\t"
+        "vmovhps    %%xmm2, (%0)                \n\t"
+        "vmovq      %%xmm4, (%0, %5)            \n\t"
+        "vmovhps    %%xmm4, (%0, %5, 2)         \n\t"
+        "5:                                     \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(dst), "+r"(n), "+r"(th), "=&r"(th0), "=&r"(th1)
+        : "r"((x86_reg)linesize), "r"(-(x86_reg)linesize),
+          "r"(-3 * (x86_reg)linesize), "r"(no_edge)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5",
+                       "%xmm6", "%xmm7", "%xmm8", "%xmm9",
+                       "%xmm12", "%xmm13", "%xmm14", "%xmm15",)
+          "memory", "cc"
+    );
+}
+
+/*
+ * 8x8 byte transpose of both edges at once, the left one in the low lanes.
+ * ymm6-9 hold pairs of rows (or columns) with their bytes interleaved,
+ * which leaves pairs of columns (or rows) in ymm10, 13, 14 and 11.
+ */
+#define TRANSPOSE                                                       \
+        "vpunpcklwd %%ymm7, %%ymm6, %%ymm10                 \n\t"       \
+        "vpunpckhwd %%ymm7, %%ymm6, %%ymm6                  \n\t"       \
+        "vpunpcklwd %%ymm9, %%ymm8, %%ymm7                  \n\t"       \
+        "vpunpckhwd %%ymm9, %%ymm8, %%ymm8                  \n\t"       \
+        "vpunpckhdq %%ymm7, %%ymm10, %%ymm13                \n\t"       \
+        "vpunpckldq %%ymm7, %%ymm10, %%ymm10                \n\t"       \
+        "vpunpckldq %%ymm8, %%ymm6, %%ymm14                 \n\t"       \
+        "vpunpckhdq %%ymm8, %%ymm6, %%ymm11                 \n\t"
+
+/* a pair of rows, the 8 bytes around either edge of both in a lane */
+#define LOAD_ROWS(reg, row0, row1)                                      \
+        "vmovdqu    "row0", %%xmm"#reg"                     \n\t"       \
+        "vinserti128 $1, "row1", %%ymm"#reg", %%ymm"#reg"   \n\t"       \
+        "vpermq     $0xd8, %%ymm"#reg", %%ymm"#reg"         \n\t"       \
+        "vpshufb    %9, %%ymm"#reg", %%ymm"#reg"            \n\t"
+
+/*
+ * Rows 0-3 from %0 and rows 4-7 from %5, with %6 = linesize and
+ * %7 = 3 * linesize. Columns p1 p0 q0 q1 end up as words in ymm1-4.
+ */
+#define LOAD_COLUMNS                                                    \
+        LOAD_ROWS(6, "(%0)", "(%0, %6)")                                \
+        LOAD_ROWS(7, "(%0, %6, 2)", "(%0, %7)")                         \
+        LOAD_ROWS(8, "(%5)", "(%5, %6)")                                \
+        LOAD_ROWS(9, "(%5, %6, 2)", "(%5, %7)")                         \
+        TRANSPOSE                                                       \
+        "vpxor      %%ymm12, %%ymm12, %%ymm12               \n\t"       \
+        "vpunpcklbw %%ymm12, %%ymm13, %%ymm1                \n\t"       \
+        "vpunpckhbw %%ymm12, %%ymm13, %%ymm2                \n\t"       \
+        "vpunpcklbw %%ymm12, %%ymm14, %%ymm3                \n\t"       \
+        "vpunpckhbw %%ymm12, %%ymm14, %%ymm4                \n\t"
+
+#define STORE_COLUMNS                                                   \
+        "vpshufb    %9, %%ymm10, %%ymm6                     \n\t"       \
+        "vpshufb    %9, %%ymm13, %%ymm7                     \n\t"       \
+        "vpshufb    %9, %%ymm14, %%ymm8                     \n\t"       \
+        "vpshufb    %9, %%ymm11, %%ymm9                     \n\t"       \
+        TRANSPOSE                                                       \
+        "vpermq     $0xd8, %%ymm10, %%ymm10                 \n\t"       \
+        "vmovdqu    %%xmm10, (%0)                           \n\t"       \
+        "vextracti128 $1, %%ymm10, (%0, %6)                 \n\t"       \
+        "vpermq     $0xd8, %%ymm13, %%ymm13                 \n\t"       \
+        "vmovdqu    %%xmm13, (%0, %6, 2)                    \n\t"       \
+        "vextracti128 $1, %%ymm13, (%0, %7)                 \n\t"       \
+        "vpermq     $0xd8, %%ymm14, %%ymm14                 \n\t"       \
+        "vmovdqu    %%xmm14, (%5)                           \n\t"       \
+        "vextracti128 $1, %%ymm14, (%5, %6)                 \n\t"       \
+        "vpermq     $0xd8, %%ymm11, %%ymm11                 \n\t"       \
+        "vmovdqu    %%xmm11, (%5, %6, 2)                    \n\t"       \
+        "vextracti128 $1, %%ymm11, (%5, %7)                 \n\t"
+
+/*
+ * Two edges per iteration: the 16 bytes from 4 left of the first edge hold
+ * the 8 columns around either edge. They are transposed so that the
+ * filter of the horizontal edges applies, and transposed back.
+ */
+static void edgev_weak_avx2(uint8_t *dst, ptrdiff_t linesize, int width,
+                            const int16_t *const *th)
+{
+    uint8_t *row0 = dst - 4, *row4 = dst - 4 + 4 * linesize;
+    const int16_t *th0, *th1;
+    x86_reg n = width;
+
+    __asm__ volatile(
+        "1:                                     \n\t"
+        LOAD_PAIR("3f")
+        LOAD_COLUMNS
+        LOAD_THRESHOLDS
+        WEAK
+        "vpackuswb  %%ymm2, %%ymm1, %%ymm13     \n\t"
+        "vpackuswb  %%ymm4, %%ymm3, %%ymm14     \n\t"
+        STORE_COLUMNS
+        "3:                                     \n\t"
+        "add        $16, %0                     \n\t"
+        "add        $16, %5                     \n\t"
+        "add        $16, %2                     \n\t"
+        "sub        $16, %1                     \n\t"
+        "jg         1b                          \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(row0), "+r"(n), "+r"(th), "=&r"(th0), "=&r"(th1), "+r"(row4)
+        : "r"((x86_reg)linesize), "r"(3 * (x86_reg)linesize), "r"(no_edge),
+          "m"(*interleave)
+        : XMM_CLOBBERS("%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm6", "%xmm7",
+                       "%xmm8", "%xmm9", "%xmm10", "%xmm11", "%xmm12", "%xmm13",
+                       "%xmm14", "%xmm15",)
+          "memory", "cc"
+    );
+}
+
+/* p2 and q2 are the high half of ymm10 and the low half of ymm11 */
+static void edgev_strong_avx2(uint8_t *dst, ptrdiff_t linesize, int width,
+                              const int16_t *const *th)
+{
+    uint8_t *row0 = dst - 4, *row4 = dst - 4 + 4 * linesize;
+    const int16_t *th0, *th1;
+    x86_reg n = width;
+
+    __asm__ volatile(
+        "1:                                     \n\t"
+        LOAD_PAIR("3f")
+        LOAD_COLUMNS
+        "vpunpckhbw %%ymm12, %%ymm10, %%ymm0    \n\t"
+        "vpunpcklbw %%ymm12, %%ymm11, %%ymm5    \n\t"
+        LOAD_THRESHOLDS
+        STRONG
+        "vpackuswb  %%ymm0, %%ymm0, %%ymm0      \n\t"
+        "vpackuswb  %%ymm5, %%ymm5, %%ymm5      \n\t"
+        "vpunpcklqdq %%ymm0, %%ymm10, %%ymm10   \n\t"
+        "vpblendd   $0xcc, %%ymm11, %%ymm5, %%ymm11 \n\t"
+        "vpackuswb  %%ymm2, %%ymm1, %%ymm13     \n\t"
+        "vpackuswb  %%ymm4, %%ymm3, %%ymm14     \n\t"
+        STORE_COLUMNS
+        "3:                                     \n\t"
+        "add        $16, %0                     \n\t"
+        "add        $16, %5                     \n\t"
+        "add        $16, %2                     \n\t"
+        "sub        $16, %1                     \n\t"
+        "jg         1b                          \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(row0), "+r"(n), "+r"(th), "=&r"(th0), "=&r"(th1), "+r"(row4)
+        : "r"((x86_reg)linesize), "r"(3 * (x86_reg)linesize), "r"(no_edge),
+          "m"(*interleave)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5",
+                       "%xmm6", "%xmm7", "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+                       "%xmm12", "%xmm13", "%xmm14", "%xmm15",)
+          "memory", "cc"
+    );
+}
+
+#endif /* HAVE_AVX2_INLINE && ARCH_X86_64 */
+
+av_cold void ff_fovdeblock_dsp_init_x86(FovDeblockDSPContext *dsp)
+{
+#if HAVE_AVX2_INLINE && ARCH_X86_64
+    int cpu_flags = av_get_cpu_flags();
+
+    if (INLINE_AVX2(cpu_flags)) {
+        dsp->edgeh[0] = edgeh_weak_avx2;
+        dsp->edgeh[1] = edgeh_strong_avx2;
+        dsp->edgev[0] = edgev_weak_avx2;
+        dsp->edgev[1] = edgev_strong_avx2;
+    }
+#endif
+}
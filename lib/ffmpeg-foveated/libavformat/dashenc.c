@@ -503,6 +503,8 @@ static void write_hls_media_playlist(OutputStream *os, AVFormatContext *s,
         if (target_duration <= duration)
             target_duration = lrint(duration);
     }
+    /* sub-second segments, 0 would make clients reload continuously */
+    target_duration = FFMAX(target_duration, 1);
 
     ff_hls_write_playlist_header(c->m3u8_out, 6, -1, target_duration,
                                  start_number, PLAYLIST_TYPE_NONE, 0);
@@ -751,7 +753,7 @@ static int write_adaptation_set(AVFormatContext *s, AVIOContext *out, int as_ind
 {
     DASHContext *c = s->priv_data;
     AdaptationSet *as = &c->as[as_index];
-    AVDictionaryEntry *lang, *role;
+    AVDictionaryEntry *lang, *role, *fovea;
     int i;
 
     avio_printf(out, "\t\t<AdaptationSet id=\"%s\" contentType=\"%s\" segmentAlignment=\"true\" bitstreamSwitching=\"true\"",
@@ -786,6 +788,10 @@ static int write_adaptation_set(AVFormatContext *s, AVIOContext *out, int as_ind
             if (st->avg_frame_rate.num)
                 avio_printf(out, " frameRate=\"%d/%d\"", st->avg_frame_rate.num, st->avg_frame_rate.den);
             avio_printf(out, ">\n");
+            fovea = av_dict_get(st->metadata, "fovea", NULL, 0);
+            if (fovea)
+                avio_printf(out, "\t\t\t\t<SupplementalProperty schemeIdUri=\"urn:ffoveated:fovea:2020\" value=\"%s\"/>\n",
+                            fovea->value);
         } else {
             avio_printf(out, "\t\t\t<Representation id=\"%d\" mimeType=\"audio/%s\" codecs=\"%s\"%s audioSamplingRate=\"%d\">\n",
                 i, os->format_name, os->codec_str, bandwidth_str, s->streams[i]->codecpar->sample_rate);
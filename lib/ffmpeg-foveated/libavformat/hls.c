@@ -187,6 +187,9 @@ struct variant {
     char audio_group[MAX_FIELD_LEN];
     char video_group[MAX_FIELD_LEN];
     char subtitles_group[MAX_FIELD_LEN];
+
+    /* x,y,sigma,delta of a gaze-region ladder variant, empty if none */
+    char fovea[MAX_FIELD_LEN];
 };
 
 typedef struct HLSContext {
@@ -212,6 +215,7 @@ typedef struct HLSContext {
     int http_persistent;
     int http_multiple;
     int http_seekable;
+    int drop_discarded;
     AVIOContext *playlist_pb;
 } HLSContext;
 
@@ -326,6 +330,7 @@ struct variant_info {
     char audio[MAX_FIELD_LEN];
     char video[MAX_FIELD_LEN];
     char subtitles[MAX_FIELD_LEN];
+    char fovea[MAX_FIELD_LEN];
 };
 
 static struct variant *new_variant(HLSContext *c, struct variant_info *info,
@@ -347,6 +352,7 @@ static struct variant *new_variant(HLSContext *c, struct variant_info *info,
         strcpy(var->audio_group, info->audio);
         strcpy(var->video_group, info->video);
         strcpy(var->subtitles_group, info->subtitles);
+        strcpy(var->fovea, info->fovea);
     }
 
     dynarray_add(&c->variants, &c->n_variants, var);
@@ -369,6 +375,9 @@ static void handle_variant_args(struct variant_info *info, const char *key,
     } else if (!strncmp(key, "SUBTITLES=", key_len)) {
         *dest     =        info->subtitles;
         *dest_len = sizeof(info->subtitles);
+    } else if (!strncmp(key, "FOVEA=", key_len)) {
+        *dest     =        info->fovea;
+        *dest_len = sizeof(info->fovea);
     }
 }
 
@@ -1706,6 +1715,10 @@ static void add_stream_to_programs(AVFormatContext *s, struct playlist *pls, AVS
 
             av_program_add_stream_index(s, i, stream->index);
 
+            /* the variant's own playlist carries its fovea */
+            if (j == 0 && v->fovea[0])
+                av_dict_set(&stream->metadata, "fovea", v->fovea, 0);
+
             if (bandwidth < 0)
                 bandwidth = v->bandwidth;
             else if (bandwidth != v->bandwidth)
@@ -1878,6 +1891,8 @@ static int hls_read_header(AVFormatContext *s)
         if (!program)
             goto fail;
         av_dict_set_int(&program->metadata, "variant_bitrate", v->bandwidth, 0);
+        if (v->fovea[0])
+            av_dict_set(&program->metadata, "fovea", v->fovea, 0);
     }
 
     /* Select the starting segments */
@@ -2031,13 +2046,22 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
                 pls->seek_stream_index = -1;
             }
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
-        } else if (first && !cur_needed && pls->needed) {
+        } else if ((first || c->drop_discarded) && !cur_needed && pls->needed) {
             ff_format_io_close(pls->parent, &pls->input);
             pls->input_read_done = 0;
             ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
             pls->needed = 0;
             changed = 1;
+            if (!first) {
+                /* resumes elsewhere if it is needed again */
+                av_packet_unref(&pls->pkt);
+                pls->pb.eof_reached = 0;
+                pls->pb.buf_end = pls->pb.buf_ptr = pls->pb.buffer;
+                pls->pb.pos = 0;
+                if (pls->ctx)
+                    ff_read_frame_flush(pls->ctx);
+            }
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
         }
     }
@@ -2339,6 +2363,8 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"drop_discarded", "Stop fetching playlists whose streams get discarded during playback",
+        OFFSET(drop_discarded), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
     {NULL}
 };
 
@@ -1462,6 +1462,8 @@ static int hls_window(AVFormatContext *s, int last, VariantStream *vs)
         if (target_duration <= en->duration)
             target_duration = lrint(en->duration);
     }
+    /* sub-second segments, 0 would make clients reload continuously */
+    target_duration = FFMAX(target_duration, 1);
 
     vs->discontinuity_set = 0;
     ff_hls_write_playlist_header(byterange_mode ? hls->m3u8_out : vs->out, hls->version, hls->allowcache,
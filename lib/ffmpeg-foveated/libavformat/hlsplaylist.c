@@ -51,6 +51,7 @@ void ff_hls_write_audio_rendition(AVIOContext *out, char *agroup,
 void ff_hls_write_stream_info(AVStream *st, AVIOContext *out,
                               int bandwidth, const char *filename, char *agroup,
                               char *codecs, char *ccgroup) {
+    AVDictionaryEntry *fovea;
 
     if (!out || !filename)
         return;
@@ -71,6 +72,10 @@ void ff_hls_write_stream_info(AVStream *st, AVIOContext *out,
         avio_printf(out, ",AUDIO=\"group_%s\"", agroup);
     if (ccgroup && strlen(ccgroup) > 0)
         avio_printf(out, ",CLOSED-CAPTIONS=\"%s\"", ccgroup);
+    /* region a gaze-region ladder variant is foveated on */
+    fovea = st ? av_dict_get(st->metadata, "fovea", NULL, 0) : NULL;
+    if (fovea)
+        avio_printf(out, ",FOVEA=\"%s\"", fovea->value);
     avio_printf(out, "\n%s\n\n", filename);
 }
 
@@ -25,6 +25,7 @@
 #include "libavutil/time.h"
 
 #include "avformat.h"
+#include "internal.h"
 #include "network.h"
 #include "srtp.h"
 #include "url.h"
@@ -32,6 +33,7 @@
 #include "rtpdec_formats.h"
 
 #define MIN_FEEDBACK_INTERVAL 200000 /* 200 ms in us */
+#define CCFB_INTERVAL          25000 /* 25 ms in us */
 
 static RTPDynamicProtocolHandler l24_dynamic_handler = {
     .enc_name   = "L24",
@@ -465,10 +467,73 @@ static int find_missing_packets(RTPDemuxContext *s, uint16_t *first_missing,
     return 1;
 }
 
+static void ccfb_record(RTPDemuxContext *s, uint16_t seq, int64_t now)
+{
+    int slot = seq % RTP_CCFB_HISTORY;
+
+    if (!s->ccfb_started) {
+        s->ccfb_begin   = seq;
+        s->ccfb_end     = seq + 1;
+        s->ccfb_started = 1;
+    } else if ((int16_t)(seq - s->ccfb_end) >= 0) {
+        s->ccfb_end = seq + 1;
+    } else if ((int16_t)(seq - s->ccfb_begin) < 0) {
+        /* already reported as lost */
+        return;
+    }
+    s->ccfb_seq[slot]     = seq;
+    s->ccfb_arrival[slot] = now;
+    if ((uint16_t)(s->ccfb_end - s->ccfb_begin) > RTP_CCFB_MAX_REPORTS)
+        s->ccfb_begin = s->ccfb_end - RTP_CCFB_MAX_REPORTS;
+    s->ccfb_new = 1;
+}
+
+static int64_t ccfb_arrival(RTPDemuxContext *s, uint16_t seq)
+{
+    int slot = seq % RTP_CCFB_HISTORY;
+    return s->ccfb_seq[slot] == seq ? s->ccfb_arrival[slot] : 0;
+}
+
+/**
+ * Write a congestion control feedback report for all packets from
+ * ccfb_begin on. Packets still missing are reported again by the next
+ * report, until they fall out of the reported range.
+ */
+static void ccfb_write(RTPDemuxContext *s, AVIOContext *pb, int64_t now)
+{
+    int n = (uint16_t)(s->ccfb_end - s->ccfb_begin), i;
+    uint64_t ntp = ff_ntp_time();
+
+    avio_w8(pb, (RTP_VERSION << 6) | 11); /* CCFB */
+    avio_w8(pb, RTCP_RTPFB);
+    avio_wb16(pb, 4 + (n + 1) / 2); /* length in words - 1 */
+    avio_wb32(pb, s->ssrc + 1);
+    avio_wb32(pb, s->ssrc); // server SSRC
+    avio_wb16(pb, s->ccfb_begin);
+    avio_wb16(pb, n);
+    for (i = 0; i < n; i++) {
+        int64_t arrival = ccfb_arrival(s, s->ccfb_begin + i);
+        /* R bit and arrival time offset in 1/1024 s, no ECN */
+        if (arrival)
+            avio_wb16(pb, 0x8000 | FFMIN((now - arrival) * 1024 / 1000000, 0x1ffe));
+        else
+            avio_wb16(pb, 0);
+    }
+    if (n & 1)
+        avio_wb16(pb, 0);
+    /* report timestamp, the middle 32 bits of the NTP time */
+    avio_wb32(pb, (ntp / 1000000) << 16 | ((ntp % 1000000) << 16) / 1000000);
+
+    while (s->ccfb_begin != s->ccfb_end && ccfb_arrival(s, s->ccfb_begin))
+        s->ccfb_begin++;
+    s->ccfb_new       = 0;
+    s->last_ccfb_time = now;
+}
+
 int ff_rtp_send_rtcp_feedback(RTPDemuxContext *s, URLContext *fd,
                               AVIOContext *avio)
 {
-    int len, need_keyframe, missing_packets;
+    int len, need_keyframe, missing_packets, need_ccfb;
     AVIOContext *pb;
     uint8_t *buf;
     int64_t now;
@@ -480,18 +545,26 @@ int ff_rtp_send_rtcp_feedback(RTPDemuxContext *s, URLContext *fd,
     need_keyframe = s->handler && s->handler->need_keyframe &&
                     s->handler->need_keyframe(s->dynamic_protocol_context);
     missing_packets = find_missing_packets(s, &first_missing, &missing_mask);
+    need_ccfb = s->ccfb && s->ccfb_new;
 
-    if (!need_keyframe && !missing_packets)
+    if (!need_keyframe && !missing_packets && !need_ccfb)
         return 0;
 
     /* Send new feedback if enough time has elapsed since the last
-     * feedback packet. */
+     * feedback packet. Congestion control feedback is paced on its own. */
 
     now = av_gettime_relative();
-    if (s->last_feedback_time &&
-        (now - s->last_feedback_time) < MIN_FEEDBACK_INTERVAL)
+    if (need_ccfb && now - s->last_ccfb_time < CCFB_INTERVAL)
+        need_ccfb = 0;
+    if (need_keyframe || missing_packets) {
+        if (s->last_feedback_time &&
+            (now - s->last_feedback_time) < MIN_FEEDBACK_INTERVAL)
+            need_keyframe = missing_packets = 0;
+        else
+            s->last_feedback_time = now;
+    }
+    if (!need_keyframe && !missing_packets && !need_ccfb)
         return 0;
-    s->last_feedback_time = now;
 
     if (!fd)
         pb = avio;
@@ -518,6 +591,9 @@ int ff_rtp_send_rtcp_feedback(RTPDemuxContext *s, URLContext *fd,
         avio_wb16(pb, missing_mask);
     }
 
+    if (need_ccfb)
+        ccfb_write(s, pb, now);
+
     avio_flush(pb);
     if (!fd)
         return 0;
@@ -547,6 +623,7 @@ RTPDemuxContext *ff_rtp_parse_open(AVFormatContext *s1, AVStream *st,
     s->ic                  = s1;
     s->st                  = st;
     s->queue_size          = queue_size;
+    s->fec_payload_type    = -1;
 
     av_log(s->ic, AV_LOG_VERBOSE, "setting jitter buffer size to %d\n",
            s->queue_size);
@@ -705,6 +782,21 @@ static int rtp_parse_packet_internal(RTPDemuxContext *s, AVPacket *pkt,
     return rv;
 }
 
+static void fec_reset(RTPDemuxContext *s)
+{
+    int i;
+
+    for (i = 0; i < RTP_FEC_HISTORY; i++)
+        av_freep(&s->fec_media[i].buf);
+    while (s->fec_queue) {
+        RTPPacket *next = s->fec_queue->next;
+        av_freep(&s->fec_queue->buf);
+        av_freep(&s->fec_queue);
+        s->fec_queue = next;
+    }
+    s->fec_queue_len = 0;
+}
+
 void ff_rtp_reset_packet_queue(RTPDemuxContext *s)
 {
     while (s->queue) {
@@ -716,6 +808,191 @@ void ff_rtp_reset_packet_queue(RTPDemuxContext *s)
     s->seq       = 0;
     s->queue_len = 0;
     s->prev_ret  = 0;
+    fec_reset(s);
+}
+
+/**
+ * Keep a copy of a media packet for FEC recovery.
+ * @return 1 if the packet has already been received or recovered
+ */
+static int fec_remember(RTPDemuxContext *s, const uint8_t *buf, int len)
+{
+    uint16_t seq = AV_RB16(buf + 2);
+    RTPPacket *p = &s->fec_media[seq % RTP_FEC_HISTORY];
+
+    if (p->buf && p->seq == seq)
+        return 1;
+    av_free(p->buf);
+    p->buf = av_memdup(buf, len);
+    p->len = p->buf ? len : 0;
+    p->seq = seq;
+    return 0;
+}
+
+/**
+ * Try to rebuild the media packet protected by an FEC packet.
+ * @return 0 if no protected packet is missing, 1 if one was rebuilt into
+ *         *out, 2 if too many are missing so far, <0 on invalid packets
+ */
+static int fec_recover(RTPDemuxContext *s, const uint8_t *buf, int len,
+                       uint8_t **out, int *out_len)
+{
+    const uint8_t *h, *parity;
+    uint64_t mask;
+    uint32_t ts;
+    uint16_t sn_base, missing_seq = 0;
+    int hlen, prot_len, length, missing = 0, i, j;
+    uint8_t b0, b1, *pkt;
+
+    hlen = 12 + 4 * (buf[0] & 0x0f);
+    if (len < hlen + 14)
+        return AVERROR_INVALIDDATA;
+    h = buf + hlen;
+    if (h[0] & 0x40) {
+        if (len < hlen + 18)
+            return AVERROR_INVALIDDATA;
+        mask   = AV_RB48(h + 12);
+        parity = h + 18;
+    } else {
+        mask   = (uint64_t)AV_RB16(h + 12) << 32;
+        parity = h + 14;
+    }
+    sn_base  = AV_RB16(h + 2);
+    prot_len = AV_RB16(h + 10);
+    if (prot_len > buf + len - parity)
+        return AVERROR_INVALIDDATA;
+
+    for (i = 0; i < 48; i++) {
+        uint16_t seq = sn_base + i;
+        const RTPPacket *p = &s->fec_media[seq % RTP_FEC_HISTORY];
+        if (!(mask & (1ULL << (47 - i))) || (p->buf && p->seq == seq))
+            continue;
+        missing_seq = seq;
+        missing++;
+    }
+    if (missing != 1)
+        return missing ? 2 : 0;
+
+    b0     = h[0];
+    b1     = h[1];
+    ts     = AV_RB32(h + 4);
+    length = AV_RB16(h + 8);
+    for (i = 0; i < 48; i++) {
+        uint16_t seq = sn_base + i;
+        const RTPPacket *p = &s->fec_media[seq % RTP_FEC_HISTORY];
+        if (!(mask & (1ULL << (47 - i))) || seq == missing_seq)
+            continue;
+        b0     ^= p->buf[0];
+        b1     ^= p->buf[1];
+        ts     ^= AV_RB32(p->buf + 4);
+        length ^= p->len - 12;
+    }
+    length &= 0xffff;
+    if (length > prot_len)
+        return AVERROR_INVALIDDATA;
+
+    pkt = av_malloc(12 + length);
+    if (!pkt)
+        return AVERROR(ENOMEM);
+    pkt[0] = (RTP_VERSION << 6) | (b0 & 0x3f);
+    pkt[1] = b1;
+    AV_WB16(pkt + 2, missing_seq);
+    AV_WB32(pkt + 4, ts);
+    AV_WB32(pkt + 8, AV_RB32(buf + 8));
+    memcpy(pkt + 12, parity, length);
+    for (i = 0; i < 48; i++) {
+        uint16_t seq = sn_base + i;
+        const RTPPacket *p = &s->fec_media[seq % RTP_FEC_HISTORY];
+        int n;
+        if (!(mask & (1ULL << (47 - i))) || seq == missing_seq)
+            continue;
+        n = FFMIN(p->len - 12, length);
+        for (j = 0; j < n; j++)
+            pkt[12 + j] ^= p->buf[12 + j];
+    }
+    *out     = pkt;
+    *out_len = 12 + length;
+    return 1;
+}
+
+static int enqueue_packet(RTPDemuxContext *s, uint8_t *buf, int len);
+
+/**
+ * Run the pending FEC packets against the received media packets, and
+ * queue every packet that can be rebuilt.
+ */
+static int fec_try_recover(RTPDemuxContext *s)
+{
+    int progress = 1, ret;
+
+    while (progress) {
+        RTPPacket **cur = &s->fec_queue;
+        progress = 0;
+        while (*cur) {
+            RTPPacket *f = *cur;
+            uint8_t *pkt;
+            int len;
+
+            ret = fec_recover(s, f->buf, f->len, &pkt, &len);
+            if (ret == 1) {
+                uint16_t seq = AV_RB16(pkt + 2);
+                fec_remember(s, pkt, len);
+                /* only useful if it has not been skipped already */
+                if ((int16_t)(seq - s->seq) > 0 || (!s->seq && !s->queue)) {
+                    av_log(s->ic, AV_LOG_DEBUG, "RTP: recovered packet %d\n", seq);
+                    if ((ret = enqueue_packet(s, pkt, len)) < 0) {
+                        av_free(pkt);
+                        return ret;
+                    }
+                } else {
+                    av_free(pkt);
+                }
+                progress = 1;
+            } else if (ret == 2) {
+                cur = &f->next;
+                continue;
+            }
+            *cur = f->next;
+            av_free(f->buf);
+            av_free(f);
+            s->fec_queue_len--;
+        }
+    }
+    return 0;
+}
+
+static int fec_parse_packet(RTPDemuxContext *s, const uint8_t *buf, int len)
+{
+    RTPPacket **tail = &s->fec_queue, *f;
+
+    /* Rebuilt packets are only useful while the reordering queue still
+     * waits for them */
+    if (s->queue_size <= 1)
+        return -1;
+
+    if (s->fec_queue_len >= RTP_FEC_PENDING) {
+        f = s->fec_queue;
+        s->fec_queue = f->next;
+        av_free(f->buf);
+        av_free(f);
+        s->fec_queue_len--;
+    }
+    while (*tail)
+        tail = &(*tail)->next;
+    f = av_mallocz(sizeof(*f));
+    if (!f)
+        return AVERROR(ENOMEM);
+    f->buf = av_memdup(buf, len);
+    if (!f->buf) {
+        av_free(f);
+        return AVERROR(ENOMEM);
+    }
+    f->len = len;
+    f->seq = AV_RB16(buf + 2);
+    *tail  = f;
+    s->fec_queue_len++;
+
+    return fec_try_recover(s) < 0 ? AVERROR(ENOMEM) : -1;
 }
 
 static int enqueue_packet(RTPDemuxContext *s, uint8_t *buf, int len)
@@ -813,6 +1090,23 @@ static int rtp_parse_one_packet(RTPDemuxContext *s, AVPacket *pkt,
         return rtcp_parse_packet(s, buf, len);
     }
 
+    if (s->fec_payload_type >= 0) {
+        if ((buf[1] & 0x7f) == s->fec_payload_type)
+            return fec_parse_packet(s, buf, len);
+        if ((buf[1] & 0x7f) == s->payload_type && s->queue_size > 1) {
+            if (fec_remember(s, buf, len)) {
+                av_log(s->ic, AV_LOG_DEBUG,
+                       "RTP: dropping duplicate or recovered packet\n");
+                return -1;
+            }
+            if (s->fec_queue && (rv = fec_try_recover(s)) < 0)
+                return rv;
+        }
+    }
+
+    if (s->ccfb && (buf[1] & 0x7f) == s->payload_type)
+        ccfb_record(s, AV_RB16(buf + 2), av_gettime_relative());
+
     if (s->st) {
         int64_t received = av_gettime_relative();
         uint32_t arrival_ts = av_rescale_q(received, AV_TIME_BASE_Q,
@@ -37,6 +37,16 @@ typedef struct RTPDynamicProtocolHandler RTPDynamicProtocolHandler;
 
 #define RTP_REORDER_QUEUE_DEFAULT_SIZE 500
 
+/** Media packets kept for FEC recovery, at least the muxer's FEC group span */
+#define RTP_FEC_HISTORY 64
+/** FEC packets kept waiting for missing media packets */
+#define RTP_FEC_PENDING 8
+
+/** Arrival times kept for congestion control feedback */
+#define RTP_CCFB_HISTORY 512
+/** Most packets covered by one congestion control feedback report */
+#define RTP_CCFB_MAX_REPORTS 256
+
 #define RTP_NOTS_VALUE ((uint32_t)-1)
 
 typedef struct RTPDemuxContext RTPDemuxContext;
@@ -173,6 +183,24 @@ struct RTPDemuxContext {
     int queue_size;   ///< The size of queue, or 0 if reordering is disabled
     /*@}*/
 
+    /** Fields for XOR FEC recovery, RFC 5109 @{ */
+    int fec_payload_type; ///< Payload type of FEC packets, or -1
+    RTPPacket fec_media[RTP_FEC_HISTORY]; ///< Recent media packets, indexed by seq
+    RTPPacket *fec_queue; ///< FEC packets that may still recover a packet
+    int fec_queue_len;
+    /*@}*/
+
+    /** Fields for congestion control feedback, RFC 8888 @{ */
+    int ccfb;             ///< Send congestion control feedback reports
+    int ccfb_started;
+    int ccfb_new;         ///< Packets were received since the last report
+    uint16_t ccfb_begin;  ///< First sequence number of the next report
+    uint16_t ccfb_end;    ///< One past the highest sequence number received
+    uint16_t ccfb_seq[RTP_CCFB_HISTORY];
+    int64_t ccfb_arrival[RTP_CCFB_HISTORY]; ///< Arrival times, indexed by seq
+    int64_t last_ccfb_time;
+    /*@}*/
+
     /* rtcp sender statistics receive */
     uint64_t last_rtcp_ntp_time;
     int64_t last_rtcp_reception_time;
@@ -34,6 +34,16 @@ static const AVOption options[] = {
     { "ssrc", "Stream identifier", offsetof(RTPMuxContext, ssrc), AV_OPT_TYPE_INT, { .i64 = 0 }, INT_MIN, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "cname", "CNAME to include in RTCP SR packets", offsetof(RTPMuxContext, cname), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_ENCODING_PARAM },
     { "seq", "Starting sequence number", offsetof(RTPMuxContext, seq), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 65535, AV_OPT_FLAG_ENCODING_PARAM },
+    { "fec_pt", "Payload type of XOR FEC packets, -1 to disable FEC", offsetof(RTPMuxContext, fec_pt), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 127, AV_OPT_FLAG_ENCODING_PARAM },
+    { "fec_fovea_k", "Foveal media packets per FEC packet, 0 for no protection", offsetof(RTPMuxContext, fec_k[RTP_FEC_FOVEA]), AV_OPT_TYPE_INT, { .i64 = 2 }, 0, RTP_FEC_MAX_SPAN, AV_OPT_FLAG_ENCODING_PARAM },
+    { "fec_periphery_k", "Peripheral media packets per FEC packet, 0 for no protection", offsetof(RTPMuxContext, fec_k[RTP_FEC_PERIPHERY]), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, RTP_FEC_MAX_SPAN, AV_OPT_FLAG_ENCODING_PARAM },
+    { "fovea_radius", "Radius of the fovea in units of the foveation sigma", offsetof(RTPMuxContext, fovea_radius), AV_OPT_TYPE_FLOAT, { .dbl = 0.5 }, 0, 100, AV_OPT_FLAG_ENCODING_PARAM },
+    { "gaze_scheduler", "Send foveal slices first and drop peripheral ones under congestion", offsetof(RTPMuxContext, gaze_sched), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_ENCODING_PARAM },
+    { "sched_burst", "Largest burst sent at once, in ms at the target bitrate", offsetof(RTPMuxContext, sched_burst), AV_OPT_TYPE_INT, { .i64 = 50 }, 1, 10000, AV_OPT_FLAG_ENCODING_PARAM },
+    { "cc_start_bitrate", "Initial target bitrate, the stream bitrate if unset", offsetof(RTPMuxContext, cc_start_bitrate), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "cc_min_bitrate", "Lowest target bitrate", offsetof(RTPMuxContext, cc_min_bitrate), AV_OPT_TYPE_INT64, { .i64 = 150000 }, 1000, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "cc_max_bitrate", "Highest target bitrate", offsetof(RTPMuxContext, cc_max_bitrate), AV_OPT_TYPE_INT64, { .i64 = 50000000 }, 1000, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM },
+    { "cc_bitrate", "Current target bitrate of the congestion controller", offsetof(RTPMuxContext, cc_bitrate), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, AV_OPT_FLAG_ENCODING_PARAM | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { NULL },
 };
 
@@ -156,6 +166,36 @@ static int rtp_write_header(AVFormatContext *s1)
     }
     s->max_payload_size = s1->packet_size - 12;
 
+    if (s->fec_pt >= 0) {
+        if (s->fec_pt == s->payload_type) {
+            av_log(s1, AV_LOG_ERROR, "FEC payload type must differ from the media payload type\n");
+            goto fail;
+        }
+        s->max_payload_size -= RTP_FEC_HEADER_SIZE;
+        if (s->max_payload_size <= 2) {
+            av_log(s1, AV_LOG_ERROR, "Max packet size %u too low for FEC\n", s1->packet_size);
+            goto fail;
+        }
+        for (n = 0; n < RTP_FEC_NB_CLASSES; n++) {
+            s->fec_group[n].buf = av_mallocz(RTP_FEC_HEADER_SIZE + s->max_payload_size);
+            if (!s->fec_group[n].buf) {
+                ret = AVERROR(ENOMEM);
+                goto fail;
+            }
+        }
+        s->fec_seq = s1->flags & AVFMT_FLAG_BITEXACT ? 0 : av_get_random_seed() & 0x0fff;
+    }
+
+    if (s->gaze_sched) {
+        if (st->codecpar->codec_id != AV_CODEC_ID_H264 &&
+            st->codecpar->codec_id != AV_CODEC_ID_HEVC) {
+            av_log(s1, AV_LOG_ERROR, "Gaze-priority scheduling is only supported for H.264 and HEVC\n");
+            goto fail;
+        }
+        if ((ret = ff_rtp_cc_init(s1)) < 0)
+            goto fail;
+    }
+
     if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
         avpriv_set_pts_info(st, 32, 1, st->codecpar->sample_rate);
     } else {
@@ -278,6 +318,8 @@ static int rtp_write_header(AVFormatContext *s1)
 
 fail:
     av_freep(&s->buf);
+    ff_rtp_fec_close(s1);
+    ff_rtp_cc_close(s1);
     return ret;
 }
 
@@ -333,6 +375,11 @@ void ff_rtp_send_data(AVFormatContext *s1, const uint8_t *buf1, int len, int m)
 {
     RTPMuxContext *s = s1->priv_data;
 
+    if (s->sched_active) {
+        ff_rtp_sched_add(s1, buf1, len, m);
+        return;
+    }
+
     av_log(s1, AV_LOG_TRACE, "rtp_send_data size=%d\n", len);
 
     /* build the RTP header */
@@ -345,6 +392,9 @@ void ff_rtp_send_data(AVFormatContext *s1, const uint8_t *buf1, int len, int m)
     avio_write(s1->pb, buf1, len);
     avio_flush(s1->pb);
 
+    if (s->fec_pt >= 0)
+        ff_rtp_fec_add(s1, buf1, len, m);
+
     s->seq = (s->seq + 1) & 0xffff;
     s->octet_count += len;
     s->packet_count++;
@@ -534,6 +584,18 @@ static int rtp_write_packet(AVFormatContext *s1, AVPacket *pkt)
     }
     s->cur_timestamp = s->base_timestamp + pkt->pts;
 
+    if (s->fec_pt >= 0 || s->gaze_sched) {
+        int fd_size;
+        const uint8_t *fd = av_packet_get_side_data(pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR,
+                                                    &fd_size);
+        if (fd && fd_size >= sizeof(s->foveation))
+            memcpy(s->foveation, fd, sizeof(s->foveation));
+        else
+            memset(s->foveation, 0, sizeof(s->foveation));
+        s->slice_ecc = 0;
+    }
+    s->sched_active = s->gaze_sched;
+
     switch(st->codecpar->codec_id) {
     case AV_CODEC_ID_PCM_MULAW:
     case AV_CODEC_ID_PCM_ALAW:
@@ -632,6 +694,15 @@ static int rtp_write_packet(AVFormatContext *s1, AVPacket *pkt)
         rtp_send_raw(s1, pkt->data, size);
         break;
     }
+    if (s->gaze_sched) {
+        int ret = ff_rtp_sched_flush(s1);
+        if (ret < 0)
+            return ret;
+    }
+    /* keep FEC groups within one frame, so that recovery never waits for
+     * the next one */
+    if (s->fec_pt >= 0)
+        ff_rtp_fec_flush(s1);
     return 0;
 }
 
@@ -643,7 +714,14 @@ static int rtp_write_trailer(AVFormatContext *s1)
      * be NULL here even if it was successfully allocated at the start. */
     if (s1->pb && (s->flags & FF_RTP_FLAG_SEND_BYE))
         rtcp_send_sr(s1, ff_ntp_time(), 1);
+    if (s1->pb && s->fec_pt >= 0)
+        ff_rtp_fec_flush(s1);
+    if (s->nb_peripheral)
+        av_log(s1, AV_LOG_VERBOSE, "Dropped %"PRId64" of %"PRId64" peripheral units\n",
+               s->nb_dropped, s->nb_peripheral);
     av_freep(&s->buf);
+    ff_rtp_fec_close(s1);
+    ff_rtp_cc_close(s1);
 
     return 0;
 }
@@ -24,6 +24,113 @@
 #include "avformat.h"
 #include "rtp.h"
 
+/** RTP FEC header plus a level 0 header with a 48 bit mask, RFC 5109 */
+#define RTP_FEC_HEADER_SIZE 18
+/** Largest distance in sequence numbers between packets of one FEC group */
+#define RTP_FEC_MAX_SPAN    48
+
+enum RTPFECClass {
+    RTP_FEC_FOVEA,
+    RTP_FEC_PERIPHERY,
+    RTP_FEC_NB_CLASSES
+};
+
+/** Packets remembered until their congestion control feedback arrives */
+#define RTP_CC_HISTORY      1024
+/** Number of delay samples the delay trend is fitted over */
+#define RTP_CC_TREND_WINDOW 20
+
+/**
+ * XOR parity accumulated over the media packets of one FEC group.
+ */
+typedef struct RTPFECGroup {
+    uint8_t *buf;         ///< RTP_FEC_HEADER_SIZE recovery fields + payload parity
+    int count;            ///< number of protected packets
+    int len;              ///< longest protected payload
+    uint16_t sn_base;
+    uint64_t mask;
+} RTPFECGroup;
+
+/**
+ * A media packet of the current frame, held back by the gaze-priority
+ * scheduler until the whole frame has been packetized.
+ */
+typedef struct RTPSchedPacket {
+    int offset;           ///< payload offset in sched_buf
+    int len;
+    int m;
+    int unit;             ///< packets of one unit are sent or dropped together
+    int send;             ///< -1 undecided, 0 dropped, 1 sent
+    uint16_t seq;
+    uint32_t timestamp;
+    float ecc;            ///< eccentricity of the slices in the packet
+} RTPSchedPacket;
+
+typedef struct RTPCCPacket {
+    int64_t send_time;
+    int size;
+    uint16_t seq;
+    int pending;          ///< sent, but not yet reported as received or lost
+} RTPCCPacket;
+
+/**
+ * Packets sent in one burst, whose delay is measured together.
+ */
+typedef struct RTPCCGroup {
+    int64_t first_send;
+    int64_t send;         ///< send time of the latest packet
+    int64_t arrival;      ///< arrival time of the latest packet
+} RTPCCGroup;
+
+enum RTPCCUsage {
+    RTP_CC_NORMAL,
+    RTP_CC_UNDERUSE,
+    RTP_CC_OVERUSE,
+};
+
+enum RTPCCState {
+    RTP_CC_HOLD,
+    RTP_CC_INCREASE,
+    RTP_CC_DECREASE,
+};
+
+/**
+ * Delay-based congestion control along the lines of Google Congestion
+ * Control: the one-way delay trend over packet groups is compared against
+ * an adaptive threshold, and the target bitrate follows an AIMD scheme
+ * driven by the resulting over-/underuse signal. All times are in
+ * microseconds, arrival times in the receiver's clock.
+ */
+typedef struct RTPCongestionControl {
+    int fd;                      ///< RTCP socket feedback is read from, or -1
+    RTPCCPacket sent[RTP_CC_HISTORY];
+    int started;
+    uint16_t ack_seq;            ///< oldest packet still awaiting feedback
+    int received, lost;          ///< since the last loss based update
+
+    int nb_reports;
+    uint32_t last_report;        ///< report timestamp of the last feedback
+    int64_t report_time;         ///< unwrapped report timestamp
+
+    RTPCCGroup group, prev_group;
+    int64_t first_arrival;
+    double acc_delay, smoothed_delay;
+    double trend_x[RTP_CC_TREND_WINDOW], trend_y[RTP_CC_TREND_WINDOW];
+    int nb_trend, nb_deltas;
+    double trend, threshold;     ///< ms
+    double overuse_time;         ///< ms the trend has been above the threshold
+    int overuse_count;
+    int64_t last_detect;
+    enum RTPCCUsage usage;
+
+    enum RTPCCState state;
+    int64_t last_update, last_decrease;
+    int64_t acked_bytes, acked_start, acked_rate;
+
+    double tokens;               ///< pacing budget in bytes
+    int64_t last_refill;
+} RTPCongestionControl;
+
 struct RTPMuxContext {
     const AVClass *av_class;
     AVFormatContext *ic;
@@ -61,6 +168,38 @@ struct RTPMuxContext {
     int flags;
 
     unsigned int frame_count;
+
+    /** XOR forward error correction, RFC 5109 @{ */
+    int fec_pt;                ///< payload type of FEC packets, -1 disables FEC
+    int fec_k[RTP_FEC_NB_CLASSES]; ///< media packets per FEC packet, 0 for none
+    int fec_seq;
+    RTPFECGroup fec_group[RTP_FEC_NB_CLASSES];
+    /** @} */
+
+    /** Foveal and peripheral slices @{ */
+    float foveation[4];        ///< descriptor of the current packet, sigma 0 if none
+    float fovea_radius;        ///< radius of the fovea, in units of sigma
+    float slice_ecc;           ///< eccentricity of the packets currently being sent
+    float buffered_ecc;        ///< lowest eccentricity of buffered_nals
+    int fragmenting;           ///< set while sending the later fragments of a unit
+    /** @} */
+
+    /** Gaze-priority scheduling and congestion control @{ */
+    int gaze_sched;
+    int sched_active;          ///< queue packets instead of sending them
+    int sched_burst;           ///< largest burst, in ms at the target bitrate
+    int sched_error;
+    RTPSchedPacket *sched;
+    unsigned int sched_size;
+    int nb_sched, nb_units;
+    uint8_t *sched_buf;
+    unsigned int sched_buf_size;
+    int sched_buf_len;
+    int64_t nb_dropped, nb_peripheral;
+    int64_t cc_bitrate;        ///< target bitrate, exported
+    int64_t cc_start_bitrate, cc_min_bitrate, cc_max_bitrate;
+    RTPCongestionControl cc;
+    /** @} */
 };
 
 typedef struct RTPMuxContext RTPMuxContext;
@@ -81,6 +220,31 @@ typedef struct RTPMuxContext RTPMuxContext;
 
 void ff_rtp_send_data(AVFormatContext *s1, const uint8_t *buf1, int len, int m);
 
+/**
+ * Add the media packet about to be sent with the current sequence number
+ * and timestamp to the FEC group of the current class, sending the FEC
+ * packet once the group is complete.
+ */
+void ff_rtp_fec_add(AVFormatContext *s1, const uint8_t *buf, int len, int m);
+/**
+ * Send FEC packets for all incomplete groups.
+ */
+void ff_rtp_fec_flush(AVFormatContext *s1);
+void ff_rtp_fec_close(AVFormatContext *s1);
+
+int ff_rtp_cc_init(AVFormatContext *s1);
+/**
+ * Hold back a media packet of the current frame.
+ */
+void ff_rtp_sched_add(AVFormatContext *s1, const uint8_t *buf, int len, int m);
+/**
+ * Read pending congestion control feedback, then send the foveal packets of
+ * the current frame followed by as many peripheral ones as the pacing
+ * budget allows, in order of eccentricity, and drop the rest.
+ */
+int ff_rtp_sched_flush(AVFormatContext *s1);
+void ff_rtp_cc_close(AVFormatContext *s1);
+
 void ff_rtp_send_h264_hevc(AVFormatContext *s1, const uint8_t *buf1, int size);
 void ff_rtp_send_h261(AVFormatContext *s1, const uint8_t *buf1, int size);
 void ff_rtp_send_h263(AVFormatContext *s1, const uint8_t *buf1, int size);
@@ -0,0 +1,462 @@
+/*
+ * RTP gaze-priority scheduling and congestion control
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * @brief Gaze-priority packet scheduling for the RTP muxer
+ *
+ * The packets of a frame are collected before any of them is sent. Units
+ * (single NAL units, aggregation packets, or all fragments of one NAL unit)
+ * within the fovea are always sent; peripheral units follow in order of
+ * eccentricity as long as the pacing budget lasts, the rest is dropped.
+ * Sequence numbers are assigned in decoding order over the units actually
+ * sent, so receivers see no gaps for dropped units and hand slices to the
+ * decoder in order, while the foveal packets still leave first.
+ *
+ * The budget is refilled at the target bitrate of a delay-based congestion
+ * controller, fed by RFC 8888 feedback the receiver sends to our RTCP port.
+ * The target bitrate is exported as the cc_bitrate option, for the caller
+ * to apply to the encoder.
+ */
+
+#include <math.h>
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/time.h"
+
+#include "avformat.h"
+#include "avio_internal.h"
+#include "network.h"
+#include "rtpenc.h"
+#include "url.h"
+
+#define RTP_HEADER_SIZE      12
+
+#define CC_BURST_TIME        5000   /* packets sent within 5 ms form a group */
+#define CC_SMOOTHING         0.9
+#define CC_THRESHOLD_GAIN    4.0
+#define CC_OVERUSE_TIME      10.0   /* ms above the threshold to signal overuse */
+#define CC_K_UP              0.0087
+#define CC_K_DOWN            0.039
+#define CC_DECREASE          0.85
+#define CC_DECREASE_INTERVAL 200000
+#define CC_INCREASE          1.08   /* per second */
+#define CC_RATE_WINDOW       500000
+#define CC_LOSS_PACKETS      20
+
+int ff_rtp_cc_init(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    URLContext *h = ffio_geturlcontext(s1->pb);
+    int *fds = NULL, nb_fds = 0;
+
+    cc->fd = -1;
+    if (h && ffurl_get_multi_file_handle(h, &fds, &nb_fds) >= 0 && nb_fds > 1)
+        cc->fd = fds[1];
+    av_free(fds);
+    if (cc->fd < 0)
+        av_log(s1, AV_LOG_WARNING,
+               "No RTCP socket to read feedback from, the target bitrate stays fixed\n");
+
+    s->cc_bitrate = s->cc_start_bitrate;
+    if (!s->cc_bitrate)
+        s->cc_bitrate = s1->streams[0]->codecpar->bit_rate;
+    if (!s->cc_bitrate)
+        s->cc_bitrate = 1000000;
+    s->cc_bitrate = av_clip64(s->cc_bitrate, s->cc_min_bitrate, s->cc_max_bitrate);
+
+    cc->threshold = 12.5;
+    cc->usage     = RTP_CC_NORMAL;
+    cc->state     = RTP_CC_INCREASE;
+    return 0;
+}
+
+void ff_rtp_cc_close(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+
+    av_freep(&s->sched);
+    av_freep(&s->sched_buf);
+    s->sched_size = s->sched_buf_size = 0;
+}
+
+static void cc_update_rate(AVFormatContext *s1, int64_t now)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    double rate = s->cc_bitrate;
+    double dt = cc->last_update ? FFMIN(now - cc->last_update, 1000000) / 1000000.0 : 0;
+
+    cc->last_update = now;
+    switch (cc->usage) {
+    case RTP_CC_OVERUSE:
+        if (cc->state != RTP_CC_DECREASE ||
+            now - cc->last_decrease > CC_DECREASE_INTERVAL) {
+            /* back off below what got through, without compounding */
+            rate = cc->acked_rate ? FFMIN(rate, CC_DECREASE * cc->acked_rate)
+                                  : rate * CC_DECREASE;
+            cc->state         = RTP_CC_DECREASE;
+            cc->last_decrease = now;
+        }
+        break;
+    case RTP_CC_UNDERUSE:
+        /* let the queues drain before probing further */
+        cc->state = RTP_CC_HOLD;
+        break;
+    default:
+        cc->state = cc->state == RTP_CC_DECREASE ? RTP_CC_HOLD : RTP_CC_INCREASE;
+        break;
+    }
+    if (cc->state == RTP_CC_INCREASE) {
+        rate *= pow(CC_INCREASE, dt);
+        /* do not run away from what actually gets through */
+        if (cc->acked_rate)
+            rate = FFMIN(rate, 1.5 * cc->acked_rate + 10000);
+    }
+    s->cc_bitrate = av_clip64(llrint(rate), s->cc_min_bitrate, s->cc_max_bitrate);
+}
+
+/**
+ * Compare the trend of the one-way delay against the adaptive threshold.
+ * @param dt time since the last call, in ms
+ */
+static void cc_detect(RTPCongestionControl *cc, double trend, double dt)
+{
+    double threshold = cc->threshold;
+
+    if (trend > threshold) {
+        cc->overuse_time += dt;
+        cc->overuse_count++;
+        if (cc->overuse_time > CC_OVERUSE_TIME && cc->overuse_count > 1 &&
+            trend >= cc->trend) {
+            cc->overuse_time  = 0;
+            cc->overuse_count = 0;
+            cc->usage         = RTP_CC_OVERUSE;
+        }
+    } else {
+        cc->overuse_time  = 0;
+        cc->overuse_count = 0;
+        cc->usage = trend < -threshold ? RTP_CC_UNDERUSE : RTP_CC_NORMAL;
+    }
+    cc->trend = trend;
+
+    /* ignore sudden spikes, otherwise follow the trend so that competing
+     * delay-insensitive flows do not starve us */
+    if (fabs(trend) < threshold + 15) {
+        double k = fabs(trend) < threshold ? CC_K_DOWN : CC_K_UP;
+        cc->threshold = av_clipd(threshold + k * (fabs(trend) - threshold) * FFMIN(dt, 100),
+                                 6, 600);
+    }
+}
+
+static void cc_update_delay(AVFormatContext *s1, const RTPCCGroup *prev,
+                            const RTPCCGroup *cur)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    double delta = ((cur->arrival - prev->arrival) - (cur->send - prev->send)) / 1000.0;
+    double mx = 0, my = 0, num = 0, den = 0;
+    int i;
+
+    if (!cc->nb_deltas)
+        cc->first_arrival = cur->arrival;
+    cc->nb_deltas = FFMIN(cc->nb_deltas + 1, 1000);
+    cc->acc_delay += delta;
+    cc->smoothed_delay = CC_SMOOTHING * cc->smoothed_delay +
+                         (1 - CC_SMOOTHING) * cc->acc_delay;
+
+    i = cc->nb_trend % RTP_CC_TREND_WINDOW;
+    cc->trend_x[i] = (cur->arrival - cc->first_arrival) / 1000.0;
+    cc->trend_y[i] = cc->smoothed_delay;
+    if (++cc->nb_trend == 2 * RTP_CC_TREND_WINDOW)
+        cc->nb_trend = RTP_CC_TREND_WINDOW;
+    if (cc->nb_trend < RTP_CC_TREND_WINDOW)
+        return;
+
+    /* least squares slope of the smoothed accumulated delay */
+    for (i = 0; i < RTP_CC_TREND_WINDOW; i++) {
+        mx += cc->trend_x[i];
+        my += cc->trend_y[i];
+    }
+    mx /= RTP_CC_TREND_WINDOW;
+    my /= RTP_CC_TREND_WINDOW;
+    for (i = 0; i < RTP_CC_TREND_WINDOW; i++) {
+        num += (cc->trend_x[i] - mx) * (cc->trend_y[i] - my);
+        den += (cc->trend_x[i] - mx) * (cc->trend_x[i] - mx);
+    }
+    if (den <= 0)
+        return;
+
+    cc_detect(cc, num / den * FFMIN(cc->nb_deltas, 60) * CC_THRESHOLD_GAIN,
+              (cur->arrival - prev->arrival) / 1000.0);
+    cc_update_rate(s1, av_gettime_relative());
+}
+
+static void cc_on_arrival(AVFormatContext *s1, const RTPCCPacket *p,
+                          int64_t arrival)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    RTPCCGroup *g = &cc->group;
+
+    if (!cc->acked_bytes)
+        cc->acked_start = arrival;
+    cc->acked_bytes += p->size;
+    if (arrival - cc->acked_start >= CC_RATE_WINDOW) {
+        cc->acked_rate  = cc->acked_bytes * 8 * 1000000 / (arrival - cc->acked_start);
+        cc->acked_bytes = 0;
+    }
+
+    if (g->first_send && p->send_time < g->first_send)
+        return; /* reordered from an earlier group */
+    if (g->first_send && p->send_time - g->first_send <= CC_BURST_TIME) {
+        g->send    = FFMAX(g->send, p->send_time);
+        g->arrival = FFMAX(g->arrival, arrival);
+        return;
+    }
+    if (g->first_send) {
+        if (cc->prev_group.first_send)
+            cc_update_delay(s1, &cc->prev_group, g);
+        cc->prev_group = *g;
+    }
+    g->first_send = g->send = p->send_time;
+    g->arrival    = arrival;
+}
+
+static void cc_parse_ccfb(AVFormatContext *s1, const uint8_t *buf, int len)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    uint32_t report;
+    uint16_t begin;
+    int n, i;
+
+    if (len < 20 || AV_RB32(buf + 8) != s->ssrc)
+        return;
+    begin = AV_RB16(buf + 12);
+    n     = AV_RB16(buf + 14);
+    if (20 + (n + 1) / 2 * 4 > len)
+        return;
+
+    /* the report timestamp is in 1/65536 s, only its differences matter */
+    report = AV_RB32(buf + 16 + (n + 1) / 2 * 4);
+    if (cc->nb_reports++)
+        cc->report_time += (int64_t)(int32_t)(report - cc->last_report) * 1000000 / 65536;
+    cc->last_report = report;
+
+    for (i = 0; i < n; i++) {
+        uint16_t seq = begin + i;
+        int v = AV_RB16(buf + 16 + 2 * i);
+        RTPCCPacket *p = &cc->sent[seq % RTP_CC_HISTORY];
+
+        /* missing packets are reported again until they arrive */
+        if (!(v & 0x8000) || p->seq != seq || !p->pending)
+            continue;
+        p->pending = 0;
+        cc->received++;
+        if ((v & 0x1fff) != 0x1fff)
+            cc_on_arrival(s1, p, cc->report_time - (v & 0x1fff) * 1000000LL / 1024);
+    }
+
+    /* packets the receiver stopped reporting on were lost */
+    if ((int16_t)(begin - cc->ack_seq) > RTP_CC_HISTORY)
+        cc->ack_seq = begin - RTP_CC_HISTORY;
+    for (; (int16_t)(begin - cc->ack_seq) > 0; cc->ack_seq++) {
+        RTPCCPacket *p = &cc->sent[cc->ack_seq % RTP_CC_HISTORY];
+        if (p->seq == cc->ack_seq && p->pending) {
+            p->pending = 0;
+            cc->lost++;
+        }
+    }
+
+    /* a burst of losses is reported over several reports, react once */
+    if (cc->received + cc->lost >= CC_LOSS_PACKETS) {
+        double loss = (double)cc->lost / (cc->received + cc->lost);
+        int64_t now = av_gettime_relative();
+        if (loss > 0.1 && now - cc->last_decrease > CC_DECREASE_INTERVAL) {
+            s->cc_bitrate = av_clip64(s->cc_bitrate * (1 - 0.5 * loss),
+                                      s->cc_min_bitrate, s->cc_max_bitrate);
+            cc->state         = RTP_CC_DECREASE;
+            cc->last_decrease = now;
+        }
+        cc->received = cc->lost = 0;
+    }
+}
+
+static void cc_read_feedback(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+    struct pollfd p = { s->cc.fd, POLLIN, 0 };
+    uint8_t buf[2048];
+    int len, off, size;
+
+    if (p.fd < 0)
+        return;
+    while (poll(&p, 1, 0) > 0 && (p.revents & POLLIN)) {
+        len = recv(p.fd, buf, sizeof(buf), 0);
+        if (len <= 0)
+            break;
+        for (off = 0; off + 4 <= len; off += size) {
+            size = (AV_RB16(buf + off + 2) + 1) * 4;
+            if (off + size > len)
+                break;
+            if ((buf[off] & 0xc0) == (RTP_VERSION << 6) &&
+                buf[off + 1] == RTCP_RTPFB && (buf[off] & 0x1f) == 11)
+                cc_parse_ccfb(s1, buf + off, size);
+        }
+    }
+}
+
+void ff_rtp_sched_add(AVFormatContext *s1, const uint8_t *buf, int len, int m)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPSchedPacket *p;
+    uint8_t *data;
+
+    if (s->sched_error < 0)
+        return;
+    p = av_fast_realloc(s->sched, &s->sched_size, (s->nb_sched + 1) * sizeof(*p));
+    if (!p) {
+        s->sched_error = AVERROR(ENOMEM);
+        return;
+    }
+    s->sched = p;
+    data = av_fast_realloc(s->sched_buf, &s->sched_buf_size, s->sched_buf_len + len);
+    if (!data) {
+        s->sched_error = AVERROR(ENOMEM);
+        return;
+    }
+    s->sched_buf = data;
+    memcpy(data + s->sched_buf_len, buf, len);
+
+    if (!s->fragmenting || !s->nb_sched)
+        s->nb_units++;
+    p += s->nb_sched++;
+    p->offset    = s->sched_buf_len;
+    p->len       = len;
+    p->m         = m;
+    p->unit      = s->nb_units;
+    p->send      = -1;
+    p->timestamp = s->timestamp;
+    p->ecc       = s->slice_ecc;
+    s->sched_buf_len += len;
+}
+
+int ff_rtp_sched_flush(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+    RTPCongestionControl *cc = &s->cc;
+    RTPSchedPacket *q = s->sched;
+    int64_t now = av_gettime_relative(), pos;
+    double burst, budget;
+    int i, pass, last = -1, marker = 0, ret = s->sched_error;
+    uint16_t seq = s->seq;
+
+    s->sched_active = 0;
+    if (ret < 0)
+        goto end;
+
+    cc_read_feedback(s1);
+
+    burst = s->cc_bitrate / 8.0 * s->sched_burst / 1000;
+    if (cc->last_refill)
+        cc->tokens += s->cc_bitrate / 8.0 * (now - cc->last_refill) / 1000000;
+    else
+        cc->tokens = burst;
+    cc->tokens      = FFMIN(cc->tokens, burst);
+    cc->last_refill = now;
+
+    /* foveal units are always sent, even into debt */
+    budget = cc->tokens;
+    for (i = 0; i < s->nb_sched; i++) {
+        if (q[i].ecc <= s->fovea_radius) {
+            q[i].send = 1;
+            budget   -= q[i].len + RTP_HEADER_SIZE;
+        }
+    }
+    /* then the most central peripheral unit, while it fits */
+    for (;;) {
+        int best = -1, send;
+        double cost = 0;
+
+        for (i = 0; i < s->nb_sched; i++)
+            if (q[i].send < 0 && (best < 0 || q[i].ecc < q[best].ecc))
+                best = i;
+        if (best < 0)
+            break;
+        for (i = best; i < s->nb_sched && q[i].unit == q[best].unit; i++)
+            cost += q[i].len + RTP_HEADER_SIZE;
+        send = cost <= budget;
+        if (send)
+            budget -= cost;
+        else
+            budget = -1;
+        for (i = best; i < s->nb_sched && q[i].unit == q[best].unit; i++)
+            q[i].send = send;
+        s->nb_peripheral++;
+        s->nb_dropped += !send;
+    }
+
+    if (!cc->started) {
+        cc->ack_seq = seq;
+        cc->started = 1;
+    }
+    for (i = 0; i < s->nb_sched; i++) {
+        marker |= q[i].m;
+        if (q[i].send) {
+            q[i].seq = seq++;
+            q[i].m   = 0;
+            last     = i;
+        }
+    }
+    if (last >= 0)
+        q[last].m = marker;
+
+    pos = avio_tell(s1->pb);
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < s->nb_sched; i++) {
+            RTPCCPacket *p;
+
+            if (!q[i].send || (q[i].ecc <= s->fovea_radius) == pass)
+                continue;
+            s->seq       = q[i].seq;
+            s->timestamp = q[i].timestamp;
+            s->slice_ecc = q[i].ecc;
+            ff_rtp_send_data(s1, s->sched_buf + q[i].offset, q[i].len, q[i].m);
+
+            p            = &cc->sent[q[i].seq % RTP_CC_HISTORY];
+            p->seq       = q[i].seq;
+            p->size      = q[i].len + RTP_HEADER_SIZE;
+            p->send_time = av_gettime_relative();
+            p->pending   = 1;
+        }
+    }
+    s->seq      = seq;
+    cc->tokens -= avio_tell(s1->pb) - pos;
+    cc->tokens  = FFMAX(cc->tokens, -burst);
+
+end:
+    s->nb_sched      = 0;
+    s->nb_units      = 0;
+    s->sched_buf_len = 0;
+    s->sched_error   = 0;
+    return ret;
+}
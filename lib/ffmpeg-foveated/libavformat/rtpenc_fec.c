@@ -0,0 +1,116 @@
+/*
+ * RTP XOR forward error correction (RFC 5109)
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * @brief XOR parity packets for the RTP muxer
+ *
+ * Media packets are split into a foveal and a peripheral class, each with
+ * its own group size; a group of k media packets is protected by one FEC
+ * packet, from which any single lost packet of the group can be rebuilt.
+ * FEC packets share the SSRC of the media stream, but use their own
+ * payload type and sequence number space. Only the ULP level 0 header is
+ * written, always with the long (48 bit) mask.
+ */
+
+#include "libavutil/intreadwrite.h"
+
+#include "avformat.h"
+#include "rtpenc.h"
+
+static void fec_send(AVFormatContext *s1, RTPFECGroup *g)
+{
+    RTPMuxContext *s = s1->priv_data;
+    uint8_t *h = g->buf;
+
+    /* E = 0, L = 1 */
+    h[0] = (h[0] & 0x3f) | 0x40;
+    AV_WB16(h + 2, g->sn_base);
+    AV_WB16(h + 10, g->len);
+    AV_WB48(h + 12, g->mask);
+
+    avio_w8(s1->pb, RTP_VERSION << 6);
+    avio_w8(s1->pb, s->fec_pt & 0x7f);
+    avio_wb16(s1->pb, s->fec_seq);
+    avio_wb32(s1->pb, s->timestamp);
+    avio_wb32(s1->pb, s->ssrc);
+    avio_write(s1->pb, h, RTP_FEC_HEADER_SIZE + g->len);
+    avio_flush(s1->pb);
+
+    s->fec_seq = (s->fec_seq + 1) & 0xffff;
+    memset(h, 0, RTP_FEC_HEADER_SIZE + g->len);
+    g->count = 0;
+    g->len   = 0;
+    g->mask  = 0;
+}
+
+void ff_rtp_fec_add(AVFormatContext *s1, const uint8_t *buf, int len, int m)
+{
+    RTPMuxContext *s = s1->priv_data;
+    enum RTPFECClass c = s->slice_ecc <= s->fovea_radius ? RTP_FEC_FOVEA
+                                                          : RTP_FEC_PERIPHERY;
+    RTPFECGroup *g = &s->fec_group[c];
+    int k = s->fec_k[c];
+    uint8_t *h, *p;
+    int i;
+
+    if (!k)
+        return;
+    if (g->count && (uint16_t)(s->seq - g->sn_base) >= RTP_FEC_MAX_SPAN)
+        fec_send(s1, g);
+    if (!g->count)
+        g->sn_base = s->seq;
+
+    /* Recovery fields: P, X, CC and M, PT of the media headers, the
+     * timestamp and the payload length. Our media packets have no padding,
+     * extension or CSRCs, so the first byte contributes nothing. */
+    h     = g->buf;
+    h[1] ^= (s->payload_type & 0x7f) | ((m & 0x01) << 7);
+    AV_WB32(h + 4, AV_RB32(h + 4) ^ s->timestamp);
+    AV_WB16(h + 8, AV_RB16(h + 8) ^ len);
+
+    p = h + RTP_FEC_HEADER_SIZE;
+    for (i = 0; i < len; i++)
+        p[i] ^= buf[i];
+    g->len   = FFMAX(g->len, len);
+    g->mask |= 1ULL << (RTP_FEC_MAX_SPAN - 1 - (uint16_t)(s->seq - g->sn_base));
+
+    if (++g->count >= k)
+        fec_send(s1, g);
+}
+
+void ff_rtp_fec_flush(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+    int i;
+
+    for (i = 0; i < RTP_FEC_NB_CLASSES; i++)
+        if (s->fec_group[i].count)
+            fec_send(s1, &s->fec_group[i]);
+}
+
+void ff_rtp_fec_close(AVFormatContext *s1)
+{
+    RTPMuxContext *s = s1->priv_data;
+    int i;
+
+    for (i = 0; i < RTP_FEC_NB_CLASSES; i++)
+        av_freep(&s->fec_group[i].buf);
+}
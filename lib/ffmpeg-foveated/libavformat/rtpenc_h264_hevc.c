@@ -27,15 +27,27 @@
  * @author Luca Abeni <lucabe72@email.it>
  */
 
+#include <float.h>
+
 #include "libavutil/intreadwrite.h"
+#include "libavcodec/get_bits.h"
+#include "libavcodec/golomb.h"
+#include "libavcodec/h264.h"
 
 #include "avformat.h"
 #include "avc.h"
 #include "rtpenc.h"
 
+/* Slices beyond this are treated as foveal */
+#define MAX_SLICES 128
+
 static void flush_buffered(AVFormatContext *s1, int last)
 {
     RTPMuxContext *s = s1->priv_data;
+    float ecc = s->slice_ecc;
+
+    // Aggregation packets are as important as their most central unit
+    s->slice_ecc = s->buffered_ecc;
     if (s->buf_ptr != s->buf) {
         // If we're only sending one single NAL unit, send it as such, skip
         // the STAP-A/AP framing
@@ -50,6 +62,7 @@ static void flush_buffered(AVFormatContext *s1, int last)
     }
     s->buf_ptr = s->buf;
     s->buffered_nals = 0;
+    s->slice_ecc = ecc;
 }
 
 static void nal_send(AVFormatContext *s1, const uint8_t *buf, int size, int last)
@@ -93,7 +106,8 @@ static void nal_send(AVFormatContext *s1, const uint8_t *buf, int size, int last
             s->buf_ptr += 2;
             memcpy(s->buf_ptr, buf, size);
             s->buf_ptr += size;
-            s->buffered_nals++;
+            if (!s->buffered_nals++ || s->slice_ecc < s->buffered_ecc)
+                s->buffered_ecc = s->slice_ecc;
         } else {
             flush_buffered(s1, 0);
             ff_rtp_send_data(s1, buf, size, last);
@@ -167,6 +181,7 @@ static void nal_send(AVFormatContext *s1, const uint8_t *buf, int size, int last
         while (size + header_size > s->max_payload_size) {
             memcpy(&s->buf[header_size], buf, s->max_payload_size - header_size);
             ff_rtp_send_data(s1, s->buf, s->max_payload_size, 0);
+            s->fragmenting = 1;
             buf  += s->max_payload_size - header_size;
             size -= s->max_payload_size - header_size;
             s->buf[flag_byte] &= ~(1 << 7);
@@ -174,31 +189,118 @@ static void nal_send(AVFormatContext *s1, const uint8_t *buf, int size, int last
         s->buf[flag_byte] |= 1 << 6;
         memcpy(&s->buf[header_size], buf, size);
         ff_rtp_send_data(s1, s->buf, size + header_size, last);
+        s->fragmenting = 0;
     }
 }
 
+/**
+ * Skip the start code or length prefix at *r.
+ * @return the start of the next NAL unit
+ */
+static const uint8_t *next_nal(RTPMuxContext *s, const uint8_t **r,
+                               const uint8_t *end)
+{
+    const uint8_t *r1;
+
+    if (s->nal_length_size) {
+        r1 = ff_avc_mp4_find_startcode(*r, end, s->nal_length_size);
+        if (!r1)
+            r1 = end;
+        *r += s->nal_length_size;
+    } else {
+        while (!*((*r)++));
+        r1 = ff_avc_find_startcode(*r, end);
+    }
+    return r1;
+}
+
+/**
+ * @return first_mb_in_slice of an H.264 slice NAL unit, -1 for other units
+ */
+static int h264_first_mb(const uint8_t *buf, int size)
+{
+    uint8_t rbsp[8 + AV_INPUT_BUFFER_PADDING_SIZE] = { 0 };
+    GetBitContext gb;
+    int type = buf[0] & 0x1f, i, n = 0;
+
+    if (type != H264_NAL_SLICE && type != H264_NAL_IDR_SLICE)
+        return -1;
+    /* the first bytes of the slice header suffice, drop emulation
+     * prevention bytes from those */
+    for (i = 1; i < size && n < 8; i++) {
+        if (i > 2 && buf[i] == 3 && !buf[i - 1] && !buf[i - 2])
+            continue;
+        rbsp[n++] = buf[i];
+    }
+    init_get_bits8(&gb, rbsp, n);
+    return get_ue_golomb_long(&gb);
+}
+
+/**
+ * Distance of the macroblock of [first_mb, end_mb) closest to the fixation
+ * point described by the foveation descriptor, in units of its sigma and in
+ * the coordinates libx264 uses for its QP offset map.
+ */
+static float slice_eccentricity(AVFormatContext *s1, int first_mb, int end_mb)
+{
+    RTPMuxContext *s = s1->priv_data;
+    AVCodecParameters *par = s1->streams[0]->codecpar;
+    int mb_w = (par->width  + 15) >> 4;
+    int mb_h = (par->height + 15) >> 4;
+    float x = s->foveation[0] * mb_w;
+    float y = s->foveation[1] * mb_h;
+    float sigma = s->foveation[2] * sqrtf(mb_w * mb_w + mb_h * mb_h);
+    float d2 = FLT_MAX;
+    int mb;
+
+    if (mb_w <= 0 || mb_h <= 0)
+        return 0;
+    end_mb = FFMIN(end_mb, mb_w * mb_h);
+    for (mb = first_mb; mb < end_mb; mb = (mb / mb_w + 1) * mb_w) {
+        int row = mb / mb_w;
+        int last = FFMIN(end_mb, (row + 1) * mb_w) - 1;
+        float dx = av_clipf(x, mb % mb_w, last % mb_w) - x;
+        float dy = row - y;
+        d2 = FFMIN(d2, dx * dx + dy * dy);
+    }
+    return d2 == FLT_MAX ? 0 : sqrtf(d2) / sigma;
+}
+
 void ff_rtp_send_h264_hevc(AVFormatContext *s1, const uint8_t *buf1, int size)
 {
-    const uint8_t *r, *end = buf1 + size;
+    const uint8_t *r, *start, *end = buf1 + size;
     RTPMuxContext *s = s1->priv_data;
+    int slice_mb[MAX_SLICES + 1], nb_slices = 0, slice = 0;
+    int classify = (s->fec_pt >= 0 || s->gaze_sched) && s->foveation[2] > 0 &&
+                   s1->streams[0]->codecpar->codec_id == AV_CODEC_ID_H264;
 
     s->timestamp = s->cur_timestamp;
     s->buf_ptr   = s->buf;
     if (s->nal_length_size)
-        r = ff_avc_mp4_find_startcode(buf1, end, s->nal_length_size) ? buf1 : end;
+        start = ff_avc_mp4_find_startcode(buf1, end, s->nal_length_size) ? buf1 : end;
     else
-        r = ff_avc_find_startcode(buf1, end);
-    while (r < end) {
-        const uint8_t *r1;
-
-        if (s->nal_length_size) {
-            r1 = ff_avc_mp4_find_startcode(r, end, s->nal_length_size);
-            if (!r1)
-                r1 = end;
-            r += s->nal_length_size;
-        } else {
-            while (!*(r++));
-            r1 = ff_avc_find_startcode(r, end);
+        start = ff_avc_find_startcode(buf1, end);
+
+    /* A slice covers the macroblocks up to the start of the next one, so
+     * collect all slice starts before measuring their eccentricity. */
+    for (r = start; classify && r < end && nb_slices < MAX_SLICES; ) {
+        const uint8_t *r1 = next_nal(s, &r, end);
+        int mb = r1 > r ? h264_first_mb(r, r1 - r) : -1;
+        if (mb >= 0)
+            slice_mb[nb_slices++] = mb;
+        r = r1;
+    }
+    slice_mb[nb_slices] = INT_MAX;
+
+    for (r = start; r < end; ) {
+        const uint8_t *r1 = next_nal(s, &r, end);
+
+        if (classify) {
+            s->slice_ecc = 0;
+            if (r1 > r && h264_first_mb(r, r1 - r) >= 0 && slice < nb_slices) {
+                s->slice_ecc = slice_eccentricity(s1, slice_mb[slice], slice_mb[slice + 1]);
+                slice++;
+            }
         }
         nal_send(s1, r, r1 - r, r1 == end);
         r = r1;
@@ -468,6 +468,7 @@ static void sdp_parse_line(AVFormatContext *s, SDPParseState *s1,
         rtsp_st = av_mallocz(sizeof(RTSPStream));
         if (!rtsp_st)
             return;
+        rtsp_st->sdp_fec_payload_type = -1;
         rtsp_st->stream_index = -1;
         dynarray_add(&rt->rtsp_streams, &rt->nb_rtsp_streams, rtsp_st);
 
@@ -569,7 +570,10 @@ static void sdp_parse_line(AVFormatContext *s, SDPParseState *s1,
             get_word(buf1, sizeof(buf1), &p);
             payload_type = atoi(buf1);
             rtsp_st = rt->rtsp_streams[rt->nb_rtsp_streams - 1];
-            if (rtsp_st->stream_index >= 0) {
+            if (av_stristart(p + strspn(p, SPACE_CHARS), "ulpfec/", NULL)) {
+                /* RFC 5109 parity packets for the media of this stream */
+                rtsp_st->sdp_fec_payload_type = payload_type;
+            } else if (rtsp_st->stream_index >= 0) {
                 st = s->streams[rtsp_st->stream_index];
                 sdp_parse_rtpmap(s, st, rtsp_st, payload_type, p);
             }
@@ -588,6 +592,11 @@ static void sdp_parse_line(AVFormatContext *s, SDPParseState *s1,
                 s1->seen_fmtp = 1;
                 av_strlcpy(s1->delayed_fmtp, buf, sizeof(s1->delayed_fmtp));
             }
+        } else if (av_strstart(p, "rtcp-fb:", &p) && s->nb_streams > 0) {
+            rtsp_st = rt->rtsp_streams[rt->nb_rtsp_streams - 1];
+            get_word(buf1, sizeof(buf1), &p); /* payload type or '*' */
+            if (strstr(p, "ack ccfb"))
+                rtsp_st->ccfb = 1;
         } else if (av_strstart(p, "ssrc:", &p) && s->nb_streams > 0) {
             rtsp_st = rt->rtsp_streams[rt->nb_rtsp_streams - 1];
             get_word(buf1, sizeof(buf1), &p);
@@ -850,6 +859,8 @@ int ff_rtsp_open_transport_ctx(AVFormatContext *s, RTSPStream *rtsp_st)
                s->iformat) {
         RTPDemuxContext *rtpctx = rtsp_st->transport_priv;
         rtpctx->ssrc = rtsp_st->ssrc;
+        rtpctx->fec_payload_type = rtsp_st->sdp_fec_payload_type;
+        rtpctx->ccfb             = rtsp_st->feedback && rtsp_st->ccfb;
         if (rtsp_st->dynamic_handler) {
             ff_rtp_parse_set_dynamic_protocol(rtsp_st->transport_priv,
                                               rtsp_st->dynamic_protocol_context,
@@ -455,6 +455,7 @@ typedef struct RTSPStream {
     struct RTSPSource **exclude_source_addrs; /**< Source-specific multicast exclude source IP addresses (from SDP content) */
     int sdp_ttl;              /**< IP Time-To-Live (from SDP content) */
     int sdp_payload_type;     /**< payload type */
+    int sdp_fec_payload_type; /**< payload type of ulpfec packets, or -1 */
     //@}
 
     /** The following are used for dynamic protocols (rtpdec_*.c/rdt.c) */
@@ -469,6 +470,9 @@ typedef struct RTSPStream {
     /** Enable sending RTCP feedback messages according to RFC 4585 */
     int feedback;
 
+    /** Enable sending RTCP congestion control feedback according to RFC 8888 */
+    int ccfb;
+
     /** SSRC for this stream, to allow identifying RTCP packets before the first RTP packet */
     uint32_t ssrc;
 
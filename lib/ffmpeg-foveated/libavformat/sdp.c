@@ -750,8 +750,18 @@ void ff_sdp_write_media(char *buff, int size, AVStream *st, int idx,
     AVCodecParameters *p = st->codecpar;
     const char *type;
     int payload_type;
+    int64_t fec_pt = -1, ccfb = 0;
+    const char *profile;
 
     payload_type = ff_rtp_get_payload_type(fmt, st->codecpar, idx);
+    if (fmt && fmt->oformat && fmt->oformat->priv_class) {
+        if (av_opt_get_int(fmt->priv_data, "fec_pt", 0, &fec_pt) < 0)
+            fec_pt = -1;
+        if (av_opt_get_int(fmt->priv_data, "gaze_scheduler", 0, &ccfb) < 0)
+            ccfb = 0;
+    }
+    /* the congestion controller needs feedback as soon as possible */
+    profile = ccfb ? "RTP/AVPF" : "RTP/AVP";
 
     switch (p->codec_type) {
         case AVMEDIA_TYPE_VIDEO   : type = "video"      ; break;
@@ -760,13 +770,22 @@ void ff_sdp_write_media(char *buff, int size, AVStream *st, int idx,
         default                 : type = "application"; break;
     }
 
-    av_strlcatf(buff, size, "m=%s %d RTP/AVP %d\r\n", type, port, payload_type);
+    if (fec_pt >= 0)
+        av_strlcatf(buff, size, "m=%s %d %s %d %"PRId64"\r\n",
+                    type, port, profile, payload_type, fec_pt);
+    else
+        av_strlcatf(buff, size, "m=%s %d %s %d\r\n", type, port, profile, payload_type);
     sdp_write_address(buff, size, dest_addr, dest_type, ttl);
     if (p->bit_rate) {
         av_strlcatf(buff, size, "b=AS:%"PRId64"\r\n", p->bit_rate / 1000);
     }
 
     sdp_write_media_attributes(buff, size, st, payload_type, fmt);
+    if (fec_pt >= 0)
+        av_strlcatf(buff, size, "a=rtpmap:%"PRId64" ulpfec/%d\r\n", fec_pt,
+                    p->codec_type == AVMEDIA_TYPE_AUDIO ? p->sample_rate : 90000);
+    if (ccfb)
+        av_strlcatf(buff, size, "a=rtcp-fb:%d ack ccfb\r\n", payload_type);
 }
 
 int av_sdp_create(AVFormatContext *ac[], int n_files, char *buf, int size)
@@ -0,0 +1,422 @@
+/*
+ * Shared memory ring buffer protocol
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ *
+ * Shared memory url_protocol for processes on the same host.
+ *
+ * The writer creates a POSIX shared memory object holding a header and
+ * nb_slots fixed-size slots. Every url_write() fills one or more slots and
+ * publishes them by advancing write_idx, url_read() consumes them by
+ * advancing read_idx. Both indices are free running and double as futex
+ * words, so a side only enters the kernel when it has to sleep or when
+ * its peer announced that it sleeps. nb_slots is a power of two, so the
+ * slot an index maps to stays continuous when the index wraps.
+ *
+ * Data is copied once into a slot by the writer and once out of it by the
+ * reader, the protocol knows nothing about packet or frame boundaries.
+ * Only one writer may own a name at a time.
+ */
+
+#define _DEFAULT_SOURCE /* Needed for syscall() with glibc */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <unistd.h>
+
+#include "libavutil/avassert.h"
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/parseutils.h"
+#include "libavutil/time.h"
+#include "os_support.h"
+#include "url.h"
+
+#define SHM_MAGIC       MKTAG('F', 'S', 'H', 'M')
+#define SHM_HEADER_SIZE 64
+#define SHM_SLOT_HEADER 8
+#define SHM_WAIT_US     100000
+
+typedef struct SHMHeader {
+    atomic_uint magic;
+    uint32_t nb_slots;
+    uint32_t slot_size;
+    atomic_uint write_idx;      ///< futex word, slots published by the writer
+    atomic_uint read_idx;       ///< futex word, slots released by the reader
+    atomic_uint reader_waiting;
+    atomic_uint writer_waiting;
+    atomic_uint closed;
+    uint32_t writer_pid;        ///< tells a live writer from a crashed one
+} SHMHeader;
+
+typedef struct SHMContext {
+    const AVClass *class;
+    int nb_slots;
+    int slot_size;
+    int timeout;
+    char name[256];
+    int fd;
+    uint8_t *map;
+    size_t map_size;
+    SHMHeader *hdr;
+    int is_writer;
+    int read_off;       ///< bytes already consumed from the current slot
+} SHMContext;
+
+#define OFFSET(x) offsetof(SHMContext, x)
+#define ED AV_OPT_FLAG_DECODING_PARAM|AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption shm_options[] = {
+    { "slots",     "Number of slots in the ring, rounded up to a power of two (writer only)",  OFFSET(nb_slots),  AV_OPT_TYPE_INT, { .i64 = 64 },     2,       1 << 16, ED },
+    { "slot_size", "Payload size of a slot in bytes (writer only)", OFFSET(slot_size), AV_OPT_TYPE_INT, { .i64 = 65536 }, 1, INT_MAX / 2, ED },
+    { "timeout",   "Time to wait for the writer in ms",          OFFSET(timeout),   AV_OPT_TYPE_INT, { .i64 = -1 },    -1,      INT_MAX, ED },
+    { NULL }
+};
+
+static const AVClass shm_class = {
+    .class_name = "shm",
+    .item_name  = av_default_item_name,
+    .option     = shm_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+static void shm_futex_wait(atomic_uint *word, unsigned int val, int64_t us)
+{
+    struct timespec ts = { .tv_sec  = us / 1000000,
+                           .tv_nsec = (us % 1000000) * 1000 };
+
+    av_assert2(sizeof(*word) == sizeof(uint32_t));
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void shm_futex_wake(atomic_uint *word)
+{
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint8_t *shm_slot(SHMContext *s, unsigned int idx)
+{
+    return s->map + SHM_HEADER_SIZE +
+           (size_t)(idx & (s->nb_slots - 1)) * (SHM_SLOT_HEADER + s->slot_size);
+}
+
+/**
+ * Check whether an object of the name is in use by a live writer.
+ * A stale one is closed for readers still mapping it.
+ */
+static int shm_in_use(SHMContext *s)
+{
+    SHMHeader *hdr;
+    struct stat st;
+    void *map;
+    int fd, in_use = 0;
+
+    fd = shm_open(s->name, O_RDWR, 0);
+    if (fd < 0)
+        return 0;
+    if (!fstat(fd, &st) && st.st_size >= SHM_HEADER_SIZE) {
+        map = mmap(NULL, SHM_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            hdr    = map;
+            in_use = atomic_load(&hdr->magic) == SHM_MAGIC &&
+                     !atomic_load(&hdr->closed) && hdr->writer_pid &&
+                     (!kill(hdr->writer_pid, 0) || errno == EPERM);
+            if (!in_use) {
+                atomic_store(&hdr->closed, 1);
+                shm_futex_wake(&hdr->write_idx);
+            }
+            munmap(map, SHM_HEADER_SIZE);
+        }
+    }
+    close(fd);
+    return in_use;
+}
+
+static int shm_open_writer(URLContext *h, SHMContext *s)
+{
+    SHMHeader *hdr;
+    int nb_slots = 2;
+
+    while (nb_slots < s->nb_slots)
+        nb_slots <<= 1;
+    s->nb_slots = nb_slots;
+    s->map_size = SHM_HEADER_SIZE +
+                  (size_t)s->nb_slots * (SHM_SLOT_HEADER + s->slot_size);
+
+    s->fd = shm_open(s->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (s->fd < 0 && errno == EEXIST) {
+        /* only one left behind by a crashed or closed writer is replaced */
+        if (shm_in_use(s)) {
+            av_log(h, AV_LOG_ERROR, "%s is in use by another writer\n", s->name);
+            return AVERROR(EBUSY);
+        }
+        shm_unlink(s->name);
+        s->fd = shm_open(s->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (s->fd < 0)
+        return AVERROR(errno);
+    if (ftruncate(s->fd, s->map_size) < 0)
+        return AVERROR(errno);
+
+    s->map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        return AVERROR(errno);
+    }
+
+    hdr = s->hdr = (SHMHeader *)s->map;
+    hdr->nb_slots  = s->nb_slots;
+    hdr->slot_size = s->slot_size;
+    hdr->writer_pid = getpid();
+    atomic_init(&hdr->write_idx, 0);
+    atomic_init(&hdr->read_idx, 0);
+    atomic_init(&hdr->reader_waiting, 0);
+    atomic_init(&hdr->writer_waiting, 0);
+    atomic_init(&hdr->closed, 0);
+    atomic_store(&hdr->magic, SHM_MAGIC);
+    return 0;
+}
+
+static int shm_open_reader(URLContext *h, SHMContext *s)
+{
+    int64_t deadline = s->timeout > 0 ? av_gettime_relative() + s->timeout * 1000LL : 0;
+    struct stat st;
+
+    /* wait for the writer to create and size the object */
+    for (;;) {
+        if (s->fd < 0)
+            s->fd = shm_open(s->name, O_RDWR, 0);
+        if (s->fd >= 0 && !fstat(s->fd, &st) && st.st_size > SHM_HEADER_SIZE)
+            break;
+        if (s->fd < 0 && errno != ENOENT)
+            return AVERROR(errno);
+        if (!deadline || av_gettime_relative() > deadline)
+            return s->fd < 0 ? AVERROR(ENOENT) : AVERROR(ETIMEDOUT);
+        if (ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+        av_usleep(10000);
+    }
+
+    s->map_size = st.st_size;
+    s->map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        return AVERROR(errno);
+    }
+    s->hdr = (SHMHeader *)s->map;
+
+    /* sized but not yet initialized by the writer, which takes no time
+     * unless the writer died in between */
+    if (!deadline)
+        deadline = av_gettime_relative() + SHM_WAIT_US;
+    while (atomic_load(&s->hdr->magic) != SHM_MAGIC) {
+        if (av_gettime_relative() > deadline)
+            return AVERROR(ETIMEDOUT);
+        if (ff_check_interrupt(&h->interrupt_callback))
+            return AVERROR_EXIT;
+        av_usleep(1000);
+    }
+    /* kept, the header stays writable by the peer */
+    s->nb_slots  = s->hdr->nb_slots;
+    s->slot_size = s->hdr->slot_size;
+    if (s->nb_slots < 2 || s->nb_slots & (s->nb_slots - 1) ||
+        s->slot_size < 1 || s->slot_size > INT_MAX / 2 ||
+        SHM_HEADER_SIZE + (size_t)s->nb_slots *
+        (SHM_SLOT_HEADER + s->slot_size) > s->map_size) {
+        av_log(h, AV_LOG_ERROR, "Inconsistent shared memory layout\n");
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static int shm_open_url(URLContext *h, const char *filename, int flags)
+{
+    SHMContext *s = h->priv_data;
+    const char *p;
+    char buf[256];
+    int ret;
+
+    av_strstart(filename, "shm:", &filename);
+    if (!*filename || *filename == '?')
+        return AVERROR(EINVAL);
+    /* POSIX shared memory names start with a single slash */
+    snprintf(s->name, sizeof(s->name), "/%s", filename + (filename[0] == '/'));
+
+    p = strchr(s->name, '?');
+    if (p) {
+        if (av_find_info_tag(buf, sizeof(buf), "slots", p))
+            s->nb_slots = av_clip(strtol(buf, NULL, 10), 2, 1 << 16);
+        if (av_find_info_tag(buf, sizeof(buf), "slot_size", p))
+            s->slot_size = av_clip(strtol(buf, NULL, 10), 1, INT_MAX / 2);
+        if (av_find_info_tag(buf, sizeof(buf), "timeout", p))
+            s->timeout = strtol(buf, NULL, 10);
+        s->name[p - s->name] = '\0';
+    }
+    if (strchr(s->name + 1, '/'))
+        return AVERROR(EINVAL);
+
+    if (s->timeout < 0 && h->rw_timeout)
+        s->timeout = h->rw_timeout / 1000;
+
+    s->fd = -1;
+    s->is_writer = flags & AVIO_FLAG_WRITE;
+    if (s->is_writer && (flags & AVIO_FLAG_READ))
+        return AVERROR(EINVAL);
+
+    ret = s->is_writer ? shm_open_writer(h, s) : shm_open_reader(h, s);
+    if (ret < 0)
+        goto fail;
+
+    h->is_streamed     = 1;
+    h->max_packet_size = s->slot_size;
+    return 0;
+
+fail:
+    if (s->map)
+        munmap(s->map, s->map_size);
+    if (s->fd >= 0) {
+        close(s->fd);
+        /* a writer only gets a descriptor for an object it created */
+        if (s->is_writer)
+            shm_unlink(s->name);
+    }
+    return ret;
+}
+
+static int shm_read(URLContext *h, uint8_t *buf, int size)
+{
+    SHMContext *s = h->priv_data;
+    SHMHeader *hdr = s->hdr;
+    unsigned int r = atomic_load_explicit(&hdr->read_idx, memory_order_relaxed);
+    unsigned int w = atomic_load_explicit(&hdr->write_idx, memory_order_acquire);
+    uint8_t *slot;
+    unsigned int slot_len;
+    int len;
+
+    if (r == w) {
+        if (atomic_load(&hdr->closed))
+            return AVERROR_EOF;
+        if (h->flags & AVIO_FLAG_NONBLOCK)
+            return AVERROR(EAGAIN);
+        /* announce the wait before re-checking, the writer wakes us
+         * only if it sees the flag */
+        atomic_store(&hdr->reader_waiting, 1);
+        w = atomic_load(&hdr->write_idx);
+        if (r == w && !atomic_load(&hdr->closed))
+            shm_futex_wait(&hdr->write_idx, w, SHM_WAIT_US);
+        atomic_store(&hdr->reader_waiting, 0);
+        /* read right away when woken for a slot, an EAGAIN would make the
+         * url layer sleep before calling again */
+        w = atomic_load_explicit(&hdr->write_idx, memory_order_acquire);
+        if (r == w) {
+            /* let the url layer handle interrupts and rw_timeout */
+            return atomic_load(&hdr->closed) ? AVERROR_EOF : AVERROR(EAGAIN);
+        }
+    }
+
+    slot     = shm_slot(s, r);
+    slot_len = AV_RN32(slot);
+    if (slot_len > s->slot_size || slot_len < s->read_off) {
+        av_log(h, AV_LOG_ERROR, "Invalid slot length %u\n", slot_len);
+        return AVERROR_INVALIDDATA;
+    }
+    len = FFMIN(size, (int)slot_len - s->read_off);
+    memcpy(buf, slot + SHM_SLOT_HEADER + s->read_off, len);
+    s->read_off += len;
+
+    if (s->read_off == slot_len) {
+        s->read_off = 0;
+        atomic_store(&hdr->read_idx, r + 1);
+        if (atomic_load(&hdr->writer_waiting))
+            shm_futex_wake(&hdr->read_idx);
+    }
+    return len;
+}
+
+static int shm_write(URLContext *h, const uint8_t *buf, int size)
+{
+    SHMContext *s = h->priv_data;
+    SHMHeader *hdr = s->hdr;
+    int written = 0;
+
+    while (written < size) {
+        unsigned int w = atomic_load_explicit(&hdr->write_idx, memory_order_relaxed);
+        unsigned int r = atomic_load_explicit(&hdr->read_idx, memory_order_acquire);
+        uint8_t *slot;
+        int len;
+
+        if (w - r == s->nb_slots) {
+            if (written)
+                return written;
+            if (h->flags & AVIO_FLAG_NONBLOCK)
+                return AVERROR(EAGAIN);
+            atomic_store(&hdr->writer_waiting, 1);
+            r = atomic_load(&hdr->read_idx);
+            if (w - r == s->nb_slots)
+                shm_futex_wait(&hdr->read_idx, r, SHM_WAIT_US);
+            atomic_store(&hdr->writer_waiting, 0);
+            if (w - atomic_load(&hdr->read_idx) == s->nb_slots)
+                return AVERROR(EAGAIN);
+        }
+
+        slot = shm_slot(s, w);
+        len  = FFMIN(size - written, s->slot_size);
+        AV_WN32(slot, len);
+        memcpy(slot + SHM_SLOT_HEADER, buf + written, len);
+        written += len;
+
+        atomic_store(&hdr->write_idx, w + 1);
+        if (atomic_load(&hdr->reader_waiting))
+            shm_futex_wake(&hdr->write_idx);
+    }
+    return written;
+}
+
+static int shm_close(URLContext *h)
+{
+    SHMContext *s = h->priv_data;
+
+    if (s->is_writer) {
+        atomic_store(&s->hdr->closed, 1);
+        shm_futex_wake(&s->hdr->write_idx);
+        shm_unlink(s->name);
+    }
+    munmap(s->map, s->map_size);
+    close(s->fd);
+    return 0;
+}
+
+const URLProtocol ff_shm_protocol = {
+    .name                = "shm",
+    .url_open            = shm_open_url,
+    .url_read            = shm_read,
+    .url_write           = shm_write,
+    .url_close           = shm_close,
+    .priv_data_size      = sizeof(SHMContext),
+    .priv_data_class     = &shm_class,
+};
@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg/sendmmsg with glibc */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -63,6 +64,7 @@
 
 #if HAVE_PTHREAD_CANCEL
 #include <pthread.h>
+#include <stdatomic.h>
 #endif
 
 #ifndef IPV6_ADD_MEMBERSHIP
@@ -73,6 +75,23 @@
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_BATCH_SIZE 1024
+
+/**
+ * Single-producer/single-consumer byte ring between the receiving thread
+ * and udp_read(). Each datagram is stored as a 32 bit length followed by
+ * its payload, both wrapping around the end of buf. head and tail are free
+ * running byte counters, so head - tail is the number of bytes in use.
+ * size is a power of two, so the offsets stay continuous when they wrap.
+ */
+typedef struct UDPRing {
+    uint8_t *buf;
+    unsigned int size;
+#if HAVE_PTHREAD_CANCEL
+    atomic_uint head;   ///< written by the producer only
+    atomic_uint tail;   ///< written by the consumer only
+#endif
+} UDPRing;
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -92,7 +111,8 @@ typedef struct UDPContext {
 
     /* Circular Buffer variables for use in UDP receive code */
     int circular_buffer_size;
-    AVFifoBuffer *fifo;
+    AVFifoBuffer *fifo;     /* transmit side, guarded by mutex */
+    UDPRing ring;           /* receive side, lock-free */
     int circular_buffer_error;
     int64_t bitrate; /* number of bits to send per second */
     int64_t burst_bits;
@@ -101,9 +121,19 @@ typedef struct UDPContext {
     pthread_t circular_buffer_thread;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    atomic_int ring_waiting; /* udp_read() sleeps on cond for ring data */
     int thread_started;
 #endif
-    uint8_t tmp[UDP_MAX_PKT_SIZE+4];
+
+    /* Datagrams moved per syscall by the circular buffer thread */
+    int batch_size;
+    uint8_t *batch_buf;     /* batch_size slots of UDP_MAX_PKT_SIZE bytes */
+    int *batch_len;
+    struct sockaddr_storage *batch_addr;
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    struct mmsghdr *batch_msg;
+    struct iovec *batch_iov;
+#endif
     int remaining_in_dg;
     char *localaddr;
     int timeout;
@@ -131,6 +161,7 @@ static const AVOption options[] = {
     { "ttl",            "Time to live (multicast only)",                   OFFSET(ttl),            AV_OPT_TYPE_INT,    { .i64 = 16 },     0, INT_MAX, E },
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
+    { "batch_size",     "Number of datagrams moved per system call by the circular buffer thread", OFFSET(batch_size), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, UDP_MAX_BATCH_SIZE, D|E },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -453,63 +484,261 @@ static int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
+static void udp_batch_free(UDPContext *s)
+{
+    av_freep(&s->batch_buf);
+    av_freep(&s->batch_len);
+    av_freep(&s->batch_addr);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    av_freep(&s->batch_msg);
+    av_freep(&s->batch_iov);
+#endif
+}
+
 #if HAVE_PTHREAD_CANCEL
+static unsigned int udp_ring_space(UDPRing *r)
+{
+    return r->size - (atomic_load_explicit(&r->head, memory_order_relaxed) -
+                      atomic_load_explicit(&r->tail, memory_order_acquire));
+}
+
+static int udp_ring_empty(UDPRing *r)
+{
+    return atomic_load(&r->head) == atomic_load_explicit(&r->tail, memory_order_relaxed);
+}
+
+static void udp_ring_copy_in(UDPRing *r, unsigned int pos, const uint8_t *src, unsigned int len)
+{
+    unsigned int off   = pos & (r->size - 1);
+    unsigned int first = FFMIN(len, r->size - off);
+
+    memcpy(r->buf + off, src, first);
+    memcpy(r->buf, src + first, len - first);
+}
+
+static void udp_ring_copy_out(UDPRing *r, unsigned int pos, uint8_t *dst, unsigned int len)
+{
+    unsigned int off   = pos & (r->size - 1);
+    unsigned int first = FFMIN(len, r->size - off);
+
+    memcpy(dst, r->buf + off, first);
+    memcpy(dst + first, r->buf, len - first);
+}
+
+/**
+ * Append one datagram to the ring. Producer side only.
+ * @return 0 on success, AVERROR(ENOSPC) if the ring cannot hold it
+ */
+static int udp_ring_write(UDPRing *r, const uint8_t *buf, int len)
+{
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint8_t tmp[4];
+
+    if (udp_ring_space(r) < len + 4)
+        return AVERROR(ENOSPC);
+
+    AV_WL32(tmp, len);
+    udp_ring_copy_in(r, head, tmp, 4);
+    udp_ring_copy_in(r, head + 4, buf, len);
+    atomic_store(&r->head, head + 4 + len);
+    return 0;
+}
+
+/**
+ * Pop the oldest datagram from the ring. Consumer side only.
+ * Bytes exceeding size are discarded.
+ * @param dg_len set to the full length of the datagram
+ * @return number of bytes copied to buf, AVERROR(EAGAIN) if the ring is empty
+ */
+static int udp_ring_read(UDPRing *r, uint8_t *buf, int size, int *dg_len)
+{
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint8_t tmp[4];
+    int len;
+
+    if (atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+        return AVERROR(EAGAIN);
+
+    udp_ring_copy_out(r, tail, tmp, 4);
+    *dg_len = AV_RL32(tmp);
+    len = FFMIN(*dg_len, size);
+    udp_ring_copy_out(r, tail + 4, buf, len);
+    atomic_store_explicit(&r->tail, tail + 4 + *dg_len, memory_order_release);
+    return len;
+}
+
+static int udp_batch_alloc(UDPContext *s)
+{
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    int i;
+#endif
+
+    s->batch_buf  = av_malloc_array(s->batch_size, UDP_MAX_PKT_SIZE);
+    s->batch_len  = av_malloc_array(s->batch_size, sizeof(*s->batch_len));
+    s->batch_addr = av_malloc_array(s->batch_size, sizeof(*s->batch_addr));
+    if (!s->batch_buf || !s->batch_len || !s->batch_addr)
+        return AVERROR(ENOMEM);
+#if HAVE_RECVMMSG || HAVE_SENDMMSG
+    s->batch_msg = av_mallocz_array(s->batch_size, sizeof(*s->batch_msg));
+    s->batch_iov = av_mallocz_array(s->batch_size, sizeof(*s->batch_iov));
+    if (!s->batch_msg || !s->batch_iov)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->batch_size; i++) {
+        s->batch_iov[i].iov_base = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+        s->batch_iov[i].iov_len  = UDP_MAX_PKT_SIZE;
+        s->batch_msg[i].msg_hdr.msg_iov    = &s->batch_iov[i];
+        s->batch_msg[i].msg_hdr.msg_iovlen = 1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Receive up to batch_size datagrams into the batch slots, blocking until
+ * at least one is available.
+ * @return number of datagrams received or a negative AVERROR
+ */
+static int udp_recv_batch(UDPContext *s)
+{
+    socklen_t addr_len = sizeof(s->batch_addr[0]);
+    int len;
+#if HAVE_RECVMMSG
+    if (s->batch_size > 1) {
+        int i, n;
+
+        for (i = 0; i < s->batch_size; i++) {
+            s->batch_msg[i].msg_hdr.msg_name    = &s->batch_addr[i];
+            s->batch_msg[i].msg_hdr.msg_namelen = addr_len;
+        }
+        n = recvmmsg(s->udp_fd, s->batch_msg, s->batch_size, MSG_WAITFORONE, NULL);
+        if (n < 0)
+            return ff_neterrno();
+        for (i = 0; i < n; i++)
+            s->batch_len[i] = s->batch_msg[i].msg_len;
+        return n;
+    }
+#endif
+    len = recvfrom(s->udp_fd, s->batch_buf, UDP_MAX_PKT_SIZE, 0,
+                   (struct sockaddr *)&s->batch_addr[0], &addr_len);
+    if (len < 0)
+        return ff_neterrno();
+    s->batch_len[0] = len;
+    return 1;
+}
+
+/**
+ * Send the first n datagrams of the batch slots.
+ * @return 0 on success or a negative AVERROR
+ */
+static int udp_send_batch(UDPContext *s, int n)
+{
+    int i;
+#if HAVE_SENDMMSG
+    if (n > 1) {
+        int sent = 0;
+
+        for (i = 0; i < n; i++) {
+            s->batch_msg[i].msg_hdr.msg_name    = s->is_connected ? NULL : &s->dest_addr;
+            s->batch_msg[i].msg_hdr.msg_namelen = s->is_connected ? 0 : s->dest_addr_len;
+            s->batch_iov[i].iov_len = s->batch_len[i];
+        }
+        while (sent < n) {
+            int ret = sendmmsg(s->udp_fd, s->batch_msg + sent, n - sent, 0);
+            if (ret < 0) {
+                ret = ff_neterrno();
+                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                    return ret;
+                continue;
+            }
+            sent += ret;
+        }
+        return 0;
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        const uint8_t *p = s->batch_buf + i * UDP_MAX_PKT_SIZE;
+        int len = s->batch_len[i];
+
+        while (len) {
+            int ret;
+            av_assert0(len > 0);
+            if (!s->is_connected) {
+                ret = sendto (s->udp_fd, p, len, 0,
+                            (struct sockaddr *) &s->dest_addr,
+                            s->dest_addr_len);
+            } else
+                ret = send(s->udp_fd, p, len, 0);
+            if (ret >= 0) {
+                len -= ret;
+                p   += ret;
+            } else {
+                ret = ff_neterrno();
+                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR))
+                    return ret;
+            }
+        }
+    }
+    return 0;
+}
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
     UDPContext *s = h->priv_data;
     int old_cancelstate;
+    int err = 0;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-    pthread_mutex_lock(&s->mutex);
     if (ff_socket_nonblock(s->udp_fd, 0) < 0) {
         av_log(h, AV_LOG_ERROR, "Failed to set blocking mode");
-        s->circular_buffer_error = AVERROR(EIO);
+        err = AVERROR(EIO);
         goto end;
     }
     while(1) {
-        int len;
-        struct sockaddr_storage addr;
-        socklen_t addr_len = sizeof(addr);
+        int i, n;
 
-        pthread_mutex_unlock(&s->mutex);
         /* Blocking operations are always cancellation points;
            see "General Information" / "Thread Cancelation Overview"
            in Single Unix. */
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
-        len = recvfrom(s->udp_fd, s->tmp+4, sizeof(s->tmp)-4, 0, (struct sockaddr *)&addr, &addr_len);
+        n = udp_recv_batch(s);
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
-        pthread_mutex_lock(&s->mutex);
-        if (len < 0) {
-            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
-                s->circular_buffer_error = ff_neterrno();
+        if (n < 0) {
+            if (n != AVERROR(EAGAIN) && n != AVERROR(EINTR)) {
+                err = n;
                 goto end;
             }
             continue;
         }
-        if (ff_ip_check_source_lists(&addr, &s->filters))
-            continue;
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
+        for (i = 0; i < n; i++) {
+            if (ff_ip_check_source_lists(&s->batch_addr[i], &s->filters))
                 continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
+            if (udp_ring_write(&s->ring, s->batch_buf + i * UDP_MAX_PKT_SIZE, s->batch_len[i]) < 0) {
+                /* No Space left */
+                if (s->overrun_nonfatal) {
+                    av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                            "Surviving due to overrun_nonfatal option\n");
+                    continue;
+                } else {
+                    av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                            "To avoid, increase fifo_size URL option. "
+                            "To survive in such case, use overrun_nonfatal option\n");
+                    err = AVERROR(EIO);
+                    goto end;
+                }
             }
         }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
-        pthread_cond_signal(&s->cond);
+        /* only take the lock if the reader is actually sleeping */
+        if (atomic_load(&s->ring_waiting)) {
+            pthread_mutex_lock(&s->mutex);
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+        }
     }
 
 end:
+    pthread_mutex_lock(&s->mutex);
+    s->circular_buffer_error = err;
     pthread_cond_signal(&s->cond);
     pthread_mutex_unlock(&s->mutex);
     return NULL;
@@ -536,8 +765,8 @@ static void *circular_buffer_task_tx( void *_URLContext)
     }
 
     for(;;) {
-        int len;
-        const uint8_t *p;
+        int len, n, ret;
+        int64_t batch_bytes = 0;
         uint8_t tmp[4];
         int64_t timestamp;
 
@@ -552,13 +781,20 @@ static void *circular_buffer_task_tx( void *_URLContext)
             len=av_fifo_size(s->fifo);
         }
 
-        av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-        len=AV_RL32(tmp);
+        /* drain as many queued datagrams as fit in one batch */
+        for (n = 0; n < s->batch_size && av_fifo_size(s->fifo) >= 4; n++) {
+            av_fifo_generic_read(s->fifo, tmp, 4, NULL);
+            len=AV_RL32(tmp);
 
-        av_assert0(len >= 0);
-        av_assert0(len <= sizeof(s->tmp));
+            av_assert0(len >= 0);
+            av_assert0(len <= UDP_MAX_PKT_SIZE);
 
-        av_fifo_generic_read(s->fifo, s->tmp, len, NULL);
+            av_fifo_generic_read(s->fifo, s->batch_buf + n * UDP_MAX_PKT_SIZE, len, NULL);
+            s->batch_len[n] = len;
+            batch_bytes += len;
+        }
+        /* wake up a writer waiting for fifo space */
+        pthread_cond_signal(&s->cond);
 
         pthread_mutex_unlock(&s->mutex);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &old_cancelstate);
@@ -579,32 +815,17 @@ static void *circular_buffer_task_tx( void *_URLContext)
                     sent_bits = 0;
                 }
             }
-            sent_bits += len * 8;
+            sent_bits += batch_bytes * 8;
             target_timestamp = start_timestamp + sent_bits * 1000000 / s->bitrate;
         }
 
-        p = s->tmp;
-        while (len) {
-            int ret;
-            av_assert0(len > 0);
-            if (!s->is_connected) {
-                ret = sendto (s->udp_fd, p, len, 0,
-                            (struct sockaddr *) &s->dest_addr,
-                            s->dest_addr_len);
-            } else
-                ret = send(s->udp_fd, p, len, 0);
-            if (ret >= 0) {
-                len -= ret;
-                p   += ret;
-            } else {
-                ret = ff_neterrno();
-                if (ret != AVERROR(EAGAIN) && ret != AVERROR(EINTR)) {
-                    pthread_mutex_lock(&s->mutex);
-                    s->circular_buffer_error = ret;
-                    pthread_mutex_unlock(&s->mutex);
-                    return NULL;
-                }
-            }
+        ret = udp_send_batch(s, n);
+        if (ret < 0) {
+            pthread_mutex_lock(&s->mutex);
+            s->circular_buffer_error = ret;
+            pthread_cond_signal(&s->cond);
+            pthread_mutex_unlock(&s->mutex);
+            return NULL;
         }
 
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_cancelstate);
@@ -699,6 +920,13 @@ static int udp_open(URLContext *h, const char *uri, int flags)
                        "'circular_buffer_size' option was set but it is not supported "
                        "on this build (pthread support is required)\n");
         }
+        if (av_find_info_tag(buf, sizeof(buf), "batch_size", p)) {
+            s->batch_size = av_clip(strtol(buf, NULL, 10), 1, UDP_MAX_BATCH_SIZE);
+            if (!HAVE_PTHREAD_CANCEL)
+                av_log(h, AV_LOG_WARNING,
+                       "'batch_size' option was set but it is not supported "
+                       "on this build (pthread support is required)\n");
+        }
         if (av_find_info_tag(buf, sizeof(buf), "bitrate", p)) {
             s->bitrate = strtoll(buf, NULL, 10);
             if (!HAVE_PTHREAD_CANCEL)
@@ -880,19 +1108,36 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     /*
       Create thread in case of:
       1. Input and circular_buffer_size is set
-      2. Output and bitrate and circular_buffer_size is set
+      2. Output and bitrate or batch_size and circular_buffer_size is set
     */
 
-    if (is_output && s->bitrate && !s->circular_buffer_size) {
+    if (is_output && (s->bitrate || s->batch_size > 1) && !s->circular_buffer_size) {
         /* Warn user in case of 'circular_buffer_size' is not set */
-        av_log(h, AV_LOG_WARNING,"'bitrate' option was set but 'circular_buffer_size' is not, but required\n");
+        av_log(h, AV_LOG_WARNING,"'bitrate' or 'batch_size' option was set but 'circular_buffer_size' is not, but required\n");
     }
 
-    if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
+    if ((!is_output && s->circular_buffer_size) ||
+        (is_output && (s->bitrate || s->batch_size > 1) && s->circular_buffer_size)) {
         int ret;
 
         /* start the task going */
-        s->fifo = av_fifo_alloc(s->circular_buffer_size);
+        if (is_output) {
+            s->fifo = av_fifo_alloc(s->circular_buffer_size);
+            if (!s->fifo)
+                goto fail;
+        } else {
+            s->ring.size = 1;
+            while (s->ring.size < s->circular_buffer_size)
+                s->ring.size <<= 1;
+            s->ring.buf  = av_malloc(s->ring.size);
+            if (!s->ring.buf)
+                goto fail;
+            atomic_init(&s->ring.head, 0);
+            atomic_init(&s->ring.tail, 0);
+            atomic_init(&s->ring_waiting, 0);
+        }
+        if (udp_batch_alloc(s) < 0)
+            goto fail;
         ret = pthread_mutex_init(&s->mutex, NULL);
         if (ret != 0) {
             av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", strerror(ret));
@@ -923,6 +1168,8 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+    av_freep(&s->ring.buf);
+    udp_batch_free(s);
     ff_ip_reset_filters(&s->filters);
     return AVERROR(EIO);
 }
@@ -944,29 +1191,25 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
     struct sockaddr_storage addr;
     socklen_t addr_len = sizeof(addr);
 #if HAVE_PTHREAD_CANCEL
-    int avail, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
+    int avail, dg_len, nonblock = h->flags & AVIO_FLAG_NONBLOCK;
 
-    if (s->fifo) {
-        pthread_mutex_lock(&s->mutex);
+    if (s->ring.buf) {
         do {
-            avail = av_fifo_size(s->fifo);
-            if (avail) { // >=size) {
-                uint8_t tmp[4];
-
-                av_fifo_generic_read(s->fifo, tmp, 4, NULL);
-                avail= AV_RL32(tmp);
-                if(avail > size){
+            /* fast path, no locking as long as datagrams are queued */
+            avail = udp_ring_read(&s->ring, buf, size, &dg_len);
+            if (avail >= 0) {
+                if (dg_len > size)
                     av_log(h, AV_LOG_WARNING, "Part of datagram lost due to insufficient buffer size\n");
-                    avail= size;
-                }
-
-                av_fifo_generic_read(s->fifo, buf, avail, NULL);
-                av_fifo_drain(s->fifo, AV_RL32(tmp) - avail);
-                pthread_mutex_unlock(&s->mutex);
                 return avail;
-            } else if(s->circular_buffer_error){
+            }
+
+            pthread_mutex_lock(&s->mutex);
+            if(s->circular_buffer_error){
                 int err = s->circular_buffer_error;
                 pthread_mutex_unlock(&s->mutex);
+                /* hand out what was received before the error first */
+                if (!udp_ring_empty(&s->ring))
+                    continue;
                 return err;
             } else if(nonblock) {
                 pthread_mutex_unlock(&s->mutex);
@@ -978,10 +1221,17 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
                 int64_t t = av_gettime() + 100000;
                 struct timespec tv = { .tv_sec  =  t / 1000000,
                                        .tv_nsec = (t % 1000000) * 1000 };
-                if (pthread_cond_timedwait(&s->cond, &s->mutex, &tv) < 0) {
+                /* announce the wait before re-checking the ring, the
+                   receiving thread signals only if it sees this flag */
+                atomic_store(&s->ring_waiting, 1);
+                if (udp_ring_empty(&s->ring) &&
+                    pthread_cond_timedwait(&s->cond, &s->mutex, &tv) < 0) {
+                    atomic_store(&s->ring_waiting, 0);
                     pthread_mutex_unlock(&s->mutex);
                     return AVERROR(errno == ETIMEDOUT ? EAGAIN : errno);
                 }
+                atomic_store(&s->ring_waiting, 0);
+                pthread_mutex_unlock(&s->mutex);
                 nonblock = 1;
             }
         } while( 1);
@@ -1022,10 +1272,21 @@ static int udp_write(URLContext *h, const uint8_t *buf, int size)
             return err;
         }
 
-        if(av_fifo_space(s->fifo) < size + 4) {
-            /* What about a partial packet tx ? */
-            pthread_mutex_unlock(&s->mutex);
-            return AVERROR(ENOMEM);
+        while (av_fifo_space(s->fifo) < size + 4) {
+            /* Without pacing the sending thread empties the fifo as fast as
+               the socket allows, so a blocking writer waits for it. */
+            if (s->bitrate || (h->flags & AVIO_FLAG_NONBLOCK) ||
+                av_fifo_size(s->fifo) + av_fifo_space(s->fifo) < size + 4) {
+                /* What about a partial packet tx ? */
+                pthread_mutex_unlock(&s->mutex);
+                return AVERROR(ENOMEM);
+            }
+            pthread_cond_wait(&s->cond, &s->mutex);
+            if (s->circular_buffer_error<0) {
+                int err=s->circular_buffer_error;
+                pthread_mutex_unlock(&s->mutex);
+                return err;
+            }
         }
         AV_WL32(tmp, size);
         av_fifo_generic_write(s->fifo, tmp, 4, NULL); /* size of packet */
@@ -1082,6 +1343,8 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+    av_freep(&s->ring.buf);
+    udp_batch_free(s);
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
@@ -26,16 +26,11 @@
 #include "mem.h"
 #include "thread.h"
 
-AVBufferRef *av_buffer_create(uint8_t *data, int size,
-                              void (*free)(void *opaque, uint8_t *data),
-                              void *opaque, int flags)
+static AVBufferRef *buffer_create(AVBuffer *buf, uint8_t *data, int size,
+                                  void (*free)(void *opaque, uint8_t *data),
+                                  void *opaque, int flags)
 {
     AVBufferRef *ref = NULL;
-    AVBuffer    *buf = NULL;
-
-    buf = av_mallocz(sizeof(*buf));
-    if (!buf)
-        return NULL;
 
     buf->data     = data;
     buf->size     = size;
@@ -44,14 +39,11 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
 
     atomic_init(&buf->refcount, 1);
 
-    if (flags & AV_BUFFER_FLAG_READONLY)
-        buf->flags |= BUFFER_FLAG_READONLY;
+    buf->flags = flags;
 
     ref = av_mallocz(sizeof(*ref));
-    if (!ref) {
-        av_freep(&buf);
+    if (!ref)
         return NULL;
-    }
 
     ref->buffer = buf;
     ref->data   = data;
@@ -60,6 +52,24 @@ AVBufferRef *av_buffer_create(uint8_t *data, int size,
     return ref;
 }
 
+AVBufferRef *av_buffer_create(uint8_t *data, int size,
+                              void (*free)(void *opaque, uint8_t *data),
+                              void *opaque, int flags)
+{
+    AVBufferRef *ret;
+    AVBuffer *buf = av_mallocz(sizeof(*buf));
+    if (!buf)
+        return NULL;
+
+    ret = buffer_create(buf, data, size, free, opaque,
+                        flags & AV_BUFFER_FLAG_READONLY ? BUFFER_FLAG_READONLY : 0);
+    if (!ret) {
+        av_free(buf);
+        return NULL;
+    }
+    return ret;
+}
+
 void av_buffer_default_free(void *opaque, uint8_t *data)
 {
     av_free(data);
@@ -118,8 +128,12 @@ static void buffer_replace(AVBufferRef **dst, AVBufferRef **src)
         av_freep(dst);
 
     if (atomic_fetch_sub_explicit(&b->refcount, 1, memory_order_acq_rel) == 1) {
+        /* b->free() may hand the structure holding *b to another thread,
+         * so the flag has to be read first */
+        int free_avbuffer = !(b->flags & BUFFER_FLAG_NO_FREE);
         b->free(b->opaque, b->data);
-        av_freep(&b);
+        if (free_avbuffer)
+            av_free(b);
     }
 }
 
@@ -225,6 +239,7 @@ AVBufferPool *av_buffer_pool_init2(int size, void *opaque,
         return NULL;
 
     ff_mutex_init(&pool->mutex, NULL);
+    atomic_init(&pool->free_list, 0);
 
     pool->size      = size;
     pool->opaque    = opaque;
@@ -243,6 +258,7 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
         return NULL;
 
     ff_mutex_init(&pool->mutex, NULL);
+    atomic_init(&pool->free_list, 0);
 
     pool->size     = size;
     pool->alloc    = alloc ? alloc : av_buffer_alloc;
@@ -252,19 +268,63 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
     return pool;
 }
 
+static BufferPoolEntry *pool_entry(AVBufferPool *pool, unsigned id)
+{
+    int s = av_log2(id);
+    return &pool->segments[s][id - (1U << s)];
+}
+
+static intptr_t pool_list_head(intptr_t old, unsigned id)
+{
+    return (((uintptr_t)old & ~POOL_ID_MASK) + POOL_ID_MASK + 1) | id;
+}
+
+static void pool_push(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    intptr_t head = atomic_load_explicit(&pool->free_list, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(&buf->next, (uintptr_t)head & POOL_ID_MASK,
+                              memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_list, &head,
+                                                    pool_list_head(head, buf->id),
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+static BufferPoolEntry *pool_pop(AVBufferPool *pool)
+{
+    intptr_t head = atomic_load_explicit(&pool->free_list, memory_order_acquire);
+    BufferPoolEntry *buf;
+    unsigned next;
+
+    do {
+        if (!((uintptr_t)head & POOL_ID_MASK))
+            return NULL;
+        buf  = pool_entry(pool, (uintptr_t)head & POOL_ID_MASK);
+        next = atomic_load_explicit(&buf->next, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_list, &head,
+                                                    pool_list_head(head, next),
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    return buf;
+}
+
 /*
  * This function gets called when the pool has been uninited and
  * all the buffers returned to it.
  */
 static void buffer_pool_free(AVBufferPool *pool)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    unsigned id;
+    int i;
 
+    for (id = 1; id <= pool->nb_entries; id++) {
+        BufferPoolEntry *buf = pool_entry(pool, id);
         buf->free(buf->opaque, buf->data);
-        av_freep(&buf);
     }
+    for (i = 0; i < FF_ARRAY_ELEMS(pool->segments); i++)
+        av_freep(&pool->segments[i]);
     ff_mutex_destroy(&pool->mutex);
 
     if (pool->pool_free)
@@ -294,37 +354,42 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
     if(CONFIG_MEMORY_POISONING)
         memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    pool_push(pool, buf);
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
 }
 
 /* allocate a new buffer and override its free() callback so that
- * it is returned to the pool on free */
+ * it is returned to the pool on free, called with pool->mutex held */
 static AVBufferRef *pool_alloc_buffer(AVBufferPool *pool)
 {
     BufferPoolEntry *buf;
     AVBufferRef     *ret;
+    unsigned id = pool->nb_entries + 1;
+    int s = av_log2(id);
+
+    if (pool->nb_entries == POOL_ID_MASK)
+        return NULL;
+    if (id == 1U << s && !pool->segments[s]) {
+        pool->segments[s] = av_malloc_array(1U << s, sizeof(*pool->segments[s]));
+        if (!pool->segments[s])
+            return NULL;
+    }
 
     ret = pool->alloc2 ? pool->alloc2(pool->opaque, pool->size) :
                          pool->alloc(pool->size);
     if (!ret)
         return NULL;
 
-    buf = av_mallocz(sizeof(*buf));
-    if (!buf) {
-        av_buffer_unref(&ret);
-        return NULL;
-    }
-
+    buf = pool_entry(pool, id);
     buf->data   = ret->buffer->data;
     buf->opaque = ret->buffer->opaque;
     buf->free   = ret->buffer->free;
     buf->pool   = pool;
+    buf->id     = id;
+    atomic_init(&buf->next, 0);
+    pool->nb_entries = id;
 
     ret->buffer->opaque = buf;
     ret->buffer->free   = pool_release_buffer;
@@ -337,19 +402,17 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
     AVBufferRef *ret;
     BufferPoolEntry *buf;
 
-    ff_mutex_lock(&pool->mutex);
-    buf = pool->pool;
+    buf = pool_pop(pool);
     if (buf) {
-        ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
-                               buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
-        }
+        ret = buffer_create(&buf->buffer, buf->data, pool->size,
+                            pool_release_buffer, buf, BUFFER_FLAG_NO_FREE);
+        if (!ret)
+            pool_push(pool, buf);
     } else {
+        ff_mutex_lock(&pool->mutex);
         ret = pool_alloc_buffer(pool);
+        ff_mutex_unlock(&pool->mutex);
     }
-    ff_mutex_unlock(&pool->mutex);
 
     if (ret)
         atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
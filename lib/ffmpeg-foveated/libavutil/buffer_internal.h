@@ -33,6 +33,11 @@
  * The buffer was av_realloc()ed, so it is reallocatable.
  */
 #define BUFFER_FLAG_REALLOCATABLE (1 << 1)
+/**
+ * The AVBuffer structure is embedded in a BufferPoolEntry and must not be
+ * freed along with the data.
+ */
+#define BUFFER_FLAG_NO_FREE       (1 << 2)
 
 struct AVBuffer {
     uint8_t *data; /**< data described by this buffer */
@@ -70,12 +75,42 @@ typedef struct BufferPoolEntry {
     void (*free)(void *opaque, uint8_t *data);
 
     AVBufferPool *pool;
-    struct BufferPoolEntry *next;
+
+    /* used instead of a separate allocation while the entry is handed out */
+    AVBuffer buffer;
+
+    /* position in the pool's entry table, starting at 1 */
+    unsigned id;
+    /* id of the entry below this one in the free list, 0 at the bottom */
+    atomic_uint next;
 } BufferPoolEntry;
 
+/*
+ * The free list head packs the id of the top entry into the low half of an
+ * intptr_t and a tag that is bumped on every push and pop into the high
+ * half, so that a pop racing with a pop-push pair of the same entry (ABA)
+ * fails its compare-and-swap. The compat atomics only provide pointer-sized
+ * atomics, hence intptr_t rather than a 64-bit type.
+ */
+#define POOL_ID_BITS (4 * sizeof(intptr_t))
+#define POOL_ID_MASK (((uintptr_t)1 << POOL_ID_BITS) - 1)
+
 struct AVBufferPool {
+    /*
+     * Serializes growing the pool, and with it calls to the alloc callback,
+     * which some users rely on. Getting and returning pooled buffers is
+     * lock-free.
+     */
     AVMutex mutex;
-    BufferPoolEntry *pool;
+    atomic_intptr_t free_list;
+
+    /*
+     * Entries are never moved or freed while the pool lives, so that a
+     * stale free list head can still be dereferenced. Entry id lives in
+     * segments[s][id - (1 << s)] with s = av_log2(id).
+     */
+    BufferPoolEntry *segments[POOL_ID_BITS];
+    unsigned nb_entries;
 
     /*
      * This is used to track when the pool is to be freed.
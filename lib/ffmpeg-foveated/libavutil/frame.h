@@ -182,9 +182,25 @@ enum AVFrameSideDataType {
 
     /**
      * data points to four floats: (x, y, sigma, delta),
-     * which describe a gaussian-shaped quality map
+     * which describe a gaussian-shaped quality map. Predicted fixations may
+     * add further sets of four floats, the first set is the primary one and
+     * the map is the union of all of them. A trailing float enables
+     * temporal foveation: the periphery is only updated every that many
+     * frames, 0 disables it. Decoders export it negated on frames that kept
+     * the periphery of the previous one. A second trailing float sets the
+     * chroma sigma relative to the luma one, chroma acuity falls off faster:
+     * the chroma gaussians are narrowed by it and their delta divided by it;
+     * 0 or 1 applies the luma map to chroma.
      */
     AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+
+    /**
+     * User data unregistered metadata associated with a video frame.
+     * This is the H.26[45] UDU SEI message, and shouldn't be used for any other purpose
+     * The data is stored as uint8_t in AVFrameSideData.data which is 16 bytes of
+     * uuid_iso_iec_11578 followed by AVFrameSideData.size - 16 bytes of user_data_payload_byte.
+     */
+    AV_FRAME_DATA_SEI_UNREGISTERED,
 };
 
 enum AVActiveFormatDescription {
@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,6 +75,78 @@ void av_max_alloc(size_t max){
     max_alloc_size = max;
 }
 
+/* bytes held by blocks of the functions below and their highest count,
+ * off by default as every allocation would update one shared counter.
+ * Blocks are not tagged, so a block allocated while off would be
+ * subtracted when freed: counting can only start before the first
+ * allocation and never stops. */
+static atomic_int      mem_accounting = ATOMIC_VAR_INIT(0);
+static atomic_int      mem_untracked  = ATOMIC_VAR_INIT(0);
+static atomic_intptr_t mem_allocated  = ATOMIC_VAR_INIT(0);
+static atomic_intptr_t mem_peak       = ATOMIC_VAR_INIT(0);
+
+int av_mem_accounting(void)
+{
+    if (atomic_load_explicit(&mem_untracked, memory_order_relaxed))
+        return AVERROR(EINVAL);
+    atomic_store_explicit(&mem_accounting, 1, memory_order_relaxed);
+    return 0;
+}
+
+static int mem_accounted(void)
+{
+    return atomic_load_explicit(&mem_accounting, memory_order_relaxed);
+}
+
+/* a block allocated while counting is off, the load keeps the cache line
+ * shared after the first one */
+static void mem_untrack(void)
+{
+    if (!atomic_load_explicit(&mem_untracked, memory_order_relaxed))
+        atomic_store_explicit(&mem_untracked, 1, memory_order_relaxed);
+}
+
+static size_t block_size(void *ptr)
+{
+#if HAVE_ALIGNED_MALLOC
+    return ptr ? _aligned_msize(ptr, ALIGN, 0) : 0;
+#elif HAVE_MALLOC_USABLE_SIZE
+    return malloc_usable_size(ptr);
+#else
+    return 0;
+#endif
+}
+
+static void mem_account(size_t add, size_t sub)
+{
+    intptr_t now, peak;
+
+    if (add == sub)
+        return;
+    now  = atomic_fetch_add_explicit(&mem_allocated, (intptr_t)(add - sub),
+                                     memory_order_relaxed) + (intptr_t)(add - sub);
+    peak = atomic_load_explicit(&mem_peak, memory_order_relaxed);
+    while (now > peak &&
+           !atomic_compare_exchange_weak_explicit(&mem_peak, &peak, now,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+size_t av_mem_allocated(size_t *peak)
+{
+    /* blocks freed by av_free() but allocated elsewhere may drive it below 0 */
+    intptr_t now = atomic_load_explicit(&mem_allocated, memory_order_relaxed);
+    intptr_t high;
+
+    now = FFMAX(now, 0);
+    if (peak) {
+        high  = atomic_exchange_explicit(&mem_peak, now, memory_order_relaxed);
+        *peak = FFMAX(high, now);
+    }
+    return now;
+}
+
 void *av_malloc(size_t size)
 {
     void *ptr = NULL;
@@ -121,6 +194,12 @@ void *av_malloc(size_t size)
 #else
     ptr = malloc(size);
 #endif
+    if (ptr) {
+        if (mem_accounted())
+            mem_account(block_size(ptr), 0);
+        else
+            mem_untrack();
+    }
     if(!ptr && !size) {
         size = 1;
         ptr= av_malloc(1);
@@ -134,15 +213,28 @@ void *av_malloc(size_t size)
 
 void *av_realloc(void *ptr, size_t size)
 {
+    size_t old_size;
+    void *new_ptr;
+    int accounted;
+
     /* let's disallow possibly ambiguous cases */
     if (size > (max_alloc_size - 32))
         return NULL;
 
+    accounted = mem_accounted();
+    old_size  = accounted ? block_size(ptr) : 0;
 #if HAVE_ALIGNED_MALLOC
-    return _aligned_realloc(ptr, size + !size, ALIGN);
+    new_ptr = _aligned_realloc(ptr, size + !size, ALIGN);
 #else
-    return realloc(ptr, size + !size);
+    new_ptr = realloc(ptr, size + !size);
 #endif
+    if (new_ptr) {
+        if (accounted)
+            mem_account(block_size(new_ptr), old_size);
+        else
+            mem_untrack();
+    }
+    return new_ptr;
 }
 
 void *av_realloc_f(void *ptr, size_t nelem, size_t elsize)
@@ -217,6 +309,8 @@ int av_reallocp_array(void *ptr, size_t nmemb, size_t size)
 
 void av_free(void *ptr)
 {
+    if (mem_accounted())
+        mem_account(0, block_size(ptr));
 #if HAVE_ALIGNED_MALLOC
     _aligned_free(ptr);
 #else
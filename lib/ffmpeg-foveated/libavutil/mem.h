@@ -692,6 +692,33 @@ static inline int av_size_mult(size_t a, size_t b, size_t *r)
  */
 void av_max_alloc(size_t max);
 
+/**
+ * Enable counting the bytes held by blocks of libavutil's
+ * @ref lavu_mem_funcs "heap management functions", off by default.
+ *
+ * Counting costs every allocation an atomic update of a shared counter.
+ * Blocks carry no mark of whether they were counted, so counting has to
+ * start before the first allocation, before any other thread allocates,
+ * and cannot be stopped.
+ *
+ * @return 0 on success, AVERROR(EINVAL) if blocks were allocated before
+ */
+int av_mem_accounting(void);
+
+/**
+ * Get the number of bytes held by blocks of libavutil's @ref lavu_mem_funcs
+ * "heap management functions", e.g. to enforce a memory budget. Needs
+ * av_mem_accounting() enabled.
+ *
+ * Blocks are counted at the size the allocator reserved for them, which
+ * needs malloc_usable_size() or _aligned_msize().
+ *
+ * @param peak if not NULL, set to the highest number since the previous
+ *             call with a non-NULL peak, which starts over then
+ * @return bytes currently held, 0 if the allocator cannot measure blocks
+ */
+size_t av_mem_allocated(size_t *peak);
+
 /**
  * @}
  * @}
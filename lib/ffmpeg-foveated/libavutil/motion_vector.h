@@ -41,8 +41,7 @@ typedef struct AVMotionVector {
      */
     int16_t dst_x, dst_y;
     /**
-     * Extra flag information.
-     * Currently unused.
+     * Extra flag information, a combination of AV_MOTION_VECTOR_FLAG_*.
      */
     uint64_t flags;
     /**
@@ -54,4 +53,10 @@ typedef struct AVMotionVector {
     uint16_t motion_scale;
 } AVMotionVector;
 
+/**
+ * The macroblock is skipped: no residual, its vector is predicted from the
+ * neighbours and so need not be zero.
+ */
+#define AV_MOTION_VECTOR_FLAG_SKIP (1 << 0)
+
 #endif /* AVUTIL_MOTION_VECTOR_H */
@@ -0,0 +1,217 @@
+/*
+ * Exact power-of-two box downscaling of 8-bit planar formats
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Fast path for SWS_AREA scaling by exactly 2x, 4x or 8x, and the
+ * sws_downscale_pyramid() helper built on top of it.
+ *
+ * Every output pixel is the rounded mean of a k x k block of input pixels,
+ * which is what the generic area filter converges to at integer ratios but
+ * without the per-pixel filter taps, the intermediate 15-bit planes or the
+ * ring buffer.
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/pixdesc.h"
+#include "swscale.h"
+#include "swscale_internal.h"
+
+static av_always_inline void downscale_c(uint8_t *dst, const uint8_t *src,
+                                         ptrdiff_t stride, int w, int shift)
+{
+    const int k = 1 << shift;
+    int x, y, i;
+
+    for (x = 0; x < w; x++) {
+        const uint8_t *s = src + (x << shift);
+        unsigned sum = 0;
+
+        for (y = 0; y < k; y++, s += stride)
+            for (i = 0; i < k; i++)
+                sum += s[i];
+        dst[x] = (sum + (1 << (2 * shift - 1))) >> (2 * shift);
+    }
+}
+
+static void downscale2_c(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    downscale_c(dst, src, stride, w, 1);
+}
+
+static void downscale4_c(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    downscale_c(dst, src, stride, w, 2);
+}
+
+static void downscale8_c(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    downscale_c(dst, src, stride, w, 3);
+}
+
+av_cold void ff_sws_downscale_dsp_init(SwsDownscaleDSP *dsp)
+{
+    dsp->row[0] = downscale2_c;
+    dsp->row[1] = downscale4_c;
+    dsp->row[2] = downscale8_c;
+
+    if (ARCH_X86)
+        ff_sws_downscale_dsp_init_x86(dsp);
+}
+
+/* run the SIMD kernel on the aligned part of the row and C on the rest */
+static void downscale_row(const SwsDownscaleDSP *dsp, uint8_t *dst,
+                          const uint8_t *src, ptrdiff_t stride, int w, int shift)
+{
+    int n = w & ~31;
+
+    if (n)
+        dsp->row[shift - 1](dst, src, stride, n);
+    if (n < w)
+        downscale_c(dst + n, src + (n << shift), stride, w - n, shift);
+}
+
+static void downscale_plane(const SwsDownscaleDSP *dsp,
+                            uint8_t *dst, ptrdiff_t dst_stride,
+                            const uint8_t *src, ptrdiff_t src_stride,
+                            int w, int h, int shift)
+{
+    int y;
+
+    for (y = 0; y < h; y++)
+        downscale_row(dsp, dst + y * dst_stride,
+                      src + (y << shift) * src_stride, src_stride, w, shift);
+}
+
+static int is_planar8(enum AVPixelFormat format)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    int i;
+
+    if (!desc || desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+                                AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL |
+                                AV_PIX_FMT_FLAG_FLOAT | AV_PIX_FMT_FLAG_BAYER))
+        return 0;
+    if (desc->nb_components > 1 && !(desc->flags & AV_PIX_FMT_FLAG_PLANAR))
+        return 0;
+    for (i = 0; i < desc->nb_components; i++)
+        if (desc->comp[i].depth != 8 || desc->comp[i].step != 1 ||
+            desc->comp[i].plane != i)
+            return 0;
+    return 1;
+}
+
+static int downscale_wrapper(SwsContext *c, const uint8_t *src[], int srcStride[],
+                                     int srcSliceY, int srcSliceH,
+                             uint8_t *dst[], int dstStride[])
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(c->dstFormat);
+    int shift = c->downscale_shift;
+    int p;
+
+    /* slices would need row carry-over between calls, leave them to the
+     * generic scaler */
+    if (srcSliceY || srcSliceH != c->srcH)
+        return c->downscale_fallback(c, src, srcStride, srcSliceY, srcSliceH,
+                                     dst, dstStride);
+
+    for (p = 0; p < desc->nb_components; p++) {
+        int chroma = p == 1 || p == 2;
+
+        downscale_plane(&c->downscale_dsp, dst[p], dstStride[p],
+                        src[p], srcStride[p],
+                        chroma ? c->chrDstW : c->dstW,
+                        chroma ? c->chrDstH : c->dstH, shift);
+    }
+    return c->dstH;
+}
+
+int ff_sws_init_downscale(SwsContext *c)
+{
+    int shift;
+
+    if (!(c->flags & SWS_AREA) || c->srcFormat != c->dstFormat ||
+        !is_planar8(c->srcFormat) || c->srcRange != c->dstRange ||
+        c->src_h_chr_pos != c->dst_h_chr_pos ||
+        c->src_v_chr_pos != c->dst_v_chr_pos || c->gamma_flag)
+        return 0;
+
+    for (shift = 1; shift <= 3; shift++)
+        if (c->srcW == c->dstW << shift && c->srcH == c->dstH << shift)
+            break;
+    if (shift > 3 ||
+        c->chrSrcW != c->chrDstW << shift || c->chrSrcH != c->chrDstH << shift)
+        return 0;
+
+    ff_sws_downscale_dsp_init(&c->downscale_dsp);
+    c->downscale_shift    = shift;
+    c->downscale_fallback = c->swscale;
+    c->swscale            = downscale_wrapper;
+    return 1;
+}
+
+int sws_downscale_pyramid(const uint8_t *const src[], const int src_stride[],
+                          int w, int h, enum AVPixelFormat format, int levels,
+                          uint8_t *const dst[][4], const int dst_stride[][4])
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    SwsDownscaleDSP dsp;
+    int p, l, y;
+
+    if (!is_planar8(format) || levels < 1 || levels > 8)
+        return AVERROR(EINVAL);
+    /* every level, chroma included, has to halve exactly */
+    if (w & ((1 << (levels + desc->log2_chroma_w)) - 1) ||
+        h & ((1 << (levels + desc->log2_chroma_h)) - 1))
+        return AVERROR(EINVAL);
+
+    ff_sws_downscale_dsp_init(&dsp);
+
+    for (p = 0; p < desc->nb_components; p++) {
+        int chroma = p == 1 || p == 2;
+        int pw = chroma ? w >> desc->log2_chroma_w : w;
+        int ph = chroma ? h >> desc->log2_chroma_h : h;
+
+        /* Walk the source in strips of 2^levels rows, producing every level
+         * of the strip before moving on, so each level reads rows of the
+         * previous one while they are still in cache. */
+        for (y = 0; y < ph >> levels; y++) {
+            const uint8_t *s = src[p] + (ptrdiff_t)(y << levels) * src_stride[p];
+            ptrdiff_t ss = src_stride[p];
+
+            for (l = 0; l < levels; l++) {
+                int rows = 1 << (levels - l - 1);
+                uint8_t *d = dst[l][p] + (ptrdiff_t)y * rows * dst_stride[l][p];
+                ptrdiff_t ds = dst_stride[l][p];
+                int i;
+
+                for (i = 0; i < rows; i++)
+                    downscale_row(&dsp, d + i * ds, s + 2 * i * ss, ss,
+                                  pw >> (l + 1), 1);
+                s  = d;
+                ss = ds;
+            }
+        }
+    }
+    return 0;
+}
@@ -321,6 +321,30 @@ void sws_convertPalette8ToPacked32(const uint8_t *src, uint8_t *dst, int num_pix
  */
 void sws_convertPalette8ToPacked24(const uint8_t *src, uint8_t *dst, int num_pixels, const uint8_t *palette);
 
+/**
+ * Build a mip pyramid of an 8-bit planar image in one pass over the source.
+ *
+ * Level l is 2^(l+1) times smaller than the source in both directions and
+ * is the rounded 2x2 box average of level l-1 (of the source for l = 0).
+ * Levels are produced strip by strip, so the source is read only once and
+ * each level reads back rows of the previous one while they are in cache.
+ *
+ * @param src        source planes
+ * @param src_stride source line sizes
+ * @param w          source width, must be a multiple of 2^levels times the
+ *                   horizontal chroma subsampling factor
+ * @param h          source height, same constraint with the vertical factor
+ * @param format     an 8-bit planar YUV, YUVA or gray format
+ * @param levels     number of levels to produce, 1 to 8
+ * @param dst        planes of each level
+ * @param dst_stride line sizes of each level
+ * @return 0 on success, AVERROR(EINVAL) if format or dimensions are not
+ *         supported
+ */
+int sws_downscale_pyramid(const uint8_t *const src[], const int src_stride[],
+                          int w, int h, enum AVPixelFormat format, int levels,
+                          uint8_t *const dst[][4], const int dst_stride[][4]);
+
 /**
  * Get the AVClass for swsContext. It can be used in combination with
  * AV_OPT_SEARCH_FAKE_OBJ for examining options.
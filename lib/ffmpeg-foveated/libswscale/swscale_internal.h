@@ -277,6 +277,14 @@ struct SwsSlice;
 struct SwsFilterDescriptor;
 
 /* This struct should be aligned on at least a 32-byte boundary. */
+typedef struct SwsDownscaleDSP {
+    /**
+     * Average the k x k blocks of the k rows at src into one row of w
+     * pixels, k = 2 << index. w is a multiple of 32.
+     */
+    void (*row[3])(uint8_t *dst, const uint8_t *src, ptrdiff_t src_stride, int w);
+} SwsDownscaleDSP;
+
 typedef struct SwsContext {
     /**
      * info on struct for av_log
@@ -625,6 +633,11 @@ typedef struct SwsContext {
     SwsDither dither;
 
     SwsAlphaBlend alphablend;
+
+    /// Exact 2x/4x/8x area downscale, see ff_sws_init_downscale().
+    SwsDownscaleDSP downscale_dsp;
+    int downscale_shift;
+    SwsFunc downscale_fallback;   ///< generic path, used for partial slices
 } SwsContext;
 //FIXME check init (where 0)
 
@@ -858,6 +871,18 @@ void ff_get_unscaled_swscale_aarch64(SwsContext *c);
  */
 SwsFunc ff_getSwsFunc(SwsContext *c);
 
+void ff_sws_downscale_dsp_init(SwsDownscaleDSP *dsp);
+void ff_sws_downscale_dsp_init_x86(SwsDownscaleDSP *dsp);
+
+/**
+ * Wrap c->swscale in a box-filter fast path if the context is an SWS_AREA
+ * downscale of an 8-bit planar format by exactly 2, 4 or 8 in both
+ * directions.
+ *
+ * @return 1 if the fast path was installed, 0 otherwise
+ */
+int ff_sws_init_downscale(SwsContext *c);
+
 void ff_sws_init_input_funcs(SwsContext *c);
 void ff_sws_init_output_funcs(SwsContext *c,
                               yuv2planar1_fn *yuv2plane1,
@@ -1829,6 +1829,11 @@ av_cold int sws_init_context(SwsContext *c, SwsFilter *srcFilter,
     }
 
     c->swscale = ff_getSwsFunc(c);
+
+    if (ff_sws_init_downscale(c) && (flags & SWS_PRINT_INFO))
+        av_log(c, AV_LOG_INFO, "using exact %dx area downscale of %s\n",
+               1 << c->downscale_shift, av_get_pix_fmt_name(srcFormat));
+
     return ff_init_filters(c);
 fail: // FIXME replace things by appropriate error codes
     if (ret == RETCODE_USE_CASCADE)  {
@@ -0,0 +1,221 @@
+/*
+ * AVX2 kernels for exact power-of-two box downscaling
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+#include "libavutil/attributes.h"
+#include "libavutil/cpu.h"
+#include "libavutil/mem.h"
+#include "libavutil/x86/asm.h"
+#include "libavutil/x86/cpu.h"
+#include "libswscale/swscale_internal.h"
+
+#if HAVE_AVX2_INLINE
+
+/* 4x4 byte transpose within each 16-byte lane */
+DECLARE_ASM_ALIGNED(32, static const uint8_t, transpose4x4)[32] = {
+    0, 4,  8, 12, 1, 5,  9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+    0, 4,  8, 12, 1, 5,  9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+};
+
+/*
+ * 32 outputs per iteration: pmaddubsw against 1s sums horizontal pairs of
+ * each row, the two rows are added, rounded and packed, and vpermq undoes
+ * the lane interleave of vpackuswb.
+ */
+static void downscale2_avx2(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    x86_reg n = w;
+
+    __asm__ volatile(
+        "vpcmpeqb   %%ymm6, %%ymm6, %%ymm6      \n\t"
+        "vpabsb     %%ymm6, %%ymm6              \n\t" // bytes 1
+        "vpmaddubsw %%ymm6, %%ymm6, %%ymm7      \n\t" // words 2
+        "1:                                     \n\t"
+        "vmovdqu      (%1),     %%ymm0          \n\t"
+        "vmovdqu    32(%1),     %%ymm1          \n\t"
+        "vmovdqu      (%1, %3), %%ymm2          \n\t"
+        "vmovdqu    32(%1, %3), %%ymm3          \n\t"
+        "vpmaddubsw %%ymm6, %%ymm0, %%ymm0      \n\t"
+        "vpmaddubsw %%ymm6, %%ymm1, %%ymm1      \n\t"
+        "vpmaddubsw %%ymm6, %%ymm2, %%ymm2      \n\t"
+        "vpmaddubsw %%ymm6, %%ymm3, %%ymm3      \n\t"
+        "vpaddw     %%ymm2, %%ymm0, %%ymm0      \n\t"
+        "vpaddw     %%ymm3, %%ymm1, %%ymm1      \n\t"
+        "vpaddw     %%ymm7, %%ymm0, %%ymm0      \n\t"
+        "vpaddw     %%ymm7, %%ymm1, %%ymm1      \n\t"
+        "vpsrlw     $2, %%ymm0, %%ymm0          \n\t"
+        "vpsrlw     $2, %%ymm1, %%ymm1          \n\t"
+        "vpackuswb  %%ymm1, %%ymm0, %%ymm0      \n\t"
+        "vpermq     $0xd8, %%ymm0, %%ymm0       \n\t"
+        "vmovdqu    %%ymm0, (%0)                \n\t"
+        "add        $64, %1                     \n\t"
+        "add        $32, %0                     \n\t"
+        "sub        $32, %2                     \n\t"
+        "jg         1b                          \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(dst), "+r"(src), "+r"(n)
+        : "r"((x86_reg)stride)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3",
+                       "%xmm6", "%xmm7",)
+          "memory", "cc"
+    );
+}
+
+#define ROW4(off, acc, addr)                                            \
+        "vmovdqu    "#off"("addr"), %%ymm4                  \n\t"       \
+        "vpmaddubsw %%ymm5, %%ymm4, %%ymm4                  \n\t"       \
+        "vpaddw     %%ymm4, "acc", "acc"                    \n\t"
+
+#define COL4(off, acc)                                                  \
+        "vmovdqu    "#off"(%1), "acc"                       \n\t"       \
+        "vpmaddubsw %%ymm5, "acc", "acc"                    \n\t"       \
+        ROW4(off, acc, "%1, %3")                                        \
+        ROW4(off, acc, "%1, %3, 2")                                     \
+        ROW4(off, acc, "%1, %4")                                        \
+        "vpmaddwd   %%ymm6, "acc", "acc"                    \n\t"       \
+        "vpaddd     %%ymm7, "acc", "acc"                    \n\t"       \
+        "vpsrld     $4, "acc", "acc"                        \n\t"
+
+/*
+ * 32 outputs per iteration from four 32-byte columns. Each column yields
+ * eight rounded sums in dwords; they are merged into one register a byte
+ * per column, transposed within the lanes and interleaved across them.
+ */
+static void downscale4_avx2(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    x86_reg n = w;
+
+    __asm__ volatile(
+        "vpcmpeqb   %%ymm7, %%ymm7, %%ymm7      \n\t"
+        "vpabsb     %%ymm7, %%ymm5              \n\t" // bytes 1
+        "vpsrlw     $15, %%ymm7, %%ymm6         \n\t" // words 1
+        "vpsrld     $31, %%ymm7, %%ymm7         \n\t"
+        "vpslld     $3, %%ymm7, %%ymm7          \n\t" // dwords 8
+        "1:                                     \n\t"
+        COL4(0,  "%%ymm0")
+        COL4(32, "%%ymm1")
+        COL4(64, "%%ymm2")
+        COL4(96, "%%ymm3")
+        "vpslld     $8,  %%ymm1, %%ymm1         \n\t"
+        "vpslld     $16, %%ymm2, %%ymm2         \n\t"
+        "vpslld     $24, %%ymm3, %%ymm3         \n\t"
+        "vpor       %%ymm1, %%ymm0, %%ymm0      \n\t"
+        "vpor       %%ymm3, %%ymm2, %%ymm2      \n\t"
+        "vpor       %%ymm2, %%ymm0, %%ymm0      \n\t"
+        "vpshufb    %5, %%ymm0, %%ymm0          \n\t"
+        "vextracti128 $1, %%ymm0, %%xmm1        \n\t"
+        "vpunpckldq %%xmm1, %%xmm0, %%xmm2      \n\t"
+        "vpunpckhdq %%xmm1, %%xmm0, %%xmm3      \n\t"
+        "vmovdqu    %%xmm2,   (%0)              \n\t"
+        "vmovdqu    %%xmm3, 16(%0)              \n\t"
+        "add        $128, %1                    \n\t"
+        "add        $32, %0                     \n\t"
+        "sub        $32, %2                     \n\t"
+        "jg         1b                          \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(dst), "+r"(src), "+r"(n)
+        : "r"((x86_reg)stride), "r"((x86_reg)stride * 3), "m"(*transpose4x4)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3",
+                       "%xmm4", "%xmm5", "%xmm6", "%xmm7",)
+          "memory", "cc"
+    );
+}
+
+#if ARCH_X86_64
+#define ROW8(off, acc, addr)                                            \
+        "vmovdqu    "#off"("addr"), %%ymm4                  \n\t"       \
+        "vpsadbw    %%ymm5, %%ymm4, %%ymm4                  \n\t"       \
+        "vpaddq     %%ymm4, "acc", "acc"                    \n\t"
+
+#define COL8(off, acc)                                                  \
+        "vmovdqu    "#off"(%1), "acc"                       \n\t"       \
+        "vpsadbw    %%ymm5, "acc", "acc"                    \n\t"       \
+        ROW8(off, acc, "%1, %4")                                        \
+        ROW8(off, acc, "%1, %4, 2")                                     \
+        ROW8(off, acc, "%1, %5")                                        \
+        ROW8(off, acc, "%3")                                            \
+        ROW8(off, acc, "%3, %4")                                        \
+        ROW8(off, acc, "%3, %4, 2")                                     \
+        ROW8(off, acc, "%3, %5")                                        \
+        "vpaddq     %%ymm7, "acc", "acc"                    \n\t"       \
+        "vpsrlq     $6, "acc", "acc"                        \n\t"
+
+/*
+ * 16 outputs per iteration: psadbw against zero sums eight pixels of a row
+ * into a qword, so each 32-byte column gives four outputs in order. The
+ * four columns are merged a word per column, packed to bytes and
+ * transposed back into order.
+ */
+static void downscale8_avx2(uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w)
+{
+    const uint8_t *src4 = src + 4 * stride;
+    x86_reg n = w;
+
+    __asm__ volatile(
+        "vpxor      %%ymm5, %%ymm5, %%ymm5      \n\t"
+        "vpcmpeqb   %%ymm7, %%ymm7, %%ymm7      \n\t"
+        "vpsrlq     $63, %%ymm7, %%ymm7         \n\t"
+        "vpsllq     $5, %%ymm7, %%ymm7          \n\t" // qwords 32
+        "1:                                     \n\t"
+        COL8(0,  "%%ymm0")
+        COL8(32, "%%ymm1")
+        COL8(64, "%%ymm2")
+        COL8(96, "%%ymm3")
+        "vpsllq     $16, %%ymm1, %%ymm1         \n\t"
+        "vpsllq     $32, %%ymm2, %%ymm2         \n\t"
+        "vpsllq     $48, %%ymm3, %%ymm3         \n\t"
+        "vpor       %%ymm1, %%ymm0, %%ymm0      \n\t"
+        "vpor       %%ymm3, %%ymm2, %%ymm2      \n\t"
+        "vpor       %%ymm2, %%ymm0, %%ymm0      \n\t"
+        "vpackuswb  %%ymm0, %%ymm0, %%ymm0      \n\t"
+        "vpermq     $0x08, %%ymm0, %%ymm0       \n\t"
+        "vpshufb    %6, %%xmm0, %%xmm0          \n\t"
+        "vmovdqu    %%xmm0, (%0)                \n\t"
+        "add        $128, %1                    \n\t"
+        "add        $128, %3                    \n\t"
+        "add        $16, %0                     \n\t"
+        "sub        $16, %2                     \n\t"
+        "jg         1b                          \n\t"
+        "vzeroupper                             \n\t"
+        : "+r"(dst), "+r"(src), "+r"(n), "+r"(src4)
+        : "r"((x86_reg)stride), "r"((x86_reg)stride * 3), "m"(*transpose4x4)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3",
+                       "%xmm4", "%xmm5", "%xmm7",)
+          "memory", "cc"
+    );
+}
+#endif /* ARCH_X86_64 */
+
+#endif /* HAVE_AVX2_INLINE */
+
+av_cold void ff_sws_downscale_dsp_init_x86(SwsDownscaleDSP *dsp)
+{
+#if HAVE_AVX2_INLINE
+    int cpu_flags = av_get_cpu_flags();
+
+    if (INLINE_AVX2(cpu_flags)) {
+        dsp->row[0] = downscale2_avx2;
+        dsp->row[1] = downscale4_avx2;
+#if ARCH_X86_64
+        dsp->row[2] = downscale8_avx2;
+#endif
+    }
+#endif
+}
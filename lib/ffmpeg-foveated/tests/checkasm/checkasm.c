@@ -168,6 +168,9 @@ static const struct {
     #if CONFIG_EQ_FILTER
         { "vf_eq", checkasm_check_vf_eq },
     #endif
+    #if CONFIG_FOVDEBLOCK_FILTER
+        { "vf_fovdeblock", checkasm_check_vf_fovdeblock },
+    #endif
     #if CONFIG_GBLUR_FILTER
         { "vf_gblur", checkasm_check_vf_gblur },
     #endif
@@ -182,6 +185,7 @@ static const struct {
     #endif
 #endif
 #if CONFIG_SWSCALE
+    { "sw_downscale", checkasm_check_sw_downscale },
     { "sw_rgb", checkasm_check_sw_rgb },
 #endif
 #if CONFIG_AVUTIL
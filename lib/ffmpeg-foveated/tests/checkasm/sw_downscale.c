@@ -0,0 +1,79 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/mem.h"
+
+#include "libswscale/swscale_internal.h"
+
+#include "checkasm.h"
+
+#define randomize_buffers(buf, size)      \
+    do {                                  \
+        int j;                            \
+        for (j = 0; j < size; j+=4)       \
+            AV_WN32(buf + j, rnd());      \
+    } while (0)
+
+#define MAX_WIDTH  256
+#define SRC_STRIDE (8 * MAX_WIDTH + 32)
+#define SRC_SIZE   (SRC_STRIDE * 8)
+
+static const int width[] = {32, 64, 96, 256};
+
+void checkasm_check_sw_downscale(void)
+{
+    LOCAL_ALIGNED_32(uint8_t, src, [SRC_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst0, [MAX_WIDTH]);
+    LOCAL_ALIGNED_32(uint8_t, dst1, [MAX_WIDTH]);
+    SwsDownscaleDSP dsp;
+    int shift, i;
+
+    declare_func(void, uint8_t *dst, const uint8_t *src, ptrdiff_t stride, int w);
+
+    ff_sws_downscale_dsp_init(&dsp);
+
+    for (shift = 1; shift <= 3; shift++) {
+        if (check_func(dsp.row[shift - 1], "downscale%d", 1 << shift)) {
+            for (i = 0; i < FF_ARRAY_ELEMS(width); i++) {
+                /* saturated rows catch overflow in the intermediate sums */
+                if (i == 1)
+                    memset(src, 0xff, SRC_SIZE);
+                else
+                    randomize_buffers(src, SRC_SIZE);
+                memset(dst0, 0, MAX_WIDTH);
+                memset(dst1, 0, MAX_WIDTH);
+                call_ref(dst0, src, SRC_STRIDE, width[i]);
+                call_new(dst1, src, SRC_STRIDE, width[i]);
+                if (memcmp(dst0, dst1, MAX_WIDTH))
+                    fail();
+
+                /* bottom-up image */
+                call_ref(dst0, src + SRC_STRIDE * ((1 << shift) - 1), -SRC_STRIDE, width[i]);
+                call_new(dst1, src + SRC_STRIDE * ((1 << shift) - 1), -SRC_STRIDE, width[i]);
+                if (memcmp(dst0, dst1, MAX_WIDTH))
+                    fail();
+            }
+            bench_new(dst1, src, SRC_STRIDE, MAX_WIDTH);
+        }
+        report("downscale%d", 1 << shift);
+    }
+}
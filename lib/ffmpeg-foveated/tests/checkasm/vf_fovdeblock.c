@@ -0,0 +1,121 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+
+#include "libavfilter/fovdeblock.h"
+
+#include "checkasm.h"
+
+#define MAX_WIDTH  256
+#define STRIDE     (MAX_WIDTH + 32)
+#define BUF_SIZE   (STRIDE * 16)
+#define MAX_EDGES  (MAX_WIDTH / 8)
+
+static const int width[] = { 8, 16, 24, 64, 240, 256 };
+
+/*
+ * 8x8 blocks of a flat level near black, mid grey or white plus a little
+ * noise, so that the edges between them both pass and fail the thresholds
+ * and the filter both clips and does not.
+ */
+static void randomize_blocks(uint8_t *buf)
+{
+    static const int level[] = { 5, 128, 250 };
+    int x, y, bx, by;
+
+    for (by = 0; by < 2; by++) {
+        for (bx = 0; bx < STRIDE / 8; bx++) {
+            int base = level[rnd() % 3] + rnd() % 17 - 8;
+
+            for (y = 0; y < 8; y++)
+                for (x = 0; x < 8; x++)
+                    buf[(8 * by + y) * STRIDE + 8 * bx + x] =
+                        av_clip_uint8(base + rnd() % 5 - 2);
+        }
+    }
+}
+
+static void randomize_thresholds(int16_t *th, const int16_t **ptr)
+{
+    int i, j, k;
+
+    for (i = 0; i < MAX_EDGES; i++) {
+        for (j = 0; j < 4; j++) {
+            int t = rnd() % (j ? 32 : 256);
+
+            for (k = 0; k < 8; k++)
+                th[32 * i + 8 * j + k] = t;
+        }
+        ptr[i] = rnd() % 4 ? th + 32 * i : NULL;
+    }
+}
+
+void checkasm_check_vf_fovdeblock(void)
+{
+    static const char *const type[] = { "weak", "strong" };
+    LOCAL_ALIGNED_32(uint8_t, src,  [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst0, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(uint8_t, dst1, [BUF_SIZE]);
+    LOCAL_ALIGNED_32(int16_t, th, [MAX_EDGES * 32]);
+    const int16_t *ptr[MAX_EDGES];
+    FovDeblockDSPContext dsp;
+    int filter, i;
+
+    declare_func(void, uint8_t *dst, ptrdiff_t linesize, int width,
+                 const int16_t *const *th);
+
+    ff_fovdeblock_dsp_init(&dsp);
+
+    for (filter = 0; filter < 2; filter++) {
+        if (check_func(dsp.edgeh[filter], "fovdeblock_edgeh_%s", type[filter])) {
+            for (i = 0; i < FF_ARRAY_ELEMS(width); i++) {
+                randomize_blocks(src);
+                randomize_thresholds(th, ptr);
+                memcpy(dst0, src, BUF_SIZE);
+                memcpy(dst1, src, BUF_SIZE);
+                call_ref(dst0 + 8 * STRIDE + 8, STRIDE, width[i], ptr);
+                call_new(dst1 + 8 * STRIDE + 8, STRIDE, width[i], ptr);
+                if (memcmp(dst0, dst1, BUF_SIZE))
+                    fail();
+            }
+            bench_new(dst1 + 8 * STRIDE + 8, STRIDE, MAX_WIDTH, ptr);
+        }
+        report("fovdeblock_edgeh_%s", type[filter]);
+
+        if (check_func(dsp.edgev[filter], "fovdeblock_edgev_%s", type[filter])) {
+            for (i = 0; i < FF_ARRAY_ELEMS(width); i++) {
+                if (width[i] % 16)
+                    continue;
+                randomize_blocks(src);
+                randomize_thresholds(th, ptr);
+                memcpy(dst0, src, BUF_SIZE);
+                memcpy(dst1, src, BUF_SIZE);
+                call_ref(dst0 + 8, STRIDE, width[i], ptr);
+                call_new(dst1 + 8, STRIDE, width[i], ptr);
+                if (memcmp(dst0, dst1, BUF_SIZE))
+                    fail();
+            }
+            bench_new(dst1 + 8, STRIDE, MAX_WIDTH, ptr);
+        }
+        report("fovdeblock_edgev_%s", type[filter]);
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ * Contention of AVBufferPool under many threads
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Threads sharing one pool each keep a few buffers in flight and cycle
+ * them, the way frame threads, encoder threads and filter slices do, e.g.
+ *
+ *     buffer_pool_bench -t 8 -n 1000000 -k 4
+ *
+ * Every buffer is stamped by its owner and checked before it is returned,
+ * so a buffer handed out twice is reported. Times are wall clock per
+ * get+unref pair over all threads, for 1, 2, 4, ... up to the given number
+ * of threads.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/time.h"
+
+#define MAX_INFLIGHT 64
+
+typedef struct Worker {
+    pthread_t thread;
+    AVBufferPool *pool;
+    int id, iterations, inflight;
+    int64_t errors;
+} Worker;
+
+static void *worker(void *arg)
+{
+    Worker *w = arg;
+    AVBufferRef *bufs[MAX_INFLIGHT] = { NULL };
+    int i;
+
+    for (i = 0; i < w->iterations; i++) {
+        int slot = i % w->inflight;
+
+        if (bufs[slot]) {
+            if (AV_RN32(bufs[slot]->data) != w->id ||
+                AV_RN32(bufs[slot]->data + 4) != i - w->inflight)
+                w->errors++;
+            av_buffer_unref(&bufs[slot]);
+        }
+        if (!(bufs[slot] = av_buffer_pool_get(w->pool))) {
+            w->errors++;
+            break;
+        }
+        AV_WN32(bufs[slot]->data,     w->id);
+        AV_WN32(bufs[slot]->data + 4, i);
+    }
+    for (i = 0; i < w->inflight; i++)
+        av_buffer_unref(&bufs[i]);
+    return NULL;
+}
+
+static int run(int threads, int iterations, int inflight)
+{
+    Worker w[64];
+    AVBufferPool *pool = av_buffer_pool_init(64, NULL);
+    int64_t t, errors = 0;
+    int i;
+
+    if (!pool)
+        return AVERROR(ENOMEM);
+    t = av_gettime_relative();
+    for (i = 0; i < threads; i++) {
+        w[i] = (Worker){ .pool = pool, .id = i, .iterations = iterations,
+                         .inflight = inflight };
+        if (pthread_create(&w[i].thread, NULL, worker, &w[i])) {
+            threads = i;
+            break;
+        }
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(w[i].thread, NULL);
+        errors += w[i].errors;
+    }
+    t = av_gettime_relative() - t;
+    av_buffer_pool_uninit(&pool);
+
+    printf("%2d threads %7.1f ns/op, %"PRId64" errors\n",
+           threads, t * 1000.0 / ((int64_t)iterations * threads), errors);
+    return errors ? AVERROR_BUG : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 8, iterations = 1000000, inflight = 4;
+    int i, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            inflight = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "%s [-t max_threads] [-n iterations] [-k buffers_per_thread]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1 || threads > 64 || iterations < 1 ||
+        inflight < 1 || inflight > MAX_INFLIGHT) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    for (i = 1; i <= threads && ret >= 0; i *= 2)
+        ret = run(i, iterations, inflight);
+    return ret < 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * Bitrate saved by chroma foveation
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Encode a panning synthetic texture with colored detail and a fixed
+ * fixation point, decode it again and compare against the source, e.g.
+ *
+ *     fov_chroma_bench -e mpeg4 -n 150 -q 4 -d 12 -g 0.15 -c 0.5
+ *
+ * Four runs: luma foveation only, the chroma falloff in the descriptor,
+ * which the encoder applies as far as its syntax allows, the fovchroma
+ * pre-filter only and both. The quality setting is the CRF of libx264 and
+ * libx265 and the fixed quantizer of the other encoders, so luma is coded
+ * the same in all runs. Reported are the bitrate, the time per frame of the
+ * pre-filter and the PSNR of luma and chroma in fovea and periphery.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavcodec/avcodec.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#define FPS        30
+#define BLOCK      16
+
+enum { FOVEA, PERIPHERY };
+
+typedef struct Bench {
+    const char *encoder;
+    int nb_frames, width, height;
+    float quality, delta, sigma, radius, falloff;
+
+    int mb_w, mb_h;
+    uint8_t *texture[3];
+    int tex_w[3], tex_h[3];
+
+    /* per run */
+    int64_t bytes, filter_time;
+    int decoded;
+    double sse[3][2];
+    int64_t px[3][2];
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-e encoder] [-n frames] [-s WxH] [-q quality] [-d delta_qp] "
+            "[-g sigma] [-r fovea_radius] [-c chroma_falloff]\n", argv0);
+    return ret;
+}
+
+/* sinusoids for structure, noise for detail that costs bits, chroma at
+ * half resolution with its own pattern */
+static int make_texture(Bench *b)
+{
+    AVLFG lfg;
+    int p, x, y;
+
+    av_lfg_init(&lfg, 0x1234);
+    for (p = 0; p < 3; p++) {
+        const int s = !!p;
+
+        b->tex_w[p]   = (b->width + b->nb_frames + 1) >> s;
+        b->tex_h[p]   = (b->height + b->nb_frames / 2 + 1) >> s;
+        b->texture[p] = av_malloc((size_t)b->tex_w[p] * b->tex_h[p]);
+        if (!b->texture[p])
+            return AVERROR(ENOMEM);
+        for (y = 0; y < b->tex_h[p]; y++)
+            for (x = 0; x < b->tex_w[p]; x++)
+                b->texture[p][y * b->tex_w[p] + x] = p ?
+                    av_clip_uint8(128 + 40 * sin((x << s) * (0.017 + 0.01 * p)) *
+                                  cos((y << s) * 0.029) +
+                                  20 * sin((x + (3 - p) * y) * 0.23) +
+                                  (int)(av_lfg_get(&lfg) % 17) - 8) :
+                    av_clip_uint8(128 + 50 * sin(x * 0.031) * cos(y * 0.023) +
+                                  30 * sin((x + 2 * y) * 0.11) +
+                                  (int)(av_lfg_get(&lfg) % 21) - 10);
+    }
+    return 0;
+}
+
+/* one pixel right and half a pixel down per frame */
+static const uint8_t *source_row(Bench *b, int p, int n, int y)
+{
+    return b->texture[p] + (size_t)(y + (n / 2 >> !!p)) * b->tex_w[p] + (n >> !!p);
+}
+
+static void measure(Bench *b, const AVFrame *frame)
+{
+    int n = frame->pts, p, bx, by, x, y;
+    float diag = b->sigma * sqrtf(b->mb_w * b->mb_w + b->mb_h * b->mb_h);
+
+    if (n < 0 || n >= b->nb_frames)
+        return;
+    b->decoded++;
+    for (p = 0; p < 3; p++) {
+        const int s = !!p, size = BLOCK >> s;
+        const int pw = b->width >> s, ph = b->height >> s;
+
+        for (by = 0; by < b->mb_h; by++) {
+            for (bx = 0; bx < b->mb_w; bx++) {
+                int w = FFMIN(size, pw - bx * size);
+                int h = FFMIN(size, ph - by * size);
+                float dx = bx + 0.5f - 0.5f * b->mb_w, dy = by + 0.5f - 0.5f * b->mb_h;
+                int r = dx * dx + dy * dy > b->radius * b->radius * diag * diag;
+                int64_t sse = 0;
+
+                for (y = 0; y < h; y++) {
+                    const uint8_t *src = source_row(b, p, n, by * size + y) + bx * size;
+                    const uint8_t *dec = frame->data[p] + (by * size + y) * frame->linesize[p] +
+                                         bx * size;
+                    for (x = 0; x < w; x++)
+                        sse += (src[x] - dec[x]) * (src[x] - dec[x]);
+                }
+                b->sse[p][r] += sse;
+                b->px[p][r]  += w * h;
+            }
+        }
+    }
+}
+
+static int decode(Bench *b, AVCodecContext *dec, AVFrame *frame, const AVPacket *pkt)
+{
+    int ret = avcodec_send_packet(dec, pkt);
+
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(dec, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            break;
+        measure(b, frame);
+        av_frame_unref(frame);
+    }
+    return ret;
+}
+
+static int encode(Bench *b, AVCodecContext *enc, AVCodecContext *dec,
+                  AVFrame *out, const AVFrame *in)
+{
+    AVPacket pkt;
+    int ret = avcodec_send_frame(enc, in);
+
+    av_init_packet(&pkt);
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(enc, &pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+        if (ret < 0)
+            return ret;
+        b->bytes += pkt.size;
+        ret = decode(b, dec, out, &pkt);
+        av_packet_unref(&pkt);
+    }
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static int init_filter(Bench *b, AVFilterGraph **graph,
+                       AVFilterContext **src, AVFilterContext **sink)
+{
+    AVFilterContext *flt;
+    char args[128];
+    int ret;
+
+    if (!(*graph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=1/%d:pixel_aspect=1/1",
+             b->width, b->height, AV_PIX_FMT_YUV420P, FPS);
+    if ((ret = avfilter_graph_create_filter(src, avfilter_get_by_name("buffer"),
+                                            "in", args, NULL, *graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(sink, avfilter_get_by_name("buffersink"),
+                                            "out", NULL, NULL, *graph)) < 0)
+        return ret;
+    snprintf(args, sizeof(args), "falloff=%f", b->falloff);
+    if ((ret = avfilter_graph_create_filter(&flt, avfilter_get_by_name("fovchroma"),
+                                            "fovchroma", args, NULL, *graph)) < 0 ||
+        (ret = avfilter_link(*src, 0, flt, 0)) < 0 ||
+        (ret = avfilter_link(flt, 0, *sink, 0)) < 0)
+        return ret;
+    return avfilter_graph_config(*graph, NULL);
+}
+
+static double psnr(double sse, int64_t px)
+{
+    return px ? 10 * log10(255.0 * 255.0 * px / FFMAX(sse, 1)) : 0;
+}
+
+static int run(Bench *b, const char *name, int descr_chroma, int prefilter)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(b->encoder);
+    AVCodecContext *enc = NULL, *dec = NULL;
+    AVFilterGraph *graph = NULL;
+    AVFilterContext *src = NULL, *sink = NULL;
+    AVFrame *in = NULL, *out = NULL, *filtered = NULL;
+    AVDictionary *opts = NULL;
+    char arg[32];
+    int i, p, y, ret;
+
+    if (!codec) {
+        fprintf(stderr, "Encoder %s not found\n", b->encoder);
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    b->bytes = b->filter_time = b->decoded = 0;
+    memset(b->sse, 0, sizeof(b->sse));
+    memset(b->px, 0, sizeof(b->px));
+
+    enc      = avcodec_alloc_context3(codec);
+    in       = av_frame_alloc();
+    out      = av_frame_alloc();
+    filtered = av_frame_alloc();
+    if (!enc || !in || !out || !filtered) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    enc->width     = b->width;
+    enc->height    = b->height;
+    enc->pix_fmt   = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, FPS };
+    enc->gop_size  = 10 * FPS;
+    if (!strcmp(b->encoder, "libx264") || !strcmp(b->encoder, "libx265")) {
+        av_dict_set(&opts, "preset", "ultrafast", 0);
+        av_dict_set(&opts, "tune", "zerolatency", 0);
+        snprintf(arg, sizeof(arg), "%f", b->quality);
+        av_dict_set(&opts, "crf", arg, 0);
+    } else {
+        enc->flags         |= AV_CODEC_FLAG_QSCALE;
+        enc->global_quality = b->quality * FF_QP2LAMBDA;
+        av_dict_set(&opts, "fovea", "1", 0);
+    }
+    if ((ret = avcodec_open2(enc, codec, &opts)) < 0)
+        goto end;
+
+    dec = avcodec_alloc_context3(avcodec_find_decoder(enc->codec_id));
+    if (!dec) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avcodec_open2(dec, dec->codec, NULL)) < 0)
+        goto end;
+    if (prefilter && (ret = init_filter(b, &graph, &src, &sink)) < 0)
+        goto end;
+
+    for (i = 0; i < b->nb_frames; i++) {
+        AVFrameSideData *sd;
+        int64_t t;
+        float *d;
+
+        in->width  = b->width;
+        in->height = b->height;
+        in->format = AV_PIX_FMT_YUV420P;
+        if ((ret = av_frame_get_buffer(in, 32)) < 0)
+            goto end;
+        for (p = 0; p < 3; p++)
+            for (y = 0; y < b->height >> !!p; y++)
+                memcpy(in->data[p] + y * in->linesize[p], source_row(b, p, i, y),
+                       b->width >> !!p);
+        in->pts     = i;
+        in->quality = enc->global_quality;
+        sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+                                    (descr_chroma ? 6 : 4) * sizeof(*d));
+        if (!sd) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        d = (float *)sd->data;
+        d[0] = 0.5;
+        d[1] = 0.5;
+        d[2] = b->sigma;
+        d[3] = b->delta;
+        if (descr_chroma) {
+            d[4] = 0;
+            d[5] = b->falloff;
+        }
+
+        if (prefilter) {
+            t = av_gettime_relative();
+            if ((ret = av_buffersrc_add_frame(src, in)) < 0 ||
+                (ret = av_buffersink_get_frame(sink, filtered)) < 0)
+                goto end;
+            b->filter_time += av_gettime_relative() - t;
+            filtered->quality = enc->global_quality;
+            ret = encode(b, enc, dec, out, filtered);
+            av_frame_unref(filtered);
+        } else {
+            ret = encode(b, enc, dec, out, in);
+        }
+        av_frame_unref(in);
+        if (ret < 0)
+            goto end;
+    }
+    if ((ret = encode(b, enc, dec, out, NULL)) < 0 ||
+        (ret = decode(b, dec, out, NULL)) < 0)
+        goto end;
+
+    printf("%-10s %8.1f kbit/s %5.2f ms/frame  Y %5.2f/%5.2f dB  "
+           "Cb %5.2f/%5.2f dB  Cr %5.2f/%5.2f dB  (%d frames)\n", name,
+           b->bytes * 8.0 * FPS / b->nb_frames / 1000,
+           b->filter_time / 1000.0 / b->nb_frames,
+           psnr(b->sse[0][FOVEA], b->px[0][FOVEA]), psnr(b->sse[0][PERIPHERY], b->px[0][PERIPHERY]),
+           psnr(b->sse[1][FOVEA], b->px[1][FOVEA]), psnr(b->sse[1][PERIPHERY], b->px[1][PERIPHERY]),
+           psnr(b->sse[2][FOVEA], b->px[2][FOVEA]), psnr(b->sse[2][PERIPHERY], b->px[2][PERIPHERY]),
+           b->decoded);
+
+end:
+    av_dict_free(&opts);
+    av_frame_free(&in);
+    av_frame_free(&out);
+    av_frame_free(&filtered);
+    avfilter_graph_free(&graph);
+    avcodec_free_context(&enc);
+    avcodec_free_context(&dec);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = { .encoder = "libx264", .nb_frames = 150, .width = 1280, .height = 720,
+                .quality = 23, .delta = 12, .sigma = 0.15, .radius = 0.5, .falloff = 0.5 };
+    int i, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            b.encoder = argv[++i];
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &b.width, &b.height) != 2)
+                return usage(argv[0], 1);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.quality = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            b.delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            b.sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            b.radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            b.falloff = atof(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames <= 1 || b.width < BLOCK || b.height < BLOCK || (b.width | b.height) & 1 ||
+        b.sigma <= 0 || b.quality <= 0 || b.falloff <= 0 || b.falloff >= 1)
+        return usage(argv[0], 1);
+
+    b.mb_w = (b.width + BLOCK - 1) / BLOCK;
+    b.mb_h = (b.height + BLOCK - 1) / BLOCK;
+    if ((ret = make_texture(&b)) >= 0) {
+        printf("%s, %d frames %dx%d, quality %g, delta %g, sigma %g, chroma falloff %g, "
+               "fovea radius %g, PSNR fovea/periphery\n", b.encoder, b.nb_frames,
+               b.width, b.height, b.quality, b.delta, b.sigma, b.falloff, b.radius);
+        if ((ret = run(&b, "luma", 0, 0)) < 0 ||
+            (ret = run(&b, "encoder", 1, 0)) < 0 ||
+            (ret = run(&b, "prefilter", 0, 1)) < 0 ||
+            (ret = run(&b, "both", 1, 1)) < 0)
+            fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+    }
+
+    for (i = 0; i < 3; i++)
+        av_free(b.texture[i]);
+    return ret < 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * Cost and gain of eccentricity-weighted deblocking
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Quantize the 8x8 DCT blocks of a synthetic frame with the QP offset map of
+ * the foveated encoders, then run it through deblocking filters, e.g.
+ *
+ *     fov_deblock_bench -s 1920x1080 -n 100 -q 26 -d 24 -g 0.1 -t 4
+ *
+ * Reported per filter are the time per frame and the PSNR and blockiness
+ * of fovea and periphery. Blockiness is the mean absolute step across
+ * 8x8 block edges over the mean step inside blocks, 1 means no visible grid.
+ * Frames are fed with an extra reference, as decoders do, so the filters
+ * have to copy them.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/time.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#define MB_SIZE 16
+
+typedef struct Bench {
+    int nb_frames, width, height, threads;
+    float qp, delta, sigma, fx, fy, radius;
+    AVFrame *src, *coded;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n frames] [-s WxH] [-q base_qp] [-d delta_qp] "
+            "[-g sigma] [-x fixation_x] [-y fixation_y] [-r fovea_radius] [-t threads]\n",
+            argv0);
+    return ret;
+}
+
+static float qp_offset(const Bench *b, int x, int y)
+{
+    int mb_w = (b->width + MB_SIZE - 1) / MB_SIZE, mb_h = (b->height + MB_SIZE - 1) / MB_SIZE;
+    float dx = x / MB_SIZE - b->fx * mb_w, dy = y / MB_SIZE - b->fy * mb_h;
+    float s  = b->sigma * sqrtf(mb_w * mb_w + mb_h * mb_h);
+
+    return b->delta * (1 - expf(-(dx * dx + dy * dy) / (s * s)));
+}
+
+static int peripheral(const Bench *b, int x, int y)
+{
+    int mb_w = (b->width + MB_SIZE - 1) / MB_SIZE, mb_h = (b->height + MB_SIZE - 1) / MB_SIZE;
+    float dx = x / MB_SIZE - b->fx * mb_w, dy = y / MB_SIZE - b->fy * mb_h;
+    float s  = b->sigma * sqrtf(mb_w * mb_w + mb_h * mb_h);
+
+    return dx * dx + dy * dy > b->radius * b->radius * s * s;
+}
+
+/* sinusoids for structure, a little noise for detail */
+static void make_source(Bench *b)
+{
+    AVLFG lfg;
+    int p, x, y;
+
+    av_lfg_init(&lfg, 0x1234);
+    for (y = 0; y < b->height; y++)
+        for (x = 0; x < b->width; x++)
+            b->src->data[0][y * b->src->linesize[0] + x] =
+                av_clip_uint8(128 + 60 * sin(x * 0.013) * cos(y * 0.017) +
+                              25 * sin((x + 2 * y) * 0.05) +
+                              (int)(av_lfg_get(&lfg) % 9) - 4);
+    for (p = 1; p < 3; p++)
+        for (y = 0; y < b->height / 2; y++)
+            for (x = 0; x < b->width / 2; x++)
+                b->src->data[p][y * b->src->linesize[p] + x] =
+                    av_clip_uint8(128 + 40 * sin(x * (p == 1 ? 0.02 : 0.03) + y * 0.01));
+}
+
+/* orthonormal 8x8 DCT-II, quantized with the H.264 step size */
+static void quantize_block(uint8_t *dst, ptrdiff_t stride, float qp)
+{
+    static float c[8][8];
+    float step = 0.625f * exp2f(qp / 6), in[8][8], tmp[8][8];
+    int u, v, i;
+
+    if (!c[0][0])
+        for (u = 0; u < 8; u++)
+            for (i = 0; i < 8; i++)
+                c[u][i] = (u ? sqrtf(2.0f / 8) : sqrtf(1.0f / 8)) * cosf((2 * i + 1) * u * M_PI / 16);
+
+    for (v = 0; v < 8; v++)
+        for (u = 0; u < 8; u++)
+            in[v][u] = dst[v * stride + u] - 128;
+    for (v = 0; v < 8; v++)
+        for (u = 0; u < 8; u++)
+            for (tmp[v][u] = 0, i = 0; i < 8; i++)
+                tmp[v][u] += c[u][i] * in[v][i];
+    for (v = 0; v < 8; v++)
+        for (u = 0; u < 8; u++) {
+            float f = 0;
+            for (i = 0; i < 8; i++)
+                f += c[v][i] * tmp[i][u];
+            in[v][u] = rintf(f / step) * step;
+        }
+    for (v = 0; v < 8; v++)
+        for (u = 0; u < 8; u++)
+            for (tmp[v][u] = 0, i = 0; i < 8; i++)
+                tmp[v][u] += c[i][v] * in[i][u];
+    for (v = 0; v < 8; v++)
+        for (u = 0; u < 8; u++) {
+            float f = 0;
+            for (i = 0; i < 8; i++)
+                f += c[i][u] * tmp[v][i];
+            dst[v * stride + u] = av_clip_uint8(lrintf(f) + 128);
+        }
+}
+
+static void make_coded(Bench *b)
+{
+    int p, x, y;
+
+    av_frame_copy(b->coded, b->src);
+    for (p = 0; p < 3; p++) {
+        int s = !!p;
+        for (y = 0; y + 8 <= b->height >> s; y += 8)
+            for (x = 0; x + 8 <= b->width >> s; x += 8)
+                quantize_block(b->coded->data[p] + y * b->coded->linesize[p] + x,
+                               b->coded->linesize[p], b->qp + qp_offset(b, x << s, y << s));
+    }
+}
+
+static double psnr(double sse, int64_t px)
+{
+    return px ? 10 * log10(255.0 * 255.0 * px / FFMAX(sse, 1)) : 0;
+}
+
+/* luma only */
+static void measure(const Bench *b, const AVFrame *f, int fovea)
+{
+    double sse = 0, edge = 0, inner = 0;
+    int64_t px = 0, nb_edge = 0, nb_inner = 0;
+    int x, y;
+
+    for (y = 0; y < b->height; y++) {
+        const uint8_t *s = b->src->data[0] + y * b->src->linesize[0];
+        const uint8_t *d = f->data[0] + y * f->linesize[0];
+        for (x = 0; x < b->width; x++) {
+            if (peripheral(b, x, y) == fovea)
+                continue;
+            sse += (s[x] - d[x]) * (s[x] - d[x]);
+            px++;
+            if (x) {
+                if (x & 7) {
+                    inner += FFABS(d[x] - d[x - 1]);
+                    nb_inner++;
+                } else {
+                    edge += FFABS(d[x] - d[x - 1]);
+                    nb_edge++;
+                }
+            }
+        }
+    }
+    printf("  %s %5.2f dB blockiness %4.2f", fovea ? "fovea" : "periphery", psnr(sse, px),
+           nb_edge && inner ? (edge / nb_edge) / (inner / nb_inner) : 0.0);
+}
+
+static int run(Bench *b, const char *name, const char *desc, int threads)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src = NULL, *sink = NULL;
+    AVFilterInOut *inputs = avfilter_inout_alloc(), *outputs = avfilter_inout_alloc();
+    AVFrame *out = av_frame_alloc();
+    int64_t t = 0;
+    char args[128];
+    int i, ret;
+
+    if (!graph || !inputs || !outputs || !out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    graph->nb_threads = threads;
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=1/30:pixel_aspect=1/1",
+             b->width, b->height, AV_PIX_FMT_YUV420P);
+    if ((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("buffer"), "in",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out",
+                                            NULL, NULL, graph)) < 0)
+        goto end;
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = src;
+    inputs->name        = av_strdup("out");
+    inputs->filter_ctx  = sink;
+    if ((ret = avfilter_graph_parse_ptr(graph, desc, &inputs, &outputs, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    for (i = 0; i < b->nb_frames; i++) {
+        int64_t t0 = av_gettime_relative();
+
+        b->coded->pts = i;
+        if ((ret = av_buffersrc_add_frame_flags(src, b->coded, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0 ||
+            (ret = av_buffersink_get_frame(sink, out)) < 0)
+            goto end;
+        t += av_gettime_relative() - t0;
+        if (i < b->nb_frames - 1)
+            av_frame_unref(out);
+    }
+
+    printf("%-14s %2d threads %6.2f ms/frame", name, threads, t / 1000.0 / b->nb_frames);
+    measure(b, out, 1);
+    measure(b, out, 0);
+    printf("\n");
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    avfilter_graph_free(&graph);
+    av_frame_free(&out);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = { .nb_frames = 100, .width = 1920, .height = 1080, .threads = 4,
+                .qp = 26, .delta = 24, .sigma = 0.1, .fx = 0.5, .fy = 0.5, .radius = 0.5 };
+    AVFrameSideData *sd;
+    float *d;
+    char desc[64];
+    int i, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &b.width, &b.height) != 2)
+                return usage(argv[0], 1);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.qp = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            b.delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            b.sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+            b.fx = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-y") && i + 1 < argc) {
+            b.fy = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            b.radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            b.threads = atoi(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames < 1 || b.width < MB_SIZE || b.height < MB_SIZE ||
+        (b.width | b.height) & 1 || b.sigma <= 0 || b.threads < 1)
+        return usage(argv[0], 1);
+
+    b.src   = av_frame_alloc();
+    b.coded = av_frame_alloc();
+    if (!b.src || !b.coded)
+        return 1;
+    b.src->width  = b.coded->width  = b.width;
+    b.src->height = b.coded->height = b.height;
+    b.src->format = b.coded->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(b.src, 32) < 0 || av_frame_get_buffer(b.coded, 32) < 0)
+        return 1;
+    make_source(&b);
+    make_coded(&b);
+    sd = av_frame_new_side_data(b.coded, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, 4 * sizeof(*d));
+    if (!sd)
+        return 1;
+    d = (float *)sd->data;
+    d[0] = b.fx;
+    d[1] = b.fy;
+    d[2] = b.sigma;
+    d[3] = b.delta;
+
+    printf("%d frames %dx%d, qp %g, delta %g, sigma %g, fovea radius %g\n",
+           b.nb_frames, b.width, b.height, b.qp, b.delta, b.sigma, b.radius);
+    snprintf(desc, sizeof(desc), "fovdeblock=radius=%g", b.radius);
+    if ((ret = run(&b, "none", "null", 1)) < 0 ||
+        (ret = run(&b, "deblock", "deblock", 1)) < 0 ||
+        (ret = run(&b, "fovdeblock", desc, 1)) < 0 ||
+        (b.threads > 1 && (ret = run(&b, "fovdeblock", desc, b.threads)) < 0))
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    av_frame_free(&b.src);
+    av_frame_free(&b.coded);
+    return ret < 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * Peripheral flicker of foveated encoding
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Encode a slowly panning synthetic texture with a fixation point that
+ * jumps every half second, decode it again and compare against the source,
+ * e.g.
+ *
+ *     fov_flicker_bench -e libx264 -n 300 -q 23 -d 12 -l 0.1
+ *
+ * Three runs are made at the same CRF:
+ *
+ *     gop3     an I-frame every 3 frames, QP offsets follow the gaze at once
+ *     refresh  periodic intra refresh, QP offsets follow the gaze at once
+ *     smooth   periodic intra refresh, QP offsets released slowly
+ *
+ * Flicker is the temporal variance of the MSE of peripheral 16x16 blocks,
+ * estimated from successive frames, (mse[t] - mse[t-1])^2 / 2, so that the
+ * slow change of quality as the fixation moves does not count.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/opt.h"
+#include "libavcodec/avcodec.h"
+
+#define FPS        30
+#define BLOCK      16
+#define FIXATION   15   /* frames between saccades */
+
+typedef struct Bench {
+    const char *encoder;
+    int nb_frames, width, height;
+    float crf, delta, sigma, radius, release;
+
+    int mb_w, mb_h;
+    float (*gaze)[2];
+    uint8_t *texture;
+    int tex_w, tex_h;
+
+    /* per run */
+    int64_t bytes;
+    int decoded;
+    double fovea_sse, periphery_sse;
+    int64_t fovea_px, periphery_px;
+    double *prev_mse;
+    double flicker;
+    int64_t nb_flicker;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-e encoder] [-n frames] [-s WxH] [-q crf] [-d delta_qp] "
+            "[-g sigma] [-r fovea_radius] [-l release]\n", argv0);
+    return ret;
+}
+
+/* sinusoids for structure, noise for detail that costs bits */
+static int make_texture(Bench *b)
+{
+    AVLFG lfg;
+    int x, y;
+
+    b->tex_w   = b->width + b->nb_frames / 2 + 1;
+    b->tex_h   = b->height + b->nb_frames / 4 + 1;
+    b->texture = av_malloc((size_t)b->tex_w * b->tex_h);
+    if (!b->texture)
+        return AVERROR(ENOMEM);
+    av_lfg_init(&lfg, 0x1234);
+    for (y = 0; y < b->tex_h; y++)
+        for (x = 0; x < b->tex_w; x++)
+            b->texture[y * b->tex_w + x] =
+                av_clip_uint8(128 + 50 * sin(x * 0.031) * cos(y * 0.023) +
+                              30 * sin((x + 2 * y) * 0.11) +
+                              (int)(av_lfg_get(&lfg) % 41) - 20);
+    return 0;
+}
+
+static const uint8_t *source_row(Bench *b, int n, int y)
+{
+    return b->texture + (size_t)(y + n / 4) * b->tex_w + n / 2;
+}
+
+static void make_gaze(Bench *b)
+{
+    AVLFG lfg;
+    float x = 0.5, y = 0.5;
+    int i;
+
+    av_lfg_init(&lfg, 0x5678);
+    for (i = 0; i < b->nb_frames; i++) {
+        if (i && !(i % FIXATION)) {
+            x = 0.15 + 0.7 * (av_lfg_get(&lfg) / (float)UINT32_MAX);
+            y = 0.15 + 0.7 * (av_lfg_get(&lfg) / (float)UINT32_MAX);
+        }
+        b->gaze[i][0] = x;
+        b->gaze[i][1] = y;
+    }
+}
+
+static void measure(Bench *b, const AVFrame *frame)
+{
+    int n = frame->pts, bx, by, x, y;
+    float diag = b->sigma * sqrtf(b->mb_w * b->mb_w + b->mb_h * b->mb_h);
+
+    if (n < 0 || n >= b->nb_frames)
+        return;
+    b->decoded++;
+    for (by = 0; by < b->mb_h; by++) {
+        for (bx = 0; bx < b->mb_w; bx++) {
+            int w = FFMIN(BLOCK, b->width - bx * BLOCK);
+            int h = FFMIN(BLOCK, b->height - by * BLOCK);
+            float dx = bx - b->gaze[n][0] * b->mb_w, dy = by - b->gaze[n][1] * b->mb_h;
+            int peripheral = dx * dx + dy * dy > b->radius * b->radius * diag * diag;
+            double *prev = &b->prev_mse[by * b->mb_w + bx];
+            int64_t sse = 0;
+            double mse;
+
+            for (y = 0; y < h; y++) {
+                const uint8_t *src = source_row(b, n, by * BLOCK + y) + bx * BLOCK;
+                const uint8_t *dec = frame->data[0] + (by * BLOCK + y) * frame->linesize[0] +
+                                     bx * BLOCK;
+                for (x = 0; x < w; x++)
+                    sse += (src[x] - dec[x]) * (src[x] - dec[x]);
+            }
+            mse = (double)sse / (w * h);
+            if (peripheral) {
+                b->periphery_sse += sse;
+                b->periphery_px  += w * h;
+                if (*prev >= 0) {
+                    b->flicker += (mse - *prev) * (mse - *prev) / 2;
+                    b->nb_flicker++;
+                }
+                *prev = mse;
+            } else {
+                b->fovea_sse += sse;
+                b->fovea_px  += w * h;
+                *prev = -1;
+            }
+        }
+    }
+}
+
+static int decode(Bench *b, AVCodecContext *dec, AVFrame *frame, const AVPacket *pkt)
+{
+    int ret = avcodec_send_packet(dec, pkt);
+
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(dec, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            break;
+        measure(b, frame);
+        av_frame_unref(frame);
+    }
+    return ret;
+}
+
+static int encode(Bench *b, AVCodecContext *enc, AVCodecContext *dec,
+                  AVFrame *out, const AVFrame *in)
+{
+    AVPacket pkt;
+    int ret = avcodec_send_frame(enc, in);
+
+    av_init_packet(&pkt);
+    while (ret >= 0) {
+        ret = avcodec_receive_packet(enc, &pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            break;
+        b->bytes += pkt.size;
+        ret = decode(b, dec, out, &pkt);
+        av_packet_unref(&pkt);
+    }
+    return ret;
+}
+
+static double psnr(double sse, int64_t px)
+{
+    return px ? 10 * log10(255.0 * 255.0 * px / FFMAX(sse, 1)) : 0;
+}
+
+static int run(Bench *b, const char *name, int gop, float release)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(b->encoder);
+    AVCodecContext *enc = NULL, *dec = NULL;
+    AVFrame *in = NULL, *out = NULL;
+    AVDictionary *opts = NULL;
+    char arg[32];
+    int i, y, ret;
+
+    if (!codec) {
+        fprintf(stderr, "Encoder %s not found\n", b->encoder);
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    b->bytes = b->decoded = b->fovea_px = b->periphery_px = b->nb_flicker = 0;
+    b->fovea_sse = b->periphery_sse = b->flicker = 0;
+    for (i = 0; i < b->mb_w * b->mb_h; i++)
+        b->prev_mse[i] = -1;
+
+    enc = avcodec_alloc_context3(codec);
+    in  = av_frame_alloc();
+    out = av_frame_alloc();
+    if (!enc || !in || !out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    enc->width     = b->width;
+    enc->height    = b->height;
+    enc->pix_fmt   = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, FPS };
+    enc->gop_size  = gop;
+    /* the private options of libx264, other encoders keep their defaults */
+    av_dict_set(&opts, "preset", "ultrafast", 0);
+    av_dict_set(&opts, "tune", "zerolatency", 0);
+    av_dict_set(&opts, "aq-mode", "1", 0);
+    av_dict_set_int(&opts, "intra-refresh", gop > 3, 0);
+    snprintf(arg, sizeof(arg), "%f", b->crf);
+    av_dict_set(&opts, "crf", arg, 0);
+    av_dict_set(&opts, "fovea_attack", "1", 0);
+    snprintf(arg, sizeof(arg), "%f", release);
+    av_dict_set(&opts, "fovea_release", arg, 0);
+    if ((ret = avcodec_open2(enc, codec, &opts)) < 0)
+        goto end;
+
+    dec = avcodec_alloc_context3(avcodec_find_decoder(enc->codec_id));
+    if (!dec) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avcodec_open2(dec, dec->codec, NULL)) < 0)
+        goto end;
+
+    in->width  = b->width;
+    in->height = b->height;
+    in->format = AV_PIX_FMT_YUV420P;
+    if ((ret = av_frame_get_buffer(in, 32)) < 0)
+        goto end;
+
+    for (i = 0; i < b->nb_frames; i++) {
+        AVFrameSideData *sd;
+        float *d;
+
+        if ((ret = av_frame_make_writable(in)) < 0)
+            goto end;
+        for (y = 0; y < b->height; y++)
+            memcpy(in->data[0] + y * in->linesize[0], source_row(b, i, y), b->width);
+        for (y = 0; y < b->height / 2; y++) {
+            memset(in->data[1] + y * in->linesize[1], 128, b->width / 2);
+            memset(in->data[2] + y * in->linesize[2], 128, b->width / 2);
+        }
+        in->pts = i;
+        av_frame_remove_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+        sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, 4 * sizeof(*d));
+        if (!sd) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        d = (float *)sd->data;
+        d[0] = b->gaze[i][0];
+        d[1] = b->gaze[i][1];
+        d[2] = b->sigma;
+        d[3] = b->delta;
+        if ((ret = encode(b, enc, dec, out, in)) < 0)
+            goto end;
+    }
+    if ((ret = encode(b, enc, dec, out, NULL)) < 0 ||
+        (ret = decode(b, dec, out, NULL)) < 0)
+        goto end;
+
+    printf("%-8s %8.1f kbit/s  fovea %5.2f dB  periphery %5.2f dB  flicker %9.2f  "
+           "(%d frames)\n", name, b->bytes * 8.0 * FPS / b->nb_frames / 1000,
+           psnr(b->fovea_sse, b->fovea_px), psnr(b->periphery_sse, b->periphery_px),
+           b->nb_flicker ? b->flicker / b->nb_flicker : 0.0, b->decoded);
+
+end:
+    av_dict_free(&opts);
+    av_frame_free(&in);
+    av_frame_free(&out);
+    avcodec_free_context(&enc);
+    avcodec_free_context(&dec);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = { .encoder = "libx264", .nb_frames = 300, .width = 1280, .height = 720,
+                .crf = 23, .delta = 12, .sigma = 0.15, .radius = 1, .release = 0.1 };
+    int i, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            b.encoder = argv[++i];
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &b.width, &b.height) != 2)
+                return usage(argv[0], 1);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.crf = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            b.delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            b.sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            b.radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            b.release = atof(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames <= 1 || b.width < BLOCK || b.height < BLOCK || (b.width | b.height) & 1 ||
+        b.sigma <= 0 || b.release <= 0 || b.release > 1)
+        return usage(argv[0], 1);
+
+    b.mb_w     = (b.width + BLOCK - 1) / BLOCK;
+    b.mb_h     = (b.height + BLOCK - 1) / BLOCK;
+    b.gaze     = av_malloc_array(b.nb_frames, sizeof(*b.gaze));
+    b.prev_mse = av_malloc_array(b.mb_w * b.mb_h, sizeof(*b.prev_mse));
+    if (!b.gaze || !b.prev_mse || make_texture(&b) < 0)
+        return 1;
+    make_gaze(&b);
+
+    printf("%s, %d frames %dx%d, crf %g, delta %g, sigma %g, fovea radius %g\n",
+           b.encoder, b.nb_frames, b.width, b.height, b.crf, b.delta, b.sigma, b.radius);
+    if ((ret = run(&b, "gop3", 3, 1)) < 0 ||
+        (ret = run(&b, "refresh", FPS, 1)) < 0 ||
+        (ret = run(&b, "smooth", FPS, b.release)) < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    av_free(b.gaze);
+    av_free(b.prev_mse);
+    av_free(b.texture);
+    return ret < 0;
+}
@@ -0,0 +1,338 @@
+/*
+ * Bitrate and speed of temporal foveation
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Encode a panning synthetic texture with a fixed fixation point, once with
+ * spatial foveation only and then with the periphery updated every 2, 3 and
+ * 4 frames, decode it again and compare against the source, e.g.
+ *
+ *     fov_temporal_bench -e mpeg4 -n 300 -q 4 -d 12 -g 0.15 -r 0.8
+ *
+ * The quality setting is the CRF of libx264 and libx265 and the fixed
+ * quantizer of the other encoders, so the fovea is coded the same in all
+ * runs. Reported are the bitrate, the encode time per frame, the PSNR of
+ * fovea and periphery and the share of frames that held the periphery, as
+ * signalled in the packet side data. The periphery is held beyond half the
+ * maximal QP offset, sqrt(ln 2) ~ 0.83 sigma, so the default fovea radius
+ * stays inside it.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavcodec/avcodec.h"
+
+#define FPS        30
+#define BLOCK      16
+
+typedef struct Bench {
+    const char *encoder;
+    int nb_frames, width, height;
+    float quality, delta, sigma, radius;
+
+    int mb_w, mb_h;
+    uint8_t *texture;
+    int tex_w, tex_h;
+
+    /* per run */
+    int64_t bytes, encode_time;
+    int decoded, held;
+    double fovea_sse, periphery_sse;
+    int64_t fovea_px, periphery_px;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-e encoder] [-n frames] [-s WxH] [-q quality] [-d delta_qp] "
+            "[-g sigma] [-r fovea_radius]\n", argv0);
+    return ret;
+}
+
+/* sinusoids for structure, noise for detail that costs bits */
+static int make_texture(Bench *b)
+{
+    AVLFG lfg;
+    int x, y;
+
+    b->tex_w   = b->width + b->nb_frames + 1;
+    b->tex_h   = b->height + b->nb_frames / 2 + 1;
+    b->texture = av_malloc((size_t)b->tex_w * b->tex_h);
+    if (!b->texture)
+        return AVERROR(ENOMEM);
+    av_lfg_init(&lfg, 0x1234);
+    for (y = 0; y < b->tex_h; y++)
+        for (x = 0; x < b->tex_w; x++)
+            b->texture[y * b->tex_w + x] =
+                av_clip_uint8(128 + 50 * sin(x * 0.031) * cos(y * 0.023) +
+                              30 * sin((x + 2 * y) * 0.11) +
+                              (int)(av_lfg_get(&lfg) % 21) - 10);
+    return 0;
+}
+
+/* one pixel right and half a pixel down per frame */
+static const uint8_t *source_row(Bench *b, int n, int y)
+{
+    return b->texture + (size_t)(y + n / 2) * b->tex_w + n;
+}
+
+static void measure(Bench *b, const AVFrame *frame)
+{
+    int n = frame->pts, bx, by, x, y;
+    float diag = b->sigma * sqrtf(b->mb_w * b->mb_w + b->mb_h * b->mb_h);
+
+    if (n < 0 || n >= b->nb_frames)
+        return;
+    b->decoded++;
+    for (by = 0; by < b->mb_h; by++) {
+        for (bx = 0; bx < b->mb_w; bx++) {
+            int w = FFMIN(BLOCK, b->width - bx * BLOCK);
+            int h = FFMIN(BLOCK, b->height - by * BLOCK);
+            float dx = bx + 0.5f - 0.5f * b->mb_w, dy = by + 0.5f - 0.5f * b->mb_h;
+            int64_t sse = 0;
+
+            for (y = 0; y < h; y++) {
+                const uint8_t *src = source_row(b, n, by * BLOCK + y) + bx * BLOCK;
+                const uint8_t *dec = frame->data[0] + (by * BLOCK + y) * frame->linesize[0] +
+                                     bx * BLOCK;
+                for (x = 0; x < w; x++)
+                    sse += (src[x] - dec[x]) * (src[x] - dec[x]);
+            }
+            if (dx * dx + dy * dy > b->radius * b->radius * diag * diag) {
+                b->periphery_sse += sse;
+                b->periphery_px  += w * h;
+            } else {
+                b->fovea_sse += sse;
+                b->fovea_px  += w * h;
+            }
+        }
+    }
+}
+
+static int decode(Bench *b, AVCodecContext *dec, AVFrame *frame, const AVPacket *pkt)
+{
+    int ret = avcodec_send_packet(dec, pkt);
+
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(dec, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            break;
+        measure(b, frame);
+        av_frame_unref(frame);
+    }
+    return ret;
+}
+
+static int encode(Bench *b, AVCodecContext *enc, AVCodecContext *dec,
+                  AVFrame *out, const AVFrame *in)
+{
+    AVPacket pkt;
+    int64_t t = av_gettime_relative();
+    int ret = avcodec_send_frame(enc, in);
+
+    av_init_packet(&pkt);
+    while (ret >= 0) {
+        int size;
+        float *d;
+
+        ret = avcodec_receive_packet(enc, &pkt);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            break;
+        if (ret < 0)
+            return ret;
+        b->encode_time += av_gettime_relative() - t;
+        b->bytes += pkt.size;
+        d = (float *)av_packet_get_side_data(&pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR, &size);
+        if (d && size >= 5 * sizeof(*d) && d[4] < 0)
+            b->held++;
+        ret = decode(b, dec, out, &pkt);
+        av_packet_unref(&pkt);
+        t = av_gettime_relative();
+    }
+    b->encode_time += av_gettime_relative() - t;
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+static double psnr(double sse, int64_t px)
+{
+    return px ? 10 * log10(255.0 * 255.0 * px / FFMAX(sse, 1)) : 0;
+}
+
+static int run(Bench *b, int period)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(b->encoder);
+    AVCodecContext *enc = NULL, *dec = NULL;
+    AVFrame *in = NULL, *out = NULL;
+    AVDictionary *opts = NULL;
+    char arg[32];
+    int i, y, ret;
+
+    if (!codec) {
+        fprintf(stderr, "Encoder %s not found\n", b->encoder);
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    b->bytes = b->encode_time = b->decoded = b->held = 0;
+    b->fovea_px = b->periphery_px = 0;
+    b->fovea_sse = b->periphery_sse = 0;
+
+    enc = avcodec_alloc_context3(codec);
+    in  = av_frame_alloc();
+    out = av_frame_alloc();
+    if (!enc || !in || !out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    enc->width     = b->width;
+    enc->height    = b->height;
+    enc->pix_fmt   = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, FPS };
+    enc->gop_size  = 10 * FPS;
+    if (!strcmp(b->encoder, "libx264") || !strcmp(b->encoder, "libx265")) {
+        av_dict_set(&opts, "preset", "ultrafast", 0);
+        av_dict_set(&opts, "tune", "zerolatency", 0);
+        snprintf(arg, sizeof(arg), "%f", b->quality);
+        av_dict_set(&opts, "crf", arg, 0);
+    } else {
+        enc->flags         |= AV_CODEC_FLAG_QSCALE;
+        enc->global_quality = b->quality * FF_QP2LAMBDA;
+        av_dict_set(&opts, "fovea", "1", 0);
+    }
+    if ((ret = avcodec_open2(enc, codec, &opts)) < 0)
+        goto end;
+
+    dec = avcodec_alloc_context3(avcodec_find_decoder(enc->codec_id));
+    if (!dec) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = avcodec_open2(dec, dec->codec, NULL)) < 0)
+        goto end;
+
+    in->width  = b->width;
+    in->height = b->height;
+    in->format = AV_PIX_FMT_YUV420P;
+    if ((ret = av_frame_get_buffer(in, 32)) < 0)
+        goto end;
+
+    for (i = 0; i < b->nb_frames; i++) {
+        AVFrameSideData *sd;
+        float *d;
+
+        if ((ret = av_frame_make_writable(in)) < 0)
+            goto end;
+        for (y = 0; y < b->height; y++)
+            memcpy(in->data[0] + y * in->linesize[0], source_row(b, i, y), b->width);
+        for (y = 0; y < b->height / 2; y++) {
+            memset(in->data[1] + y * in->linesize[1], 128, b->width / 2);
+            memset(in->data[2] + y * in->linesize[2], 128, b->width / 2);
+        }
+        in->pts     = i;
+        in->quality = enc->global_quality;
+        av_frame_remove_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+        sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+                                    (period > 1 ? 5 : 4) * sizeof(*d));
+        if (!sd) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        d = (float *)sd->data;
+        d[0] = 0.5;
+        d[1] = 0.5;
+        d[2] = b->sigma;
+        d[3] = b->delta;
+        if (period > 1)
+            d[4] = period;
+        if ((ret = encode(b, enc, dec, out, in)) < 0)
+            goto end;
+    }
+    if ((ret = encode(b, enc, dec, out, NULL)) < 0 ||
+        (ret = decode(b, dec, out, NULL)) < 0)
+        goto end;
+
+    printf("period %d %8.1f kbit/s %6.2f ms/frame  fovea %5.2f dB  periphery %5.2f dB  "
+           "held %3d%%  (%d frames)\n", period,
+           b->bytes * 8.0 * FPS / b->nb_frames / 1000,
+           b->encode_time / 1000.0 / b->nb_frames,
+           psnr(b->fovea_sse, b->fovea_px), psnr(b->periphery_sse, b->periphery_px),
+           100 * b->held / b->nb_frames, b->decoded);
+
+end:
+    av_dict_free(&opts);
+    av_frame_free(&in);
+    av_frame_free(&out);
+    avcodec_free_context(&enc);
+    avcodec_free_context(&dec);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = { .encoder = "libx264", .nb_frames = 300, .width = 1280, .height = 720,
+                .quality = 23, .delta = 12, .sigma = 0.15, .radius = 0.8 };
+    int i, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            b.encoder = argv[++i];
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &b.width, &b.height) != 2)
+                return usage(argv[0], 1);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.quality = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            b.delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            b.sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            b.radius = atof(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames <= 1 || b.width < BLOCK || b.height < BLOCK || (b.width | b.height) & 1 ||
+        b.sigma <= 0 || b.quality <= 0)
+        return usage(argv[0], 1);
+
+    b.mb_w = (b.width + BLOCK - 1) / BLOCK;
+    b.mb_h = (b.height + BLOCK - 1) / BLOCK;
+    if (make_texture(&b) < 0)
+        return 1;
+
+    printf("%s, %d frames %dx%d, quality %g, delta %g, sigma %g, fovea radius %g\n",
+           b.encoder, b.nb_frames, b.width, b.height, b.quality, b.delta, b.sigma, b.radius);
+    for (i = 1; i <= 4 && ret >= 0; i++)
+        if ((ret = run(&b, i)) < 0)
+            fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    av_free(b.texture);
+    return ret < 0;
+}
@@ -0,0 +1,353 @@
+/*
+ * Quality and cost of filling the held periphery of temporal foveation
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Encode a panning synthetic texture, with a patch moving against the pan,
+ * with temporal foveation around a fixed fixation, e.g.
+ *
+ *     fov_upconv_bench -e mpeg4 -n 120 -q 4 -p 3 -b 2
+ *
+ * then decode it with exported motion vectors and run it through a filter
+ * that leaves the held periphery as it is and through fovupconv. Reported per
+ * filter are the time per frame and the PSNR of fovea and periphery against
+ * the source, on the frames that held the periphery.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/time.h"
+#include "libavcodec/avcodec.h"
+#include "libavfilter/avfilter.h"
+#include "libavfilter/buffersink.h"
+#include "libavfilter/buffersrc.h"
+
+#define FPS        90
+#define BLOCK      16
+#define PATCH      96
+
+typedef struct Bench {
+    const char *encoder;
+    int nb_frames, width, height, period;
+    float quality, delta, sigma, radius, budget;
+
+    int mb_w, mb_h;
+    uint8_t *texture;
+    int tex_w, tex_h;
+    AVPacket *packets;
+    int nb_packets;
+
+    /* per run */
+    int64_t filter_time;
+    int held;
+    double fovea_sse, periphery_sse;
+    int64_t fovea_px, periphery_px;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-e encoder] [-n frames] [-s WxH] [-q quality] [-d delta_qp] "
+            "[-g sigma] [-r fovea_radius] [-p period] [-b budget_ms]\n", argv0);
+    return ret;
+}
+
+/* sinusoids for structure, noise for detail that costs bits */
+static int make_texture(Bench *b)
+{
+    AVLFG lfg;
+    int x, y;
+
+    b->tex_w   = b->width + 2 * b->nb_frames + 1;
+    b->tex_h   = b->height + b->nb_frames + 1;
+    b->texture = av_malloc((size_t)b->tex_w * b->tex_h);
+    if (!b->texture)
+        return AVERROR(ENOMEM);
+    av_lfg_init(&lfg, 0x1234);
+    for (y = 0; y < b->tex_h; y++)
+        for (x = 0; x < b->tex_w; x++)
+            b->texture[y * b->tex_w + x] =
+                av_clip_uint8(128 + 50 * sin(x * 0.031) * cos(y * 0.023) +
+                              30 * sin((x + 2 * y) * 0.11) +
+                              (int)(av_lfg_get(&lfg) % 21) - 10);
+    return 0;
+}
+
+/* two pixels right and one down per frame, the patch goes left */
+static int source(const Bench *b, int n, int x, int y)
+{
+    int px = b->width / 8 + 2 * (b->nb_frames - n) / 3, py = b->height / 6;
+
+    if (x >= px && x < px + PATCH && y >= py && y < py + PATCH)
+        return 255 - b->texture[(y - py) * b->tex_w + (x - px)];
+    return b->texture[(size_t)(y + n) * b->tex_w + x + 2 * n];
+}
+
+static int peripheral(const Bench *b, int bx, int by)
+{
+    float diag = b->sigma * sqrtf(b->mb_w * b->mb_w + b->mb_h * b->mb_h);
+    float dx = bx + 0.5f - 0.5f * b->mb_w, dy = by + 0.5f - 0.5f * b->mb_h;
+
+    return dx * dx + dy * dy > b->radius * b->radius * diag * diag;
+}
+
+static void measure(Bench *b, const AVFrame *frame)
+{
+    AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+    int n = frame->pts, x, y;
+
+    if (n < 0 || n >= b->nb_frames || !sd || sd->size < 5 * sizeof(float) ||
+        ((float *)sd->data)[4] >= 0)
+        return;
+    b->held++;
+    for (y = 0; y < b->height; y++) {
+        const uint8_t *dec = frame->data[0] + y * frame->linesize[0];
+        for (x = 0; x < b->width; x++) {
+            int e = source(b, n, x, y) - dec[x];
+            if (peripheral(b, x / BLOCK, y / BLOCK)) {
+                b->periphery_sse += e * e;
+                b->periphery_px++;
+            } else {
+                b->fovea_sse += e * e;
+                b->fovea_px++;
+            }
+        }
+    }
+}
+
+static int encode(Bench *b)
+{
+    const AVCodec *codec = avcodec_find_encoder_by_name(b->encoder);
+    AVCodecContext *enc = NULL;
+    AVFrame *in = av_frame_alloc();
+    AVDictionary *opts = NULL;
+    int i, x, y, ret;
+
+    if (!codec) {
+        fprintf(stderr, "Encoder %s not found\n", b->encoder);
+        ret = AVERROR_ENCODER_NOT_FOUND;
+        goto end;
+    }
+    enc = avcodec_alloc_context3(codec);
+    b->packets = av_calloc(b->nb_frames, sizeof(*b->packets));
+    if (!enc || !in || !b->packets) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    enc->width     = b->width;
+    enc->height    = b->height;
+    enc->pix_fmt   = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, FPS };
+    enc->gop_size  = 10 * FPS;
+    enc->flags    |= AV_CODEC_FLAG_QSCALE;
+    enc->global_quality = b->quality * FF_QP2LAMBDA;
+    av_dict_set(&opts, "fovea", "1", 0);
+    if ((ret = avcodec_open2(enc, codec, &opts)) < 0)
+        goto end;
+
+    in->width  = b->width;
+    in->height = b->height;
+    in->format = AV_PIX_FMT_YUV420P;
+    if ((ret = av_frame_get_buffer(in, 32)) < 0)
+        goto end;
+
+    for (i = 0; i <= b->nb_frames; i++) {
+        AVFrameSideData *sd;
+        float *d;
+
+        if (i < b->nb_frames) {
+            if ((ret = av_frame_make_writable(in)) < 0)
+                goto end;
+            for (y = 0; y < b->height; y++)
+                for (x = 0; x < b->width; x++)
+                    in->data[0][y * in->linesize[0] + x] = source(b, i, x, y);
+            for (y = 0; y < b->height / 2; y++) {
+                memset(in->data[1] + y * in->linesize[1], 128, b->width / 2);
+                memset(in->data[2] + y * in->linesize[2], 128, b->width / 2);
+            }
+            in->pts     = i;
+            in->quality = enc->global_quality;
+            av_frame_remove_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+            sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, 5 * sizeof(*d));
+            if (!sd) {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            d = (float *)sd->data;
+            d[0] = 0.5;
+            d[1] = 0.5;
+            d[2] = b->sigma;
+            d[3] = b->delta;
+            d[4] = b->period;
+        }
+        ret = avcodec_send_frame(enc, i < b->nb_frames ? in : NULL);
+        while (ret >= 0 && b->nb_packets < b->nb_frames) {
+            ret = avcodec_receive_packet(enc, &b->packets[b->nb_packets]);
+            if (ret >= 0)
+                b->nb_packets++;
+        }
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            goto end;
+    }
+    ret = 0;
+
+end:
+    av_dict_free(&opts);
+    av_frame_free(&in);
+    avcodec_free_context(&enc);
+    return ret;
+}
+
+static int run(Bench *b, const char *name, const char *desc)
+{
+    AVCodecContext *dec = avcodec_alloc_context3(avcodec_find_decoder_by_name(b->encoder));
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    AVFilterContext *src = NULL, *sink = NULL;
+    AVFilterInOut *inputs = avfilter_inout_alloc(), *outputs = avfilter_inout_alloc();
+    AVFrame *frame = av_frame_alloc(), *out = av_frame_alloc();
+    char args[128];
+    int i, ret;
+
+    b->filter_time = b->held = b->fovea_px = b->periphery_px = 0;
+    b->fovea_sse = b->periphery_sse = 0;
+    if (!dec || !graph || !inputs || !outputs || !frame || !out) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    dec->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+    if ((ret = avcodec_open2(dec, dec->codec, NULL)) < 0)
+        goto end;
+
+    graph->nb_threads = 1;
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=1/%d:pixel_aspect=1/1",
+             b->width, b->height, AV_PIX_FMT_YUV420P, FPS);
+    if ((ret = avfilter_graph_create_filter(&src, avfilter_get_by_name("buffer"), "in",
+                                            args, NULL, graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&sink, avfilter_get_by_name("buffersink"), "out",
+                                            NULL, NULL, graph)) < 0)
+        goto end;
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = src;
+    inputs->name        = av_strdup("out");
+    inputs->filter_ctx  = sink;
+    if ((ret = avfilter_graph_parse_ptr(graph, desc, &inputs, &outputs, NULL)) < 0 ||
+        (ret = avfilter_graph_config(graph, NULL)) < 0)
+        goto end;
+
+    for (i = 0; i <= b->nb_packets; i++) {
+        ret = avcodec_send_packet(dec, i < b->nb_packets ? &b->packets[i] : NULL);
+        while (ret >= 0) {
+            int64_t t;
+
+            ret = avcodec_receive_frame(dec, frame);
+            if (ret < 0)
+                break;
+            t = av_gettime_relative();
+            if ((ret = av_buffersrc_add_frame(src, frame)) < 0 ||
+                (ret = av_buffersink_get_frame(sink, out)) < 0)
+                goto end;
+            b->filter_time += av_gettime_relative() - t;
+            measure(b, out);
+            av_frame_unref(out);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            goto end;
+    }
+    ret = 0;
+
+    printf("%-10s %6.3f ms/frame  fovea %5.2f dB  periphery %5.2f dB  (%d held frames)\n",
+           name, b->filter_time / 1000.0 / b->nb_frames,
+           10 * log10(255.0 * 255.0 * b->fovea_px / FFMAX(b->fovea_sse, 1)),
+           10 * log10(255.0 * 255.0 * b->periphery_px / FFMAX(b->periphery_sse, 1)),
+           b->held);
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    avfilter_graph_free(&graph);
+    av_frame_free(&frame);
+    av_frame_free(&out);
+    avcodec_free_context(&dec);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    Bench b = { .encoder = "mpeg4", .nb_frames = 120, .width = 1280, .height = 720,
+                .period = 3, .quality = 4, .delta = 12, .sigma = 0.15, .radius = 0.8,
+                .budget = 2 };
+    char desc[64];
+    int i, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            b.encoder = argv[++i];
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &b.width, &b.height) != 2)
+                return usage(argv[0], 1);
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.quality = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            b.delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            b.sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            b.radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            b.period = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            b.budget = atof(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames <= 1 || b.width < 2 * PATCH || b.height < 2 * PATCH ||
+        (b.width | b.height) & 1 || b.sigma <= 0 || b.quality <= 0 || b.period < 2)
+        return usage(argv[0], 1);
+
+    b.mb_w = (b.width + BLOCK - 1) / BLOCK;
+    b.mb_h = (b.height + BLOCK - 1) / BLOCK;
+    if (make_texture(&b) < 0)
+        return 1;
+
+    printf("%s, %d frames %dx%d, quality %g, delta %g, sigma %g, period %d, fovea radius %g\n",
+           b.encoder, b.nb_frames, b.width, b.height, b.quality, b.delta, b.sigma,
+           b.period, b.radius);
+    av_log_set_level(AV_LOG_VERBOSE);
+    snprintf(desc, sizeof(desc), "fovupconv=budget=%g", b.budget);
+    if ((ret = encode(&b)) < 0 ||
+        (ret = run(&b, "null", "null")) < 0 ||
+        (ret = run(&b, "fovupconv", desc)) < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    for (i = 0; i < b.nb_packets; i++)
+        av_packet_unref(&b.packets[i]);
+    av_free(b.packets);
+    av_free(b.texture);
+    return ret < 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Inter-process handoff latency benchmark
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Fork a reader process and hand fixed-size messages to it through a
+ * protocol, reporting the one-way latency from avio_write() in the parent
+ * to avio_read() returning in the child, e.g.
+ *
+ *     ipc_bench -s 65536 shm:ipc_bench
+ *     ipc_bench -s 65536 unix:/tmp/ipc_bench.sock
+ *
+ * For unix sockets the reader listens. Timestamps are taken from the
+ * monotonic clock, which both processes share.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n messages] [-s size] [-i interval_us] url\n", argv0);
+    return ret;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+    return FFDIFFSIGN(va, vb);
+}
+
+static int reader(const char *url, int nb_msgs, int size)
+{
+    AVIOContext *in = NULL;
+    AVDictionary *opts = NULL;
+    int64_t *lat, sum = 0;
+    uint8_t *buf;
+    int i, ret;
+
+    if (av_strstart(url, "unix:", NULL))
+        av_dict_set(&opts, "listen", "1", 0);
+    av_dict_set(&opts, "timeout", "5000", 0);
+    ret = avio_open2(&in, url, AVIO_FLAG_READ, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", url, av_err2str(ret));
+        return 1;
+    }
+
+    buf = av_malloc(size);
+    lat = av_malloc_array(nb_msgs, sizeof(*lat));
+    if (!buf || !lat)
+        return 1;
+
+    for (i = 0; i < nb_msgs; i++) {
+        if (avio_read(in, buf, size) != size)
+            break;
+        lat[i] = av_gettime_relative() - (int64_t)AV_RN64(buf);
+        sum   += lat[i];
+    }
+    if (i) {
+        qsort(lat, i, sizeof(*lat), cmp_int64);
+        printf("%s: %d x %d bytes, latency mean %.1f us, p50 %"PRId64" us, "
+               "p99 %"PRId64" us, max %"PRId64" us\n", url, i, size,
+               (double)sum / i, lat[i / 2], lat[i * 99 / 100], lat[i - 1]);
+    }
+
+    avio_closep(&in);
+    av_free(buf);
+    av_free(lat);
+    return i == nb_msgs ? 0 : 1;
+}
+
+static int writer(const char *url, int nb_msgs, int size, int interval)
+{
+    AVIOContext *out = NULL;
+    uint8_t *buf;
+    int i, ret;
+
+    /* give the reader time to listen */
+    av_usleep(200000);
+    ret = avio_open2(&out, url, AVIO_FLAG_WRITE, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", url, av_err2str(ret));
+        return 1;
+    }
+    buf = av_mallocz(size);
+    if (!buf)
+        return 1;
+
+    for (i = 0; i < nb_msgs; i++) {
+        AV_WN64(buf, av_gettime_relative());
+        avio_write(out, buf, size);
+        avio_flush(out);
+        av_usleep(interval);
+    }
+
+    avio_closep(&out);
+    av_free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int nb_msgs = 10000, size = 4096, interval = 200, i, status = 1;
+    const char *url = NULL;
+    pid_t pid;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            nb_msgs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            interval = atoi(argv[++i]);
+        } else if (!url) {
+            url = argv[i];
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (!url || nb_msgs <= 0 || size < 8 || interval < 0)
+        return usage(argv[0], 1);
+
+    avformat_network_init();
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (!pid)
+        return reader(url, nb_msgs, size);
+
+    writer(url, nb_msgs, size, interval);
+    waitpid(pid, &status, 0);
+    avformat_network_deinit();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,618 @@
+/*
+ * RTP congestion control benchmark over an emulated bottleneck
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Stream synthetic foveated H.264 access units in real time with the RTP
+ * muxer through a token bucket shaper on the loopback interface, and
+ * depacketize them with the RTP demuxer, which sends congestion control
+ * feedback straight back to the muxer, e.g.
+ *
+ *     rtp_cc_bench -b 6000 -c 4000 -C 2000 -q 200
+ *
+ * The link capacity drops to the second value for the middle third of the
+ * run. The encoder is modelled by sizing each frame to the bitrate asked
+ * for, either fixed or the muxer's cc_bitrate of the previous frame, with
+ * slice sizes following the QP offsets libx264 applies for the foveation
+ * descriptor. Three runs are made:
+ *
+ *     fifo   no congestion control, fixed encoder bitrate
+ *     cc     congestion control feeding the encoder, nothing dropped
+ *     gaze   congestion control and gaze-priority scheduling
+ *
+ * Foveal latency is measured from av_write_frame() to the arrival of the
+ * last packet of the foveal slices, and to the demuxer handing out the last
+ * foveal slice, which needs all slices before it in decoding order too.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/common.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/lfg.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavcodec/put_bits.h"
+#include "libavformat/avformat.h"
+#include "libavformat/avio_internal.h"
+#include "libavformat/internal.h"
+#include "libavformat/network.h"
+#include "libavformat/rtpdec.h"
+#include "libavformat/rtpdec_formats.h"
+#include "libavformat/url.h"
+
+#define FPS            30
+#define MAX_SLICES     64
+#define MTU            1500
+#define QUEUE_PACKETS  8192
+#define REORDER_DELAY  100000
+
+typedef struct Frame {
+    int64_t send_time;
+    int nal_size[MAX_SLICES];
+    int foveal[MAX_SLICES];
+    int received[MAX_SLICES];
+    int64_t arrival[MAX_SLICES];  ///< packet completing the slice arrived
+    int64_t ready[MAX_SLICES];    ///< demuxer handed out the slice
+} Frame;
+
+typedef struct Datagram {
+    int64_t arrival;
+    int len;
+    uint8_t data[MTU];
+} Datagram;
+
+typedef struct Bench {
+    Frame *frames;
+    int nb_frames, nb_slices, mb_w, mb_h;
+    int port;
+    volatile int stop;
+    volatile int ready;
+    int error;
+
+    /* shaper */
+    int64_t start;
+    double rate[2];
+    int queue_ms;
+    int64_t forwarded_bytes, link_drops;
+
+    /* receiver */
+    int64_t arrival[65536];
+    RTPDemuxContext *rtp;
+    PayloadContext *payload;
+    AVFormatContext *ic;
+    Frame *cur_frame;
+    int cur_slice;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n frames] [-s slices] [-b encoder_kbps] [-c link_kbps] "
+            "[-C reduced_link_kbps] [-q queue_ms] [-r fovea_radius] [-d delta_qp] "
+            "[-g sigma] [-p port]\n", argv0);
+    return ret;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t va = *(const int64_t *)a, vb = *(const int64_t *)b;
+    return FFDIFFSIGN(va, vb);
+}
+
+static double link_rate(Bench *b, int64_t now)
+{
+    int64_t third = (int64_t)b->nb_frames * 1000000 / FPS / 3;
+    int64_t t = now - b->start;
+    return t >= third && t < 2 * third ? b->rate[1] : b->rate[0];
+}
+
+/* drop-tail queue in front of a link of the current capacity */
+static void *shaper(void *arg)
+{
+    Bench *b = arg;
+    struct sockaddr_in addr = { 0 }, dst = { 0 };
+    Datagram *q = av_malloc_array(QUEUE_PACKETS, sizeof(*q));
+    int fd, head = 0, count = 0, one = 1;
+    int64_t queued = 0, link_free = 0, done = 0;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(b->port);
+    dst                  = addr;
+    dst.sin_port         = htons(b->port + 4);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (!q || fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        b->error = AVERROR(EIO);
+        b->stop  = 1;
+        av_free(q);
+        return NULL;
+    }
+    b->ready = 2;
+
+    while (!b->stop) {
+        struct pollfd p = { fd, POLLIN, 0 };
+        int64_t now = av_gettime_relative(), timeout = 10000;
+        double rate = link_rate(b, now);
+
+        if (count) {
+            Datagram *d = &q[head];
+            if (!done)
+                done = FFMAX(link_free, d->arrival) + d->len * 8 * 1000000LL / rate;
+            if (now >= done) {
+                sendto(fd, d->data, d->len, 0, (struct sockaddr *)&dst, sizeof(dst));
+                b->forwarded_bytes += d->len;
+                queued   -= d->len;
+                link_free = done;
+                done      = 0;
+                head      = (head + 1) % QUEUE_PACKETS;
+                count--;
+                continue;
+            }
+            timeout = done - now;
+        }
+        poll(&p, 1, (timeout + 999) / 1000);
+        for (;;) {
+            Datagram *d = &q[(head + count) % QUEUE_PACKETS];
+            int len = recv(fd, d->data, MTU, MSG_DONTWAIT);
+            if (len <= 0)
+                break;
+            now = av_gettime_relative();
+            if (count == QUEUE_PACKETS ||
+                queued + len > link_rate(b, now) * b->queue_ms / 8000) {
+                b->link_drops++;
+                continue;
+            }
+            d->arrival = now;
+            d->len     = len;
+            queued    += len;
+            count++;
+        }
+    }
+    closesocket(fd);
+    av_free(q);
+    return NULL;
+}
+
+static int first_mb(const uint8_t *p, int size)
+{
+    int zeros = 0, bit = 0, v = 0, i;
+
+    while (bit < size * 8 && !((p[bit >> 3] >> (7 - (bit & 7))) & 1)) {
+        zeros++;
+        bit++;
+    }
+    for (i = 0, bit++; i < zeros && bit < size * 8; i++, bit++)
+        v = v << 1 | ((p[bit >> 3] >> (7 - (bit & 7))) & 1);
+    return v + (1 << zeros) - 1;
+}
+
+/*
+ * STAP-A packets come out of the demuxer as several NAL units with start
+ * codes, FU-A fragments one by one with a start code on the first only.
+ * The synthetic payload has no zero bytes, so start codes are unambiguous.
+ */
+static void deliver(Bench *b, AVPacket *pkt, int64_t now)
+{
+    int64_t f = (pkt->pts + 1500) / 3000;
+    int nb_mbs = b->mb_w * b->mb_h, pos = 0, i, mb, next;
+
+    while (pos < pkt->size) {
+        const uint8_t *p = pkt->data + pos;
+        int size = pkt->size - pos;
+
+        if (size > 5 && AV_RB32(p) == 1) {
+            mb = first_mb(p + 5, size - 5);
+            for (i = 0; i < b->nb_slices && i * nb_mbs / b->nb_slices != mb; i++)
+                ;
+            b->cur_frame = f >= 0 && f < b->nb_frames && i < b->nb_slices ?
+                           &b->frames[f] : NULL;
+            b->cur_slice = i;
+            p    += 4;
+            size -= 4;
+            pos  += 4;
+        }
+        for (next = 0; next + 4 <= size && AV_RB32(p + next) != 1; next++)
+            ;
+        if (next + 4 > size)
+            next = size;
+        pos += next;
+        if (b->cur_frame) {
+            Frame *fr = b->cur_frame;
+            i = b->cur_slice;
+            fr->received[i] += next;
+            fr->arrival[i]   = b->arrival[b->rtp->seq];
+            fr->ready[i]     = now;
+        }
+    }
+}
+
+static void receive(Bench *b, uint8_t *buf, int len)
+{
+    int64_t now = av_gettime_relative();
+    AVPacket pkt;
+    int ret;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    ret = ff_rtp_parse_packet(b->rtp, &pkt, buf ? &buf : NULL, len);
+    av_free(buf);
+    while (ret >= 0) {
+        if (pkt.size)
+            deliver(b, &pkt, now);
+        av_packet_unref(&pkt);
+        if (!ret)
+            break;
+        ret = ff_rtp_parse_packet(b->rtp, &pkt, NULL, 0);
+    }
+}
+
+static int interrupt_cb(void *opaque)
+{
+    Bench *b = opaque;
+    return b->stop;
+}
+
+static void *receiver(void *arg)
+{
+    Bench *b = arg;
+    AVIOInterruptCB cb = { interrupt_cb, b };
+    AVIOContext *in = NULL;
+    URLContext *h;
+    uint8_t buf[RTP_MAX_PACKET_LENGTH];
+    char url[256];
+    int len, ret;
+
+    snprintf(url, sizeof(url), "rtp://127.0.0.1:%d?localrtpport=%d&localrtcpport=%d",
+             b->port + 2, b->port + 4, b->port + 5);
+    ret = avio_open2(&in, url, AVIO_FLAG_READ_WRITE, &cb, NULL);
+    if (ret < 0) {
+        b->error = ret;
+        b->stop  = 1;
+        return NULL;
+    }
+    h = ffio_geturlcontext(in);
+    b->ready = 1;
+
+    while (!b->stop) {
+        uint8_t *copy;
+        int64_t now;
+
+        len = avio_read_partial(in, buf, sizeof(buf));
+        if (len < 0)
+            break;
+        now = av_gettime_relative();
+        if (len >= 12 && !RTP_PT_IS_RTCP(buf[1]))
+            b->arrival[AV_RB16(buf + 2)] = now;
+        if ((copy = av_memdup(buf, len)))
+            receive(b, copy, len);
+        /* give up on missing packets like the RTSP demuxer does */
+        while (b->rtp->queue_len &&
+               av_gettime_relative() - ff_rtp_queued_packet_time(b->rtp) > REORDER_DELAY)
+            receive(b, NULL, 0);
+        ff_rtp_send_rtcp_feedback(b->rtp, h, NULL);
+    }
+    avio_closep(&in);
+    return NULL;
+}
+
+/* foveal test of the muxer: any macroblock of the slice within radius * sigma */
+static int is_foveal(const float *d, float radius, int first, int end,
+                     int mb_w, int mb_h)
+{
+    float x = d[0] * mb_w, y = d[1] * mb_h;
+    float r = radius * d[2] * sqrtf(mb_w * mb_w + mb_h * mb_h);
+    int mb;
+
+    for (mb = first; mb < end; mb = (mb / mb_w + 1) * mb_w) {
+        int row = mb / mb_w, last = FFMIN(end, (row + 1) * mb_w) - 1;
+        float dx = av_clipf(x, mb % mb_w, last % mb_w) - x, dy = row - y;
+        if (dx * dx + dy * dy <= r * r)
+            return 1;
+    }
+    return 0;
+}
+
+static uint8_t *make_frame(Bench *b, Frame *fr, AVLFG *lfg, const float *d,
+                           float radius, int64_t bitrate, int *size)
+{
+    int nb_mbs = b->mb_w * b->mb_h, i, j, pos = 0;
+    double weight[MAX_SLICES], total = 0, bytes;
+    uint8_t *data;
+
+    /* bits follow the QP offset at the center of the slice, 6 QP per halving */
+    for (i = 0; i < b->nb_slices; i++) {
+        int mid = (i * nb_mbs / b->nb_slices + (i + 1) * nb_mbs / b->nb_slices) / 2;
+        float dx = mid % b->mb_w - d[0] * b->mb_w, dy = mid / b->mb_w - d[1] * b->mb_h;
+        float s = d[2] * sqrtf(b->mb_w * b->mb_w + b->mb_h * b->mb_h);
+        float qp = d[3] * (1 - expf(-(dx * dx + dy * dy) / (s * s)));
+        weight[i] = pow(2, -qp / 6.0);
+        total    += weight[i];
+    }
+    /* rate control is never exact */
+    bytes = bitrate / 8.0 / FPS * (0.75 + 0.5 * av_lfg_get(lfg) / UINT32_MAX);
+
+    data = av_malloc(bytes + b->nb_slices * 48);
+    if (!data)
+        return NULL;
+    for (i = 0; i < b->nb_slices; i++) {
+        int first = i * nb_mbs / b->nb_slices, start;
+        int len = FFMAX(40, bytes * weight[i] / total);
+        PutBitContext pb;
+
+        fr->foveal[i] = is_foveal(d, radius, first, (i + 1) * nb_mbs / b->nb_slices,
+                                  b->mb_w, b->mb_h);
+        AV_WB32(data + pos, 1);
+        start = pos + 4;
+        data[start] = 0x41;
+        pos = start + 1;
+        init_put_bits(&pb, data + pos, 8);
+        put_bits(&pb, 2 * av_log2(first + 1) + 1, first + 1);
+        while (put_bits_count(&pb) & 7)
+            put_bits(&pb, 1, 1);
+        flush_put_bits(&pb);
+        pos += put_bits_count(&pb) >> 3;
+        for (j = 0; j < len; j++)
+            data[pos++] = 1 + av_lfg_get(lfg) % 255;
+        fr->nal_size[i] = pos - start;
+    }
+    *size = pos;
+    return data;
+}
+
+static int run(const char *mode, Bench *b, int64_t bitrate, float radius,
+               double delta, double sigma)
+{
+    AVFormatContext *oc = NULL;
+    AVDictionary *opts = NULL;
+    AVStream *st, *ist;
+    pthread_t shaper_thread, receiver_thread;
+    int64_t *lat_arrival, *lat_ready, sum_arrival = 0, sum_ready = 0, rate_sum = 0;
+    int i, j, ret, complete = 0, periphery = 0, periphery_ok = 0;
+    int gaze = strcmp(mode, "fifo");
+    char url[256], arg[32];
+    AVLFG lfg;
+
+    memset(b->frames, 0, b->nb_frames * sizeof(*b->frames));
+    memset(b->arrival, 0, sizeof(b->arrival));
+    b->stop = b->ready = b->error = 0;
+    b->forwarded_bytes = b->link_drops = 0;
+    b->cur_frame = NULL;
+    av_lfg_init(&lfg, 1);
+
+    /* receiver */
+    b->ic = avformat_alloc_context();
+    if (!b->ic || !(ist = avformat_new_stream(b->ic, NULL)))
+        return AVERROR(ENOMEM);
+    ist->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    ist->codecpar->codec_id   = AV_CODEC_ID_H264;
+    avpriv_set_pts_info(ist, 32, 1, 90000);
+    b->rtp = ff_rtp_parse_open(b->ic, ist, 96, RTP_REORDER_QUEUE_DEFAULT_SIZE);
+    b->payload = av_mallocz(ff_h264_dynamic_handler.priv_data_size);
+    if (!b->rtp || !b->payload)
+        return AVERROR(ENOMEM);
+    ff_rtp_parse_set_dynamic_protocol(b->rtp, b->payload, &ff_h264_dynamic_handler);
+    b->rtp->ccfb = 1;
+    if (pthread_create(&receiver_thread, NULL, receiver, b))
+        return AVERROR(EINVAL);
+    while (!b->ready && !b->stop)
+        av_usleep(1000);
+    b->start = av_gettime_relative();
+    if (pthread_create(&shaper_thread, NULL, shaper, b)) {
+        b->stop = 1;
+        pthread_join(receiver_thread, NULL);
+        return AVERROR(EINVAL);
+    }
+    while (b->ready < 2 && !b->stop)
+        av_usleep(1000);
+
+    /* sender */
+    snprintf(url, sizeof(url), "rtp://127.0.0.1:%d?localrtpport=%d&localrtcpport=%d&pkt_size=1200",
+             b->port, b->port + 2, b->port + 3);
+    if ((ret = avformat_alloc_output_context2(&oc, NULL, "rtp", url)) < 0 ||
+        (ret = avio_open(&oc->pb, url, AVIO_FLAG_WRITE)) < 0)
+        goto fail;
+    st = avformat_new_stream(oc, NULL);
+    if (!st) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codecpar->codec_id   = AV_CODEC_ID_H264;
+    st->codecpar->width      = b->mb_w * 16;
+    st->codecpar->height     = b->mb_h * 16;
+    st->codecpar->bit_rate   = bitrate;
+    st->time_base            = (AVRational){ 1, 90000 };
+    av_dict_set(&opts, "rtpflags", "skip_rtcp", 0);
+    if (gaze) {
+        av_dict_set(&opts, "gaze_scheduler", "1", 0);
+        /* without dropping, everything counts as foveal */
+        snprintf(arg, sizeof(arg), "%f", strcmp(mode, "cc") ? radius : 100);
+        av_dict_set(&opts, "fovea_radius", arg, 0);
+    }
+    ret = avformat_write_header(oc, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        goto fail;
+
+    b->start = av_gettime_relative();
+    for (i = 0; i < b->nb_frames && !b->stop; i++) {
+        Frame *fr = &b->frames[i];
+        int64_t rate = bitrate, wait;
+        float d[4];
+        AVPacket pkt;
+        uint8_t *sd;
+
+        wait = b->start + i * 1000000LL / FPS - av_gettime_relative();
+        if (wait > 0)
+            av_usleep(wait);
+        if (gaze)
+            av_opt_get_int(oc->priv_data, "cc_bitrate", 0, &rate);
+        rate_sum += rate;
+
+        /* fixation drifting on a Lissajous path */
+        d[0] = 0.5 + 0.3 * sin(i * 0.05);
+        d[1] = 0.5 + 0.3 * sin(i * 0.031);
+        d[2] = sigma;
+        d[3] = delta;
+        av_init_packet(&pkt);
+        pkt.data = make_frame(b, fr, &lfg, d, radius, rate, &pkt.size);
+        if (!pkt.data) {
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        pkt.pts = pkt.dts = i * 3000LL;
+        sd = av_packet_new_side_data(&pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR, sizeof(d));
+        if (sd)
+            memcpy(sd, d, sizeof(d));
+        fr->send_time = av_gettime_relative();
+        ret = av_write_frame(oc, &pkt);
+        av_packet_free_side_data(&pkt);
+        av_free(pkt.data);
+        if (ret < 0)
+            break;
+    }
+    av_write_trailer(oc);
+    /* drain the bottleneck queue */
+    av_usleep(1000000);
+
+fail:
+    b->stop = 1;
+    pthread_join(shaper_thread, NULL);
+    pthread_join(receiver_thread, NULL);
+    if (oc)
+        avio_closep(&oc->pb);
+    avformat_free_context(oc);
+    ff_rtp_parse_close(b->rtp);
+    av_freep(&b->payload);
+    avformat_free_context(b->ic);
+    if (ret < 0 || b->error < 0)
+        return ret < 0 ? ret : b->error;
+
+    lat_arrival = av_malloc_array(b->nb_frames, sizeof(*lat_arrival));
+    lat_ready   = av_malloc_array(b->nb_frames, sizeof(*lat_ready));
+    if (!lat_arrival || !lat_ready)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < b->nb_frames; i++) {
+        Frame *fr = &b->frames[i];
+        int64_t arrival = 0, ready = 0;
+        int ok = 1;
+
+        for (j = 0; j < b->nb_slices; j++) {
+            int got = fr->received[j] == fr->nal_size[j];
+            if (fr->foveal[j]) {
+                ok     &= got;
+                arrival = FFMAX(arrival, fr->arrival[j]);
+                ready   = FFMAX(ready, fr->ready[j]);
+            } else {
+                periphery++;
+                periphery_ok += got;
+            }
+        }
+        if (ok && arrival) {
+            lat_arrival[complete] = arrival - fr->send_time;
+            lat_ready[complete]   = ready - fr->send_time;
+            sum_arrival += lat_arrival[complete];
+            sum_ready   += lat_ready[complete];
+            complete++;
+        }
+    }
+    qsort(lat_arrival, complete, sizeof(*lat_arrival), cmp_int64);
+    qsort(lat_ready, complete, sizeof(*lat_ready), cmp_int64);
+
+    printf("%-5s target %5.2f Mbit/s  link %5.2f Mbit/s, %5"PRId64" drops  "
+           "fovea complete %5.1f%%  latency %6.1f/%6.1f ms  ready %6.1f/%6.1f ms  "
+           "periphery %5.1f%%\n", mode,
+           rate_sum / 1e6 / b->nb_frames,
+           b->forwarded_bytes * 8.0 * FPS / b->nb_frames / 1e6, b->link_drops,
+           100.0 * complete / b->nb_frames,
+           complete ? sum_arrival / 1000.0 / complete : 0.0,
+           complete ? lat_arrival[complete * 95 / 100] / 1000.0 : 0.0,
+           complete ? sum_ready / 1000.0 / complete : 0.0,
+           complete ? lat_ready[complete * 95 / 100] / 1000.0 : 0.0,
+           periphery ? 100.0 * periphery_ok / periphery : 0.0);
+    av_free(lat_arrival);
+    av_free(lat_ready);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static Bench b = { .nb_frames = 600, .nb_slices = 16, .mb_w = 80, .mb_h = 45,
+                       .port = 46000, .queue_ms = 200 };
+    int64_t bitrate = 6000000;
+    double delta = 12, sigma = 0.15, radius = 0.5;
+    int i, ret = 0;
+
+    b.rate[0] = 4000000;
+    b.rate[1] = 2000000;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            b.nb_slices = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            bitrate = atoi(argv[++i]) * 1000LL;
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            b.rate[0] = atoi(argv[++i]) * 1000.0;
+        } else if (!strcmp(argv[i], "-C") && i + 1 < argc) {
+            b.rate[1] = atoi(argv[++i]) * 1000.0;
+        } else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+            b.queue_ms = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            sigma = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            b.port = atoi(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_frames < 3 || b.nb_slices <= 0 || b.nb_slices > MAX_SLICES ||
+        bitrate <= 0 || b.rate[0] <= 0 || b.rate[1] <= 0 || b.queue_ms <= 0)
+        return usage(argv[0], 1);
+
+    av_log_set_level(AV_LOG_ERROR);
+    avformat_network_init();
+    b.frames = av_malloc_array(b.nb_frames, sizeof(*b.frames));
+    if (!b.frames)
+        return 1;
+
+    printf("%d frames, %d slices, encoder %.2f Mbit/s, link %.2f Mbit/s "
+           "(%.2f in the middle third), %d ms queue\n", b.nb_frames, b.nb_slices,
+           bitrate / 1e6, b.rate[0] / 1e6, b.rate[1] / 1e6, b.queue_ms);
+    if ((ret = run("fifo", &b, bitrate, radius, delta, sigma)) < 0 ||
+        (ret = run("cc",   &b, bitrate, radius, delta, sigma)) < 0 ||
+        (ret = run("gaze", &b, bitrate, radius, delta, sigma)) < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    av_free(b.frames);
+    avformat_network_deinit();
+    return ret < 0;
+}
@@ -0,0 +1,398 @@
+/*
+ * RTP FEC loss-injection benchmark
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Packetize synthetic foveated H.264 access units with the RTP muxer, drop
+ * packets at random and depacketize the rest with the RTP demuxer, once
+ * without FEC, once with uniform FEC and once with FEC weighted toward the
+ * foveal slices, e.g.
+ *
+ *     rtp_fec_bench -l 5 -u 4 -f 2 -p 0
+ *
+ * Slice sizes follow the QP offsets libx264 applies for the foveation
+ * descriptor, and the fixation point wanders across the frame. The same
+ * seed is used for every run, so all runs see the same loss process.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/lfg.h"
+#include "libavcodec/put_bits.h"
+#include "libavformat/avformat.h"
+#include "libavformat/internal.h"
+#include "libavformat/rtpdec.h"
+#include "libavformat/rtpdec_formats.h"
+
+#define FEC_PT  97
+#define MAX_SLICES 64
+
+typedef struct Frame {
+    uint8_t *data;
+    int size;
+    int nb_slices;
+    int offset[MAX_SLICES + 1];
+    int foveal[MAX_SLICES];
+    uint8_t *received;
+    int received_size;
+} Frame;
+
+typedef struct Bench {
+    AVLFG lfg;
+    double loss;
+    int64_t media_bytes, fec_bytes;
+    int media_packets, fec_packets, lost;
+    RTPDemuxContext *rtp;
+    PayloadContext *payload;
+    AVFormatContext *ic;
+    Frame *frames;
+    int nb_frames;
+} Bench;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n frames] [-s slices] [-l loss_percent] [-u uniform_k] "
+            "[-f fovea_k] [-p periphery_k] [-r fovea_radius] [-d delta_qp] [-g sigma]\n",
+            argv0);
+    return ret;
+}
+
+static void receive(Bench *b, uint8_t *buf, int len)
+{
+    AVPacket pkt;
+    int ret;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    ret = ff_rtp_parse_packet(b->rtp, &pkt, buf ? &buf : NULL, len);
+    av_free(buf);
+    while (ret >= 0) {
+        int64_t f = pkt.size ? (pkt.pts + 1500) / 3000 : -1;
+        if (f >= 0 && f < b->nb_frames) {
+            Frame *fr = &b->frames[f];
+            if (fr->received_size + pkt.size <= 2 * fr->size) {
+                memcpy(fr->received + fr->received_size, pkt.data, pkt.size);
+                fr->received_size += pkt.size;
+            }
+        }
+        av_packet_unref(&pkt);
+        if (!ret)
+            break;
+        ret = ff_rtp_parse_packet(b->rtp, &pkt, NULL, 0);
+    }
+}
+
+static int write_packet(void *opaque, uint8_t *buf, int size)
+{
+    Bench *b = opaque;
+    int fec = size >= 12 && (buf[1] & 0x7f) == FEC_PT;
+    uint8_t *copy;
+
+    if (size < 12 || RTP_PT_IS_RTCP(buf[1]))
+        return size;
+    if (fec) {
+        b->fec_bytes += size;
+        b->fec_packets++;
+    } else {
+        b->media_bytes += size;
+        b->media_packets++;
+    }
+    if (av_lfg_get(&b->lfg) < b->loss * UINT32_MAX) {
+        b->lost++;
+        return size;
+    }
+    copy = av_memdup(buf, size);
+    if (copy)
+        receive(b, copy, size);
+    return size;
+}
+
+static int contains(const uint8_t *buf, int size, const uint8_t *needle, int len)
+{
+    int i;
+
+    for (i = 0; i + len <= size; i++)
+        if (!memcmp(buf + i, needle, len))
+            return 1;
+    return 0;
+}
+
+/* foveal test of the muxer: any macroblock of the slice within radius * sigma */
+static int is_foveal(const float *d, float radius, int first_mb, int end_mb,
+                     int mb_w, int mb_h)
+{
+    float x = d[0] * mb_w, y = d[1] * mb_h;
+    float r = radius * d[2] * sqrtf(mb_w * mb_w + mb_h * mb_h);
+    int mb;
+
+    for (mb = first_mb; mb < end_mb; mb = (mb / mb_w + 1) * mb_w) {
+        int row = mb / mb_w, last = FFMIN(end_mb, (row + 1) * mb_w) - 1;
+        float dx = av_clipf(x, mb % mb_w, last % mb_w) - x, dy = row - y;
+        if (dx * dx + dy * dy <= r * r)
+            return 1;
+    }
+    return 0;
+}
+
+static int make_frame(Frame *fr, AVLFG *lfg, const float *d, float radius,
+                      int idx, int nb_slices, int mb_w, int mb_h)
+{
+    int nb_mbs = mb_w * mb_h, i, j, pos = 0;
+    int sizes[MAX_SLICES], total = 0;
+
+    /* bits follow the QP offset at the center of the slice, 6 QP per halving */
+    for (i = 0; i < nb_slices; i++) {
+        int mid = (i * nb_mbs / nb_slices + (i + 1) * nb_mbs / nb_slices) / 2;
+        float dx = (mid % mb_w - d[0] * mb_w), dy = (mid / mb_w - d[1] * mb_h);
+        float s = d[2] * sqrtf(mb_w * mb_w + mb_h * mb_h);
+        float qp = d[3] * (1 - expf(-(dx * dx + dy * dy) / (s * s)));
+        sizes[i] = 40 + 4000 * nb_mbs / nb_slices / 510 * pow(2, -qp / 6.0) * (idx ? 1 : 4);
+        total   += sizes[i] + 12;
+    }
+
+    fr->data     = av_malloc(total);
+    fr->received = av_malloc(2 * total);
+    if (!fr->data || !fr->received)
+        return AVERROR(ENOMEM);
+    fr->nb_slices = nb_slices;
+
+    for (i = 0; i < nb_slices; i++) {
+        int first_mb = i * nb_mbs / nb_slices;
+        PutBitContext pb;
+
+        fr->offset[i] = pos;
+        fr->foveal[i] = is_foveal(d, radius, first_mb, (i + 1) * nb_mbs / nb_slices,
+                                  mb_w, mb_h);
+        AV_WB32(fr->data + pos, 1);
+        fr->data[pos + 4] = idx ? 0x41 : 0x65;
+        pos += 5;
+        init_put_bits(&pb, fr->data + pos, 8);
+        /* ue(v) first_mb_in_slice */
+        put_bits(&pb, 2 * av_log2(first_mb + 1) + 1, first_mb + 1);
+        /* no zero bytes in the rest, to avoid start code emulation */
+        while (put_bits_count(&pb) & 7)
+            put_bits(&pb, 1, 1);
+        flush_put_bits(&pb);
+        pos += put_bits_count(&pb) >> 3;
+        for (j = 0; j < sizes[i]; j++)
+            fr->data[pos++] = 1 + av_lfg_get(lfg) % 255;
+    }
+    fr->offset[nb_slices] = pos;
+    fr->size = pos;
+    return 0;
+}
+
+static int run(const char *name, Frame *frames, float (*desc)[4], int nb_frames,
+               int mb_w, int mb_h, double loss, float radius, int fovea_k,
+               int periphery_k, int use_fec)
+{
+    Bench b = { .loss = loss, .frames = frames, .nb_frames = nb_frames };
+    AVFormatContext *oc = NULL;
+    AVDictionary *opts = NULL;
+    AVStream *st, *ist;
+    uint8_t *iobuf;
+    char arg[32];
+    int i, j, ret, intact = 0, fovea = 0, fovea_ok = 0, periphery = 0, periphery_ok = 0;
+
+    av_lfg_init(&b.lfg, 0x1234);
+    for (i = 0; i < nb_frames; i++)
+        frames[i].received_size = 0;
+
+    /* receiver */
+    b.ic = avformat_alloc_context();
+    if (!b.ic || !(ist = avformat_new_stream(b.ic, NULL)))
+        return AVERROR(ENOMEM);
+    ist->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    ist->codecpar->codec_id   = AV_CODEC_ID_H264;
+    avpriv_set_pts_info(ist, 32, 1, 90000);
+    b.rtp = ff_rtp_parse_open(b.ic, ist, 96, 256);
+    if (!b.rtp)
+        return AVERROR(ENOMEM);
+    b.payload = av_mallocz(ff_h264_dynamic_handler.priv_data_size);
+    if (!b.payload)
+        return AVERROR(ENOMEM);
+    ff_rtp_parse_set_dynamic_protocol(b.rtp, b.payload, &ff_h264_dynamic_handler);
+    if (use_fec)
+        b.rtp->fec_payload_type = FEC_PT;
+
+    /* sender */
+    ret = avformat_alloc_output_context2(&oc, NULL, "rtp", NULL);
+    if (ret < 0)
+        return ret;
+    iobuf = av_malloc(1500);
+    oc->pb = avio_alloc_context(iobuf, 1500, 1, &b, NULL, write_packet, NULL);
+    if (!iobuf || !oc->pb)
+        return AVERROR(ENOMEM);
+    oc->pb->max_packet_size = 1500;
+    oc->packet_size = 1400;
+    oc->flags |= AVFMT_FLAG_BITEXACT;
+    st = avformat_new_stream(oc, NULL);
+    if (!st)
+        return AVERROR(ENOMEM);
+    st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codecpar->codec_id   = AV_CODEC_ID_H264;
+    st->codecpar->width      = mb_w * 16;
+    st->codecpar->height     = mb_h * 16;
+    st->time_base            = (AVRational){ 1, 90000 };
+    if (use_fec) {
+        av_dict_set_int(&opts, "fec_pt", FEC_PT, 0);
+        av_dict_set_int(&opts, "fec_fovea_k", fovea_k, 0);
+        av_dict_set_int(&opts, "fec_periphery_k", periphery_k, 0);
+        snprintf(arg, sizeof(arg), "%f", radius);
+        av_dict_set(&opts, "fovea_radius", arg, 0);
+    }
+    av_dict_set(&opts, "rtpflags", "skip_rtcp", 0);
+    ret = avformat_write_header(oc, &opts);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    for (i = 0; i < nb_frames; i++) {
+        AVPacket pkt;
+        uint8_t *sd;
+
+        av_init_packet(&pkt);
+        pkt.data = frames[i].data;
+        pkt.size = frames[i].size;
+        pkt.pts  = pkt.dts = i * 3000LL;
+        sd = av_packet_new_side_data(&pkt, AV_PKT_DATA_FOVEATION_DESCRIPTOR, sizeof(desc[i]));
+        if (!sd)
+            return AVERROR(ENOMEM);
+        memcpy(sd, desc[i], sizeof(desc[i]));
+        ret = av_write_frame(oc, &pkt);
+        av_packet_free_side_data(&pkt);
+        if (ret < 0)
+            return ret;
+    }
+    av_write_trailer(oc);
+    /* drain the reordering queue */
+    while (b.rtp->queue_len > 0)
+        receive(&b, NULL, 0);
+
+    for (i = 0; i < nb_frames; i++) {
+        Frame *fr = &frames[i];
+        if (fr->received_size == fr->size && !memcmp(fr->received, fr->data, fr->size))
+            intact++;
+        for (j = 0; j < fr->nb_slices; j++) {
+            int len = fr->offset[j + 1] - fr->offset[j];
+            int ok  = contains(fr->received, fr->received_size, fr->data + fr->offset[j], len);
+            if (fr->foveal[j]) {
+                fovea++;
+                fovea_ok += ok;
+            } else {
+                periphery++;
+                periphery_ok += ok;
+            }
+        }
+    }
+
+    printf("%-10s overhead %5.1f%%  lost %5d/%-6d  frames intact %5.1f%%  "
+           "foveal slices %5.1f%%  peripheral slices %5.1f%%\n", name,
+           100.0 * b.fec_bytes / b.media_bytes, b.lost,
+           b.media_packets + b.fec_packets, 100.0 * intact / nb_frames,
+           fovea ? 100.0 * fovea_ok / fovea : 0.0,
+           periphery ? 100.0 * periphery_ok / periphery : 0.0);
+
+    ff_rtp_parse_close(b.rtp);
+    av_free(b.payload);
+    avformat_free_context(b.ic);
+    av_freep(&oc->pb->buffer);
+    avio_context_free(&oc->pb);
+    avformat_free_context(oc);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int nb_frames = 300, nb_slices = 16, uniform_k = 4, fovea_k = 2, periphery_k = 0;
+    int mb_w = 120, mb_h = 68, i, ret = 0;
+    double loss = 5, delta = 12, sigma = 0.15, radius = 0.5;
+    float (*desc)[4];
+    Frame *frames;
+    AVLFG lfg;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            nb_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            nb_slices = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            loss = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+            uniform_k = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            fovea_k = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            periphery_k = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            delta = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+            sigma = atof(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (nb_frames <= 0 || nb_slices <= 0 || nb_slices > MAX_SLICES ||
+        loss < 0 || loss > 100 || uniform_k < 0 || fovea_k < 0 || periphery_k < 0)
+        return usage(argv[0], 1);
+
+    av_log_set_level(AV_LOG_ERROR);
+    av_lfg_init(&lfg, 1);
+    frames = av_mallocz_array(nb_frames, sizeof(*frames));
+    desc   = av_malloc_array(nb_frames, sizeof(*desc));
+    if (!frames || !desc)
+        return 1;
+    for (i = 0; i < nb_frames; i++) {
+        /* fixation drifting on a Lissajous path */
+        desc[i][0] = 0.5 + 0.3 * sin(i * 0.05);
+        desc[i][1] = 0.5 + 0.3 * sin(i * 0.031);
+        desc[i][2] = sigma;
+        desc[i][3] = delta;
+        if (make_frame(&frames[i], &lfg, desc[i], radius, i, nb_slices, mb_w, mb_h) < 0)
+            return 1;
+    }
+
+    printf("%d frames, %d slices, %.1f%% loss, uniform k=%d, foveated k=%d/%d\n",
+           nb_frames, nb_slices, loss, uniform_k, fovea_k, periphery_k);
+    loss /= 100;
+    if ((ret = run("none",     frames, desc, nb_frames, mb_w, mb_h, loss, radius, 0, 0, 0)) < 0 ||
+        (ret = run("uniform",  frames, desc, nb_frames, mb_w, mb_h, loss, radius,
+                   uniform_k, uniform_k, 1)) < 0 ||
+        (ret = run("foveated", frames, desc, nb_frames, mb_w, mb_h, loss, radius,
+                   fovea_k, periphery_k, 1)) < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    for (i = 0; i < nb_frames; i++) {
+        av_free(frames[i].data);
+        av_free(frames[i].received);
+    }
+    av_free(frames);
+    av_free(desc);
+    return ret < 0;
+}
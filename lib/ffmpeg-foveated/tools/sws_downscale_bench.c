@@ -0,0 +1,166 @@
+/*
+ * Speed of integer-ratio downscales in libswscale
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Time 2x, 4x and 8x downscales of a YUV420P frame through the generic
+ * bilinear scaler, the SWS_AREA fast path with and without SIMD, and a
+ * three-level sws_downscale_pyramid(), e.g.
+ *
+ *     sws_downscale_bench -s 3840x2160 -n 50
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/cpu.h"
+#include "libavutil/frame.h"
+#include "libavutil/lfg.h"
+#include "libavutil/time.h"
+#include "libswscale/swscale.h"
+
+#define LEVELS 3
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n frames] [-s WxH]\n", argv0);
+    return ret;
+}
+
+static AVFrame *alloc_frame(int w, int h)
+{
+    AVFrame *f = av_frame_alloc();
+
+    if (!f)
+        return NULL;
+    f->width  = w;
+    f->height = h;
+    f->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(f, 32) < 0)
+        av_frame_free(&f);
+    return f;
+}
+
+static int run_sws(const AVFrame *src, AVFrame *dst, int flags, const char *name, int n)
+{
+    struct SwsContext *sws;
+    int64_t t = 0;
+    int i;
+
+    sws = sws_getContext(src->width, src->height, src->format,
+                         dst->width, dst->height, dst->format, flags, NULL, NULL, NULL);
+    if (!sws)
+        return AVERROR(EINVAL);
+    for (i = 0; i < n; i++) {
+        int64_t t0 = av_gettime_relative();
+        sws_scale(sws, (const uint8_t * const *)src->data, src->linesize, 0, src->height,
+                  dst->data, dst->linesize);
+        t += av_gettime_relative() - t0;
+    }
+    sws_freeContext(sws);
+    printf("  %-16s %7.2f ms/frame\n", name, t / 1000.0 / n);
+    return 0;
+}
+
+static int run_pyramid(const AVFrame *src, AVFrame **lvl, const char *name, int n)
+{
+    uint8_t *dst[LEVELS][4];
+    int dst_stride[LEVELS][4];
+    int64_t t = 0;
+    int i, l, ret;
+
+    for (l = 0; l < LEVELS; l++) {
+        memcpy(dst[l], lvl[l]->data, sizeof(dst[l]));
+        memcpy(dst_stride[l], lvl[l]->linesize, sizeof(dst_stride[l]));
+    }
+    for (i = 0; i < n; i++) {
+        int64_t t0 = av_gettime_relative();
+        ret = sws_downscale_pyramid((const uint8_t * const *)src->data, src->linesize,
+                                    src->width, src->height, src->format, LEVELS,
+                                    dst, dst_stride);
+        t += av_gettime_relative() - t0;
+        if (ret < 0)
+            return ret;
+    }
+    printf("  %-16s %7.2f ms/frame\n", name, t / 1000.0 / n);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    AVFrame *src, *lvl[LEVELS] = { NULL };
+    AVLFG lfg;
+    int w = 3840, h = 2160, n = 50;
+    int i, p, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            n = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &w, &h) != 2)
+                return usage(argv[0], 1);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (n < 1 || w < 16 << LEVELS || h < 16 << LEVELS || (w | h) & ((2 << LEVELS) - 1))
+        return usage(argv[0], 1);
+
+    if (!(src = alloc_frame(w, h)))
+        return 1;
+    av_lfg_init(&lfg, 0xdeadbeef);
+    for (p = 0; p < 3; p++) {
+        int y, x, ph = p ? h / 2 : h, pw = p ? w / 2 : w;
+        for (y = 0; y < ph; y++)
+            for (x = 0; x < pw; x++)
+                src->data[p][y * src->linesize[p] + x] = av_lfg_get(&lfg);
+    }
+    for (i = 0; i < LEVELS; i++)
+        if (!(lvl[i] = alloc_frame(w >> (i + 1), h >> (i + 1))))
+            return 1;
+
+    printf("%d frames %dx%d yuv420p\n", n, w, h);
+    for (i = 0; i < LEVELS && ret >= 0; i++) {
+        printf("%dx -> %dx%d\n", 2 << i, lvl[i]->width, lvl[i]->height);
+        av_force_cpu_flags(-1);
+        if ((ret = run_sws(src, lvl[i], SWS_BILINEAR, "bilinear", n)) < 0 ||
+            (ret = run_sws(src, lvl[i], SWS_AREA, "area", n)) < 0)
+            break;
+        av_force_cpu_flags(0);
+        ret = run_sws(src, lvl[i], SWS_AREA, "area, no simd", n);
+    }
+    if (ret >= 0) {
+        printf("pyramid 2x+4x+8x\n");
+        av_force_cpu_flags(-1);
+        if ((ret = run_pyramid(src, lvl, "pyramid", n)) >= 0) {
+            av_force_cpu_flags(0);
+            ret = run_pyramid(src, lvl, "pyramid, no simd", n);
+        }
+    }
+    if (ret < 0)
+        fprintf(stderr, "Benchmark failed: %s\n", av_err2str(ret));
+
+    av_frame_free(&src);
+    for (i = 0; i < LEVELS; i++)
+        av_frame_free(&lvl[i]);
+    return ret < 0;
+}
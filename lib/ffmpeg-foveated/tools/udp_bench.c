@@ -0,0 +1,185 @@
+/*
+ * UDP loopback throughput benchmark
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Send a fixed number of datagrams through the udp protocol over the
+ * loopback interface and report packets/s and CPU time per Mbit, e.g.
+ *
+ *     udp_bench -n 200000 -s 1200 -b 1
+ *     udp_bench -n 200000 -s 1200 -b 32
+ *
+ * to compare per-datagram syscalls against recvmmsg/sendmmsg batching.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
+
+#include "libavutil/intreadwrite.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+
+typedef struct BenchContext {
+    char url[256];
+    int nb_packets;
+    int pkt_size;
+    int sent;
+    int error;
+} BenchContext;
+
+static int usage(const char *argv0, int ret)
+{
+    fprintf(stderr, "%s [-n packets] [-s size] [-b batch_size] [-p port] [-f fifo_size]\n", argv0);
+    return ret;
+}
+
+static int64_t cpu_time(void)
+{
+#if HAVE_GETRUSAGE
+    struct rusage rusage;
+
+    getrusage(RUSAGE_SELF, &rusage);
+    return (rusage.ru_utime.tv_sec * 1000000LL) + rusage.ru_utime.tv_usec +
+           (rusage.ru_stime.tv_sec * 1000000LL) + rusage.ru_stime.tv_usec;
+#else
+    return av_gettime_relative();
+#endif
+}
+
+static void *sender(void *arg)
+{
+    BenchContext *b = arg;
+    AVIOContext *out = NULL;
+    uint8_t *buf;
+    int i, ret;
+
+    ret = avio_open2(&out, b->url, AVIO_FLAG_WRITE, NULL, NULL);
+    buf = av_mallocz(b->pkt_size);
+    if (ret < 0 || !buf) {
+        b->error = ret < 0 ? ret : AVERROR(ENOMEM);
+        av_free(buf);
+        return NULL;
+    }
+
+    for (i = 0; i < b->nb_packets; i++) {
+        AV_WL32(buf, i);
+        avio_write(out, buf, b->pkt_size);
+        avio_flush(out);
+        if (out->error) {
+            b->error = out->error;
+            break;
+        }
+    }
+    b->sent = i;
+
+    avio_closep(&out);
+    av_free(buf);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    BenchContext b = { .nb_packets = 100000, .pkt_size = 1200 };
+    int batch_size = 1, port = 45678, fifo_size = 7 * 4096, i, ret;
+    int64_t received = 0, bytes = 0, start, last, wall, cpu;
+    char in_url[256];
+    AVIOContext *in = NULL;
+    pthread_t thread;
+    uint8_t *buf;
+    double mbit;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            b.nb_packets = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            b.pkt_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            batch_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            fifo_size = atoi(argv[++i]);
+        } else {
+            return usage(argv[0], 1);
+        }
+    }
+    if (b.nb_packets <= 0 || b.pkt_size < 4 || b.pkt_size > 65507 || batch_size <= 0)
+        return usage(argv[0], 1);
+
+    avformat_network_init();
+
+    snprintf(in_url, sizeof(in_url),
+             "udp://127.0.0.1:%d?fifo_size=%d&batch_size=%d&overrun_nonfatal=1&timeout=500000",
+             port, fifo_size, batch_size);
+    snprintf(b.url, sizeof(b.url),
+             "udp://127.0.0.1:%d?pkt_size=%d&fifo_size=%d&batch_size=%d",
+             port, b.pkt_size, fifo_size, batch_size);
+
+    ret = avio_open2(&in, in_url, AVIO_FLAG_READ, NULL, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", in_url, av_err2str(ret));
+        return 1;
+    }
+    buf = av_malloc(65536);
+    if (!buf)
+        return 1;
+
+    start = last = av_gettime_relative();
+    cpu   = cpu_time();
+    if (pthread_create(&thread, NULL, sender, &b)) {
+        fprintf(stderr, "pthread_create failed\n");
+        return 1;
+    }
+
+    while (received < b.nb_packets) {
+        ret = avio_read_partial(in, buf, 65536);
+        if (ret < 0)
+            break;
+        received++;
+        bytes += ret;
+        last = av_gettime_relative();
+    }
+    /* do not count the final read timeout if datagrams were lost */
+    wall = FFMAX(last - start, 1);
+    cpu  = cpu_time() - cpu;
+
+    pthread_join(thread, NULL);
+    if (b.error < 0)
+        fprintf(stderr, "Sender failed: %s\n", av_err2str(b.error));
+
+    mbit = bytes * 8 / 1000000.0;
+    printf("batch_size %d, %d byte datagrams\n", batch_size, b.pkt_size);
+    printf("sent %d, received %"PRId64" (%.2f%% loss)\n", b.sent, received,
+           b.sent ? 100.0 * (b.sent - received) / b.sent : 0.0);
+    printf("%.0f packets/s, %.1f Mbit/s, %.3f ms CPU per Mbit\n",
+           received * 1000000.0 / wall, mbit * 1000000.0 / wall,
+           mbit > 0 ? cpu / 1000.0 / mbit : 0.0);
+
+    avio_closep(&in);
+    av_free(buf);
+    avformat_network_deinit();
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "autotune.h"
+#include "pexit.h"
+
+#include <libavutil/cpu.h>
+#include <libavutil/time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HOST_SIZE 64
+
+/* by increasing quality and cost, none slower than medium keeps realtime */
+static const char *presets[] = {
+	"ultrafast", "superfast", "veryfast", "faster", "fast", "medium", NULL,
+};
+
+typedef struct trial {
+	enc_tuning t;
+	double fps; //achieved
+	double latency; //95th percentile in ms
+	int pass;
+} trial;
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int load(const char *host, const char *codec, int width, int height,
+		double fps, enc_tuning *t)
+{
+	char line[256], h[HOST_SIZE], c[32], preset[sizeof(t->preset)];
+	int w, ht, threads, sliced, found = 0;
+	double f;
+	FILE *file;
+
+	file = fopen(AUTOTUNE_PATH, "r");
+	if (!file)
+		return 0;
+	/* the last entry counts, delete it to calibrate again */
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%63[^,],%31[^,],%d,%d,%lf,%15[^,],%d,%d", h, c, &w, &ht,
+			   &f, preset, &threads, &sliced) != 8)
+			continue;
+		if (strcmp(h, host) || strcmp(c, codec) || w != width || ht != height ||
+		    fabs(f - fps) > 0.01)
+			continue;
+		strcpy(t->preset, preset);
+		t->threads = threads;
+		t->sliced = sliced;
+		found = 1;
+	}
+	fclose(file);
+	return found;
+}
+
+static void store(const char *host, const char *codec, int width, int height,
+		  double fps, const trial *r)
+{
+	FILE *file;
+	long size;
+
+	file = fopen(AUTOTUNE_PATH, "a");
+	if (!file) {
+		perror("cannot store the autotuner's result");
+		return;
+	}
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	if (size == 0)
+		fprintf(file, "host,codec,width,height,fps,preset,threads,sliced,"
+			"measured_fps,p95_latency_ms\n");
+	fprintf(file, "%s,%s,%d,%d,%.3f,%s,%d,%d,%.1f,%.2f\n", host, codec, width,
+		height, fps, r->t.preset, r->t.threads, r->t.sliced, r->fps, r->latency);
+	fclose(file);
+}
+
+/* something to search motion in, frames are windows moving across it */
+static uint8_t *texture_alloc(int width, int height, int *stride)
+{
+	uint8_t *tex;
+	int x, y;
+
+	*stride = width + 3 * AUTOTUNE_FRAMES;
+	tex = malloc((size_t) *stride * (height + AUTOTUNE_FRAMES));
+	if (!tex)
+		pexit("malloc failed");
+	for (y = 0; y < height + AUTOTUNE_FRAMES; y++) {
+		for (x = 0; x < *stride; x++)
+			tex[y * *stride + x] = (x ^ y) * 7 + ((x * 13 + y * 29) & 15);
+	}
+	return tex;
+}
+
+/* frame i of the clip, copied as it runs within the frame interval */
+static void fill_frame(AVFrame *frame, int i, const uint8_t *tex, int stride)
+{
+	int y;
+
+	for (y = 0; y < frame->height; y++)
+		memcpy(frame->data[0] + y * frame->linesize[0],
+		       tex + (y + i) * stride + 3 * i, frame->width);
+	for (y = 0; y < frame->height / 2; y++) {
+		memset(frame->data[1] + y * frame->linesize[1], 128 + (y + i) % 32,
+		       frame->width / 2);
+		memset(frame->data[2] + y * frame->linesize[2], 128 - (y + i) % 32,
+		       frame->width / 2);
+	}
+}
+
+/* encode the clip paced at fps, 0 if the encoder cannot be opened */
+static int measure(enc_id id, AVCodec *codec, int width, int height,
+		   AVRational frame_rate, double fps, trial *r)
+{
+	AVCodecContext *avctx;
+	AVDictionary *options = NULL;
+	AVFrameSideData *sd;
+	AVFrame *frame;
+	AVPacket *pkt;
+	int64_t sent[AUTOTUNE_FRAMES];
+	double latency[AUTOTUNE_FRAMES];
+	/* centered, as the map costs the same wherever the fovea is */
+	const float descr[5] = { 0.5, 0.5, 0.1, 10, 0 };
+	int64_t start, now, due, lag = 0;
+	uint8_t *tex;
+	int i, ret, stride, received = 0, counted = 0;
+
+	set_encoder_tuning(&r->t);
+	set_codec_options(&options, id);
+	set_encoder_tuning(NULL);
+
+	avctx = avcodec_alloc_context3(codec);
+	pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	if (!avctx || !pkt || !frame)
+		pexit("allocation failed");
+	avctx->time_base = av_inv_q(frame_rate);
+	avctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	avctx->width = width;
+	avctx->height = height;
+	ret = avcodec_open2(avctx, codec, &options);
+	av_dict_free(&options);
+	if (ret < 0) {
+		avcodec_free_context(&avctx);
+		av_packet_free(&pkt);
+		av_frame_free(&frame);
+		return 0;
+	}
+
+	tex = texture_alloc(width, height, &stride);
+	start = av_gettime_relative();
+	for (i = 0; i <= AUTOTUNE_FRAMES; i++) {
+		if (i < AUTOTUNE_FRAMES) {
+			frame->format = AV_PIX_FMT_YUV420P;
+			frame->width = width;
+			frame->height = height;
+			if (av_frame_get_buffer(frame, 32) < 0)
+				pexit("av_frame_get_buffer failed");
+			fill_frame(frame, i, tex, stride);
+			frame->pts = i;
+			sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+						    sizeof(descr));
+			if (!sd)
+				pexit("side data allocation failed");
+			memcpy(sd->data, descr, sizeof(descr));
+
+			due = start + i * 1000000 / fps;
+			now = av_gettime_relative();
+			if (now < due)
+				av_usleep(due - now);
+			sent[i] = av_gettime_relative();
+			lag = FFMAX(lag, sent[i] - due);
+			ret = avcodec_send_frame(avctx, frame);
+			av_frame_unref(frame);
+		} else {
+			ret = avcodec_send_frame(avctx, NULL);
+		}
+		if (ret < 0)
+			pexit("avcodec_send_frame failed");
+
+		while ((ret = avcodec_receive_packet(avctx, pkt)) == 0) {
+			now = av_gettime_relative();
+			if (pkt->pts >= AUTOTUNE_WARMUP && pkt->pts < AUTOTUNE_FRAMES)
+				latency[counted++] = (now - sent[pkt->pts]) / 1000.0;
+			received++;
+			av_packet_unref(pkt);
+		}
+		if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+			pexit("avcodec_receive_packet failed");
+	}
+	now = av_gettime_relative();
+
+	r->fps = received * 1000000.0 / (now - start);
+	qsort(latency, counted, sizeof(*latency), compare_double);
+	r->latency = counted ? latency[counted * 95 / 100] : 0;
+	/* an encoder falling behind sends frames later than due */
+	r->pass = counted && lag <= 1000000 / fps &&
+		  r->latency <= AUTOTUNE_LATENCY * 1000 / av_q2d(frame_rate);
+
+	free(tex);
+	avcodec_free_context(&avctx);
+	av_packet_free(&pkt);
+	av_frame_free(&frame);
+	return 1;
+}
+
+int autotune(enc_id id, int width, int height, AVRational frame_rate, enc_tuning *t)
+{
+	char host[HOST_SIZE];
+	const char *name = "libx264";
+	AVCodec *codec;
+	trial r, best, fastest;
+	double fps = av_q2d(frame_rate);
+	int threads[3];
+	int p, i, s, passed;
+
+	if (id != LIBX264 || fps <= 0)
+		return -1;
+	codec = avcodec_find_encoder_by_name(name);
+	if (!codec)
+		return -1;
+	if (gethostname(host, sizeof(host)) < 0)
+		strcpy(host, "localhost");
+	host[sizeof(host) - 1] = '\0';
+	/* the csv has no quoting */
+	for (i = 0; host[i]; i++) {
+		if (host[i] == ',')
+			host[i] = '_';
+	}
+
+	if (load(host, name, width, height, fps, t))
+		return 0;
+
+	threads[0] = 1;
+	threads[1] = FFMAX(av_cpu_count() / 2, 1);
+	threads[2] = av_cpu_count();
+
+	fprintf(stderr, "autotune: %dx%d at %.2f fps on %s\n", width, height, fps, host);
+	memset(&best, 0, sizeof(best));
+	memset(&fastest, 0, sizeof(fastest));
+	for (p = 0; presets[p]; p++) {
+		passed = 0;
+		for (i = 0; i < 3; i++) {
+			if (i && threads[i] == threads[i - 1])
+				continue;
+			/* one thread is the same either way */
+			for (s = threads[i] == 1; s < 2; s++) {
+				memset(&r, 0, sizeof(r));
+				strcpy(r.t.preset, presets[p]);
+				r.t.threads = threads[i];
+				r.t.sliced = !s;
+				if (!measure(id, codec, width, height, frame_rate,
+					     fps * (1 + AUTOTUNE_HEADROOM), &r))
+					continue;
+				fprintf(stderr, "autotune: %s, %d %s threads: %.1f fps, p95 %.2f ms%s\n",
+					r.t.preset, r.t.threads, r.t.sliced ? "slice" : "frame",
+					r.fps, r.latency, r.pass ? "" : ", fails");
+				if (!p && (!fastest.t.threads || r.latency < fastest.latency))
+					fastest = r;
+				if (r.pass && (!passed || r.latency < best.latency)) {
+					best = r;
+					passed = 1;
+				}
+			}
+		}
+		if (!passed)
+			break;
+	}
+
+	/* stored anyway, not to calibrate again on every start */
+	if (!best.pass) {
+		fprintf(stderr, "autotune: no setting keeps %.2f fps, the fastest is used\n", fps);
+		best = fastest;
+	}
+	if (!best.t.threads)
+		return -1;
+	*t = best.t;
+	store(host, name, width, height, fps, &best);
+	fprintf(stderr, "autotune: %s, %d %s threads\n", t->preset, t->threads,
+		t->sliced ? "slice" : "frame");
+	return 1;
+}
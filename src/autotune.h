@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "codec.h"
+
+/*
+ * Startup autotuner for libx264. On the first start on a host, a synthetic
+ * clip with a foveation descriptor is encoded at the target frame rate plus
+ * headroom, for each preset from ultrafast on and one, half and all cores
+ * in slice or frame threads. A setting passes if the encoder keeps the pace
+ * and the 95th percentile of the time from sending a frame to receiving its
+ * packet stays within AUTOTUNE_LATENCY frame intervals. The slowest passing
+ * preset wins, with its lowest latency threading; presets slower than the
+ * first one without a passing setting are not tried. The result is kept
+ * per host, codec, resolution and frame rate in AUTOTUNE_PATH.
+ */
+
+#define AUTOTUNE_PATH "autotune.csv"
+#define AUTOTUNE_FRAMES 48 //encoded per setting
+#define AUTOTUNE_WARMUP 8 //of these, not counted
+#define AUTOTUNE_HEADROOM 0.3 //the pace is the target frame rate times 1 + headroom
+#define AUTOTUNE_LATENCY 2 //frame intervals at the target frame rate
+
+/**
+ * Look up the settings for this host, calibrate and store them on the
+ * first start.
+ *
+ * @param id encoder, only LIBX264 is tuned
+ * @param width frame width to encode
+ * @param height frame height to encode
+ * @param frame_rate target frame rate
+ * @param t set to the settings, left as is if there are none
+ * @return 1 if calibrated now, 0 if looked up, -1 if nothing to tune
+ */
+int autotune(enc_id id, int width, int height, AVRational frame_rate, enc_tuning *t);
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bdrate.h"
+
+#include <math.h>
+
+/*
+ * Least-squares fit of a polynomial of the given degree, coefficients in
+ * ascending order. Normal equations are fine for degree 3 and a handful of
+ * points once x is centered.
+ */
+static void polyfit(const double *x, const double *y, int n, int degree, double *c)
+{
+	double a[4][5] = { { 0 } };
+	int i, j, k;
+
+	for (i = 0; i < n; i++) {
+		double pi = 1;
+		for (j = 0; j <= degree; j++, pi *= x[i]) {
+			double pk = 1;
+			for (k = 0; k <= degree; k++, pk *= x[i])
+				a[j][k] += pi * pk;
+			a[j][degree + 1] += pi * y[i];
+		}
+	}
+	/* Gauss-Jordan elimination with partial pivoting */
+	for (j = 0; j <= degree; j++) {
+		int p = j;
+		for (i = j + 1; i <= degree; i++)
+			if (fabs(a[i][j]) > fabs(a[p][j]))
+				p = i;
+		for (k = 0; k <= degree + 1; k++) {
+			double tmp = a[j][k];
+			a[j][k] = a[p][k];
+			a[p][k] = tmp;
+		}
+		for (i = 0; i <= degree; i++) {
+			double f;
+			if (i == j || a[j][j] == 0)
+				continue;
+			f = a[i][j] / a[j][j];
+			for (k = j; k <= degree + 1; k++)
+				a[i][k] -= f * a[j][k];
+		}
+	}
+	for (j = 0; j <= degree; j++)
+		c[j] = a[j][j] ? a[j][degree + 1] / a[j][j] : 0;
+}
+
+static double polyint(const double *c, int degree, double lo, double hi)
+{
+	double sum = 0;
+	int j;
+
+	for (j = 0; j <= degree; j++)
+		sum += c[j] / (j + 1) * (pow(hi, j + 1) - pow(lo, j + 1));
+	return sum;
+}
+
+double bd_rate(const double *ref_rate, const double *ref_q,
+	       const double *test_rate, const double *test_q, int n)
+{
+	double lr[BD_MAX_POINTS], lt[BD_MAX_POINTS], qr[BD_MAX_POINTS], qt[BD_MAX_POINTS];
+	double cr[4], ct[4];
+	double lo_r = INFINITY, hi_r = -INFINITY, lo_t = INFINITY, hi_t = -INFINITY;
+	double mean = 0, lo, hi;
+	int degree = n < 4 ? n - 1 : 3;
+	int i;
+
+	if (n < 2 || n > BD_MAX_POINTS)
+		return NAN;
+	for (i = 0; i < n; i++)
+		mean += (ref_q[i] + test_q[i]) / (2 * n);
+	for (i = 0; i < n; i++) {
+		lr[i] = log10(ref_rate[i]);
+		lt[i] = log10(test_rate[i]);
+		qr[i] = ref_q[i] - mean;
+		qt[i] = test_q[i] - mean;
+		lo_r = fmin(lo_r, qr[i]);
+		hi_r = fmax(hi_r, qr[i]);
+		lo_t = fmin(lo_t, qt[i]);
+		hi_t = fmax(hi_t, qt[i]);
+	}
+	lo = fmax(lo_r, lo_t);
+	hi = fmin(hi_r, hi_t);
+	if (hi <= lo)
+		return NAN;
+
+	polyfit(qr, lr, n, degree, cr);
+	polyfit(qt, lt, n, degree, ct);
+	return (pow(10, (polyint(ct, degree, lo, hi) - polyint(cr, degree, lo, hi)) /
+		    (hi - lo)) - 1) * 100;
+}
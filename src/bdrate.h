@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/* most rate points a curve may have */
+#define BD_MAX_POINTS 16
+
+/**
+ * Bjøntegaard delta rate of a test against a reference curve: log rate is
+ * fit as a polynomial in quality and averaged over the common quality
+ * range.
+ *
+ * @param ref_rate reference bitrates
+ * @param ref_q reference qualities, e.g. PSNR
+ * @param test_rate test bitrates
+ * @param test_q test qualities
+ * @param n number of points per curve, at most BD_MAX_POINTS
+ * @return rate difference in percent, negative if the test saves bits, NAN
+ *         if the quality ranges do not overlap
+ */
+double bd_rate(const double *ref_rate, const double *ref_q,
+	       const double *test_rate, const double *test_q, int n);
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "budget.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+
+/* queues take a while to drain to a new depth, about a second of frames */
+#define BUDGET_INTERVAL 30
+
+void budget_init(mem_budget *mb, size_t limit)
+{
+	mb->limit = limit;
+	mb->halvings = 0;
+	mb->checks = BUDGET_INTERVAL;
+	/* costs every allocation a shared atomic update, worth it with a limit */
+	if (limit && av_mem_accounting() < 0)
+		fprintf(stderr, "libav heap allocated before budget_init, counting queues only\n");
+}
+
+size_t packet_bytes(const void *data)
+{
+	const AVPacket *pkt = data;
+
+	if (!pkt)
+		return 0;
+	return sizeof(*pkt) + (pkt->buf ? pkt->buf->size : pkt->size);
+}
+
+size_t frame_bytes(const void *data)
+{
+	const AVFrame *frame = data;
+	size_t bytes;
+	int i;
+
+	if (!frame)
+		return 0;
+	bytes = sizeof(*frame);
+	for (i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+		bytes += frame->buf[i]->size;
+	for (i = 0; i < frame->nb_extended_buf; i++)
+		bytes += frame->extended_buf[i]->size;
+	return bytes;
+}
+
+static void add_bytes(Queue *q, void *arg)
+{
+	*(size_t *) arg += queue_bytes(q, NULL, NULL);
+}
+
+size_t budget_used(void)
+{
+	size_t used = av_mem_allocated(NULL);
+
+	if (!used)
+		queue_foreach_accounted(add_bytes, &used);
+	return used;
+}
+
+int budget_admit(mem_budget *mb)
+{
+	mb->halvings = 0;
+	mb->checks = BUDGET_INTERVAL;
+	return !mb->limit || budget_used() <= mb->limit;
+}
+
+static void halve_limit(Queue *q, void *arg)
+{
+	(void) arg;
+	queue_set_limit(q, q->limit / 2);
+}
+
+static void double_limit(Queue *q, void *arg)
+{
+	(void) arg;
+	queue_set_limit(q, q->limit * 2);
+}
+
+void budget_enforce(mem_budget *mb)
+{
+	size_t used;
+
+	if (!mb->limit || ++mb->checks < BUDGET_INTERVAL)
+		return;
+
+	used = budget_used();
+	if (used > mb->limit) {
+		queue_foreach_accounted(halve_limit, NULL);
+		mb->halvings++;
+	} else if (mb->halvings && used < mb->limit / 4 * 3) {
+		queue_foreach_accounted(double_limit, NULL);
+		mb->halvings--;
+	} else {
+		return;
+	}
+	mb->checks = 0;
+}
+
+static void print_queue(Queue *q, void *arg)
+{
+	size_t peak_bytes, peak_length, bytes;
+
+	bytes = queue_bytes(q, &peak_bytes, &peak_length);
+	fprintf((FILE *) arg, "%s,%zu,%zu,%zu,%zu,%zu\n", q->name, bytes, peak_bytes,
+		peak_length, q->limit, q->capacity);
+}
+
+void budget_report(const mem_budget *mb, FILE *f)
+{
+	size_t peak, used;
+
+	used = av_mem_allocated(&peak);
+	fprintf(f, "queue,bytes,peak_bytes,peak_length,limit,capacity\n");
+	queue_foreach_accounted(print_queue, f);
+	fprintf(f, "libav heap: %zu bytes, peak %zu, budget %zu\n", used, peak, mb->limit);
+}
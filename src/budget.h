@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "queue.h"
+#include <stdio.h>
+
+/*
+ * Memory budget of a session. Its footprint is what the libav* heap holds:
+ * codec state, buffer pools and the frames and packets queued between the
+ * stages, which the accounted queues break down. Above the budget the
+ * depths of all accounted queues are halved, at most once per
+ * BUDGET_INTERVAL checks, and doubled again once the footprint fell below
+ * three quarters of it. A new session is not admitted while the budget is
+ * exceeded, e.g. by what previous sessions leaked.
+ */
+
+typedef struct mem_budget {
+	size_t limit; //bytes, 0 for no limit
+	int halvings; //of the queue depths, undone one by one
+	int checks; //since the queue depths last changed
+} mem_budget;
+
+/**
+ * Initialize a budget. With a limit, libav's heap is counted from here on,
+ * call before anything allocates through libav. Otherwise only frames and
+ * packets in queues count.
+ *
+ * @param mb budget to initialize
+ * @param limit bytes per session, 0 for no limit
+ */
+void budget_init(mem_budget *mb, size_t limit);
+
+/**
+ * Bytes held by the libav* heap, by the accounted queues if the allocator
+ * cannot measure its blocks.
+ */
+size_t budget_used(void);
+
+/**
+ * Whether a new session may start, queues of a new session start at full depth.
+ */
+int budget_admit(mem_budget *mb);
+
+/**
+ * Shrink or restore the depth of the accounted queues, call once per frame.
+ */
+void budget_enforce(mem_budget *mb);
+
+/**
+ * Print bytes held and high-water marks per accounted queue and of the
+ * libav* heap, the marks start over.
+ */
+void budget_report(const mem_budget *mb, FILE *f);
+
+/**
+ * Bytes held by a queued AVPacket, for queue_account.
+ */
+size_t packet_bytes(const void *pkt);
+
+/**
+ * Bytes held by a queued AVFrame, for queue_account. Buffers shared by
+ * frames in several queues count in each.
+ */
+size_t frame_bytes(const void *frame);
@@ -16,38 +16,95 @@
  */
 
 #include "codec.h"
+#include "control.h"
+#include "filter.h"
+#include "metrics.h"
 #include "pexit.h"
+#include "probe.h"
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 
-static void set_codec_options(AVDictionary **opt, enc_id id)
+#define MAX_FOVEATION_SLICES 128 //per frame, as many as the RTP scheduler tracks
+
+static enc_tuning tuning;
+
+void set_encoder_tuning(const enc_tuning *t)
+{
+	if (t)
+		tuning = *t;
+	else
+		memset(&tuning, 0, sizeof(tuning));
+}
+
+void set_codec_options(AVDictionary **opt, enc_id id)
 {
 	switch (id) {
 	case LIBX264:
-		av_dict_set(opt, "preset", "ultrafast", 0);
+		av_dict_set(opt, "preset", tuning.preset[0] ? tuning.preset : "ultrafast", 0);
 		av_dict_set(opt, "tune", "zerolatency", 0);
 		av_dict_set(opt, "aq-mode", "1", 0);
-		av_dict_set(opt, "gop-size", "3", 0);
+		/*
+		 * Periodic intra refresh instead of I-frames, which reset the
+		 * whole periphery at once and make it flicker. A refresh sweeps
+		 * the picture every 30 frames.
+		 */
+		av_dict_set(opt, "intra-refresh", "1", 0);
+		av_dict_set(opt, "g", "30", 0);
+		/* carries the latency probe's stamps */
+		av_dict_set(opt, "udu_sei", "1", 0);
+		if (tuning.threads) {
+			av_dict_set_int(opt, "threads", tuning.threads, 0);
+			av_dict_set(opt, "thread_type", tuning.sliced ? "slice" : "frame", 0);
+		}
 		break;
 	case LIBX265:
 		av_dict_set(opt, "preset", "ultrafast", 0);
 		av_dict_set(opt, "tune", "zerolatency", 0);
-		av_dict_set(opt, "x265-params", "aq-mode=1", 0);
-		av_dict_set(opt, "gop-size", "3", 0);
+		av_dict_set(opt, "x265-params", "aq-mode=1:intra-refresh=1:keyint=30", 0);
+		break;
+	case LIBKVAZAAR:
+		/* no intra refresh in kvazaar, tiles are set up by the wrapper */
+		av_dict_set(opt, "kvazaar-params", "preset=ultrafast,gop=0,period=30", 0);
 		break;
 	default:
 		pexit("trying to set options for unsupported codec");
 	}
 }
 
-rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char** xcoords, char **ycoords, char **qoffsets, char **sigmas)
+/*
+ * Slices for the RTP scheduler, which sends a slice as foveal if it comes
+ * within half a sigma of the fixation. Slices of half the foveal diameter in
+ * macroblock rows leave the rows above and below the fovea to the periphery,
+ * for the smallest fovea of the run.
+ */
+static int foveation_slices(int width, int height, char **sigmas)
+{
+	float sigma = 0, s, rows;
+	int mb_w = (width + 15) / 16, mb_h = (height + 15) / 16;
+	int i;
+
+	for (i = 0; sigmas[i]; i++) {
+		s = strtof(sigmas[i], NULL);
+		if (s > 0 && (!sigma || s < sigma))
+			sigma = s;
+	}
+	if (!sigma)
+		return 0;
+
+	//sigma is relative to the diagonal, the fovea's diameter spans one sigma
+	rows = FFMAX(sigma * sqrtf(mb_w * mb_w + mb_h * mb_h) / 2, 1);
+	return FFMIN((int) ceilf(mb_h / rows), MAX_FOVEATION_SLICES);
+}
+
+rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char** xcoords, char **ycoords, char **qoffsets, char **sigmas, int64_t max_rate)
 {
 	rep_enc_ctx *ec;
 	AVCodecContext *avctx;
 	AVCodec *codec;
 	AVDictionary *options = NULL;
 
-	ec = malloc(sizeof(enc_ctx));
+	ec = malloc(sizeof(rep_enc_ctx));
 	if (!ec)
 		pexit("malloc failed");
 
@@ -60,6 +117,10 @@ rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char** xcoords, char
 		set_codec_options(&options, LIBX265);
 		codec = avcodec_find_encoder_by_name("libx265");
 		break;
+	case LIBKVAZAAR:
+		set_codec_options(&options, LIBKVAZAAR);
+		codec = avcodec_find_encoder_by_name("libkvazaar");
+		break;
 	default:
 		codec = NULL;
 	}
@@ -75,6 +136,11 @@ rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char** xcoords, char
 	avctx->pix_fmt		= codec->pix_fmts[0]; //first supported pixel format
 	avctx->width		= dc->avctx->width;
 	avctx->height		= dc->avctx->height;
+	/* 100 ms buffer, CRF stays in charge below the maximum rate */
+	avctx->rc_max_rate	= max_rate;
+	avctx->rc_buffer_size	= max_rate / 10;
+	if (id == LIBX264 && max_rate)
+		avctx->slices	= foveation_slices(avctx->width, avctx->height, sigmas);
 
 	if (avcodec_open2(avctx, avctx->codec, &options) < 0)
 		pexit("avcodec_open2 failed");
@@ -90,6 +156,7 @@ rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char** xcoords, char
 	ec->ycoords = ycoords;
 	ec->qoffsets = qoffsets;
 	ec->sigmas = sigmas;
+	SDL_AtomicSet(&ec->max_rate, max_rate);
 	return ec;
 }
 
@@ -113,6 +180,10 @@ enc_ctx *encoder_init(enc_id id, dec_ctx *dc, char* path)
 		set_codec_options(&options, LIBX265);
 		codec = avcodec_find_encoder_by_name("libx265");
 		break;
+	case LIBKVAZAAR:
+		set_codec_options(&options, LIBKVAZAAR);
+		codec = avcodec_find_encoder_by_name("libkvazaar");
+		break;
 	default:
 		codec = NULL;
 	}
@@ -128,9 +199,7 @@ enc_ctx *encoder_init(enc_id id, dec_ctx *dc, char* path)
 	avctx->pix_fmt		= codec->pix_fmts[0]; //first supported pixel format
 	avctx->width		= dc->avctx->width;
 	avctx->height		= dc->avctx->height;
-
-	if (avcodec_open2(avctx, avctx->codec, &options) < 0)
-		pexit("avcodec_open2 failed");
+	/* opened by encoder_thread, its workers count towards PERF_ENCODER */
 
 	ec->frames = dc->frames;
 	/* output queues have length 1 to enforce RT processing */
@@ -140,6 +209,10 @@ enc_ctx *encoder_init(enc_id id, dec_ctx *dc, char* path)
 	ec->avctx = avctx;
 	ec->options = options;
 	ec->id = id;
+	/* chroma acuity falls off faster than luma acuity, blur what the
+	 * encoder would otherwise spend bits on in the periphery */
+	ec->prefilter = prefilter_init("fovchroma", 0);
+	ec->follow = NULL;
 
 	ec->path = path;
 
@@ -161,6 +234,9 @@ enc_ctx *encoder_init(enc_id id, dec_ctx *dc, char* path)
 	strcat(logpath, ".csv");
 	printf(logpath);
 	ec->log = fopen(logpath, "w");
+	//raw samples next to it, to evaluate saccade and blink suppression
+	strcpy(logpath + strlen(logpath) - 4, "-gaze.csv");
+	gaze_log_open(logpath);
 	#endif
 
 	return ec;
@@ -172,6 +248,7 @@ void encoder_free(enc_ctx **ec)
 
 	e = *ec;
 	queue_free(&e->frames);
+	postfilter_free(&e->prefilter);
 	avcodec_free_context(&e->avctx);
 	av_dict_free(&e->options);
 	free(e);
@@ -215,6 +292,7 @@ int replicate_encoder_thread(void *ptr)
 	int ret;
 	int64_t *timestamp;
 	int frame_number = 0;
+	int max_rate;
 	float x, y, q, sigma;
 
 	pkt = av_packet_alloc(); //NULL check in loop.
@@ -258,6 +336,14 @@ int replicate_encoder_thread(void *ptr)
 			sd->data = (uint8_t *) descr;
 			frame_number++;
 			frame->pict_type = 0; //keep undefined to prevent warnings
+
+			/* libx264 reconfigures VBV when these change */
+			max_rate = SDL_AtomicGet(&ec->max_rate);
+			if (ec->avctx->rc_max_rate && max_rate &&
+			    max_rate != ec->avctx->rc_max_rate) {
+				ec->avctx->rc_max_rate = max_rate;
+				ec->avctx->rc_buffer_size = max_rate / 10;
+			}
 			supply_frame(ec->avctx, frame);
 			av_frame_free(&frame);
 
@@ -290,7 +376,14 @@ int encoder_thread(void *ptr)
 	size_t descr_size = 4*sizeof(float);
 	int ret;
 	int64_t *timestamp;
+	int64_t start;
 	int frame_number = 0;
+	unsigned i;
+
+	/* the lookahead and frame threads of libx264 are created here */
+	perf_inherit(PERF_ENCODER);
+	if (avcodec_open2(ec->avctx, ec->avctx->codec, &ec->options) < 0)
+		pexit("avcodec_open2 failed");
 
 	pkt = av_packet_alloc(); //NULL check in loop.
 
@@ -300,6 +393,7 @@ int encoder_thread(void *ptr)
 
 		ret = avcodec_receive_packet(ec->avctx, pkt);
 		if (ret == 0) {
+			metrics_observe(METRIC_FRAME_BITS, 8 * (int64_t) pkt->size);
 			queue_append(ec->packets, pkt);
 			pkt = av_packet_alloc();
 			continue;
@@ -309,19 +403,49 @@ int encoder_thread(void *ptr)
 			if (!frame)
 				break;
 
-			sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, descr_size);
-			if (!sd)
-				pexit("side data allocation failed");
-
-			descr = foveation_descriptor(ec->avctx->width, ec->avctx->height);
-			sd->data = (uint8_t *) descr;
+			/* operator changes, between two frames */
+			control_apply(ec->avctx);
+			start = av_gettime_relative();
+			perf_begin(PERF_FOVEATION);
+			sd = av_frame_get_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR);
+			if (sd) {
+				//predicted fixations, the lab setup decides on sigma and qp offset
+				descr = (float *) sd->data;
+				for (i = 0; i < sd->size / descr_size; i++) {
+					descr[4*i + 2] = foveation_sigma(ec->avctx->width, ec->avctx->height);
+					descr[4*i + 3] = get_qp_offset();
+				}
+				if (sd->size % descr_size >= 2*sizeof(float))
+					descr[4*i + 1] = get_chroma_falloff();
+				if (ec->follow)
+					reader_follow_gaze(ec->follow, descr[0], descr[1]);
+			} else {
+				//with the temporal period for saccade and blink suppression and the chroma falloff
+				sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+							    descr_size + 2*sizeof(float));
+				if (!sd)
+					pexit("side data allocation failed");
+
+				//copied, filters only see the data of the side data buffer
+				descr = foveation_descriptor(ec->avctx->width, ec->avctx->height);
+				memcpy(sd->data, descr, sd->size);
+				free(descr);
+				descr = (float *) sd->data;
+			}
 			#ifdef ET
 			log_fov_descr(ec->log, descr, frame_number);
 			#endif
 			frame_number++;
 
+			frame = prefilter_frame(ec->prefilter, frame);
+			perf_end(PERF_FOVEATION);
+			metrics_observe(METRIC_FOVEATION, av_gettime_relative() - start);
+			metrics_frame(PERF_FOVEATION);
 			frame->pict_type = 0; //keep undefined to prevent warnings
+			start = av_gettime_relative();
 			supply_frame(ec->avctx, frame);
+			metrics_observe(METRIC_ENCODE, av_gettime_relative() - start);
+			control_applied(ec->avctx);
 			av_frame_free(&frame);
 
 			timestamp = malloc(sizeof(int64_t));
@@ -330,6 +454,8 @@ int encoder_thread(void *ptr)
 			*timestamp = av_gettime_relative();
 
 			queue_append(ec->timestamps, timestamp);
+			perf_frame(PERF_ENCODER);
+			metrics_frame(PERF_ENCODER);
 
 		} else if (ret == AVERROR_EOF) {
 			break;
@@ -342,6 +468,7 @@ int encoder_thread(void *ptr)
 	queue_append(ec->timestamps, NULL);
 	avcodec_close(ec->avctx);
 	fclose(ec->log);
+	gaze_log_close();
 	avcodec_free_context(&ec->avctx);
 	encoder_free(&ec);
 	return 0;
@@ -372,6 +499,10 @@ dec_ctx *source_decoder_init(rdr_ctx *rc, int queue_capacity)
 		pexit("avcodec_find_decoder failed");
 
 	avctx->codec_id = codec->id;
+	#ifdef SALIENCY
+	//motion vectors are the main feature of the saliency estimator
+	avctx->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+	#endif
 
 	ret = avcodec_open2(avctx, codec, NULL);
 	if (ret < 0)
@@ -385,6 +516,8 @@ dec_ctx *source_decoder_init(rdr_ctx *rc, int queue_capacity)
 	dc->frames = queue_init(queue_capacity);
 	dc->avctx = avctx;
 	dc->frame_rate = stream->r_frame_rate;
+	dc->stage = PERF_SRC_DECODER;
+	dc->start_pts = rc->start_pts;
 
 	return dc;
 }
@@ -411,6 +544,7 @@ int decoder_thread(void *ptr)
 	AVCodecContext *avctx = dc->avctx;
 	AVFrame *frame;
 	AVPacket *packet;
+	int64_t ts;
 
 	frame = av_frame_alloc();
 	for (;;) {
@@ -419,13 +553,34 @@ int decoder_thread(void *ptr)
 
 		ret = avcodec_receive_frame(avctx, frame);
 		if (ret == 0) {
+			/* decoded to reach the start of a trial, not shown */
+			ts = frame->best_effort_timestamp;
+			if (dc->start_pts != AV_NOPTS_VALUE && ts != AV_NOPTS_VALUE) {
+				if (ts < dc->start_pts) {
+					av_frame_unref(frame);
+					continue;
+				}
+				frame->pts = ts - dc->start_pts;
+			}
 			// valid frame - enqueue and allocate new buffer
+			if (dc->stage == PERF_SRC_DECODER)
+				probe_stamp_frame(frame);
+			else if (dc->stage == PERF_FOV_DECODER)
+				probe_decoded(frame);
 			queue_append(dc->frames, frame);
+			perf_frame(dc->stage);
+			metrics_frame(dc->stage);
 			frame = av_frame_alloc();
 			continue;
 		} else if (ret == AVERROR(EAGAIN)) {
 			//provide another packet to the decoder
 			packet = queue_extract(dc->packets);
+			/* before the start, only what later frames refer to */
+			if (dc->start_pts != AV_NOPTS_VALUE && packet) {
+				ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+				avctx->skip_frame = ts != AV_NOPTS_VALUE && ts < dc->start_pts ?
+						    AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+			}
 			supply_packet(avctx, packet);
 			//FIXME: The next line (if uncommented) causes segfaults on windows!
 			//av_packet_free(&packet);
@@ -462,6 +617,9 @@ dec_ctx *fov_decoder_init(enc_ctx *ec)
 	if (!avctx)
 		pexit("avcodec_alloc_context3 failed");
 
+	//fovupconv moves the held periphery along them
+	avctx->flags2 |= AV_CODEC_FLAG2_EXPORT_MVS;
+
 	ret = avcodec_open2(avctx, codec, NULL);
 	if (ret < 0)
 		pexit("avcodec_open2 failed");
@@ -473,6 +631,8 @@ dec_ctx *fov_decoder_init(enc_ctx *ec)
 	dc->packets = ec->packets;
 	dc->frames = queue_init(1);
 	dc->avctx = avctx;
+	dc->stage = PERF_FOV_DECODER;
+	dc->start_pts = AV_NOPTS_VALUE;
 
 	return dc;
 }
@@ -498,6 +658,7 @@ params *params_limit_init(enc_id id)
 
 	switch (id) {
 	case LIBX264:
+	case LIBKVAZAAR:
 		p->delta_min = 0;
 		p->delta_max = 51;
 		p->std_min = 0;
@@ -20,10 +20,13 @@
 #include "common.h"
 #include "io.h"
 #include "et.h"
+#include "perf.h"
 #include <libavformat/avformat.h>
 #include <libavutil/frame.h>
 #include <libavutil/time.h>
 
+struct flt_ctx;
+
 /**
  * Decoder context / status information.
  * Queues allow to consume packets and emit frames.
@@ -35,6 +38,8 @@ typedef struct dec_ctx {
 	AVCodecContext *avctx; //to access internals (time_base etc.)
 	enc_id id;
 	AVRational frame_rate;
+	perf_stage stage; //counted as
+	int64_t start_pts; //earlier frames are dropped, later ones start at 0, AV_NOPTS_VALUE for none
 } dec_ctx;
 
 /**
@@ -47,6 +52,8 @@ typedef struct enc_ctx {
 	Queue *timestamps; //timestamps to measure encoding-decoding-display lag
 	AVCodecContext *avctx;
 	AVDictionary *options; //encoder options
+	struct flt_ctx *prefilter; //peripheral chroma low-pass before encoding
+	rdr_ctx *follow; //switched to the variant closest to predicted fixations, may be NULL
 	enc_id id;
 	int run; // run of the same video, just for logging purposes
 	char *path;  // filename, just for logging purposes
@@ -67,14 +74,42 @@ typedef struct rep_enc_ctx {
 	char** ycoords;
 	char** qoffsets;
 	char** sigmas;
+	SDL_atomic_t max_rate; // VBV maximum rate in bit/s requested by the writer, 0 to keep
 } rep_enc_ctx;
 
+/**
+ * Preset and threading of libx264 for the host, see autotune.h
+ */
+typedef struct enc_tuning {
+	char preset[16];
+	int threads; //0 for the encoder's choice
+	int sliced; //slice instead of frame threads
+} enc_tuning;
+
+/**
+ * Stream with a preset and threading other than the defaults of
+ * set_codec_options, for libx264.
+ *
+ * @param t settings to use from now on, NULL for the defaults
+ */
+void set_encoder_tuning(const enc_tuning *t);
+
+/**
+ * Set the encoder options the workbench streams with, e.g. preset, tuning
+ * and intra refresh.
+ *
+ * @param opt dictionary to add the options to
+ * @param id codec the options are meant for, pexit for unsupported codecs
+ */
+void set_codec_options(AVDictionary **opt, enc_id id);
+
 /**
  * Initialize a realtime (re)encoder
  *
  * Output queues have length 1 to enforce consumption of already processed
  * frames before futher frames can be added, as additional buffering is unnecessary
- * in real time applications.
+ * in real time applications. The encoder is opened by encoder_thread, so
+ * that its worker threads are counted with it, see perf_inherit.
  * @param id identifies the encoder to use.
  * @param dc context of the decoder which supplies the frames, to set e.g. the time base.
  * @param w_ctx window context, necessary for pseudo-gaze emulation through the mouse pointer.
@@ -85,8 +120,14 @@ enc_ctx *encoder_init(enc_id id, dec_ctx *dc, char *path);
 /**
  * Initialize a replication encoder, which produces the same stream that was
  * created in a real-time experiment previously.
+ *
+ * VBV can not be enabled once the encoder is open, so a stream whose rate is
+ * adapted later through max_rate needs an initial maximum rate. Such a stream
+ * goes to the RTP scheduler, so libx264 also splits its frames into slices
+ * small enough to separate the fovea from the periphery.
+ * @param max_rate initial VBV maximum rate in bit/s, 0 for plain CRF.
  */
-rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char **xcoords, char **ycoords, char **qoffsets,char **sigmas);
+rep_enc_ctx *replicate_encoder_init(enc_id id, dec_ctx *dc, char **xcoords, char **ycoords, char **qoffsets,char **sigmas, int64_t max_rate);
 
 
 /**
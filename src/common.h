@@ -17,11 +17,21 @@
 
 #pragma once
 
+/*
+ * Without an eye tracker, fixations are predicted from the content by the
+ * fovsaliency filter. Build with -DMOUSE to emulate the gaze with the mouse
+ * pointer instead.
+ */
+#if !defined(ET) && !defined(MOUSE)
+#define SALIENCY
+#endif
+
 // ids to identify supported codecs
 typedef enum {
 	LIBX264,
 	LIBX265,
 	LIBVPX,
+	LIBKVAZAAR,
 } enc_id;
 
 typedef struct params {
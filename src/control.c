@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "control.h"
+#include "et.h"
+#include "pexit.h"
+
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define LINE_SIZE 256
+#define PRESET_SIZE 32
+
+enum {
+	DELTA,
+	SIGMA,
+	CRF,
+	BITRATE,
+	MAXRATE,
+	BUFSIZE,
+	PRESET,
+	FALLOFF,
+	SETTINGS,
+};
+
+/* changes rate control, only libx264 reconfigures at runtime */
+#define RATE_CONTROL (1 << CRF | 1 << BITRATE | 1 << MAXRATE | 1 << BUFSIZE | 1 << PRESET)
+
+enum {
+	IDLE,
+	PENDING, //received, waiting for a frame
+	APPLIED, //set, waiting for the frame to be sent
+};
+
+typedef struct change {
+	unsigned set; //bit per setting
+	double value[SETTINGS];
+	char preset[PRESET_SIZE];
+	int64_t received;
+	int state;
+	const char *error;
+	int64_t latency; //us
+} change;
+
+static const char *setting_names[SETTINGS] = {
+	"delta", "sigma", "crf", "bitrate", "maxrate", "bufsize", "preset",
+	"falloff",
+};
+
+static change ch; //under mutex
+static SDL_mutex *mutex;
+static SDL_cond *done;
+static SDL_atomic_t pending; //a change is PENDING or APPLIED
+
+/* parse a line into c, NULL on success, the reason otherwise */
+static const char *parse(char *line, change *c)
+{
+	char *save, *token, *value, *end;
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	for (token = strtok_r(line, " \t\r\n", &save); token;
+	     token = strtok_r(NULL, " \t\r\n", &save)) {
+		value = strchr(token, '=');
+		if (!value)
+			return "expected key=value";
+		*value++ = '\0';
+
+		for (i = 0; i < SETTINGS; i++) {
+			if (!strcmp(token, setting_names[i]))
+				break;
+		}
+		if (i == SETTINGS)
+			return "unknown key";
+
+		if (i == PRESET) {
+			if (strlen(value) >= PRESET_SIZE)
+				return "preset name too long";
+			strcpy(c->preset, value);
+		} else {
+			c->value[i] = strtod(value, &end);
+			if (end == value || *end || c->value[i] < 0)
+				return "expected a non-negative number";
+		}
+		c->set |= 1 << i;
+	}
+	if (!c->set)
+		return "no settings";
+	if (c->set & 1 << FALLOFF && (c->value[FALLOFF] <= 0 || c->value[FALLOFF] > 1))
+		return "falloff must be in (0, 1]";
+	return NULL;
+}
+
+/* the settings the encoder cannot take, before any is applied */
+static const char *check(const change *c, const AVCodecContext *avctx)
+{
+	if (c->set & RATE_CONTROL && strcmp(avctx->codec->name, "libx264"))
+		return "rate control changes need libx264";
+	if (c->set & 1 << CRF && avctx->bit_rate)
+		return "crf needs a session without a bitrate";
+	if (c->set & 1 << BITRATE && !avctx->bit_rate)
+		return "bitrate needs a session started with one";
+	return NULL;
+}
+
+void control_apply(AVCodecContext *avctx)
+{
+	change *c = &ch;
+
+	if (!SDL_AtomicGet(&pending))
+		return;
+
+	SDL_LockMutex(mutex);
+	if (c->state == PENDING) {
+		c->error = check(c, avctx);
+		if (!c->error) {
+			if (c->set & 1 << DELTA)
+				set_qp_offset(c->value[DELTA]);
+			if (c->set & 1 << SIGMA)
+				set_sigma_override(c->value[SIGMA]);
+			if (c->set & 1 << CRF)
+				av_opt_set_double(avctx->priv_data, "crf", c->value[CRF], 0);
+			if (c->set & 1 << BITRATE)
+				avctx->bit_rate = c->value[BITRATE];
+			if (c->set & 1 << MAXRATE) {
+				avctx->rc_max_rate = c->value[MAXRATE];
+				/* 100 ms unless given */
+				if (!(c->set & 1 << BUFSIZE))
+					avctx->rc_buffer_size = c->value[MAXRATE] / 10;
+			}
+			if (c->set & 1 << BUFSIZE)
+				avctx->rc_buffer_size = c->value[BUFSIZE];
+			if (c->set & 1 << PRESET)
+				av_opt_set(avctx->priv_data, "preset", c->preset, 0);
+			if (c->set & 1 << FALLOFF)
+				set_chroma_falloff(c->value[FALLOFF]);
+		}
+		c->state = APPLIED;
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+void control_applied(AVCodecContext *avctx)
+{
+	change *c = &ch;
+	uint8_t *preset;
+
+	if (!SDL_AtomicGet(&pending))
+		return;
+
+	SDL_LockMutex(mutex);
+	if (c->state == APPLIED) {
+		/* libx264 falls back to the last preset if it cannot switch */
+		if (!c->error && c->set & 1 << PRESET &&
+		    av_opt_get(avctx->priv_data, "preset", 0, &preset) >= 0) {
+			if (strcmp((char *) preset, c->preset))
+				c->error = "preset rejected, see the encoder log";
+			av_free(preset);
+		}
+		c->latency = av_gettime_relative() - c->received;
+		c->state = IDLE;
+		SDL_AtomicSet(&pending, 0);
+		SDL_CondSignal(done);
+	}
+	SDL_UnlockMutex(mutex);
+}
+
+/* hand a change to the encoder thread and wait for it, reply to fd */
+static void submit(int fd, change *c)
+{
+	char reply[LINE_SIZE];
+	int n;
+
+	SDL_LockMutex(mutex);
+	ch = *c;
+	ch.received = av_gettime_relative();
+	ch.state = PENDING;
+	SDL_AtomicSet(&pending, 1);
+	while (ch.state != IDLE) {
+		if (SDL_CondWaitTimeout(done, mutex, CONTROL_TIMEOUT) == SDL_MUTEX_TIMEDOUT &&
+		    ch.state == PENDING) {
+			/* no encoder running, e.g. between runs */
+			ch.state = IDLE;
+			ch.error = "no frame to apply it to";
+			SDL_AtomicSet(&pending, 0);
+		}
+	}
+	if (ch.error)
+		n = snprintf(reply, sizeof(reply), "error %s\n", ch.error);
+	else
+		n = snprintf(reply, sizeof(reply), "ok %.1f\n", ch.latency / 1000.0);
+	SDL_UnlockMutex(mutex);
+
+	fprintf(stderr, "control: %s", reply);
+	send(fd, reply, n, MSG_NOSIGNAL);
+}
+
+static int serve_thread(void *ptr)
+{
+	int fd = (intptr_t) ptr;
+	char line[LINE_SIZE], reply[LINE_SIZE];
+	const char *error;
+	change c;
+	size_t len;
+	ssize_t n;
+	char *newline;
+	int client;
+
+	for (;;) {
+		client = accept(fd, NULL, NULL);
+		if (client < 0)
+			continue;
+
+		len = 0;
+		while ((n = recv(client, line + len, sizeof(line) - 1 - len, 0)) > 0) {
+			len += n;
+			line[len] = '\0';
+			while ((newline = strchr(line, '\n'))) {
+				*newline = '\0';
+				error = parse(line, &c);
+				if (error) {
+					n = snprintf(reply, sizeof(reply), "error %s\n", error);
+					send(client, reply, n, MSG_NOSIGNAL);
+				} else {
+					submit(client, &c);
+				}
+				len -= newline + 1 - line;
+				memmove(line, newline + 1, len + 1);
+			}
+			/* a line longer than the buffer is dropped */
+			if (len == sizeof(line) - 1)
+				len = 0;
+		}
+		close(client);
+	}
+	return 0;
+}
+
+int control_serve(const char *path)
+{
+	struct sockaddr_un addr;
+	SDL_Thread *server;
+	mode_t mask;
+	int fd, ret;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+
+	mutex = SDL_CreateMutex();
+	done = SDL_CreateCond();
+	if (!mutex || !done)
+		pexit("SDL_CreateMutex or SDL_CreateCond failed");
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	/* settings change what viewers see, the owner only, from creation on;
+	 * the umask is the process's, called before the pipeline's threads */
+	mask = umask(S_IRWXG | S_IRWXO);
+	ret = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(mask);
+	if (ret < 0 || listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	server = SDL_CreateThread(serve_thread, "control", (void *) (intptr_t) fd);
+	if (!server)
+		pexit(SDL_GetError());
+	SDL_DetachThread(server);
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libavcodec/avcodec.h>
+
+/*
+ * Runtime control channel. A client connects to a Unix domain socket and
+ * sends one line of key=value settings per change, e.g.
+ *
+ *     crf=20 preset=veryfast delta=8
+ *
+ * Keys are delta (qp offset), sigma (relative to the frame diagonal, 0 for
+ * the lab setup's), crf, bitrate, maxrate, bufsize (bit/s and bits), preset
+ * and falloff (chroma sigma relative to the luma one, 1 for none). The
+ * encoder thread applies all settings of a line between two frames or none
+ * of them; libx264 reconfigures itself when the frame is sent. The client
+ * is answered with "ok <ms>" once the first frame with the new settings was
+ * sent, the apply latency since the line was received, or with
+ * "error <reason>". Rate control settings need libx264, crf a session
+ * without a bitrate, bitrate one started with a bitrate.
+ */
+
+#define CONTROL_PATH "/tmp/ffoveated.sock"
+#define CONTROL_TIMEOUT 2000 //ms to wait for a frame to apply a change to
+
+/**
+ * Accept control clients in a thread, one at a time.
+ *
+ * @param path of the socket, an existing file there is replaced
+ * @return 0 on success, -1 if the socket cannot be bound
+ */
+int control_serve(const char *path);
+
+/**
+ * Apply a pending change, call from the encoder thread before the
+ * foveation descriptor of a frame is set. Costs an atomic read otherwise.
+ *
+ * @param avctx the encoder
+ */
+void control_apply(AVCodecContext *avctx);
+
+/**
+ * Answer the client after the frame a change was applied to was sent.
+ *
+ * @param avctx the encoder
+ */
+void control_applied(AVCodecContext *avctx);
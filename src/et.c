@@ -16,17 +16,33 @@
  */
 
 #include "et.h"
+#include "metrics.h"
 #include "pexit.h"
+#include <libavutil/time.h>
 #include <SDL2/SDL.h>
+#include <stdio.h>
 
 //#define ET
+/* viewing distance in mm the foveation sigma assumes as well */
+#define VIEW_DISTANCE 650
+
 static gaze *gs;
 static lab_setup *ls;
 static SDL_Window *win;
 static params *p;
 
+#ifdef ET
+/* frame origin and size in screen pixels, for the gaze log, under gs->mutex */
+static float frame_x, frame_y, frame_w, frame_h;
+/* monotonic time the last sample arrived, under gs->mutex */
+static int64_t sample_time;
+#endif
+static FILE *gaze_log;
+
 static SDL_mutex *qp_offset_mutex;
 static float qp_offset;
+static float sigma_override; //under qp_offset_mutex, 0 for the lab setup's
+static float chroma_falloff = CHROMA_FALLOFF; //under qp_offset_mutex
 
 void set_qp_offset(int q)
 {
@@ -44,6 +60,50 @@ float get_qp_offset()
 	return q;
 }
 
+void set_sigma_override(float sigma)
+{
+	SDL_LockMutex(qp_offset_mutex);
+	sigma_override = sigma;
+	SDL_UnlockMutex(qp_offset_mutex);
+}
+
+void set_chroma_falloff(float falloff)
+{
+	SDL_LockMutex(qp_offset_mutex);
+	chroma_falloff = falloff;
+	SDL_UnlockMutex(qp_offset_mutex);
+}
+
+float get_chroma_falloff()
+{
+	float falloff;
+	SDL_LockMutex(qp_offset_mutex);
+	falloff = chroma_falloff;
+	SDL_UnlockMutex(qp_offset_mutex);
+	return falloff;
+}
+
+float foveation_sigma(int frame_width, int frame_height)
+{
+	float frame_width_mm, frame_height_mm;
+	float sigma;
+
+	SDL_LockMutex(qp_offset_mutex);
+	sigma = sigma_override;
+	SDL_UnlockMutex(qp_offset_mutex);
+	if (sigma > 0)
+		return sigma;
+
+	frame_width_mm = ls->screen_width * (float) frame_width / ls->screen_res_w;
+	frame_height_mm = ls->screen_height * (float) frame_height / ls->screen_res_h;
+
+	/*
+	 * we assume a distance of 650mm to the screen,
+	 * then 2 * tan(2.5°) * 650 = 56.7mm is a reasonable choice for foveation diameter
+	 */
+	return 56.7 / sqrt(pow(frame_width_mm, 2) + pow(frame_height_mm, 2));
+}
+
 float *foveation_descriptor(int frame_width, int frame_height)
 {
 	float *fd;
@@ -51,23 +111,33 @@ float *foveation_descriptor(int frame_width, int frame_height)
 	int x_int, y_int;
 	int win_x, win_y;
 	int win_width, win_height;
-
-	float frame_width_mm, frame_height_mm;
+	int suppressed = 0;
+	double gx, gy;
 
 	SDL_GetWindowSize(win, &win_width, &win_height);
 	SDL_GetWindowPosition(win, &win_x, &win_y);
 
-	fd = malloc(4*sizeof(float));
+	fd = malloc(6*sizeof(float));
 	if (!fd)
 		pexit("malloc failed");
 
 	#ifdef ET
 	SDL_LockMutex(gs->mutex);
+	//predicted landing point of a saccade, the last fixation during a blink
+	gaze_target(&gs->gc, &gx, &gy);
+	suppressed = gaze_suppressed(&gs->gc);
+	metrics_set(METRIC_GAZE_AGE, av_gettime_relative() - sample_time);
 	//gaze coordinates have their origin at the upper left screen corner, shift to upper left window corner
-	x = (float) gs->gazeX_mean - win_x;
-	y = (float) gs->gazeY_mean - win_y;
+	x = (float) gx - win_x;
+	y = (float) gy - win_y;
+	frame_x = win_x + (win_width - frame_width) / 2;
+	frame_y = win_y + (win_height - frame_height) / 2;
+	frame_w = frame_width;
+	frame_h = frame_height;
 	SDL_UnlockMutex(gs->mutex);
 	#else
+	(void) gx;
+	(void) gy;
 	SDL_GetMouseState(&x_int, &y_int);
 	//mouse coordinates have origin already at upper left window corner
 	x = (float) x_int;
@@ -80,27 +150,58 @@ float *foveation_descriptor(int frame_width, int frame_height)
 	fd[0] = x / frame_width;
 	fd[1] = y / frame_height;
 
-	frame_width_mm = ls->screen_width * (float) frame_width / ls->screen_res_w;
-	frame_height_mm = ls->screen_height * (float) frame_height / ls->screen_res_h;
-
-	/*
-	 * we assume a distance of 650mm to the screen,
-	 * then 2 * tan(2.5°) * 650 = 56.7mm is a reasonable choice for foveation diameter
-	 */
-	fd[2] = 56.7 / sqrt(pow(frame_width_mm, 2) + pow(frame_height_mm, 2));
+	fd[2] = foveation_sigma(frame_width, frame_height);
 	fd[3] = get_qp_offset();
+	fd[4] = 0;
+	fd[5] = get_chroma_falloff();
+
+	if (suppressed) {
+		//vision is suppressed, the whole frame at minimal cost
+		fd[0] = -1;
+		fd[1] = -1;
+		fd[2] = SUPPRESS_SIGMA;
+		fd[3] = fminf(fd[3] + SUPPRESS_QP, p->delta_max);
+		fd[4] = SUPPRESS_PERIOD;
+	}
 
 	return fd;
 }
 
+void gaze_log_open(const char *path)
+{
+	#ifdef ET
+	SDL_LockMutex(gs->mutex);
+	gaze_log = fopen(path, "w");
+	if (!gaze_log)
+		pexit("fopen failed");
+	fprintf(gaze_log, "t,x,y,valid,event\n");
+	SDL_UnlockMutex(gs->mutex);
+	#else
+	(void) path;
+	#endif
+}
+
+void gaze_log_close(void)
+{
+	SDL_LockMutex(gs->mutex);
+	if (gaze_log)
+		fclose(gaze_log);
+	gaze_log = NULL;
+	SDL_UnlockMutex(gs->mutex);
+}
+
 #ifdef ET
 int __stdcall update_gaze(struct SampleStruct sampleData)
 {
 	double x, y, z; //mean eye coordinates for distance
 	//double theta;
+	eye_data *eye;
+	gaze_event event;
+	int valid;
 
 
 	SDL_LockMutex(gs->mutex);
+	sample_time = av_gettime_relative();
 	gs->left.x = sampleData.leftEye.eyePositionX;
 	gs->left.y = sampleData.leftEye.eyePositionY;
 	gs->left.z = sampleData.leftEye.eyePositionZ;
@@ -120,12 +221,27 @@ int __stdcall update_gaze(struct SampleStruct sampleData)
 	y = (gs->left.y + gs->right.y) / 2;
 	z = (gs->left.z + gs->right.z) / 2;
 
-	gs->gazeX_mean = (gs->left.gazeX + gs->right.gazeX) / 2;
-	gs->gazeY_mean = (gs->left.gazeY + gs->right.gazeY) / 2;
+	/* a lost eye reports a zero pupil, average only what is tracked */
+	valid = (gs->left.diam > 0) + (gs->right.diam > 0);
+	if (valid == 2) {
+		gs->gazeX_mean = (gs->left.gazeX + gs->right.gazeX) / 2;
+		gs->gazeY_mean = (gs->left.gazeY + gs->right.gazeY) / 2;
+	} else if (valid) {
+		eye = gs->left.diam > 0 ? &gs->left : &gs->right;
+		gs->gazeX_mean = eye->gazeX;
+		gs->gazeY_mean = eye->gazeY;
+	}
 
 	// distance towards eyetracker, not screen!!!
 	gs->distance = sqrt(x*x + y*y + z*z);
 
+	event = gaze_classify(&gs->gc, sampleData.timestamp,
+			      gs->gazeX_mean, gs->gazeY_mean, valid);
+	if (gaze_log && frame_w > 0)
+		fprintf(gaze_log, "%lld,%f,%f,%d,%d\n", (long long) sampleData.timestamp,
+			(gs->gazeX_mean - frame_x) / frame_w,
+			(gs->gazeY_mean - frame_y) / frame_h, valid > 0, event);
+
 	SDL_UnlockMutex(gs->mutex);
 
 	return 0;
@@ -169,6 +285,11 @@ void setup_ivx(enc_id id)
 	ls->camera_z = 0;
 	ls->camera_inclination = 20; //degrees upward for the SMI bracket
 	gs->mutex = SDL_CreateMutex();
+	gs->gazeX_mean = 0;
+	gs->gazeY_mean = 0;
+	/* screen pixels per degree at the center of the screen */
+	gaze_classifier_init(&gs->gc, ls->screen_res_w / ls->screen_width *
+			     VIEW_DISTANCE * tan(M_PI / 180));
 	p = params_limit_init(id);
 
 	qp_offset_mutex = SDL_CreateMutex();
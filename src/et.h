@@ -21,11 +21,26 @@
 #include <SDL2/SDL.h>
 #include "common.h"
 #include "codec.h"
+#include "gazeevent.h"
 #include "io.h"
 #ifdef ET
 #include <iViewXAPI.h>
 #endif
 
+/*
+ * Foveation descriptor while vision is suppressed: no fixation within the
+ * frame, a sigma that leaves no fovea, this much on top of the offset and a
+ * temporal period that holds the whole frame until the suppression ends.
+ * Held MBs are skipped, so the frame after a saccade is predicted from the
+ * last one seen instead of a degraded one.
+ */
+#define SUPPRESS_QP 12
+#define SUPPRESS_SIGMA 0.001f
+#define SUPPRESS_PERIOD 1000
+
+/* chroma sigma relative to the luma one, the default of fovchroma */
+#define CHROMA_FALLOFF 0.6f
+
 /* Data to be set as REDGeometryStruct */
 typedef struct lab_setup {
 	double screen_width; // in mm mm
@@ -53,6 +68,7 @@ typedef struct gaze {
 	eye_data left;
 	eye_data right;
 	double distance; //mean eye-screen distance
+	gaze_classifier gc; //fixation, saccade or blink at the last sample
 	SDL_mutex *mutex;
 } gaze;
 
@@ -70,11 +86,53 @@ void set_ivx_window(SDL_Window *w);
 /**
  * Allocate a foveation descriptor to pass to an encoder as AVSideData
  *
+ * During saccades and blinks, vision is suppressed and the frame is coded at
+ * minimal cost, see SUPPRESS_QP. A decelerating saccade moves the fovea to
+ * its predicted landing point.
  * @param frame resolution in x and y direction
- * @return float* 4-tuple: x and y coordinate, stddev and max quality offset
+ * @return float* 6-tuple: x and y coordinate, stddev, max quality offset,
+ * temporal period and chroma falloff
  */
 float *foveation_descriptor(int frame_res_x, int frame_res_y);
 
+/**
+ * Standard deviation of the foveation gaussian for the lab setup, relative
+ * to the frame diagonal, unless set_sigma_override set one
+ *
+ * @param frame resolution in x and y direction
+ * @return float sigma as used in the foveation descriptor
+ */
+float foveation_sigma(int frame_res_x, int frame_res_y);
+
+/**
+ * Use a fixed sigma instead of the lab setup's, e.g. set by an operator.
+ *
+ * @param sigma relative to the frame diagonal, 0 to return to the lab setup
+ */
+void set_sigma_override(float sigma);
+
+/**
+ * Chroma sigma relative to the luma one for the foveation descriptor, see
+ * the fovchroma filter.
+ *
+ * @param falloff in (0, 1], 1 applies the luma map to chroma; defaults to
+ * CHROMA_FALLOFF
+ */
+void set_chroma_falloff(float falloff);
+
+float get_chroma_falloff();
+
+
+/**
+ * Log every eye tracker sample as t,x,y,valid,event, with t in us and x, y
+ * relative to the frame as in the foveation descriptor. Samples before the
+ * first foveation_descriptor call are not logged. No-op without ET.
+ *
+ * @param path of the csv file
+ */
+void gaze_log_open(const char *path);
+
+void gaze_log_close(void);
 
 void set_qp_offset(int q);
 
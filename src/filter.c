@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filter.h"
+#include "pexit.h"
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <stdio.h>
+#include <string.h>
+
+flt_ctx *postfilter_init(dec_ctx *dc, const char *desc, int threads)
+{
+	flt_ctx *fc;
+
+	fc = malloc(sizeof(flt_ctx));
+	if (!fc)
+		pexit("malloc failed");
+
+	fc->desc = strdup(desc);
+	if (!fc->desc)
+		pexit("strdup failed");
+
+	fc->in = dc->frames;
+	fc->frames = queue_init(1);
+	fc->graph = NULL;
+	fc->src = NULL;
+	fc->sink = NULL;
+	fc->threads = threads;
+
+	return fc;
+}
+
+flt_ctx *prefilter_init(const char *desc, int threads)
+{
+	flt_ctx *fc;
+
+	fc = malloc(sizeof(flt_ctx));
+	if (!fc)
+		pexit("malloc failed");
+
+	fc->desc = strdup(desc);
+	if (!fc->desc)
+		pexit("strdup failed");
+
+	fc->in = NULL;
+	fc->frames = NULL;
+	fc->graph = NULL;
+	fc->src = NULL;
+	fc->sink = NULL;
+	fc->threads = threads;
+
+	return fc;
+}
+
+static void configure_graph(flt_ctx *fc, AVFrame *frame)
+{
+	AVFilterInOut *inputs, *outputs;
+	char args[256];
+
+	fc->graph = avfilter_graph_alloc();
+	if (!fc->graph)
+		pexit("avfilter_graph_alloc failed");
+	fc->graph->nb_threads = fc->threads;
+
+	/* the filters keep pts, so the time base does not matter */
+	snprintf(args, sizeof(args),
+		"video_size=%dx%d:pix_fmt=%d:time_base=1/1:pixel_aspect=1/1",
+		frame->width, frame->height, frame->format);
+
+	if (avfilter_graph_create_filter(&fc->src, avfilter_get_by_name("buffer"),
+					 "in", args, NULL, fc->graph) < 0)
+		pexit("creating buffer source failed");
+
+	if (avfilter_graph_create_filter(&fc->sink, avfilter_get_by_name("buffersink"),
+					 "out", NULL, NULL, fc->graph) < 0)
+		pexit("creating buffer sink failed");
+
+	outputs = avfilter_inout_alloc();
+	inputs = avfilter_inout_alloc();
+	if (!outputs || !inputs)
+		pexit("avfilter_inout_alloc failed");
+
+	outputs->name = av_strdup("in");
+	outputs->filter_ctx = fc->src;
+	outputs->pad_idx = 0;
+	outputs->next = NULL;
+
+	inputs->name = av_strdup("out");
+	inputs->filter_ctx = fc->sink;
+	inputs->pad_idx = 0;
+	inputs->next = NULL;
+
+	if (avfilter_graph_parse_ptr(fc->graph, fc->desc, &inputs, &outputs, NULL) < 0)
+		pexit("avfilter_graph_parse_ptr failed");
+
+	if (avfilter_graph_config(fc->graph, NULL) < 0)
+		pexit("avfilter_graph_config failed");
+
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+}
+
+int postfilter_thread(void *ptr)
+{
+	flt_ctx *fc = (flt_ctx *) ptr;
+	AVFrame *frame;
+	int ret;
+
+	for (;;) {
+		frame = queue_extract(fc->in);
+		if (!frame)
+			break;
+
+		if (!fc->graph)
+			configure_graph(fc, frame);
+
+		if (av_buffersrc_add_frame(fc->src, frame) < 0)
+			pexit("av_buffersrc_add_frame failed");
+		av_frame_free(&frame);
+
+		for (;;) {
+			frame = av_frame_alloc();
+			if (!frame)
+				pexit("av_frame_alloc failed");
+
+			ret = av_buffersink_get_frame(fc->sink, frame);
+			if (ret < 0) {
+				av_frame_free(&frame);
+				if (ret != AVERROR(EAGAIN))
+					pexit("av_buffersink_get_frame failed");
+				break;
+			}
+			queue_append(fc->frames, frame);
+		}
+	}
+
+	//enqueue flush frame to output
+	queue_append(fc->frames, NULL);
+	postfilter_free(&fc);
+	return 0;
+}
+
+AVFrame *prefilter_frame(flt_ctx *fc, AVFrame *frame)
+{
+	if (!fc->graph)
+		configure_graph(fc, frame);
+
+	if (av_buffersrc_add_frame(fc->src, frame) < 0)
+		pexit("av_buffersrc_add_frame failed");
+	av_frame_free(&frame);
+
+	frame = av_frame_alloc();
+	if (!frame)
+		pexit("av_frame_alloc failed");
+	if (av_buffersink_get_frame(fc->sink, frame) < 0)
+		pexit("av_buffersink_get_frame failed");
+
+	return frame;
+}
+
+void postfilter_free(flt_ctx **fc)
+{
+	flt_ctx *f;
+
+	f = *fc;
+	avfilter_graph_free(&f->graph);
+	if (f->in)
+		queue_free(&f->in);
+	free(f->desc);
+	free(f);
+	*fc = NULL;
+}
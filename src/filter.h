@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "codec.h"
+#include "queue.h"
+#include <libavfilter/avfilter.h>
+#include <libavutil/frame.h>
+
+/**
+ * Post-filter context / status information.
+ * Frames are filtered between a decoder and the window, the filter graph is
+ * configured with the first frame. Passed to postfilter_thread through
+ * SDL_CreateThread. A pre-filter runs in the thread of its encoder and has
+ * no queues.
+ */
+typedef struct flt_ctx {
+	Queue *in;     //input
+	Queue *frames; //output
+	AVFilterGraph *graph;
+	AVFilterContext *src;
+	AVFilterContext *sink;
+	char *desc;    //filter graph description, e.g. "fovdeblock"
+	int threads;   //slice threads, 0 for one per cpu
+} flt_ctx;
+
+/**
+ * Initialize a post-filter for the frames of a decoder.
+ *
+ * The output queue has length 1, see encoder_init.
+ * @param dc decoder supplying the frames.
+ * @param desc libavfilter graph description with one input and one output.
+ * @param threads number of slice threads, 0 for one per cpu.
+ * @return flt_ctx* with its queues initialized.
+ */
+flt_ctx *postfilter_init(dec_ctx *dc, const char *desc, int threads);
+
+/**
+ * Filter AVFrames and put the results in a queue.
+ *
+ * Adds NULL frame to queue in the end and frees the context and its input
+ * queue.
+ * @param ptr will be cast to (flt_ctx *)
+ * @return int 0 on success
+ */
+int postfilter_thread(void *ptr);
+
+/**
+ * Initialize a pre-filter, run synchronously by an encoder on each frame.
+ *
+ * @param desc libavfilter graph description with one input and one output,
+ * every filter has to emit one frame per input frame.
+ * @param threads number of slice threads, 0 for one per cpu.
+ * @return flt_ctx* without queues.
+ */
+flt_ctx *prefilter_init(const char *desc, int threads);
+
+/**
+ * Filter one AVFrame, side data like the foveation descriptor is kept.
+ *
+ * @param fc pre-filter context.
+ * @param frame frame to filter, freed.
+ * @return AVFrame* filtered frame.
+ */
+AVFrame *prefilter_frame(flt_ctx *fc, AVFrame *frame);
+
+/**
+ * Free the post-filter context and its input queue, set fc to NULL.
+ *
+ * The output queue is freed by its consumer, usually the window.
+ * @param fc post-filter context to be freed.
+ */
+void postfilter_free(flt_ctx **fc);
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gazeevent.h"
+
+#include <math.h>
+
+/*
+ * Main sequence: the peak velocity of a saccade saturates with its
+ * amplitude A as V_MAX * (1 - exp(-A / A_SAT)), in deg/s and degrees.
+ */
+#define V_MAX 500.0
+#define A_SAT 14.0
+
+/* the saccade decelerates once the velocity fell below this share of its peak */
+#define DECELERATION 0.8
+
+void gaze_classifier_init(gaze_classifier *gc, double px_per_deg)
+{
+	gc->px_per_deg = px_per_deg;
+	gc->saccade_velocity = 30;
+	gc->max_saccade = 150000;
+	gc->max_blink = 500000;
+
+	gc->event = GAZE_LOST;
+	gc->t = 0;
+	gc->x = gc->y = 0;
+	gc->onset = 0;
+	gc->onset_x = gc->onset_y = 0;
+	gc->peak = 0;
+	gc->landing = 0;
+	gc->land_x = gc->land_y = 0;
+	gc->started = 0;
+}
+
+/* extrapolate from the onset along the current direction */
+static void predict_landing(gaze_classifier *gc, double x, double y)
+{
+	double dx = x - gc->onset_x, dy = y - gc->onset_y;
+	double d = sqrt(dx * dx + dy * dy);
+	double a;
+
+	a = -A_SAT * log(1 - fmin(gc->peak, 0.95 * V_MAX) / V_MAX) * gc->px_per_deg;
+	if (d <= 0 || a <= d) {
+		gc->land_x = x;
+		gc->land_y = y;
+	} else {
+		gc->land_x = gc->onset_x + dx * a / d;
+		gc->land_y = gc->onset_y + dy * a / d;
+	}
+}
+
+gaze_event gaze_classify(gaze_classifier *gc, int64_t t, double x, double y, int valid)
+{
+	double v;
+
+	if (!valid) {
+		if (!gc->started) {
+			gc->event = GAZE_LOST;
+		} else if (gc->event != GAZE_BLINK && gc->event != GAZE_LOST) {
+			gc->event = GAZE_BLINK;
+			gc->onset = gc->t;
+			gc->onset_x = gc->x;
+			gc->onset_y = gc->y;
+		} else if (gc->event == GAZE_BLINK && t - gc->onset > gc->max_blink) {
+			gc->event = GAZE_LOST;
+		}
+		return gc->event;
+	}
+
+	if (gc->started && t <= gc->t)
+		return gc->event;
+
+	if (!gc->started || gc->event == GAZE_BLINK || gc->event == GAZE_LOST) {
+		/* no velocity across gaps */
+		gc->event = GAZE_FIXATION;
+	} else {
+		v = sqrt((x - gc->x) * (x - gc->x) + (y - gc->y) * (y - gc->y)) /
+		    gc->px_per_deg / ((t - gc->t) / 1e6);
+
+		if (gc->event == GAZE_FIXATION && v > gc->saccade_velocity) {
+			gc->event = GAZE_SACCADE;
+			gc->onset = gc->t;
+			gc->onset_x = gc->x;
+			gc->onset_y = gc->y;
+			gc->peak = v;
+			gc->landing = 0;
+		} else if (gc->event == GAZE_SACCADE) {
+			if (v < gc->saccade_velocity || t - gc->onset > gc->max_saccade) {
+				gc->event = GAZE_FIXATION;
+			} else {
+				gc->peak = fmax(gc->peak, v);
+				if (v < DECELERATION * gc->peak)
+					gc->landing = 1;
+				if (gc->landing)
+					predict_landing(gc, x, y);
+			}
+		}
+	}
+
+	gc->started = 1;
+	gc->t = t;
+	gc->x = x;
+	gc->y = y;
+	return gc->event;
+}
+
+int gaze_suppressed(const gaze_classifier *gc)
+{
+	return gc->event == GAZE_BLINK || (gc->event == GAZE_SACCADE && !gc->landing);
+}
+
+void gaze_target(const gaze_classifier *gc, double *x, double *y)
+{
+	if (gc->event == GAZE_SACCADE && gc->landing) {
+		*x = gc->land_x;
+		*y = gc->land_y;
+	} else if (gc->event == GAZE_BLINK) {
+		*x = gc->onset_x;
+		*y = gc->onset_y;
+	} else {
+		*x = gc->x;
+		*y = gc->y;
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Vision is largely suppressed during saccades and blinks, frames shown
+ * then may be coded at minimal cost. Samples are classified by their
+ * velocity (I-VT) and validity, the landing point of a saccade is predicted
+ * from its peak velocity once it decelerates.
+ */
+
+typedef enum gaze_event {
+	GAZE_FIXATION,
+	GAZE_SACCADE,
+	GAZE_BLINK,
+	GAZE_LOST, //no valid samples for longer than a blink lasts
+} gaze_event;
+
+typedef struct gaze_classifier {
+	double px_per_deg; //units of the gaze coordinates per degree visual angle
+	double saccade_velocity; //onset threshold in deg/s
+	int64_t max_saccade; //in us, longer movements are pursuits
+	int64_t max_blink; //in us, longer gaps are tracking losses
+
+	gaze_event event;
+	int64_t t; //time of the last valid sample in us
+	double x, y; //last valid sample
+	int64_t onset; //last valid sample before the saccade or blink
+	double onset_x, onset_y;
+	double peak; //peak velocity of the current saccade in deg/s
+	int landing; //saccade is decelerating, land_x and land_y are valid
+	double land_x, land_y;
+	int started; //at least one valid sample was seen
+} gaze_classifier;
+
+/**
+ * Initialize a classifier with the default thresholds.
+ *
+ * @param gc classifier to initialize
+ * @param px_per_deg units of the gaze coordinates per degree visual angle
+ */
+void gaze_classifier_init(gaze_classifier *gc, double px_per_deg);
+
+/**
+ * Classify one gaze sample.
+ *
+ * @param gc classifier state
+ * @param t sample time in us, increasing
+ * @param x horizontal gaze position
+ * @param y vertical gaze position
+ * @param valid 0 if the tracker lost both eyes, e.g. in a blink
+ * @return gaze_event the movement the sample belongs to
+ */
+gaze_event gaze_classify(gaze_classifier *gc, int64_t t, double x, double y, int valid);
+
+/**
+ * Whether vision is suppressed at the last sample: in a blink or a saccade
+ * whose landing point is not predicted yet.
+ */
+int gaze_suppressed(const gaze_classifier *gc);
+
+/**
+ * Where quality is needed at the last sample: the predicted landing point
+ * of a decelerating saccade, the position before a blink or the last
+ * sample otherwise.
+ */
+void gaze_target(const gaze_classifier *gc, double *x, double *y);
@@ -0,0 +1,838 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline foveation for on-demand video from the gaze of many viewers.
+ *
+ * The gaze logs of earlier viewers of a clip, as written by replicate, are
+ * aggregated into one attention heatmap per frame: every fixation sample
+ * adds a gaussian, the sum is smoothed over neighbouring frames. The
+ * heatmap is reduced to up to a handful of foci covering most of the
+ * attention, which become one multi-fixation foveation descriptor per
+ * frame. The clip is then encoded in two passes with x264's lookahead and
+ * macroblock tree, once with and once without these descriptors, at a
+ * ladder of bitrates. Reported are the Bjøntegaard rate differences on
+ * plain and eccentricity-weighted PSNR, the latter averaged over all
+ * viewers, and the share of fixations that land in the preserved regions,
+ * where the QP offset stays below delta / 2.
+ *
+ * The heatmap is built in parallel stages, each frame's sum over all
+ * viewers is reduced by one thread. Encodes run in parallel with one
+ * single-threaded encoder each.
+ */
+
+#include "bdrate.h"
+#include "gazeevent.h"
+#include "io.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/fifo.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+
+/* as in rdsweep: errors at eccentricity e are weighted by E2 / (E2 + e) */
+#define E2 2.3
+
+/* heatmap resolution in pixels, well below the accuracy of a tracker */
+#define HM_CELL 32
+
+/* frames splatted per work item */
+#define FRAME_CHUNK 64
+
+/* foci weaker than this share of the strongest one are single viewers */
+#define MIN_PEAK 0.1f
+
+typedef struct viewer {
+	float *x, *y; //per frame, relative to the frame, NAN without a sample
+	uint8_t *fixation; //the sample belongs to a fixation
+	int n; //frames with entries
+} viewer;
+
+typedef struct heatmap_job {
+	int kbps;
+	int foveated;
+	/* results */
+	int frames;
+	int64_t bytes;
+	double seconds; //duration of the encoded video
+	double sse, n;
+	double wsse, wsum;
+} heatmap_job;
+
+typedef struct heatmap {
+	const char *clip;
+	const char *encoder;
+	viewer *viewers;
+	int nb_viewers;
+	int width, height; //of the clip
+	AVRational fps;
+	int frames; //with gaze data
+	int max_frames;
+	float fov; //diagonal field of view of the frame in degrees
+	float delta, sigma;
+	float spread; //standard deviation of a fixation's gaussian in degrees
+	int radius; //of the temporal smoothing in frames
+	int max_foci;
+	float mass; //share of the attention the foci should cover
+	/* heatmap cells and per frame maps and foci */
+	int w, h;
+	float *map;
+	float *foci; //max_foci sets of (x, y, sigma, delta)
+	int *nb_foci;
+	heatmap_job *jobs;
+	/* the current parallel stage */
+	void (*stage)(struct heatmap *h, int item);
+	int nb_items;
+	SDL_atomic_t next;
+	int nb_threads;
+} heatmap;
+
+/* state of one encoding pass */
+typedef struct pass {
+	AVCodecContext *enc;
+	AVCodecContext *dec; //second pass only
+	AVFifoBuffer *refs; //source frames in coding order, opaque is the frame number
+	AVPacket *pkt;
+	AVFrame *out;
+	double *mb_sse;
+	char *stats; //first pass statistics of encoders without a stats file
+	size_t stats_size;
+} pass;
+
+void display_usage(char *progname)
+{
+	printf("foveate a clip for on-demand streaming along the gaze of many viewers\n");
+	printf("usage:\n$ %s [-e encoder] [-b kbps,...] [-d delta] [-s sigma] "
+	       "[-k foci] [-m mass] [-g spread] [-t frames] [-f fov] [-j threads] "
+	       "[-n frames] [-p points.csv] clip gazelogs\n", progname);
+	printf("gazelogs lists one file per viewer and line, gaze logs hold "
+	       "frame,x,y[,...] lines with relative coordinates\n");
+}
+
+static int parse_list(const char *arg, float *list)
+{
+	char *copy, *tok, *save;
+	int n = 0;
+
+	copy = strdup(arg);
+	if (!copy)
+		pexit("strdup failed");
+	for (tok = strtok_r(copy, ",", &save); tok && n < BD_MAX_POINTS;
+	     tok = strtok_r(NULL, ",", &save))
+		list[n++] = strtof(tok, NULL);
+	free(copy);
+	return n;
+}
+
+static float px_per_deg(const heatmap *h)
+{
+	return sqrtf(h->width * h->width + h->height * h->height) / h->fov;
+}
+
+/*
+ * Read a viewer's gaze log, one sample per frame. Samples outside of the
+ * frame are tracking losses, the rest is classified as in the suppression
+ * of saccades and blinks.
+ */
+static void read_viewer(heatmap *h, viewer *v, const char *path)
+{
+	char **lines, **l;
+	gaze_classifier gc;
+	float x, y;
+	int f;
+
+	lines = parse_lines(path);
+	v->n = 0;
+	for (l = lines; *l; l++)
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) == 3 && f >= v->n)
+			v->n = f + 1;
+	if (h->max_frames)
+		v->n = FFMIN(v->n, h->max_frames);
+
+	v->x = malloc(v->n * sizeof(float));
+	v->y = malloc(v->n * sizeof(float));
+	v->fixation = malloc(v->n);
+	if (v->n && (!v->x || !v->y || !v->fixation))
+		pexit("malloc failed");
+	for (f = 0; f < v->n; f++)
+		v->x[f] = v->y[f] = NAN;
+
+	/* headers are skipped */
+	for (l = lines; *l; l++) {
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) != 3 || f < 0 || f >= v->n ||
+		    x < 0 || x > 1 || y < 0 || y > 1)
+			continue;
+		v->x[f] = x;
+		v->y[f] = y;
+	}
+	free_lines(&lines);
+
+	gaze_classifier_init(&gc, px_per_deg(h));
+	for (f = 0; f < v->n; f++) {
+		int valid = !isnan(v->x[f]);
+
+		gaze_classify(&gc, av_rescale(f, 1000000LL * h->fps.den, h->fps.num),
+			      v->x[f] * h->width, v->y[f] * h->height, valid);
+		v->fixation[f] = valid && gc.event == GAZE_FIXATION;
+	}
+	h->frames = FFMAX(h->frames, v->n);
+}
+
+static int stage_thread(void *ptr)
+{
+	heatmap *h = (heatmap *) ptr;
+	int i;
+
+	while ((i = SDL_AtomicAdd(&h->next, 1)) < h->nb_items)
+		h->stage(h, i);
+	return 0;
+}
+
+/* call stage on items 0 to nb_items - 1 in parallel */
+static void run_stage(heatmap *h, int nb_items, void (*stage)(heatmap *h, int item))
+{
+	SDL_Thread **threads;
+	int i;
+
+	h->stage = stage;
+	h->nb_items = nb_items;
+	SDL_AtomicSet(&h->next, 0);
+
+	threads = malloc(h->nb_threads * sizeof(SDL_Thread *));
+	if (!threads)
+		pexit("malloc failed");
+	for (i = 0; i < h->nb_threads; i++)
+		threads[i] = SDL_CreateThread(stage_thread, "heatmap", h);
+	for (i = 0; i < h->nb_threads; i++)
+		SDL_WaitThread(threads[i], NULL);
+	free(threads);
+}
+
+/* sum the fixations of all viewers on a chunk of frames */
+static void splat(heatmap *h, int chunk)
+{
+	float s = h->spread * px_per_deg(h) / HM_CELL;
+	int r = ceilf(3 * s);
+	int f, v, x, y;
+
+	for (f = chunk * FRAME_CHUNK; f < FFMIN((chunk + 1) * FRAME_CHUNK, h->frames); f++) {
+		float *map = h->map + (size_t)f * h->w * h->h;
+
+		for (v = 0; v < h->nb_viewers; v++) {
+			const viewer *vw = &h->viewers[v];
+			float cx, cy;
+
+			if (f >= vw->n || !vw->fixation[f])
+				continue;
+			cx = vw->x[f] * h->width / HM_CELL;
+			cy = vw->y[f] * h->height / HM_CELL;
+			for (y = FFMAX((int)cy - r, 0); y <= FFMIN((int)cy + r, h->h - 1); y++) {
+				float dy = y + 0.5f - cy;
+
+				for (x = FFMAX((int)cx - r, 0); x <= FFMIN((int)cx + r, h->w - 1); x++) {
+					float dx = x + 0.5f - cx;
+
+					map[y * h->w + x] += expf(-(dx * dx + dy * dy) / (2 * s * s));
+				}
+			}
+		}
+	}
+}
+
+/* box filter one row of cells over +-radius frames */
+static void smooth(heatmap *h, int row)
+{
+	size_t stride = (size_t)h->w * h->h;
+	float *tmp;
+	double sum;
+	int f, x, lo, hi;
+
+	tmp = malloc(h->frames * sizeof(float));
+	if (!tmp)
+		pexit("malloc failed");
+	for (x = row * h->w; x < (row + 1) * h->w; x++) {
+		for (f = 0; f < h->frames; f++)
+			tmp[f] = h->map[f * stride + x];
+		sum = 0;
+		for (f = 0; f < FFMIN(h->radius, h->frames); f++)
+			sum += tmp[f];
+		for (f = 0; f < h->frames; f++) {
+			lo = f - h->radius;
+			hi = f + h->radius;
+			if (hi < h->frames)
+				sum += tmp[hi];
+			if (lo > 0)
+				sum -= tmp[lo - 1];
+			h->map[f * stride + x] = sum / (FFMIN(hi, h->frames - 1) - FFMAX(lo, 0) + 1);
+		}
+	}
+	free(tmp);
+}
+
+/*
+ * Greedily pick the strongest cells as foci until they cover the requested
+ * share of the attention. A focus claims the cells within the region it
+ * preserves and sits at the centroid of their attention.
+ */
+static void extract(heatmap *h, int f)
+{
+	const float *map = h->map + (size_t)f * h->w * h->h;
+	float *focus = h->foci + (size_t)f * h->max_foci * 4;
+	float r = h->sigma * sqrtf(h->width * h->width + h->height * h->height) *
+		  sqrtf(logf(2)) / HM_CELL;
+	float *left, first = 0;
+	double total = 0, covered = 0;
+	int cells = h->w * h->h;
+	int i, x, y;
+
+	left = malloc(cells * sizeof(float));
+	if (!left)
+		pexit("malloc failed");
+	memcpy(left, map, cells * sizeof(float));
+	for (i = 0; i < cells; i++)
+		total += left[i];
+
+	h->nb_foci[f] = 0;
+	while (total > 0 && h->nb_foci[f] < h->max_foci && covered < h->mass * total) {
+		double sx = 0, sy = 0, m = 0;
+		int best = 0, bx, by;
+
+		for (i = 1; i < cells; i++)
+			if (left[i] > left[best])
+				best = i;
+		if (left[best] <= 0 || left[best] < MIN_PEAK * first)
+			break;
+		if (!h->nb_foci[f])
+			first = left[best];
+
+		bx = best % h->w;
+		by = best / h->w;
+		for (y = FFMAX(by - (int)r, 0); y <= FFMIN(by + (int)r, h->h - 1); y++) {
+			for (x = FFMAX(bx - (int)r, 0); x <= FFMIN(bx + (int)r, h->w - 1); x++) {
+				float *c = &left[y * h->w + x];
+
+				if ((x - bx) * (x - bx) + (y - by) * (y - by) > r * r)
+					continue;
+				sx += *c * (x + 0.5);
+				sy += *c * (y + 0.5);
+				m += *c;
+				*c = 0;
+			}
+		}
+		covered += m;
+
+		focus[0] = fminf(sx / m * HM_CELL / h->width, 1);
+		focus[1] = fminf(sy / m * HM_CELL / h->height, 1);
+		focus[2] = h->sigma;
+		focus[3] = h->delta;
+		focus += 4;
+		h->nb_foci[f]++;
+	}
+	free(left);
+}
+
+/* the offset the encoders give the macroblock at x, y in frame f */
+static float qp_offset(const heatmap *h, int f, float x, float y)
+{
+	const float *focus = h->foci + (size_t)f * h->max_foci * 4;
+	int bw = (h->width + 15) / 16, bh = (h->height + 15) / 16;
+	int bx = FFMIN(x * bw, bw - 1), by = FFMIN(y * bh, bh - 1);
+	float s2 = h->sigma * h->sigma * (bw * bw + bh * bh);
+	float offset = h->nb_foci[f] ? h->delta : 0;
+	int i;
+
+	for (i = 0; i < h->nb_foci[f]; i++, focus += 4) {
+		float dx = bx - focus[0] * bw, dy = by - focus[1] * bh;
+
+		offset = fminf(offset, focus[3] * (1 - expf(-(dx * dx + dy * dy) / s2)));
+	}
+	return offset;
+}
+
+static AVCodecContext *open_encoder(heatmap *h, const AVCodecContext *src, AVRational tb,
+				    heatmap_job *job, int second, const char *stats, pass *p)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+	AVDictionary *options = NULL;
+
+	codec = avcodec_find_encoder_by_name(h->encoder);
+	if (!codec)
+		pexit("encoder not found");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+
+	if (!strcmp(h->encoder, "libx264")) {
+		/*
+		 * Nothing waits for the frames, unlike the workbench's low
+		 * latency settings the lookahead and macroblock tree run,
+		 * foveation adds to their offsets.
+		 */
+		av_dict_set(&options, "preset", "medium", 0);
+		av_dict_set(&options, "aq-mode", "1", 0);
+		av_dict_set(&options, "mbtree", "1", 0);
+		av_dict_set(&options, "stats", stats, 0);
+	} else {
+		/* mpegvideo encoders pass their statistics in memory */
+		av_dict_set(&options, "fovea", "1", 0);
+		if (second)
+			avctx->stats_in = p->stats;
+	}
+	avctx->flags		|= second ? AV_CODEC_FLAG_PASS2 : AV_CODEC_FLAG_PASS1;
+	avctx->bit_rate		= job->kbps * 1000LL;
+	avctx->time_base	= tb;
+	avctx->framerate	= h->fps;
+	avctx->pix_fmt		= AV_PIX_FMT_YUV420P;
+	avctx->width		= src->width;
+	avctx->height		= src->height;
+	avctx->thread_count	= 1;
+
+	if (avcodec_open2(avctx, codec, &options) < 0)
+		pexit("avcodec_open2 failed");
+	av_dict_free(&options);
+	return avctx;
+}
+
+static AVCodecContext *open_decoder(enum AVCodecID id, const AVCodecParameters *par)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+
+	codec = avcodec_find_decoder(id);
+	if (!codec)
+		pexit("avcodec_find_decoder failed");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+	if (par && avcodec_parameters_to_context(avctx, par) < 0)
+		pexit("avcodec_parameters_to_context failed");
+	avctx->thread_count = 1;
+	if (avcodec_open2(avctx, codec, NULL) < 0)
+		pexit("avcodec_open2 failed");
+	return avctx;
+}
+
+/*
+ * Luma errors per macroblock, weighted by the eccentricity for every
+ * viewer with a sample on the frame.
+ */
+static void score_frame(heatmap *h, heatmap_job *job, double *mb_sse,
+			const AVFrame *ref, const AVFrame *dist, int n)
+{
+	int bw = (ref->width + 15) / 16, bh = (ref->height + 15) / 16;
+	float ppd = px_per_deg(h);
+	int x, y, v;
+
+	memset(mb_sse, 0, bw * bh * sizeof(*mb_sse));
+	for (y = 0; y < ref->height; y++) {
+		const uint8_t *a = ref->data[0] + y * ref->linesize[0];
+		const uint8_t *b = dist->data[0] + y * dist->linesize[0];
+		double *row = mb_sse + y / 16 * bw;
+
+		for (x = 0; x < ref->width; x++) {
+			int d = a[x] - b[x];
+
+			row[x / 16] += d * d;
+		}
+	}
+	for (x = 0; x < bw * bh; x++)
+		job->sse += mb_sse[x];
+	job->n += ref->width * ref->height;
+
+	for (v = 0; v < h->nb_viewers; v++) {
+		const viewer *vw = &h->viewers[v];
+		float gx, gy;
+
+		if (n >= vw->n || isnan(vw->x[n]))
+			continue;
+		gx = vw->x[n] * ref->width;
+		gy = vw->y[n] * ref->height;
+		for (y = 0; y < bh; y++) {
+			float cy = FFMIN(y * 16 + 8, ref->height);
+			int ph = FFMIN(16, ref->height - y * 16);
+
+			for (x = 0; x < bw; x++) {
+				float cx = FFMIN(x * 16 + 8, ref->width);
+				float e = hypotf(cx - gx, cy - gy) / ppd;
+				float w = E2 / (E2 + e);
+
+				job->wsse += w * mb_sse[y * bw + x];
+				job->wsum += w * FFMIN(16, ref->width - x * 16) * ph;
+			}
+		}
+	}
+}
+
+static void append_stats(pass *p)
+{
+	const char *s = p->enc->stats_out;
+	size_t len;
+
+	if (!s || !*s)
+		return;
+	len = strlen(s);
+	p->stats = realloc(p->stats, p->stats_size + len + 1);
+	if (!p->stats)
+		pexit("realloc failed");
+	memcpy(p->stats + p->stats_size, s, len + 1);
+	p->stats_size += len;
+}
+
+static void drain(heatmap *h, heatmap_job *job, pass *p)
+{
+	AVFrame *ref;
+
+	while (avcodec_receive_packet(p->enc, p->pkt) == 0) {
+		if (!p->dec) {
+			append_stats(p);
+			av_packet_unref(p->pkt);
+			continue;
+		}
+		job->bytes += p->pkt->size;
+		if (avcodec_send_packet(p->dec, p->pkt) < 0)
+			pexit("avcodec_send_packet failed");
+		av_packet_unref(p->pkt);
+	}
+	if (!p->dec)
+		return;
+	while (avcodec_receive_frame(p->dec, p->out) == 0) {
+		if (av_fifo_size(p->refs) < (int)sizeof(ref))
+			pexit("decoder returned more frames than were encoded");
+		av_fifo_generic_read(p->refs, &ref, sizeof(ref), NULL);
+		score_frame(h, job, p->mb_sse, ref, p->out, (int)(intptr_t)ref->opaque);
+		av_frame_free(&ref);
+		av_frame_unref(p->out);
+	}
+}
+
+static void encode_frame(heatmap *h, heatmap_job *job, pass *p, AVFrame *frame, int n)
+{
+	AVFrameSideData *sd;
+	AVFrame *ref;
+
+	if (frame->format != AV_PIX_FMT_YUV420P)
+		pexit("clips have to be yuv420p");
+
+	if (p->dec) {
+		ref = av_frame_clone(frame);
+		if (!ref)
+			pexit("av_frame_clone failed");
+		ref->opaque = (void *)(intptr_t)n;
+		if (av_fifo_space(p->refs) < (int)sizeof(ref) &&
+		    av_fifo_grow(p->refs, av_fifo_size(p->refs)) < 0)
+			pexit("av_fifo_grow failed");
+		av_fifo_generic_write(p->refs, &ref, sizeof(ref), NULL);
+	}
+
+	/* both passes see the same foci */
+	if (job->foveated && n < h->frames && h->nb_foci[n]) {
+		sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+					    h->nb_foci[n] * 4 * sizeof(float));
+		if (!sd)
+			pexit("side data allocation failed");
+		memcpy(sd->data, h->foci + (size_t)n * h->max_foci * 4, sd->size);
+	}
+	frame->pict_type = 0; //keep undefined to prevent warnings
+	frame->pts = n;
+
+	if (avcodec_send_frame(p->enc, frame) < 0)
+		pexit("avcodec_send_frame failed");
+	drain(h, job, p);
+}
+
+static void encode_pass(heatmap *h, heatmap_job *job, int second, const char *stats, pass *p)
+{
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *src_dec;
+	AVPacket *pkt;
+	AVFrame *frame;
+	int index, n = 0, eof = 0;
+
+	if (avformat_open_input(&fctx, h->clip, NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+
+	src_dec = open_decoder(fctx->streams[index]->codecpar->codec_id,
+			       fctx->streams[index]->codecpar);
+	p->enc = open_encoder(h, src_dec, av_inv_q(h->fps), job, second, stats, p);
+	p->dec = second ? open_decoder(p->enc->codec_id, NULL) : NULL;
+	p->refs = av_fifo_alloc(16 * sizeof(AVFrame *));
+	p->pkt = av_packet_alloc();
+	p->out = av_frame_alloc();
+	p->mb_sse = malloc(((h->width + 15) / 16) * ((h->height + 15) / 16) * sizeof(double));
+	pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	if (!p->refs || !p->pkt || !p->out || !p->mb_sse || !pkt || !frame)
+		pexit("allocation failed");
+
+	while (!eof) {
+		if (h->max_frames && n >= h->max_frames) {
+			eof = 1;
+		} else if (av_read_frame(fctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(src_dec, NULL);
+		} else if (pkt->stream_index == index) {
+			if (avcodec_send_packet(src_dec, pkt) < 0)
+				pexit("avcodec_send_packet failed");
+		}
+		av_packet_unref(pkt);
+
+		while ((!h->max_frames || n < h->max_frames) &&
+		       avcodec_receive_frame(src_dec, frame) == 0) {
+			encode_frame(h, job, p, frame, n++);
+			av_frame_unref(frame);
+		}
+	}
+
+	/* flush encoder, then the decoder of its output */
+	avcodec_send_frame(p->enc, NULL);
+	drain(h, job, p);
+	if (p->dec) {
+		avcodec_send_packet(p->dec, NULL);
+		drain(h, job, p);
+		job->frames = n;
+		job->seconds = n * av_q2d(av_inv_q(h->fps));
+	}
+
+	while (av_fifo_size(p->refs) >= (int)sizeof(frame)) {
+		av_fifo_generic_read(p->refs, &frame, sizeof(frame), NULL);
+		av_frame_free(&frame);
+	}
+	av_fifo_freep(&p->refs);
+	av_frame_free(&frame);
+	av_frame_free(&p->out);
+	av_packet_free(&pkt);
+	av_packet_free(&p->pkt);
+	free(p->mb_sse);
+	avcodec_free_context(&src_dec);
+	avcodec_free_context(&p->enc);
+	avcodec_free_context(&p->dec);
+	avformat_close_input(&fctx);
+}
+
+static void run_job(heatmap *h, int i)
+{
+	heatmap_job *job = &h->jobs[i];
+	pass p = { 0 };
+	char stats[64], path[80];
+
+	snprintf(stats, sizeof(stats), "heatmap-%d-%d.log", (int)getpid(), i);
+	encode_pass(h, job, 0, stats, &p);
+	encode_pass(h, job, 1, stats, &p);
+	fprintf(stderr, "%d kbit/s%s: %d frames done\n", job->kbps,
+		job->foveated ? " foveated" : "", job->frames);
+
+	free(p.stats);
+	remove(stats);
+	snprintf(path, sizeof(path), "%s.mbtree", stats);
+	remove(path);
+}
+
+static double psnr(double sse, double n)
+{
+	if (sse <= 0)
+		return 100;
+	return 10 * log10(255.0 * 255.0 * n / sse);
+}
+
+int main(int argc, char **argv)
+{
+	float rates[BD_MAX_POINTS] = { 500, 1000, 2000, 4000 };
+	double rr[BD_MAX_POINTS], rt[BD_MAX_POINTS], er[BD_MAX_POINTS], et[BD_MAX_POINTS];
+	double pr[BD_MAX_POINTS], pt[BD_MAX_POINTS];
+	AVFormatContext *fctx = NULL;
+	AVStream *st;
+	char *points = NULL;
+	char **gazelogs;
+	heatmap h = { 0 };
+	int64_t fixations = 0, preserved = 0, foci = 0;
+	int nb_rates = 4;
+	int opt, index, i, f;
+	FILE *fp;
+
+	h.encoder = "libx264";
+	h.delta = 12;
+	h.sigma = 0.1;
+	h.max_foci = 4;
+	h.mass = 0.8;
+	h.spread = 1;
+	h.radius = 6;
+	h.fov = 40;
+	h.nb_threads = SDL_GetCPUCount();
+
+	while ((opt = getopt(argc, argv, "e:b:d:s:k:m:g:t:f:j:n:p:")) != -1) {
+		switch (opt) {
+		case 'e':
+			h.encoder = optarg;
+			break;
+		case 'b':
+			nb_rates = parse_list(optarg, rates);
+			break;
+		case 'd':
+			h.delta = strtof(optarg, NULL);
+			break;
+		case 's':
+			h.sigma = strtof(optarg, NULL);
+			break;
+		case 'k':
+			h.max_foci = atoi(optarg);
+			break;
+		case 'm':
+			h.mass = strtof(optarg, NULL);
+			break;
+		case 'g':
+			h.spread = strtof(optarg, NULL);
+			break;
+		case 't':
+			h.radius = atoi(optarg);
+			break;
+		case 'f':
+			h.fov = strtof(optarg, NULL);
+			break;
+		case 'j':
+			h.nb_threads = atoi(optarg);
+			break;
+		case 'n':
+			h.max_frames = atoi(optarg);
+			break;
+		case 'p':
+			points = optarg;
+			break;
+		default:
+			display_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || nb_rates < 2 || h.nb_threads < 1 || h.max_foci < 1 ||
+	    h.delta <= 0 || h.sigma <= 0 || h.spread <= 0 || h.radius < 0 || h.fov <= 0) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	h.clip = argv[optind];
+
+	if (avformat_open_input(&fctx, h.clip, NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+	st = fctx->streams[index];
+	h.width = st->codecpar->width;
+	h.height = st->codecpar->height;
+	h.fps = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+	avformat_close_input(&fctx);
+
+	gazelogs = parse_lines(argv[optind + 1]);
+	for (h.nb_viewers = 0; gazelogs[h.nb_viewers]; h.nb_viewers++)
+		;
+	h.viewers = calloc(h.nb_viewers, sizeof(viewer));
+	if (!h.viewers)
+		pexit("calloc failed");
+	for (i = 0; i < h.nb_viewers; i++)
+		read_viewer(&h, &h.viewers[i], gazelogs[i]);
+	if (!h.frames)
+		pexit("gaze logs without samples");
+
+	h.w = (h.width + HM_CELL - 1) / HM_CELL;
+	h.h = (h.height + HM_CELL - 1) / HM_CELL;
+	h.map = calloc((size_t)h.frames * h.w * h.h, sizeof(float));
+	h.foci = malloc((size_t)h.frames * h.max_foci * 4 * sizeof(float));
+	h.nb_foci = malloc(h.frames * sizeof(int));
+	if (!h.map || !h.foci || !h.nb_foci)
+		pexit("allocation failed");
+	run_stage(&h, (h.frames + FRAME_CHUNK - 1) / FRAME_CHUNK, splat);
+	run_stage(&h, h.h, smooth);
+	run_stage(&h, h.frames, extract);
+
+	for (f = 0; f < h.frames; f++)
+		foci += h.nb_foci[f];
+	for (i = 0; i < h.nb_viewers; i++) {
+		const viewer *v = &h.viewers[i];
+
+		for (f = 0; f < v->n; f++) {
+			if (!v->fixation[f])
+				continue;
+			fixations++;
+			preserved += qp_offset(&h, f, v->x[f], v->y[f]) < h.delta / 2;
+		}
+	}
+
+	/* reference and foveated encode per rate */
+	h.jobs = calloc(2 * nb_rates, sizeof(heatmap_job));
+	if (!h.jobs)
+		pexit("calloc failed");
+	for (i = 0; i < 2 * nb_rates; i++) {
+		h.jobs[i].kbps = rates[i / 2];
+		h.jobs[i].foveated = i % 2;
+	}
+	run_stage(&h, 2 * nb_rates, run_job);
+
+	for (i = 0; i < nb_rates; i++) {
+		heatmap_job *ref = &h.jobs[2 * i], *test = ref + 1;
+
+		rr[i] = ref->bytes * 8 / ref->seconds;
+		rt[i] = test->bytes * 8 / test->seconds;
+		er[i] = psnr(ref->wsse, ref->wsum);
+		et[i] = psnr(test->wsse, test->wsum);
+		pr[i] = psnr(ref->sse, ref->n);
+		pt[i] = psnr(test->sse, test->n);
+	}
+
+	if (points) {
+		fp = fopen(points, "w");
+		if (!fp)
+			pexit("fopen failed");
+		fprintf(fp, "target_kbps,foveated,frames,kbps,psnr,ew_psnr\n");
+		for (i = 0; i < 2 * nb_rates; i++) {
+			heatmap_job *job = &h.jobs[i];
+
+			fprintf(fp, "%d,%d,%d,%.1f,%.3f,%.3f\n", job->kbps, job->foveated,
+				job->frames, job->bytes * 8 / job->seconds / 1000,
+				psnr(job->sse, job->n), psnr(job->wsse, job->wsum));
+		}
+		fclose(fp);
+	}
+
+	printf("viewers,frames,foci_per_frame,fixations_preserved,bd_rate_ew_psnr,bd_rate_psnr\n");
+	printf("%d,%d,%.2f,%.1f%%,%.2f,%.2f\n", h.nb_viewers, h.frames,
+	       (double)foci / h.frames, fixations ? 100.0 * preserved / fixations : NAN,
+	       bd_rate(rr, er, rt, et, nb_rates), bd_rate(rr, pr, rt, pt, nb_rates));
+
+	for (i = 0; i < h.nb_viewers; i++) {
+		free(h.viewers[i].x);
+		free(h.viewers[i].y);
+		free(h.viewers[i].fixation);
+	}
+	free(h.viewers);
+	free(h.map);
+	free(h.foci);
+	free(h.nb_foci);
+	free(h.jobs);
+	free_lines(&gazelogs);
+	return EXIT_SUCCESS;
+}
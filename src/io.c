@@ -16,8 +16,13 @@
  */
 
 #include "io.h"
+#include "keyindex.h"
+#include "metrics.h"
+#include "perf.h"
 #include "pexit.h"
+#include <libavutil/opt.h>
 #include <libavutil/time.h>
+#include <math.h>
 #include <limits.h> /* PATH_MAX */
 
 char **parse_lines(const char *pathname)
@@ -94,11 +99,13 @@ int reader_thread(void *ptr)
 			pexit("av_read_frame failed");
 
 		/* discard invalid buffers and non-video packages */
-		if (pkt->buf == NULL || pkt->stream_index != rc->stream_index) {
+		if (pkt->buf == NULL || !reader_select(rc, pkt)) {
 			av_packet_free(&pkt);
 			continue;
 		}
 		queue_append(rc->packets, pkt);
+		perf_frame(PERF_READER);
+		metrics_frame(PERF_READER);
 	}
 	/* finally enqueue NULL to enter draining mode */
 	queue_append(rc->packets, NULL);
@@ -107,21 +114,123 @@ int reader_thread(void *ptr)
 	return 0;
 }
 
+/* nearest variant to x, y, distances in pixels once the size is known */
+static int closest_region(rdr_ctx *rc, float x, float y)
+{
+	AVCodecParameters *par = rc->fctx->streams[rc->stream_index]->codecpar;
+	float w = par->width > 0 ? par->width : 1, h = par->height > 0 ? par->height : 1;
+	float d, best_d = INFINITY;
+	unsigned int i;
+	int best = rc->stream_index;
+
+	for (i = 0; i < rc->fctx->nb_streams; i++) {
+		float dx = (rc->regions[2 * i] - x) * w;
+		float dy = (rc->regions[2 * i + 1] - y) * h;
+
+		if (rc->regions[2 * i] < 0)
+			continue;
+		d = dx * dx + dy * dy;
+		if (d < best_d) {
+			best_d = d;
+			best = i;
+		}
+	}
+	return best;
+}
+
+void reader_follow_gaze(rdr_ctx *rc, float x, float y)
+{
+	if (rc->regions)
+		SDL_AtomicSet(&rc->want, closest_region(rc, x, y));
+}
+
+int reader_select(rdr_ctx *rc, const AVPacket *pkt)
+{
+	AVStream **st = rc->fctx->streams;
+	int want;
+
+	if (!rc->regions)
+		return pkt->stream_index == rc->stream_index;
+
+	want = SDL_AtomicGet(&rc->want);
+	if (want != rc->pending) {
+		if (rc->pending != rc->stream_index)
+			st[rc->pending]->discard = AVDISCARD_ALL;
+		st[want]->discard = AVDISCARD_DEFAULT;
+		rc->pending = want;
+		rc->pending_dts = AV_NOPTS_VALUE;
+	}
+	/*
+	 * Segments start with a keyframe, all variants at the same times. The
+	 * keyframe of either variant may come first: a pending one past the
+	 * last packet passed on, or the current one once the pending variant
+	 * caught up to it, its own keyframe for the same time follows.
+	 */
+	if (rc->pending != rc->stream_index && pkt->flags & AV_PKT_FLAG_KEY) {
+		if ((pkt->stream_index == rc->pending &&
+		     (rc->last_dts == AV_NOPTS_VALUE ||
+		      av_compare_ts(pkt->dts, st[rc->pending]->time_base,
+				    rc->last_dts, st[rc->stream_index]->time_base) > 0)) ||
+		    (pkt->stream_index == rc->stream_index && rc->pending_dts != AV_NOPTS_VALUE &&
+		     av_compare_ts(rc->pending_dts, st[rc->pending]->time_base,
+				   rc->last_dts, st[rc->stream_index]->time_base) >= 0)) {
+			st[rc->stream_index]->discard = AVDISCARD_ALL;
+			rc->stream_index = rc->pending;
+		}
+	}
+	if (pkt->stream_index != rc->stream_index) {
+		if (pkt->stream_index == rc->pending)
+			rc->pending_dts = pkt->dts;
+		return 0;
+	}
+	rc->last_dts = pkt->dts;
+	return 1;
+}
+
+/* variants foveated on different regions, NULL if there are less than two */
+static float *ladder_regions(AVFormatContext *fctx)
+{
+	AVDictionaryEntry *fovea;
+	float *regions;
+	unsigned int i;
+	int n = 0;
+
+	regions = malloc(2 * fctx->nb_streams * sizeof(float));
+	if (!regions)
+		pexit("malloc failed");
+	for (i = 0; i < fctx->nb_streams; i++) {
+		regions[2 * i] = regions[2 * i + 1] = -1;
+		fovea = av_dict_get(fctx->streams[i]->metadata, "fovea", NULL, 0);
+		if (fovea && fctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+		    sscanf(fovea->value, "%f,%f", &regions[2 * i], &regions[2 * i + 1]) == 2)
+			n++;
+	}
+	if (n < 2)
+		free(regions);
+	return n < 2 ? NULL : regions;
+}
+
 rdr_ctx *reader_init(char *filename, int queue_capacity)
 {
 	rdr_ctx *rc;
 	int ret;
 	int stream_index;
 	AVFormatContext *fctx;
+	AVDictionary *options = NULL;
 	Queue *packets;
 	char *fn_cpy;
+	float *regions;
+	unsigned int i;
 
 	// preparations: allocate, open and set required datastructures
 	fctx = avformat_alloc_context();
 	if (!fctx)
 		pexit("avformat_alloc_context failed");
 
-	ret = avformat_open_input(&fctx, filename, NULL, NULL);
+	/* stop fetching ladder variants that are switched away from */
+	av_dict_set(&options, "drop_discarded", "1", 0);
+	ret = avformat_open_input(&fctx, filename, NULL, &options);
+	av_dict_free(&options);
 	if (ret < 0)
 		pexit("avformat_open_input failed");
 
@@ -132,31 +241,85 @@ rdr_ctx *reader_init(char *filename, int queue_capacity)
 	fctx->streams[stream_index]->discard = AVDISCARD_DEFAULT;
 	packets = queue_init(queue_capacity);
 
+	/* only the variant at the center is fetched at first */
+	regions = ladder_regions(fctx);
+	if (regions)
+		for (i = 0; i < fctx->nb_streams; i++)
+			fctx->streams[i]->discard = AVDISCARD_ALL;
+
 	// allocate and set the context
 	rc = malloc(sizeof(rdr_ctx));
 	if (!rc)
 		pexit("malloc failed");
 
-	fn_cpy = malloc(strlen(filename));
+	fn_cpy = malloc(strlen(filename) + 1);
 	if (!fn_cpy)
 		pexit("malloc failed");
-	strncpy(fn_cpy, filename, strlen(filename));
+	strcpy(fn_cpy, filename);
 
 	rc->fctx = fctx;
 	rc->stream_index = stream_index;
 	rc->filename = fn_cpy;
 	rc->packets = packets;
 	rc->abort = 0;
+	rc->regions = regions;
+	rc->last_dts = AV_NOPTS_VALUE;
+	rc->pending_dts = AV_NOPTS_VALUE;
+	rc->start_pts = AV_NOPTS_VALUE;
+	if (regions) {
+		rc->stream_index = closest_region(rc, 0.5, 0.5);
+		fctx->streams[rc->stream_index]->discard = AVDISCARD_DEFAULT;
+	}
+	rc->pending = rc->stream_index;
+	SDL_AtomicSet(&rc->want, rc->stream_index);
 
 	return rc;
 }
 
+int reader_seek(rdr_ctx *rc, double start)
+{
+	AVFormatContext *fctx = rc->fctx;
+	AVStream *st = fctx->streams[rc->stream_index];
+	key_index *ki;
+	const key_entry *e;
+	int64_t target;
+	int ret = AVERROR(EINVAL);
+
+	if (rc->regions || start <= 0)
+		return ret;
+	target = llrint(start / av_q2d(st->time_base));
+	if (st->start_time != AV_NOPTS_VALUE)
+		target += st->start_time;
+
+	ki = keyindex_open(rc->filename, rc->stream_index);
+	e = ki ? keyindex_find(ki, target) : NULL;
+	if (e) {
+		/* a byte offset is found at once, a timestamp may take a search */
+		if (!st->nb_index_entries && e->pos >= 0 &&
+		    !(fctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+			ret = av_seek_frame(fctx, rc->stream_index, e->pos, AVSEEK_FLAG_BYTE);
+		if (ret < 0)
+			ret = av_seek_frame(fctx, rc->stream_index,
+					    e->dts != AV_NOPTS_VALUE ? e->dts : e->pts,
+					    AVSEEK_FLAG_BACKWARD);
+	} else if (!ki) {
+		/* no index for network inputs, the demuxer may still seek */
+		ret = av_seek_frame(fctx, rc->stream_index, target, AVSEEK_FLAG_BACKWARD);
+	}
+	keyindex_free(&ki);
+
+	if (ret >= 0)
+		rc->start_pts = target;
+	return ret;
+}
+
 void reader_free(rdr_ctx **rc)
 {
 	rdr_ctx *r;
 
 	r = *rc;
 	free(r->filename);
+	free(r->regions);
 	avformat_free_context(r->fctx);
 	free(*rc);
 	*rc = NULL;
@@ -167,10 +330,13 @@ wtr_ctx *writer_init(char *path, Queue *packets, rdr_ctx *rc, AVCodecContext *en
 	wtr_ctx *w;
 	AVFormatContext *ctx;
 	AVStream *stream;
+	AVDictionary *options = NULL;
+	char sdp[4096];
 	int ret;
 
 	ctx = NULL;
-	avformat_alloc_output_context2(&ctx, NULL, NULL, path);
+	/* the rtp muxer is not guessed from the url */
+	avformat_alloc_output_context2(&ctx, NULL, strncmp(path, "rtp://", 6) ? NULL : "rtp", path);
 	if (!ctx)
 		pexit("output context allocation failed");
 
@@ -189,9 +355,23 @@ wtr_ctx *writer_init(char *path, Queue *packets, rdr_ctx *rc, AVCodecContext *en
 	if (ret < 0)
 		pexit("avio_open failed");
 
-	ret = avformat_write_header(ctx, NULL);
+	if (!strcmp(ctx->oformat->name, "rtp")) {
+		av_dict_set(&options, "gaze_scheduler", "1", 0);
+		if (enc_ctx->rc_max_rate)
+			av_dict_set_int(&options, "cc_start_bitrate", enc_ctx->rc_max_rate, 0);
+	}
+
+	ret = avformat_write_header(ctx, &options);
+	av_dict_free(&options);
 	if (ret < 0)
-		pexit("malloc failed");
+		pexit("avformat_write_header failed");
+
+	if (!strcmp(ctx->oformat->name, "rtp")) {
+		if (av_sdp_create(&ctx, 1, sdp, sizeof(sdp)) < 0)
+			pexit("av_sdp_create failed");
+		printf("SDP:\n%s\n", sdp);
+		fflush(stdout);
+	}
 
 	w = malloc(sizeof(wtr_ctx));
 	if (!w)
@@ -199,7 +379,7 @@ wtr_ctx *writer_init(char *path, Queue *packets, rdr_ctx *rc, AVCodecContext *en
 
 	w->fctx = ctx;
 	w->packets = packets;
-	//w->fctx = enc_ctx;
+	w->target_rate = NULL;
 
 	return w;
 }
@@ -208,6 +388,7 @@ int writer_thread(void *ptr)
 {
 	wtr_ctx *w;
 	AVPacket *pkt;
+	int64_t rate;
 	int ret;
 
 	w = (wtr_ctx *) ptr;
@@ -222,6 +403,11 @@ int writer_thread(void *ptr)
 		if (ret < 0)
 			pexit("av_interleaved_write_frame failed");
 
+		/* fails for anything but RTP, leaving the target untouched */
+		if (w->target_rate &&
+		    av_opt_get_int(w->fctx->priv_data, "cc_bitrate", 0, &rate) >= 0)
+			SDL_AtomicSet(w->target_rate, FFMIN(rate, INT_MAX));
+
 	}
 	av_write_trailer(w->fctx);
 	avformat_free_context(w->fctx);
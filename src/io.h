@@ -27,12 +27,20 @@ typedef struct rdr_ctx {
 	Queue *packets;
 	AVFormatContext *fctx;
 	int abort;
+	/* gaze-region ladder: variants foveated on different regions */
+	float *regions; //relative x, y per stream, negative if not a variant, NULL without ladder
+	SDL_atomic_t want; //variant foveated closest to the gaze
+	int pending; //variant fetched alongside until its next keyframe
+	int64_t last_dts; //of the last packet passed on
+	int64_t pending_dts; //of the last packet of the pending variant
+	int64_t start_pts; //trial start set by reader_seek, AV_NOPTS_VALUE for none
 } rdr_ctx;
 
 // Passed to writer_thread through SDL_CreateThread
 typedef struct wtr_ctx {
 	Queue *packets;
 	AVFormatContext *fctx;
+	SDL_atomic_t *target_rate; // receives the RTP muxer's cc_bitrate in bit/s, may be NULL
 } wtr_ctx;
 
 /**
@@ -76,6 +84,8 @@ int reader_thread(void *ptr);
  *
  * Open and demultiplex the file given in reader_ctx->filename.
  * Identify the "best" video stream index, usually there will only be one.
+ * HLS master playlists whose variants carry "fovea" metadata are read as
+ * gaze-region ladder, starting at the variant closest to the center.
  * Must be freed through reader_free.
  *
  * Calls pexit in case of a failure.
@@ -84,6 +94,45 @@ int reader_thread(void *ptr);
  */
 rdr_ctx *reader_init(char *filename, int queue_capacity);
 
+/**
+ * Start reading at the last keyframe before a time, mid-clip trials then
+ * take as long to their first frame as the start of the clip.
+ *
+ * The keyframe is looked up in the index of the file, see keyindex.h, and
+ * seeked to by timestamp if the demuxer has an index of its own, by byte
+ * offset otherwise. Frames before the start are to be dropped by the
+ * decoder, see dec_ctx. Call before reader_thread starts.
+ * @param rc reader context, not a gaze-region ladder
+ * @param start time in seconds from the start of the stream
+ * @return 0 on success, a negative AVERROR otherwise, reading starts at the
+ *         beginning then
+ */
+int reader_seek(rdr_ctx *rc, double start);
+
+/**
+ * Follow the gaze on a gaze-region ladder.
+ *
+ * The reader switches to the variant foveated closest to the gaze at that
+ * variant's next keyframe. Inputs without a ladder are not affected. May be
+ * called from any thread.
+ * @param rc reader context
+ * @param x horizontal gaze position relative to the frame width
+ * @param y vertical gaze position relative to the frame height
+ */
+void reader_follow_gaze(rdr_ctx *rc, float x, float y);
+
+/**
+ * Decide whether a packet read from rc->fctx is passed on.
+ *
+ * On a gaze-region ladder, the wanted variant is fetched alongside the
+ * current one until it reaches a keyframe past the last packet passed on,
+ * then the reader switches over and stops fetching the old one.
+ * @param rc reader context
+ * @param pkt packet just read
+ * @return 1 if pkt belongs to the stream read, 0 otherwise
+ */
+int reader_select(rdr_ctx *rc, const AVPacket *pkt);
+
 /**
  * Free the reader_context and all private resources.
  * The output queue is not freed! The receiver has to take
@@ -95,11 +144,18 @@ void reader_free(rdr_ctx **rc);
 
 /**
  * Create and initialize a writer context
+ *
+ * RTP output uses gaze-priority scheduling with congestion control, starting
+ * at the encoder's maximum rate if it has one, and prints the SDP a receiver
+ * needs to send feedback.
  */
 wtr_ctx *writer_init(char *filename, Queue *packets, rdr_ctx *rc, AVCodecContext *enc_ctx);
 
 /**
  * Accept packets from a queue and write them to multiplexed container
  * on disk.
+ *
+ * After each packet, the target bitrate of the RTP congestion controller is
+ * stored in target_rate, if both exist.
  */
 int writer_thread(void *ptr);
\ No newline at end of file
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "keyindex.h"
+#include "pexit.h"
+
+#include <inttypes.h>
+#include <limits.h> /* PATH_MAX */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SIDECAR_SUFFIX ".keys.csv"
+
+static int compare_pts(const void *a, const void *b)
+{
+	const key_entry *x = a, *y = b;
+
+	return (x->pts > y->pts) - (x->pts < y->pts);
+}
+
+static void append(key_index *ki, const key_entry *e)
+{
+	key_entry *entries;
+
+	/* doubles at powers of two */
+	if (!(ki->nb_entries & (ki->nb_entries - 1))) {
+		entries = realloc(ki->entries, 2 * (ki->nb_entries + 1) * sizeof(*entries));
+		if (!entries)
+			pexit("realloc failed");
+		ki->entries = entries;
+	}
+	ki->entries[ki->nb_entries++] = *e;
+}
+
+static key_index *load(const char *path, const struct stat *st, int stream_index)
+{
+	char line[256];
+	key_index *ki;
+	key_entry e;
+	long long size, mtime;
+	int stream, num, den;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	/* header, the file's size and mtime when indexed, then the entries */
+	if (!fgets(line, sizeof(line), f) || !fgets(line, sizeof(line), f) ||
+	    sscanf(line, "%lld,%lld,%d,%d,%d", &size, &mtime, &stream, &num, &den) != 5 ||
+	    !fgets(line, sizeof(line), f) || strcmp(line, "pts,dts,pos\n") ||
+	    size != st->st_size || mtime != st->st_mtime || stream != stream_index ||
+	    num <= 0 || den <= 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	ki = calloc(1, sizeof(*ki));
+	if (!ki)
+		pexit("calloc failed");
+	ki->stream_index = stream;
+	ki->time_base = av_make_q(num, den);
+	while (fgets(line, sizeof(line), f) &&
+	       sscanf(line, "%" SCNd64 ",%" SCNd64 ",%" SCNd64, &e.pts, &e.dts, &e.pos) == 3)
+		append(ki, &e);
+	fclose(f);
+	return ki;
+}
+
+static void store(const char *path, const struct stat *st, const key_index *ki)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(path, "w");
+	if (!f) {
+		perror("cannot store the keyframe index");
+		return;
+	}
+	fprintf(f, "size,mtime,stream,time_base_num,time_base_den\n");
+	fprintf(f, "%lld,%lld,%d,%d,%d\n", (long long) st->st_size,
+		(long long) st->st_mtime, ki->stream_index, ki->time_base.num,
+		ki->time_base.den);
+	fprintf(f, "pts,dts,pos\n");
+	for (i = 0; i < ki->nb_entries; i++)
+		fprintf(f, "%" PRId64 ",%" PRId64 ",%" PRId64 "\n", ki->entries[i].pts,
+			ki->entries[i].dts, ki->entries[i].pos);
+	fclose(f);
+}
+
+/* read every packet of the stream once, without decoding */
+static key_index *scan(const char *filename, int stream_index)
+{
+	AVFormatContext *fctx = NULL;
+	AVPacket pkt;
+	key_index *ki;
+	key_entry e;
+	unsigned i;
+
+	if (avformat_open_input(&fctx, filename, NULL, NULL) < 0)
+		return NULL;
+	if (avformat_find_stream_info(fctx, NULL) < 0 ||
+	    stream_index >= (int) fctx->nb_streams) {
+		avformat_close_input(&fctx);
+		return NULL;
+	}
+	for (i = 0; i < fctx->nb_streams; i++) {
+		if (i != (unsigned) stream_index)
+			fctx->streams[i]->discard = AVDISCARD_ALL;
+	}
+
+	ki = calloc(1, sizeof(*ki));
+	if (!ki)
+		pexit("calloc failed");
+	ki->stream_index = stream_index;
+	ki->time_base = fctx->streams[stream_index]->time_base;
+
+	while (av_read_frame(fctx, &pkt) >= 0) {
+		if (pkt.stream_index == stream_index && pkt.flags & AV_PKT_FLAG_KEY) {
+			e.pts = pkt.pts != AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+			e.dts = pkt.dts;
+			e.pos = pkt.pos;
+			if (e.pts != AV_NOPTS_VALUE)
+				append(ki, &e);
+		}
+		av_packet_unref(&pkt);
+	}
+	avformat_close_input(&fctx);
+
+	/* leading pictures aside, keyframes come in presentation order anyway */
+	qsort(ki->entries, ki->nb_entries, sizeof(*ki->entries), compare_pts);
+	return ki;
+}
+
+key_index *keyindex_open(const char *filename, int stream_index)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	key_index *ki;
+
+	/* urls and pipes have no stable size to tell an outdated index by */
+	if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+		return NULL;
+	if (snprintf(path, sizeof(path), "%s" SIDECAR_SUFFIX, filename) >= (int) sizeof(path))
+		return NULL;
+
+	ki = load(path, &st, stream_index);
+	if (ki)
+		return ki;
+
+	ki = scan(filename, stream_index);
+	if (ki)
+		store(path, &st, ki);
+	return ki;
+}
+
+const key_entry *keyindex_find(const key_index *ki, int64_t pts)
+{
+	int lo = 0, hi = ki->nb_entries, mid;
+
+	/* the first entry past pts */
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ki->entries[mid].pts <= pts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &ki->entries[lo - 1] : NULL;
+}
+
+void keyindex_free(key_index **ki)
+{
+	if (!*ki)
+		return;
+	free((*ki)->entries);
+	free(*ki);
+	*ki = NULL;
+}
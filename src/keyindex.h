@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libavformat/avformat.h>
+#include <stdint.h>
+
+/*
+ * Keyframe index of a video stream, to start trials mid-clip. The file is
+ * scanned once, the index is kept next to it as <file>.keys.csv and built
+ * again once the file's size or modification time changes.
+ */
+
+typedef struct key_entry {
+	int64_t pts;
+	int64_t dts; //AV_NOPTS_VALUE if unknown
+	int64_t pos; //byte offset of the packet, -1 if unknown
+} key_entry;
+
+typedef struct key_index {
+	int stream_index;
+	AVRational time_base;
+	key_entry *entries; //by pts
+	int nb_entries;
+} key_index;
+
+/**
+ * Load the keyframe index of a local file, build and store it first if
+ * there is none or it is outdated.
+ *
+ * @param filename of the video
+ * @param stream_index video stream to index
+ * @return index to free with keyindex_free, NULL for network inputs or if
+ *         the file cannot be read
+ */
+key_index *keyindex_open(const char *filename, int stream_index);
+
+/**
+ * Find the last keyframe at or before a timestamp.
+ *
+ * @param pts in the stream's time base
+ * @return entry, NULL if pts is before the first keyframe
+ */
+const key_entry *keyindex_find(const key_index *ki, int64_t pts);
+
+void keyindex_free(key_index **ki);
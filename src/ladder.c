@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Gaze-region ladder for large audiences.
+ *
+ * Instead of one encode per viewer, a clip is encoded once per region of a
+ * grid over the frame, each variant foveated on the center of its region.
+ * All variants have keyframes at the same frames, every segment starts
+ * with one, so that a client can switch between them along with the gaze
+ * of its viewer. They are written as switchable representations of one
+ * DASH adaptation set, with an HLS master playlist beside it, or as HLS
+ * variant streams, the region each is foveated on in its "fovea" metadata.
+ * Encoding cost grows with the number of regions instead of viewers.
+ */
+
+#include "codec.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct variant {
+	float x, y; //center of the region the variant is foveated on
+	AVCodecContext *enc;
+	AVStream *st;
+	int64_t bytes;
+	double encode_time; //in seconds
+} variant;
+
+typedef struct ladder {
+	const char *encoder;
+	int cols, rows;
+	float crf, delta, sigma;
+	float seg_duration; //in seconds
+	int max_rate; //in kbit/s, advertised in the manifests
+	int max_frames;
+	variant *variants;
+	int nb_variants;
+	AVFormatContext *out;
+	AVPacket *pkt;
+} ladder;
+
+void display_usage(char *progname)
+{
+	printf("encode a ladder of variants foveated on a grid of regions\n");
+	printf("usage:\n$ %s [-e encoder] [-g colsxrows] [-c crf] [-d delta] [-s sigma] "
+	       "[-l seconds] [-m kbps] [-n frames] clip out.mpd|out_%%v.m3u8\n", progname);
+	printf("DASH output writes an HLS master.m3u8 beside the MPD\n");
+}
+
+static AVCodecContext *open_encoder(ladder *l, const AVCodecContext *src, AVRational fps,
+				    int gop, int global_header)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+	AVDictionary *options = NULL;
+	char buf[16];
+
+	codec = avcodec_find_encoder_by_name(l->encoder);
+	if (!codec)
+		pexit("encoder not found");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+
+	snprintf(buf, sizeof(buf), "%d", gop);
+	if (!strcmp(l->encoder, "libx264")) {
+		/*
+		 * The workbench's settings, but switching needs IDR frames at
+		 * the same frames in all variants instead of intra refresh.
+		 */
+		set_codec_options(&options, LIBX264);
+		av_dict_set(&options, "intra-refresh", "0", 0);
+		av_dict_set(&options, "forced-idr", "1", 0);
+		av_dict_set(&options, "sc_threshold", "0", 0);
+		av_dict_set(&options, "g", buf, 0);
+		snprintf(buf, sizeof(buf), "%g", l->crf);
+		av_dict_set(&options, "crf", buf, 0);
+		/* 100 ms buffer as in replicate */
+		avctx->rc_max_rate	= l->max_rate * 1000LL;
+		avctx->rc_buffer_size	= l->max_rate * 100;
+	} else {
+		/* mpegvideo encoders, the crf is their fixed quantizer */
+		avctx->flags |= AV_CODEC_FLAG_QSCALE;
+		avctx->global_quality = l->crf * FF_QP2LAMBDA;
+		avctx->gop_size = gop;
+		av_dict_set(&options, "fovea", "1", 0);
+		av_dict_set(&options, "sc_threshold", "1000000000", 0);
+	}
+	if (global_header)
+		avctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	avctx->time_base	= av_inv_q(fps);
+	avctx->framerate	= fps;
+	avctx->pix_fmt		= AV_PIX_FMT_YUV420P;
+	avctx->width		= src->width;
+	avctx->height		= src->height;
+
+	if (avcodec_open2(avctx, codec, &options) < 0)
+		pexit("avcodec_open2 failed");
+	av_dict_free(&options);
+	return avctx;
+}
+
+static AVCodecContext *open_decoder(const AVCodecParameters *par)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+
+	codec = avcodec_find_decoder(par->codec_id);
+	if (!codec)
+		pexit("avcodec_find_decoder failed");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+	if (avcodec_parameters_to_context(avctx, par) < 0)
+		pexit("avcodec_parameters_to_context failed");
+	if (avcodec_open2(avctx, codec, NULL) < 0)
+		pexit("avcodec_open2 failed");
+	return avctx;
+}
+
+static void open_output(ladder *l, const char *path, const AVCodecContext *src,
+			AVRational fps)
+{
+	AVDictionary *options = NULL;
+	char buf[64], seg[1024], *map;
+	int gop = FFMAX(lrintf(l->seg_duration * av_q2d(fps)), 1);
+	int i, global_header;
+
+	if (avformat_alloc_output_context2(&l->out, NULL, NULL, path) < 0)
+		pexit("avformat_alloc_output_context2 failed");
+	global_header = l->out->oformat->flags & AVFMT_GLOBALHEADER;
+
+	/* as many characters as "v:%d " needs for every variant */
+	map = malloc(l->nb_variants * 8);
+	if (!map)
+		pexit("malloc failed");
+	map[0] = '\0';
+
+	for (i = 0; i < l->nb_variants; i++) {
+		variant *v = &l->variants[i];
+
+		v->x = (i % l->cols + 0.5f) / l->cols;
+		v->y = (i / l->cols + 0.5f) / l->rows;
+		v->enc = open_encoder(l, src, fps, gop, global_header);
+		v->st = avformat_new_stream(l->out, NULL);
+		if (!v->st)
+			pexit("avformat_new_stream failed");
+		if (avcodec_parameters_from_context(v->st->codecpar, v->enc) < 0)
+			pexit("avcodec_parameters_from_context failed");
+		v->st->codecpar->bit_rate = l->max_rate * 1000LL;
+		v->st->time_base = v->enc->time_base;
+		v->st->avg_frame_rate = fps;
+		snprintf(buf, sizeof(buf), "%g,%g,%g,%g", v->x, v->y, l->sigma, l->delta);
+		av_dict_set(&v->st->metadata, "fovea", buf, 0);
+		sprintf(map + strlen(map), "%sv:%d", i ? " " : "", i);
+	}
+
+	snprintf(buf, sizeof(buf), "%g", l->seg_duration);
+	if (!strcmp(l->out->oformat->name, "dash")) {
+		av_dict_set(&options, "seg_duration", buf, 0);
+		av_dict_set(&options, "adaptation_sets", "id=0,streams=v", 0);
+		av_dict_set(&options, "hls_playlist", "1", 0);
+	} else if (!strcmp(l->out->oformat->name, "hls")) {
+		/* out_%v_%d.ts, the default out_%v%d.ts is ambiguous past ten variants */
+		snprintf(seg, sizeof(seg), "%.*s_%%d.ts", (int)(strrchr(path, '.') - path), path);
+		av_dict_set(&options, "hls_segment_filename", seg, 0);
+		av_dict_set(&options, "hls_time", buf, 0);
+		av_dict_set(&options, "hls_list_size", "0", 0);
+		av_dict_set(&options, "var_stream_map", map, 0);
+		av_dict_set(&options, "master_pl_name", "master.m3u8", 0);
+	} else {
+		pexit("output has to be DASH or HLS");
+	}
+	free(map);
+
+	if (!(l->out->oformat->flags & AVFMT_NOFILE) &&
+	    avio_open(&l->out->pb, path, AVIO_FLAG_WRITE) < 0)
+		pexit("avio_open failed");
+	if (avformat_write_header(l->out, &options) < 0)
+		pexit("avformat_write_header failed");
+	av_dict_free(&options);
+}
+
+static void drain(ladder *l, int i)
+{
+	variant *v = &l->variants[i];
+
+	while (avcodec_receive_packet(v->enc, l->pkt) == 0) {
+		v->bytes += l->pkt->size;
+		av_packet_rescale_ts(l->pkt, v->enc->time_base, v->st->time_base);
+		l->pkt->stream_index = i;
+		if (av_interleaved_write_frame(l->out, l->pkt) < 0)
+			pexit("av_interleaved_write_frame failed");
+	}
+}
+
+/* one frame into every variant, foveated on its region */
+static void encode_frame(ladder *l, AVFrame *frame, int n, int gop)
+{
+	AVFrameSideData *sd;
+	AVFrame *in;
+	float *descr;
+	int64_t t;
+	int i;
+
+	for (i = 0; i < l->nb_variants; i++) {
+		variant *v = &l->variants[i];
+
+		in = av_frame_clone(frame);
+		if (!in)
+			pexit("av_frame_clone failed");
+		sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+					    4 * sizeof(float));
+		if (!sd)
+			pexit("side data allocation failed");
+		descr = (float *) sd->data;
+		descr[0] = v->x;
+		descr[1] = v->y;
+		descr[2] = l->sigma;
+		descr[3] = l->delta;
+		/* every segment starts with a keyframe, the same in all variants */
+		in->pict_type = n % gop ? AV_PICTURE_TYPE_NONE : AV_PICTURE_TYPE_I;
+		in->pts = n;
+		in->quality = v->enc->global_quality;
+
+		t = av_gettime_relative();
+		if (avcodec_send_frame(v->enc, in) < 0)
+			pexit("avcodec_send_frame failed");
+		v->encode_time += (av_gettime_relative() - t) / 1e6;
+		av_frame_free(&in);
+		drain(l, i);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *dec;
+	AVStream *st;
+	AVPacket *pkt;
+	AVFrame *frame;
+	AVRational fps;
+	ladder l = { 0 };
+	double seconds, total = 0, time = 0;
+	int index, opt, gop, i, n = 0, eof = 0;
+
+	l.encoder = "libx264";
+	l.cols = 3;
+	l.rows = 3;
+	l.crf = 23;
+	l.delta = 12;
+	l.seg_duration = 1;
+	l.max_rate = 4000;
+
+	while ((opt = getopt(argc, argv, "e:g:c:d:s:l:m:n:")) != -1) {
+		switch (opt) {
+		case 'e':
+			l.encoder = optarg;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%dx%d", &l.cols, &l.rows) != 2)
+				l.cols = 0;
+			break;
+		case 'c':
+			l.crf = strtof(optarg, NULL);
+			break;
+		case 'd':
+			l.delta = strtof(optarg, NULL);
+			break;
+		case 's':
+			l.sigma = strtof(optarg, NULL);
+			break;
+		case 'l':
+			l.seg_duration = strtof(optarg, NULL);
+			break;
+		case 'm':
+			l.max_rate = atoi(optarg);
+			break;
+		case 'n':
+			l.max_frames = atoi(optarg);
+			break;
+		default:
+			display_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || l.cols < 1 || l.rows < 1 || l.crf <= 0 ||
+	    l.delta <= 0 || l.sigma < 0 || l.seg_duration <= 0 || l.max_rate <= 0) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	l.nb_variants = l.cols * l.rows;
+
+	if (avformat_open_input(&fctx, argv[optind], NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+	st = fctx->streams[index];
+	fps = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+	dec = open_decoder(st->codecpar);
+
+	/*
+	 * By default the region a variant preserves, where the offset stays
+	 * below delta / 2, reaches the corners of its grid cell.
+	 */
+	if (!l.sigma)
+		l.sigma = 0.5f * hypotf(1.0f / l.cols * dec->width, 1.0f / l.rows * dec->height) /
+			  hypotf(dec->width, dec->height) / sqrtf(logf(2));
+
+	l.variants = calloc(l.nb_variants, sizeof(variant));
+	l.pkt = av_packet_alloc();
+	pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	if (!l.variants || !l.pkt || !pkt || !frame)
+		pexit("allocation failed");
+	gop = FFMAX(lrintf(l.seg_duration * av_q2d(fps)), 1);
+	open_output(&l, argv[optind + 1], dec, fps);
+
+	while (!eof) {
+		if (l.max_frames && n >= l.max_frames) {
+			eof = 1;
+		} else if (av_read_frame(fctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(dec, NULL);
+		} else if (pkt->stream_index == index) {
+			if (avcodec_send_packet(dec, pkt) < 0)
+				pexit("avcodec_send_packet failed");
+		}
+		av_packet_unref(pkt);
+
+		while ((!l.max_frames || n < l.max_frames) &&
+		       avcodec_receive_frame(dec, frame) == 0) {
+			if (frame->format != AV_PIX_FMT_YUV420P)
+				pexit("clips have to be yuv420p");
+			encode_frame(&l, frame, n++, gop);
+			av_frame_unref(frame);
+		}
+	}
+	for (i = 0; i < l.nb_variants; i++) {
+		avcodec_send_frame(l.variants[i].enc, NULL);
+		drain(&l, i);
+	}
+	if (av_write_trailer(l.out) < 0)
+		pexit("av_write_trailer failed");
+	if (!n)
+		pexit("no frames");
+
+	seconds = n * av_q2d(av_inv_q(fps));
+	printf("variant,x,y,sigma,kbps,encode_ms\n");
+	for (i = 0; i < l.nb_variants; i++) {
+		variant *v = &l.variants[i];
+
+		printf("%d,%.3f,%.3f,%.3f,%.1f,%.2f\n", i, v->x, v->y, l.sigma,
+		       v->bytes * 8 / seconds / 1000, v->encode_time * 1000 / n);
+		total += v->bytes * 8 / seconds / 1000;
+		time += v->encode_time * 1000 / n;
+		avcodec_free_context(&v->enc);
+	}
+	printf("all,,,,%.1f,%.2f\n", total, time);
+
+	if (!(l.out->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&l.out->pb);
+	avformat_free_context(l.out);
+	avformat_close_input(&fctx);
+	avcodec_free_context(&dec);
+	av_packet_free(&pkt);
+	av_packet_free(&l.pkt);
+	av_frame_free(&frame);
+	free(l.variants);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Switch latency and bitrate of a client reading a gaze-region ladder.
+ *
+ * A gaze log is replayed against a ladder written by ladder, read through
+ * the client's reader: whenever the gaze moves into another region the
+ * reader is asked to follow it, the switch completes at the next keyframe
+ * of the wanted variant. The latency of a switch is the media time from
+ * the request to the first packet of the new variant. Reported are the
+ * switch latencies, the share of frames shown from the variant covering
+ * the gaze, the bitrate of all packets the demuxer delivers, including
+ * those of a variant received while waiting for its keyframe, and the
+ * bitrate of the packets passed on.
+ */
+
+#include "io.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct gaze_log {
+	float *x; //per frame, relative to the frame, NAN without a sample
+	float *y;
+	int n;
+} gaze_log;
+
+void display_usage(char *progname)
+{
+	printf("replay a gaze log against a gaze-region ladder\n");
+	printf("usage:\n$ %s master.m3u8 gazelog\n", progname);
+	printf("gaze logs hold frame,x,y[,...] lines with relative coordinates\n");
+}
+
+static void read_gaze_log(gaze_log *g, const char *path)
+{
+	char **lines, **l;
+	float x, y;
+	int f;
+
+	lines = parse_lines(path);
+	g->n = 0;
+	for (l = lines; *l; l++)
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) == 3 && f >= g->n)
+			g->n = f + 1;
+	if (!g->n)
+		pexit("gaze log without samples");
+
+	g->x = malloc(g->n * sizeof(float));
+	g->y = malloc(g->n * sizeof(float));
+	if (!g->x || !g->y)
+		pexit("malloc failed");
+	for (f = 0; f < g->n; f++)
+		g->x[f] = g->y[f] = NAN;
+	/* headers and samples outside of the frame are skipped */
+	for (l = lines; *l; l++)
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) == 3 && f >= 0 &&
+		    x >= 0 && x <= 1 && y >= 0 && y <= 1) {
+			g->x[f] = x;
+			g->y[f] = y;
+		}
+	free_lines(&lines);
+}
+
+int main(int argc, char **argv)
+{
+	rdr_ctx *rc;
+	AVPacket *pkt;
+	AVStream *st;
+	gaze_log g;
+	int64_t first = AV_NOPTS_VALUE, request = AV_NOPTS_VALUE;
+	int64_t t, last = AV_NOPTS_VALUE, frame_us = 0;
+	int64_t received = 0, played = 0;
+	double latency, sum = 0, max = 0, seconds;
+	int frames = 0, on_target = 0, switches = 0;
+	int want, cur, n;
+
+	if (argc != 3) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	read_gaze_log(&g, argv[2]);
+
+	rc = reader_init(argv[1], 1);
+	if (!rc->regions)
+		pexit("input is no gaze-region ladder");
+	want = cur = rc->stream_index;
+
+	pkt = av_packet_alloc();
+	if (!pkt)
+		pexit("av_packet_alloc failed");
+	while (av_read_frame(rc->fctx, pkt) >= 0) {
+		received += pkt->size;
+		if (!reader_select(rc, pkt)) {
+			av_packet_unref(pkt);
+			continue;
+		}
+		st = rc->fctx->streams[pkt->stream_index];
+		t = av_rescale_q(pkt->pts, st->time_base, AV_TIME_BASE_Q);
+		if (first == AV_NOPTS_VALUE)
+			first = t;
+		/* segments carry no frame rate, the first two frames tell it */
+		else if (!frame_us && t > last)
+			frame_us = t - last;
+		last = t;
+
+		if (rc->stream_index != cur) {
+			latency = (t - request) / 1000.0;
+			sum += latency;
+			max = fmax(max, latency);
+			switches++;
+			cur = rc->stream_index;
+		}
+
+		/* the frame shown now, the viewer looks at the same time */
+		n = frame_us ? (t - first + frame_us / 2) / frame_us : 0;
+		if (n >= 0 && n < g.n && !isnan(g.x[n])) {
+			reader_follow_gaze(rc, g.x[n], g.y[n]);
+			if (SDL_AtomicGet(&rc->want) != want) {
+				want = SDL_AtomicGet(&rc->want);
+				/* a request still pending counts from its start */
+				if (want != cur && request == AV_NOPTS_VALUE)
+					request = t;
+			}
+		}
+		if (want == cur)
+			request = AV_NOPTS_VALUE;
+		on_target += want == cur;
+		played += pkt->size;
+		frames++;
+		av_packet_unref(pkt);
+	}
+	if (!frames)
+		pexit("no frames");
+
+	seconds = frames * frame_us / 1e6;
+	printf("variants,frames,switches,mean_latency_ms,max_latency_ms,on_target,"
+	       "received_kbps,played_kbps\n");
+	printf("%d,%d,%d,%.1f,%.1f,%.1f%%,%.1f,%.1f\n", rc->fctx->nb_streams, frames,
+	       switches, switches ? sum / switches : 0, max, 100.0 * on_target / frames,
+	       received * 8 / seconds / 1000, played * 8 / seconds / 1000);
+
+	av_packet_free(&pkt);
+	avformat_close_input(&rc->fctx);
+	queue_free(&rc->packets);
+	reader_free(&rc);
+	free(g.x);
+	free(g.y);
+	return EXIT_SUCCESS;
+}
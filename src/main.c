@@ -15,9 +15,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "autotune.h"
+#include "budget.h"
 #include "io.h"
 #include "codec.h"
+#include "control.h"
+#include "filter.h"
+#include "metrics.h"
 #include "pexit.h"
+#include "probe.h"
 #include "window.h"
 
 #include <inttypes.h>
@@ -30,20 +36,25 @@
 #include <string.h>
 #include <SDL2/SDL.h>
 
-#ifdef ET
 #include "et.h"
+#ifdef ET
 #include "iViewXAPI.h"
 #endif
 
 rdr_ctx *rc;
 dec_ctx *src_dc, *fov_dc;
 enc_ctx *ec;
+flt_ctx *fov_fc;
+#ifdef SALIENCY
+flt_ctx *sal_fc;
+#endif
 win_ctx *wc;
+mem_budget budget;
 
 void display_usage(int argc, char *progname)
 {
-	if (argc != 2) {
-		printf("usage:\n$ %s videofile \n", progname);
+	if (argc != 2 && argc != 3) {
+		printf("usage:\n$ %s videofile [start seconds]\n", progname);
 		exit(EXIT_FAILURE);
 	}
 }
@@ -56,6 +67,7 @@ void event_loop(int run)
 {
 	SDL_Event event;
 	int fn = 0; //frame number
+	int ret;
 	int fps = src_dc->frame_rate.num / src_dc->frame_rate.den;
 	char msgbuf[1024];
 
@@ -77,8 +89,23 @@ void event_loop(int run)
 	while (1) {
 		fn++;
 		// check for events to handle, meanwhile just render frames
-		if (frame_refresh(wc))
+		perf_begin(PERF_REFRESH);
+		ret = frame_refresh(wc);
+		perf_end(PERF_REFRESH);
+		if (ret)
 			break;
+		budget_enforce(&budget);
+
+		#ifndef SALIENCY
+		/* switch ladder variants along with the gaze */
+		if (rc->regions) {
+			float *fd = foveation_descriptor(src_dc->avctx->width, src_dc->avctx->height);
+
+			if (fd[0] >= 0)
+				reader_follow_gaze(rc, fd[0], fd[1]);
+			free(fd);
+		}
+		#endif
 
 		if (fn % (fps * delay[run]) == 0) {
 			// reduce qp every second by reduce[run]
@@ -115,41 +142,108 @@ void event_loop(int run)
 int main(int argc, char **argv)
 {
 	char **paths;
-	SDL_Thread *reader, *src_decoder, *encoder, *fov_decoder;
+	SDL_Thread *reader, *src_decoder, *encoder, *fov_decoder, *postfilter;
+	#ifdef SALIENCY
+	SDL_Thread *saliency;
+	#endif
 	const int queue_capacity = 32;
+	const size_t memory_budget = (size_t) 1 << 30;
+	const char *probe_host = "127.0.0.1"; //sender of network inputs
+	enc_tuning tuning;
+	double start = 0; //of each trial in the clip
 
 	display_usage(argc, argv[0]);
+	if (argc == 3)
+		start = strtod(argv[2], NULL);
 
 	signal(SIGTERM, exit);
 	signal(SIGINT, exit);
+	/* libav's heap is only counted from before its first allocation */
+	budget_init(&budget, memory_budget);
 
 	setup_ivx(LIBX264);
+	#ifdef PERF
+	perf_open("perf.csv");
+	#endif
 	wc = window_init();
 	set_ivx_window(wc->window);
+	if (metrics_serve(METRICS_PORT) < 0)
+		perror("cannot serve metrics");
+	if (control_serve(CONTROL_PATH) < 0)
+		perror("cannot serve the control socket");
+	/* stamps of a remote sender are on its clock */
+	if (strstr(argv[1], "://") || av_match_ext(argv[1], "sdp")) {
+		if (probe_sync(probe_host, PROBE_PORT) < 0)
+			fprintf(stderr, "no latency probe at %s, clocks not aligned\n", probe_host);
+	}
 
 	for (int run = 0; run < 10; run++) {
+		if (!budget_admit(&budget)) {
+			fprintf(stderr, "memory budget of %zu bytes exceeded, no further runs\n",
+				memory_budget);
+			break;
+		}
 		rc = reader_init(argv[1], queue_capacity);
+		if (start > 0 && reader_seek(rc, start) < 0)
+			fprintf(stderr, "cannot start at %.3f s, starting at 0\n", start);
 		src_dc = source_decoder_init(rc, queue_capacity);
+		/* calibrated on the first start on this host, then looked up */
+		if (run == 0 && autotune(LIBX264, src_dc->avctx->width, src_dc->avctx->height,
+					 src_dc->frame_rate, &tuning) >= 0)
+			set_encoder_tuning(&tuning);
 		ec = encoder_init(LIBX264, src_dc, argv[1]);
+		#ifdef SALIENCY
+		/* no gaze to follow, foveate where viewers most likely look */
+		sal_fc = postfilter_init(src_dc, "fovsaliency=fixations=2", 1);
+		ec->frames = sal_fc->frames;
+		/* switch ladder variants along with the primary fixation */
+		ec->follow = rc;
+		#endif
 		fov_dc = fov_decoder_init(ec);
+		/* fill in a periphery sent at a reduced frame rate, then hide its
+		 * blocking, so that a higher qp offset looks the same */
+		fov_fc = postfilter_init(fov_dc, "fovupconv,fovdeblock", 0);
+
+		queue_account(rc->packets, "packets", packet_bytes);
+		queue_account(src_dc->frames, "frames", frame_bytes);
+		#ifdef SALIENCY
+		queue_account(sal_fc->frames, "saliency", frame_bytes);
+		#endif
+		queue_account(ec->packets, "encoded", packet_bytes);
+		queue_account(fov_dc->frames, "decoded", frame_bytes);
+		queue_account(fov_fc->frames, "postfiltered", frame_bytes);
 
 		reader = SDL_CreateThread(reader_thread, "reader", rc);
 		src_decoder = SDL_CreateThread(decoder_thread, "src_decoder", src_dc);
+		#ifdef SALIENCY
+		saliency = SDL_CreateThread(postfilter_thread, "saliency", sal_fc);
+		SDL_DetachThread(saliency);
+		#endif
 		encoder = SDL_CreateThread(encoder_thread, "encoder", ec);
 		fov_decoder = SDL_CreateThread(decoder_thread, "fov_decoder", fov_dc);
+		postfilter = SDL_CreateThread(postfilter_thread, "postfilter", fov_fc);
 
 		SDL_DetachThread(reader);
 		SDL_DetachThread(src_decoder);
 		SDL_DetachThread(encoder);
 		SDL_DetachThread(fov_decoder);
+		SDL_DetachThread(postfilter);
 
 		SDL_SetWindowFullscreen(wc->window, SDL_WINDOW_FULLSCREEN_DESKTOP);
 		SDL_RaiseWindow(wc->window);
-		set_window_source(wc, fov_dc->frames, ec->timestamps, src_dc->avctx->time_base);
+		set_window_source(wc, fov_fc->frames, ec->timestamps, src_dc->avctx->time_base);
 		event_loop(0);
+		budget_report(&budget, stderr);
+		probe_report(stderr);
+		#ifdef PERF
+		perf_report(stdout);
+		#endif
 		pause(wc->window);
 	}
 
+	#ifdef PERF
+	perf_close();
+	#endif
 	free_lines(&paths);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+#include "pexit.h"
+#include "queue.h"
+
+#include <libavutil/bprint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define BUCKETS 10 //the last one is +Inf
+#define REQUEST_SIZE 1024
+
+typedef struct histogram_def {
+	const char *name;
+	const char *help;
+	double scale; //observed units per exposed unit
+	int64_t bounds[BUCKETS - 1]; //upper bucket edges in observed units
+} histogram_def;
+
+typedef struct histogram {
+	atomic_llong buckets[BUCKETS]; //not cumulative, summed up at scrape time
+	atomic_llong sum;
+	atomic_llong count;
+} histogram;
+
+static const char *stage_names[PERF_STAGES] = {
+	"reader", "src_decoder", "encoder", "foveation", "fov_decoder", "refresh",
+};
+
+static const char *counter_names[METRIC_COUNTERS][2] = {
+	{ "foveated_frames_dropped_total", "Frames flushed before they were shown." },
+	{ "foveated_frames_late_total", "Frames shown after their presentation time." },
+};
+
+static const char *gauge_names[METRIC_GAUGES][2] = {
+	{ "foveated_gaze_sample_age_seconds", "Age of the gaze sample the last descriptor used." },
+};
+
+static const histogram_def histogram_defs[METRIC_HISTOGRAMS] = {
+	{ "foveated_encode_seconds", "Time to submit a frame to the encoder.", 1e6,
+	  { 1000, 2000, 5000, 10000, 20000, 33000, 50000, 100000, 200000 } },
+	{ "foveated_foveation_seconds", "Time for the foveation descriptor and prefilter.", 1e6,
+	  { 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000 } },
+	{ "foveated_frame_bits", "Size of an encoded frame.", 1,
+	  { 1000, 3000, 10000, 30000, 100000, 300000, 1000000, 3000000, 10000000 } },
+};
+
+static atomic_llong frames[PERF_STAGES];
+static atomic_llong counters[METRIC_COUNTERS];
+static atomic_llong gauges[METRIC_GAUGES];
+static histogram histograms[METRIC_HISTOGRAMS];
+
+void metrics_frame(perf_stage stage)
+{
+	atomic_fetch_add_explicit(&frames[stage], 1, memory_order_relaxed);
+}
+
+void metrics_count(metric_counter c)
+{
+	atomic_fetch_add_explicit(&counters[c], 1, memory_order_relaxed);
+}
+
+void metrics_set(metric_gauge g, int64_t value)
+{
+	atomic_store_explicit(&gauges[g], value, memory_order_relaxed);
+}
+
+void metrics_observe(metric_histogram h, int64_t value)
+{
+	const histogram_def *d = &histogram_defs[h];
+	histogram *hg = &histograms[h];
+	int b;
+
+	for (b = 0; b < BUCKETS - 1; b++) {
+		if (value <= d->bounds[b])
+			break;
+	}
+	atomic_fetch_add_explicit(&hg->buckets[b], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hg->sum, value, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hg->count, 1, memory_order_relaxed);
+}
+
+static int64_t load(atomic_llong *v)
+{
+	return atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static void write_queue(Queue *q, void *arg)
+{
+	AVBPrint *bp = arg;
+
+	av_bprintf(bp, "foveated_queue_depth{queue=\"%s\"} %d\n", q->name, queue_length(q));
+}
+
+/* a scrape sees each value at some point during the scrape, not all at once */
+static void write_metrics(AVBPrint *bp)
+{
+	const histogram_def *d;
+	histogram *hg;
+	int64_t cumulative;
+	int i, b;
+
+	av_bprintf(bp, "# HELP foveated_frames_total Frames a stage passed on.\n");
+	av_bprintf(bp, "# TYPE foveated_frames_total counter\n");
+	for (i = 0; i < PERF_STAGES; i++)
+		av_bprintf(bp, "foveated_frames_total{stage=\"%s\"} %" PRId64 "\n",
+			   stage_names[i], load(&frames[i]));
+
+	for (i = 0; i < METRIC_COUNTERS; i++) {
+		av_bprintf(bp, "# HELP %s %s\n", counter_names[i][0], counter_names[i][1]);
+		av_bprintf(bp, "# TYPE %s counter\n", counter_names[i][0]);
+		av_bprintf(bp, "%s %" PRId64 "\n", counter_names[i][0], load(&counters[i]));
+	}
+
+	for (i = 0; i < METRIC_GAUGES; i++) {
+		av_bprintf(bp, "# HELP %s %s\n", gauge_names[i][0], gauge_names[i][1]);
+		av_bprintf(bp, "# TYPE %s gauge\n", gauge_names[i][0]);
+		av_bprintf(bp, "%s %.15g\n", gauge_names[i][0], load(&gauges[i]) / 1e6);
+	}
+
+	av_bprintf(bp, "# HELP foveated_queue_depth Elements held by a queue.\n");
+	av_bprintf(bp, "# TYPE foveated_queue_depth gauge\n");
+	queue_foreach_accounted(write_queue, bp);
+
+	for (i = 0; i < METRIC_HISTOGRAMS; i++) {
+		d = &histogram_defs[i];
+		hg = &histograms[i];
+		av_bprintf(bp, "# HELP %s %s\n", d->name, d->help);
+		av_bprintf(bp, "# TYPE %s histogram\n", d->name);
+		cumulative = 0;
+		for (b = 0; b < BUCKETS - 1; b++) {
+			cumulative += load(&hg->buckets[b]);
+			av_bprintf(bp, "%s_bucket{le=\"%.15g\"} %" PRId64 "\n", d->name,
+				   d->bounds[b] / d->scale, cumulative);
+		}
+		cumulative += load(&hg->buckets[b]);
+		av_bprintf(bp, "%s_bucket{le=\"+Inf\"} %" PRId64 "\n", d->name, cumulative);
+		av_bprintf(bp, "%s_sum %.15g\n", d->name, load(&hg->sum) / d->scale);
+		av_bprintf(bp, "%s_count %" PRId64 "\n", d->name, load(&hg->count));
+	}
+}
+
+static void respond(int fd, const char *status, const char *body, size_t size)
+{
+	char header[256];
+	int n;
+
+	n = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\n"
+		     "Content-Type: text/plain; version=0.0.4\r\n"
+		     "Content-Length: %zu\r\n"
+		     "Connection: close\r\n\r\n", status, size);
+	send(fd, header, n, MSG_NOSIGNAL);
+	send(fd, body, size, MSG_NOSIGNAL);
+}
+
+static int serve_thread(void *ptr)
+{
+	int fd = (intptr_t) ptr;
+	char request[REQUEST_SIZE];
+	AVBPrint bp;
+	ssize_t n;
+	int client;
+
+	for (;;) {
+		client = accept(fd, NULL, NULL);
+		if (client < 0)
+			continue;
+
+		/* the request line is all we look at */
+		n = recv(client, request, sizeof(request) - 1, 0);
+		if (n > 0) {
+			request[n] = '\0';
+			if (!strncmp(request, "GET /metrics ", 13) || !strncmp(request, "GET / ", 6)) {
+				av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+				write_metrics(&bp);
+				if (av_bprint_is_complete(&bp))
+					respond(client, "200 OK", bp.str, bp.len);
+				else
+					respond(client, "500 Internal Server Error", "", 0);
+				av_bprint_finalize(&bp, NULL);
+			} else {
+				respond(client, "404 Not Found", "", 0);
+			}
+		}
+		close(client);
+	}
+	return 0;
+}
+
+int metrics_serve(int port)
+{
+	struct sockaddr_in addr;
+	SDL_Thread *server;
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	server = SDL_CreateThread(serve_thread, "metrics", (void *) (intptr_t) fd);
+	if (!server)
+		pexit(SDL_GetError());
+	SDL_DetachThread(server);
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "perf.h"
+
+#include <stdint.h>
+
+/*
+ * Live pipeline metrics, served in the Prometheus text format. Updates are
+ * relaxed atomic adds and stores, the pipeline threads never wait on a
+ * scrape. Queue depths are read at scrape time from the accounted queues.
+ */
+
+#define METRICS_PORT 9464 //TCP, on localhost only
+
+typedef enum metric_counter {
+	METRIC_DROPPED, //decoded, but flushed before they were shown
+	METRIC_LATE, //shown after their presentation time
+	METRIC_COUNTERS,
+} metric_counter;
+
+typedef enum metric_gauge {
+	METRIC_GAZE_AGE, //us since the sample the last descriptor used
+	METRIC_GAUGES,
+} metric_gauge;
+
+typedef enum metric_histogram {
+	METRIC_ENCODE, //us to submit a frame to the encoder
+	METRIC_FOVEATION, //us for the descriptor and prefilter
+	METRIC_FRAME_BITS, //bits of an encoded frame
+	METRIC_HISTOGRAMS,
+} metric_histogram;
+
+/**
+ * Count a frame a stage passed on.
+ */
+void metrics_frame(perf_stage stage);
+
+/**
+ * Increment a counter by one.
+ */
+void metrics_count(metric_counter c);
+
+/**
+ * Set a gauge.
+ */
+void metrics_set(metric_gauge g, int64_t value);
+
+/**
+ * Add an observation to a histogram.
+ *
+ * @param value in the unit of the histogram, see metric_histogram
+ */
+void metrics_observe(metric_histogram h, int64_t value);
+
+/**
+ * Answer GET /metrics on 127.0.0.1 in a thread.
+ *
+ * @param port TCP port to listen on
+ * @return 0 on success, -1 if the port cannot be bound
+ */
+int metrics_serve(int port);
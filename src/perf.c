@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perf.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum {
+	CYCLES,
+	INSTRUCTIONS,
+	LLC_MISSES,
+	CONTEXT_SWITCHES,
+	COUNTERS,
+};
+
+typedef struct stage_counters {
+	int fd[COUNTERS]; //-1 if unavailable
+	long tid; //thread the counters count, 0 before the first call
+	int running; //between perf_begin and perf_end
+	uint64_t start[COUNTERS];
+	uint64_t total[COUNTERS]; //since the last report
+	int64_t frames; //since the last report
+	int64_t frame; //running number for the log
+} stage_counters;
+
+static const char *stage_names[PERF_STAGES] = {
+	"reader", "src_decoder", "encoder", "foveation", "fov_decoder", "refresh",
+};
+
+static stage_counters stages[PERF_STAGES];
+static int enabled;
+static FILE *perf_log;
+
+#ifdef __linux__
+static long thread_id(void)
+{
+	return syscall(SYS_gettid);
+}
+
+/* counts the calling thread on any CPU, with inherit the threads it creates */
+static int open_counter(uint32_t type, uint64_t config, int inherit)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_hv = 1;
+	attr.inherit = inherit;
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		/* user space only, a perf_event_paranoid of 2 allows no more */
+		attr.exclude_kernel = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	return fd;
+}
+
+static void open_counters(int *fd, int inherit)
+{
+	static const uint32_t type[COUNTERS] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE,
+	};
+	/* generic cache misses are last level cache misses on most CPUs */
+	static const uint64_t config[COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES,
+	};
+	int i;
+
+	for (i = 0; i < COUNTERS; i++)
+		fd[i] = open_counter(type[i], config[i], inherit);
+}
+
+static void close_counters(int *fd)
+{
+	int i;
+
+	for (i = 0; i < COUNTERS; i++)
+		if (fd[i] >= 0)
+			close(fd[i]);
+}
+
+static void read_counters(const int *fd, uint64_t *v)
+{
+	int i;
+
+	for (i = 0; i < COUNTERS; i++)
+		if (fd[i] < 0 || read(fd[i], &v[i], sizeof(v[i])) != sizeof(v[i]))
+			v[i] = 0;
+}
+#else
+static long thread_id(void)
+{
+	return 1;
+}
+
+static void open_counters(int *fd, int inherit)
+{
+	int i;
+
+	(void) inherit;
+	for (i = 0; i < COUNTERS; i++)
+		fd[i] = -1;
+}
+
+static void close_counters(int *fd)
+{
+	(void) fd;
+}
+
+static void read_counters(const int *fd, uint64_t *v)
+{
+	(void) fd;
+	memset(v, 0, COUNTERS * sizeof(*v));
+}
+#endif
+
+void perf_open(const char *path)
+{
+	int fd[COUNTERS];
+	int available = 0;
+	int i;
+
+	/* the same counters the stages open, tried on this thread */
+	open_counters(fd, 0);
+	for (i = 0; i < COUNTERS; i++)
+		available |= fd[i] >= 0;
+	close_counters(fd);
+	if (!available) {
+		fprintf(stderr, "performance counters unavailable, not counting\n");
+		return;
+	}
+
+	if (path) {
+		perf_log = fopen(path, "w");
+		if (!perf_log)
+			perror("cannot open performance counter log");
+		else
+			fprintf(perf_log, "stage,frame,cycles,instructions,llc_misses,context_switches\n");
+	}
+	enabled = 1;
+}
+
+void perf_inherit(perf_stage stage)
+{
+	stage_counters *s = &stages[stage];
+
+	if (!enabled)
+		return;
+
+	if (s->tid)
+		close_counters(s->fd);
+	open_counters(s->fd, 1);
+	s->tid = thread_id();
+	s->running = 0;
+}
+
+void perf_begin(perf_stage stage)
+{
+	stage_counters *s = &stages[stage];
+	long tid;
+
+	if (!enabled)
+		return;
+
+	/* threads of a previous run are gone, count the new one */
+	tid = thread_id();
+	if (s->tid != tid) {
+		if (s->tid)
+			close_counters(s->fd);
+		open_counters(s->fd, 0);
+		s->tid = tid;
+	}
+	read_counters(s->fd, s->start);
+	s->running = 1;
+}
+
+void perf_end(perf_stage stage)
+{
+	stage_counters *s = &stages[stage];
+	uint64_t now[COUNTERS];
+	int i;
+
+	if (!enabled || !s->running || s->tid != thread_id())
+		return;
+
+	read_counters(s->fd, now);
+	for (i = 0; i < COUNTERS; i++) {
+		now[i] -= s->start[i];
+		s->total[i] += now[i];
+	}
+	if (perf_log)
+		fprintf(perf_log, "%s,%" PRId64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+			stage_names[stage], s->frame, now[CYCLES], now[INSTRUCTIONS],
+			now[LLC_MISSES], now[CONTEXT_SWITCHES]);
+	s->frames++;
+	s->frame++;
+	s->running = 0;
+}
+
+void perf_frame(perf_stage stage)
+{
+	perf_end(stage);
+	perf_begin(stage);
+}
+
+void perf_report(FILE *f)
+{
+	stage_counters *s;
+	int i;
+
+	if (!enabled)
+		return;
+
+	fprintf(f, "stage,frames,mcycles_per_frame,ipc,llc_misses_per_kinstr,"
+		"context_switches_per_frame\n");
+	for (i = 0; i < PERF_STAGES; i++) {
+		s = &stages[i];
+		if (!s->frames)
+			continue;
+		fprintf(f, "%s,%" PRId64 ",%.3f,%.2f,%.3f,%.2f\n", stage_names[i], s->frames,
+			s->total[CYCLES] / 1e6 / s->frames,
+			s->total[CYCLES] ? (double) s->total[INSTRUCTIONS] / s->total[CYCLES] : 0,
+			s->total[INSTRUCTIONS] ? 1e3 * s->total[LLC_MISSES] / s->total[INSTRUCTIONS] : 0,
+			(double) s->total[CONTEXT_SWITCHES] / s->frames);
+		memset(s->total, 0, sizeof(s->total));
+		s->frames = 0;
+	}
+}
+
+void perf_close(void)
+{
+	enabled = 0;
+	if (perf_log)
+		fclose(perf_log);
+	perf_log = NULL;
+}
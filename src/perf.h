@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Hardware performance counters per pipeline stage, to tell whether a stage
+ * is compute-, memory- or sync-bound: a low IPC with many LLC misses per
+ * instruction points at memory, many context switches per frame at waiting
+ * on queues. Each stage counts the thread running it, with counters opened
+ * on the first call from that thread, plus the threads it creates after
+ * perf_inherit, e.g. the workers of a codec it opens. All calls are no-ops before
+ * perf_open and wherever counters are unavailable (not Linux, denied by
+ * perf_event_paranoid, no PMU in a VM), single counters read as 0 then.
+ */
+
+typedef enum perf_stage {
+	PERF_READER,
+	PERF_SRC_DECODER,
+	PERF_ENCODER,
+	PERF_FOVEATION, //descriptor and prefilter, inside PERF_ENCODER
+	PERF_FOV_DECODER,
+	PERF_REFRESH,
+	PERF_STAGES,
+} perf_stage;
+
+/**
+ * Enable counting.
+ *
+ * @param path per-frame deltas are written to as csv, NULL for none
+ */
+void perf_open(const char *path);
+
+/**
+ * Open the counters of a stage on the calling thread so that they also count
+ * every thread it creates from now on, e.g. call before avcodec_open2 for a
+ * codec with worker threads. Sections are still delimited by perf_begin and
+ * perf_end from the calling thread, whatever the workers run meanwhile adds
+ * to them.
+ */
+void perf_inherit(perf_stage stage);
+
+/**
+ * Count a section of the calling thread, ended by perf_end.
+ */
+void perf_begin(perf_stage stage);
+
+/**
+ * End a section begun by perf_begin, it counts as one frame.
+ */
+void perf_end(perf_stage stage);
+
+/**
+ * End the frame begun by the last call and begin the next one, for loops
+ * producing a frame per iteration. Waits on queues are included.
+ */
+void perf_frame(perf_stage stage);
+
+/**
+ * Print per stage totals since the last report and start over.
+ *
+ * @param f stream to print the csv summary to
+ */
+void perf_report(FILE *f);
+
+/**
+ * Close the per-frame log, counting stops.
+ */
+void perf_close(void);
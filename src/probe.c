@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "probe.h"
+#include "pexit.h"
+
+#include <libavutil/common.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/time.h>
+#include <inttypes.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define SYNC_ROUNDS 8
+#define SYNC_TIMEOUT 200000 //us to wait for each answer
+
+/* user data: uuid, frame id, capture time */
+#define STAMP_SIZE (16 + 4 + 8)
+
+/* datagrams: type, then big-endian fields */
+#define REQUEST_SIZE (1 + 8) //t1
+#define ANSWER_SIZE (1 + 3 * 8) //t1, t2, t3
+#define REPORT_SIZE (1 + 4 + 8) //frame id, latency
+
+enum {
+	DECODED,
+	PRESENTED,
+	REPORTED,
+	HISTOGRAMS,
+};
+
+typedef struct histogram {
+	int64_t bins[PROBE_BINS];
+	int64_t count;
+	int64_t sum; //us
+	int64_t max;
+} histogram;
+
+static const char *histogram_names[HISTOGRAMS] = {
+	"decoded", "presented", "reported",
+};
+
+/* tells the stamp apart from other user data, e.g. x264's version string */
+static const uint8_t probe_uuid[16] = {
+	0x2f, 0x6f, 0x76, 0x65, 0x61, 0x74, 0x65, 0x64,
+	0x9a, 0x41, 0x4c, 0x1e, 0xb7, 0x05, 0xd3, 0x62,
+};
+
+static histogram histograms[HISTOGRAMS];
+static SDL_SpinLock histogram_lock;
+static int64_t offset; //sender's clock minus ours
+static int report_fd = -1; //connected to the sender
+static uint32_t next_id;
+
+static void count(int h, int64_t latency)
+{
+	histogram *hg = &histograms[h];
+
+	SDL_AtomicLock(&histogram_lock);
+	hg->bins[av_clip64(latency / 1000, 0, PROBE_BINS - 1)]++;
+	hg->count++;
+	hg->sum += latency;
+	hg->max = FFMAX(hg->max, latency);
+	SDL_AtomicUnlock(&histogram_lock);
+}
+
+int probe_read(const AVFrame *frame, probe_stamp *stamp)
+{
+	const AVFrameSideData *sd;
+	int i;
+
+	for (i = 0; i < frame->nb_side_data; i++) {
+		sd = frame->side_data[i];
+		if (sd->type != AV_FRAME_DATA_SEI_UNREGISTERED || sd->size != STAMP_SIZE ||
+		    memcmp(sd->data, probe_uuid, sizeof(probe_uuid)))
+			continue;
+		stamp->id = AV_RB32(sd->data + 16);
+		stamp->capture = AV_RB64(sd->data + 20);
+		return 1;
+	}
+	return 0;
+}
+
+void probe_stamp_frame(AVFrame *frame)
+{
+	AVFrameSideData *sd;
+	probe_stamp stamp;
+
+	if (!probe_read(frame, &stamp)) {
+		stamp.id = next_id++;
+		stamp.capture = av_gettime_relative();
+	}
+	/* the source's other user data, e.g. its encoder's version string, would
+	 * be re-encoded and mislead the client's decoder */
+	av_frame_remove_side_data(frame, AV_FRAME_DATA_SEI_UNREGISTERED);
+	sd = av_frame_new_side_data(frame, AV_FRAME_DATA_SEI_UNREGISTERED, STAMP_SIZE);
+	if (!sd)
+		pexit("side data allocation failed");
+	memcpy(sd->data, probe_uuid, sizeof(probe_uuid));
+	AV_WB32(sd->data + 16, stamp.id);
+	AV_WB64(sd->data + 20, stamp.capture);
+}
+
+/* the capture time on our clock */
+static int64_t latency(const probe_stamp *stamp)
+{
+	return av_gettime_relative() - (stamp->capture - offset);
+}
+
+void probe_decoded(const AVFrame *frame)
+{
+	probe_stamp stamp;
+
+	if (probe_read(frame, &stamp))
+		count(DECODED, latency(&stamp));
+}
+
+void probe_presented(const AVFrame *frame)
+{
+	probe_stamp stamp;
+	uint8_t buf[REPORT_SIZE];
+	int64_t l;
+
+	if (!probe_read(frame, &stamp))
+		return;
+	l = latency(&stamp);
+	count(PRESENTED, l);
+	if (report_fd >= 0) {
+		buf[0] = 'R';
+		AV_WB32(buf + 1, stamp.id);
+		AV_WB64(buf + 5, l);
+		send(report_fd, buf, sizeof(buf), 0);
+	}
+}
+
+static int serve_thread(void *ptr)
+{
+	int fd = (intptr_t) ptr;
+	struct sockaddr_storage from;
+	socklen_t len;
+	uint8_t buf[ANSWER_SIZE];
+	ssize_t n;
+	int64_t t2;
+
+	for (;;) {
+		len = sizeof(from);
+		n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &len);
+		t2 = av_gettime_relative();
+		if (n == REQUEST_SIZE && buf[0] == 'Q') {
+			buf[0] = 'A';
+			AV_WB64(buf + 9, t2);
+			AV_WB64(buf + 17, av_gettime_relative());
+			sendto(fd, buf, ANSWER_SIZE, 0, (struct sockaddr *) &from, len);
+		} else if (n == REPORT_SIZE && buf[0] == 'R') {
+			count(REPORTED, (int64_t) AV_RB64(buf + 5));
+		}
+	}
+	return 0;
+}
+
+int probe_serve(int port)
+{
+	struct sockaddr_in addr;
+	SDL_Thread *server;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	server = SDL_CreateThread(serve_thread, "probe", (void *) (intptr_t) fd);
+	if (!server)
+		pexit(SDL_GetError());
+	SDL_DetachThread(server);
+	return 0;
+}
+
+int probe_sync(const char *host, int port)
+{
+	struct addrinfo hints, *ai;
+	struct timeval tv = { 0, SYNC_TIMEOUT };
+	char service[8];
+	uint8_t buf[ANSWER_SIZE];
+	int64_t t1, t2, t3, t4, delay, best = INT64_MAX;
+	ssize_t n;
+	int fd, i;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(host, service, &hints, &ai))
+		return -1;
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(ai);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* the round trip with the least delay has the least asymmetry */
+	for (i = 0; i < SYNC_ROUNDS; i++) {
+		buf[0] = 'Q';
+		t1 = av_gettime_relative();
+		AV_WB64(buf + 1, t1);
+		if (send(fd, buf, REQUEST_SIZE, 0) != REQUEST_SIZE)
+			break;
+		/* late answers to earlier rounds are skipped */
+		do {
+			n = recv(fd, buf, sizeof(buf), 0);
+		} while (n == ANSWER_SIZE && (int64_t) AV_RB64(buf + 1) != t1);
+		t4 = av_gettime_relative();
+		if (n != ANSWER_SIZE || buf[0] != 'A')
+			continue;
+
+		t2 = AV_RB64(buf + 9);
+		t3 = AV_RB64(buf + 17);
+		delay = (t4 - t1) - (t3 - t2);
+		if (delay < best) {
+			best = delay;
+			offset = ((t2 - t1) + (t3 - t4)) / 2;
+		}
+	}
+	if (best == INT64_MAX) {
+		close(fd);
+		return -1;
+	}
+
+	if (report_fd >= 0)
+		close(report_fd);
+	report_fd = fd;
+	return 0;
+}
+
+/* upper edge of the bin holding the p-th percentile, in ms */
+static int percentile(const histogram *h, int p)
+{
+	int64_t sum = 0;
+	int b;
+
+	for (b = 0; b < PROBE_BINS - 1; b++) {
+		sum += h->bins[b];
+		if (100 * sum >= p * h->count)
+			break;
+	}
+	return b + 1;
+}
+
+void probe_report(FILE *f)
+{
+	histogram h[HISTOGRAMS];
+	int i, b, any = 0;
+
+	SDL_AtomicLock(&histogram_lock);
+	memcpy(h, histograms, sizeof(h));
+	memset(histograms, 0, sizeof(histograms));
+	SDL_AtomicUnlock(&histogram_lock);
+
+	for (i = 0; i < HISTOGRAMS; i++)
+		any |= h[i].count > 0;
+	if (!any)
+		return;
+
+	fprintf(f, "latency,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+	for (i = 0; i < HISTOGRAMS; i++) {
+		if (!h[i].count)
+			continue;
+		fprintf(f, "%s,%" PRId64 ",%.2f,%d,%d,%d,%.2f\n", histogram_names[i],
+			h[i].count, h[i].sum / 1000.0 / h[i].count, percentile(&h[i], 50),
+			percentile(&h[i], 95), percentile(&h[i], 99), h[i].max / 1000.0);
+	}
+	/* empty bins are left out */
+	fprintf(f, "bin_ms,decoded,presented,reported\n");
+	for (b = 0; b < PROBE_BINS; b++) {
+		if (!h[DECODED].bins[b] && !h[PRESENTED].bins[b] && !h[REPORTED].bins[b])
+			continue;
+		fprintf(f, "%d,%" PRId64 ",%" PRId64 ",%" PRId64 "\n", b, h[DECODED].bins[b],
+			h[PRESENTED].bins[b], h[REPORTED].bins[b]);
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libavutil/frame.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Glass-to-glass latency probe, across processes. The sender stamps each
+ * source frame with a frame id and the monotonic time it left the source
+ * decoder, which H.264 encoders carry to the client as user data
+ * unregistered SEI. The client reads the stamp after decoding and when the
+ * frame is presented. An NTP-style exchange over UDP aligns the clocks:
+ * of a few round trips, the offset of the fastest one is kept. The client
+ * reports the latency of each presented frame back, so the sender keeps
+ * the same histogram. Within one process the clocks are the same.
+ */
+
+#define PROBE_PORT 5010 //UDP, clock exchange and reports
+#define PROBE_BINS 500 //of 1 ms, the last one takes all longer latencies
+
+typedef struct probe_stamp {
+	uint32_t id;
+	int64_t capture; //sender's monotonic clock in us
+} probe_stamp;
+
+/**
+ * Stamp a frame leaving the source decoder, unless it carries a stamp of a
+ * remote sender already. Any other user data unregistered SEI is removed.
+ * Call from one thread.
+ */
+void probe_stamp_frame(AVFrame *frame);
+
+/**
+ * Read the stamp of a frame.
+ *
+ * @return 1 if the frame is stamped, 0 otherwise
+ */
+int probe_read(const AVFrame *frame, probe_stamp *stamp);
+
+/**
+ * Count the latency of a frame the foveated decoder returned.
+ */
+void probe_decoded(const AVFrame *frame);
+
+/**
+ * Count the glass-to-glass latency of a frame, right after presenting it,
+ * and report it to the sender.
+ */
+void probe_presented(const AVFrame *frame);
+
+/**
+ * Answer clock requests and collect the reports of clients in a thread.
+ *
+ * @param port UDP port to listen on
+ * @return 0 on success, -1 if the port cannot be bound
+ */
+int probe_serve(int port);
+
+/**
+ * Align the clock with a sender's, reports go to it from then on.
+ *
+ * @param host sender serving the probe
+ * @param port UDP port it listens on
+ * @return 0 on success, -1 without an answer, the offset stays 0 then
+ */
+int probe_sync(const char *host, int port);
+
+/**
+ * Print the latency histograms since the last report and start over:
+ * decoded and presented frames on the client, reported ones on the sender.
+ *
+ * @param f stream to print the csv to
+ */
+void probe_report(FILE *f);
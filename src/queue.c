@@ -38,6 +38,16 @@ static void pexit_(const char *msg, const char *file, const int line)
 // Convenience macro to report runtime errors with debug information.
 #define pexit(s) pexit_(s, __FILE__, __LINE__)
 
+/* accounted queues, guarded by accounted_lock */
+static Queue *accounted;
+static SDL_SpinLock accounted_lock;
+
+// elements held, call with q->mutex locked
+static size_t queue_count(Queue *q)
+{
+	return (q->rear + q->capacity + 1 - q->front) % (q->capacity + 1);
+}
+
 Queue *queue_init(size_t capacity)
 {
 	Queue *q;
@@ -54,6 +64,14 @@ Queue *queue_init(size_t capacity)
 	q->front = 0;
 	q->rear  = 0;
 	q->capacity = capacity;
+	q->limit = capacity;
+
+	q->name = NULL;
+	q->item_size = NULL;
+	q->bytes = 0;
+	q->peak_bytes = 0;
+	q->peak_length = 0;
+	q->next_accounted = NULL;
 
 	q->mutex = SDL_CreateMutex();
 	q->full  = SDL_CreateCond();
@@ -73,6 +91,16 @@ static void queue_flush(Queue *q, void (*free_fkt)(void *))
 void queue_free(Queue **q)
 {
 	Queue *qd = *q;
+	Queue **a;
+
+	SDL_AtomicLock(&accounted_lock);
+	for (a = &accounted; *a; a = &(*a)->next_accounted) {
+		if (*a == qd) {
+			*a = qd->next_accounted;
+			break;
+		}
+	}
+	SDL_AtomicUnlock(&accounted_lock);
 
 	SDL_DestroyMutex(qd->mutex);
 	SDL_DestroyCond(qd->full);
@@ -88,14 +116,22 @@ void queue_append(Queue *q, void *data)
 	if (SDL_LockMutex(q->mutex))
 		pexit(SDL_GetError());
 
-	new_rear = (q->rear + 1) % (q->capacity + 1);
-	//check if full
-	if (new_rear == q->front) {
+	//check if full, the limit may have been lowered meanwhile
+	while (queue_count(q) >= q->limit) {
 		if (SDL_CondWait(q->full, q->mutex))
 			pexit(SDL_GetError());
 	}
+	new_rear = (q->rear + 1) % (q->capacity + 1);
 	q->data[q->rear] = data;
 	q->rear = new_rear;
+
+	if (q->item_size) {
+		q->bytes += q->item_size(data);
+		if (q->bytes > q->peak_bytes)
+			q->peak_bytes = q->bytes;
+		if (queue_count(q) > q->peak_length)
+			q->peak_length = queue_count(q);
+	}
 	/* at least one item is now queued*/
 	if (SDL_CondSignal(q->empty))
 		pexit(SDL_GetError());
@@ -120,6 +156,8 @@ void *queue_extract(Queue *q)
 
 	data = q->data[q->front];
 	q->front = (q->front + 1) % (q->capacity + 1);
+	if (q->item_size)
+		q->bytes -= q->item_size(data);
 
 	if (SDL_CondSignal(q->full))
 		pexit(SDL_GetError());
@@ -129,15 +167,68 @@ void *queue_extract(Queue *q)
 	return data;
 }
 
-int queue_length(Queue *q) {
-
+int queue_length(Queue *q)
+{
 	size_t l;
-	SDL_LockMutex(q->mutex);
-	if (q->front >= q->rear)
-		l = q->front - q->rear;
-	else
-		l = q->capacity - (q->rear - q->front) -1;
 
+	SDL_LockMutex(q->mutex);
+	l = queue_count(q);
 	SDL_UnlockMutex(q->mutex);
 	return l;
 }
+
+void queue_account(Queue *q, const char *name, size_t (*item_size)(const void *data))
+{
+	SDL_LockMutex(q->mutex);
+	q->name = name;
+	q->item_size = item_size;
+	q->bytes = 0;
+	SDL_UnlockMutex(q->mutex);
+
+	SDL_AtomicLock(&accounted_lock);
+	q->next_accounted = accounted;
+	accounted = q;
+	SDL_AtomicUnlock(&accounted_lock);
+}
+
+size_t queue_bytes(Queue *q, size_t *peak_bytes, size_t *peak_length)
+{
+	size_t bytes;
+
+	SDL_LockMutex(q->mutex);
+	bytes = q->bytes;
+	if (peak_bytes) {
+		*peak_bytes = q->peak_bytes;
+		q->peak_bytes = q->bytes;
+	}
+	if (peak_length) {
+		*peak_length = q->peak_length;
+		q->peak_length = queue_count(q);
+	}
+	SDL_UnlockMutex(q->mutex);
+	return bytes;
+}
+
+void queue_set_limit(Queue *q, size_t limit)
+{
+	if (limit < 1)
+		limit = 1;
+	if (limit > q->capacity)
+		limit = q->capacity;
+
+	SDL_LockMutex(q->mutex);
+	if (limit > q->limit)
+		SDL_CondBroadcast(q->full);
+	q->limit = limit;
+	SDL_UnlockMutex(q->mutex);
+}
+
+void queue_foreach_accounted(void (*visit)(Queue *q, void *arg), void *arg)
+{
+	Queue *q;
+
+	SDL_AtomicLock(&accounted_lock);
+	for (q = accounted; q; q = q->next_accounted)
+		visit(q, arg);
+	SDL_AtomicUnlock(&accounted_lock);
+}
@@ -27,11 +27,20 @@
 typedef struct Queue {
 	void **data;
 	size_t capacity;
+	size_t limit; //elements held before append blocks, at most capacity
 	unsigned int front;
 	unsigned int rear;
 	SDL_mutex *mutex;
 	SDL_cond *full;
 	SDL_cond *empty;
+
+	/* memory accounting, see queue_account */
+	const char *name;
+	size_t (*item_size)(const void *data); //NULL if not accounted
+	size_t bytes; //held by the queued elements
+	size_t peak_bytes; //high-water marks since the last queue_bytes
+	size_t peak_length;
+	struct Queue *next_accounted;
 } Queue;
 
 /**
@@ -78,8 +87,46 @@ void *queue_extract(Queue *q);
  * Length of the queue (elements contained).
  *
  * Locks q->mutex during length calculation, unlocks afterwards.
- * Result might be incorrect in multithreaded applications, be careful!
+ * Other threads may append or extract right after, be careful!
  * @param q queue to examine
  * @return int length of q
  */
 int queue_length(Queue *q);
+
+/**
+ * Count the bytes held by the elements of a queue.
+ *
+ * The queue is listed for queue_foreach_accounted until queue_free.
+ * @param q queue to account
+ * @param name to report it by
+ * @param item_size bytes held by an element, which may be NULL
+ */
+void queue_account(Queue *q, const char *name, size_t (*item_size)(const void *data));
+
+/**
+ * Bytes held by the elements of an accounted queue.
+ *
+ * @param q queue to examine
+ * @param peak_bytes if not NULL, set to the high-water mark in bytes since the
+ *        previous call with a non-NULL peak_bytes, which starts over then
+ * @param peak_length if not NULL, set to the high-water mark in elements
+ * @return size_t bytes held now
+ */
+size_t queue_bytes(Queue *q, size_t *peak_bytes, size_t *peak_length);
+
+/**
+ * Hold at most limit elements, append blocks beyond.
+ *
+ * Elements already queued beyond a lowered limit are kept, they drain.
+ * @param q queue to limit
+ * @param limit number of elements, clipped to 1 and the capacity
+ */
+void queue_set_limit(Queue *q, size_t limit);
+
+/**
+ * Call visit on each accounted queue not freed yet, queue_free waits.
+ *
+ * @param visit called with each queue and arg, must not free it
+ * @param arg passed on
+ */
+void queue_foreach_accounted(void (*visit)(Queue *q, void *arg), void *arg);
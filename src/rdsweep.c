@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Rate-distortion sweep over CRF x delta x sigma.
+ *
+ * Every clip is encoded once per grid point with the workbench's x264
+ * settings, the foveation descriptor following the clip's gaze log, plus
+ * once per CRF without foveation as the reference. Each encode is decoded
+ * again and scored with plain and eccentricity-weighted PSNR. Per (delta,
+ * sigma), the Bjøntegaard rate difference against the reference over the
+ * CRF points and the relative encode time are printed as CSV.
+ *
+ * Jobs run in parallel with one single-threaded encoder each, so encode
+ * times are comparable across jobs.
+ */
+
+#include "bdrate.h"
+#include "codec.h"
+#include "io.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/fifo.h>
+#include <libavutil/time.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+
+#define MAX_GRID 16
+
+/*
+ * Eccentricity at which cortical magnification halves, in degrees. Errors
+ * at eccentricity e are weighted by E2 / (E2 + e).
+ */
+#define E2 2.3
+
+typedef struct gaze_log {
+	float *x; //per frame, relative to frame width
+	float *y; //per frame, relative to frame height
+	int n;
+} gaze_log;
+
+typedef struct sweep_job {
+	int clip;
+	int crf;
+	float delta; //0 encodes the non-foveated reference
+	float sigma;
+	/* results */
+	int frames;
+	int64_t bytes;
+	double seconds; //duration of the encoded video
+	double encode_time; //in seconds
+	double psnr;
+	double ew_psnr;
+} sweep_job;
+
+typedef struct sweep {
+	char **clips;
+	gaze_log *gaze;
+	sweep_job *jobs;
+	int nb_jobs;
+	SDL_atomic_t next;
+	int max_frames;
+	float fov; //diagonal field of view of the frame in degrees
+} sweep;
+
+/* error sums of one job */
+typedef struct score {
+	double sse;
+	double n;
+	double wsse;
+	double wsum;
+} score;
+
+void display_usage(char *progname)
+{
+	printf("sweep foveation parameters and report BD-rates as CSV\n");
+	printf("usage:\n$ %s [-j threads] [-n frames] [-c crf,...] [-d delta,...] "
+	       "[-s sigma,...] [-f fov] [-p points.csv] clips gazelogs\n", progname);
+	printf("clips and gazelogs list one file per line, gaze logs hold "
+	       "frame,x,y[,...] lines with relative coordinates\n");
+}
+
+static int parse_list(const char *arg, float *list)
+{
+	char *copy, *tok, *save;
+	int n = 0;
+
+	copy = strdup(arg);
+	if (!copy)
+		pexit("strdup failed");
+	for (tok = strtok_r(copy, ",", &save); tok && n < MAX_GRID;
+	     tok = strtok_r(NULL, ",", &save))
+		list[n++] = strtof(tok, NULL);
+	free(copy);
+	return n;
+}
+
+/*
+ * Same format as the encoder's ET log. Samples are placed by their frame
+ * number, frames without one keep the gaze of the previous sample, those
+ * before the first sample take the first.
+ */
+static void read_gaze_log(gaze_log *g, const char *path)
+{
+	char **lines, **l;
+	float x, y;
+	int f, first = -1;
+
+	lines = parse_lines(path);
+	g->n = 0;
+	for (l = lines; *l; l++)
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) == 3 && f >= g->n)
+			g->n = f + 1;
+	if (!g->n)
+		pexit("gaze log without samples");
+
+	g->x = malloc(g->n * sizeof(float));
+	g->y = malloc(g->n * sizeof(float));
+	if (!g->x || !g->y)
+		pexit("malloc failed");
+	for (f = 0; f < g->n; f++)
+		g->x[f] = g->y[f] = NAN;
+	/* headers are skipped */
+	for (l = lines; *l; l++)
+		if (sscanf(*l, "%d,%f,%f", &f, &x, &y) == 3 && f >= 0) {
+			g->x[f] = x;
+			g->y[f] = y;
+		}
+	free_lines(&lines);
+
+	for (f = 0; f < g->n; f++) {
+		if (isnan(g->x[f])) {
+			if (first >= 0) {
+				g->x[f] = g->x[f - 1];
+				g->y[f] = g->y[f - 1];
+			}
+		} else if (first < 0) {
+			first = f;
+		}
+	}
+	for (f = 0; f < first; f++) {
+		g->x[f] = g->x[first];
+		g->y[f] = g->y[first];
+	}
+}
+
+static void score_frame(score *s, const AVFrame *ref, const AVFrame *dist,
+			float gx, float gy, float fov)
+{
+	float diag = sqrtf(ref->width * ref->width + ref->height * ref->height);
+	float deg_per_px = fov / diag;
+	int x, y;
+
+	gx *= ref->width;
+	gy *= ref->height;
+	for (y = 0; y < ref->height; y++) {
+		const uint8_t *a = ref->data[0] + y * ref->linesize[0];
+		const uint8_t *b = dist->data[0] + y * dist->linesize[0];
+		float dy2 = (y - gy) * (y - gy);
+
+		for (x = 0; x < ref->width; x++) {
+			float e = deg_per_px * sqrtf((x - gx) * (x - gx) + dy2);
+			float w = E2 / (E2 + e);
+			int d = a[x] - b[x];
+
+			s->sse += d * d;
+			s->wsse += w * d * d;
+			s->wsum += w;
+		}
+	}
+	s->n += ref->width * ref->height;
+}
+
+static double psnr(double sse, double n)
+{
+	if (sse <= 0)
+		return 100;
+	return 10 * log10(255.0 * 255.0 * n / sse);
+}
+
+/*
+ * Decode everything the output decoder has and score it against the
+ * oldest source frames, which come back in the same order.
+ */
+static void drain_decoder(AVCodecContext *dec, AVFrame *out, AVFifoBuffer *fifo,
+			  score *s, const gaze_log *g, float fov)
+{
+	AVFrame *ref;
+	int n;
+
+	while (avcodec_receive_frame(dec, out) == 0) {
+		if (av_fifo_size(fifo) < (int)sizeof(ref))
+			pexit("decoder returned more frames than were encoded");
+		av_fifo_generic_read(fifo, &ref, sizeof(ref), NULL);
+		n = FFMIN((int)(intptr_t)ref->opaque, g->n - 1);
+		score_frame(s, ref, out, g->x[n], g->y[n], fov);
+		av_frame_free(&ref);
+		av_frame_unref(out);
+	}
+}
+
+/* only the calls into the encoder count towards its time */
+static void drain_encoder(AVCodecContext *enc, AVCodecContext *dec,
+			  AVPacket *pkt, sweep_job *job)
+{
+	int64_t t = av_gettime_relative();
+
+	while (avcodec_receive_packet(enc, pkt) == 0) {
+		job->encode_time += (av_gettime_relative() - t) / 1e6;
+		job->bytes += pkt->size;
+		if (avcodec_send_packet(dec, pkt) < 0)
+			pexit("avcodec_send_packet failed");
+		av_packet_unref(pkt);
+		t = av_gettime_relative();
+	}
+	job->encode_time += (av_gettime_relative() - t) / 1e6;
+}
+
+static AVCodecContext *open_encoder(const AVCodecContext *src, AVRational tb,
+				    AVRational fps, int crf)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+	AVDictionary *options = NULL;
+	char buf[16];
+
+	codec = avcodec_find_encoder_by_name("libx264");
+	if (!codec)
+		pexit("encoder not found");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+
+	set_codec_options(&options, LIBX264);
+	snprintf(buf, sizeof(buf), "%d", crf);
+	av_dict_set(&options, "crf", buf, 0);
+
+	avctx->time_base	= tb;
+	avctx->framerate	= fps;
+	avctx->pix_fmt		= AV_PIX_FMT_YUV420P;
+	avctx->width		= src->width;
+	avctx->height		= src->height;
+	avctx->thread_count	= 1;
+
+	if (avcodec_open2(avctx, codec, &options) < 0)
+		pexit("avcodec_open2 failed");
+	av_dict_free(&options);
+	return avctx;
+}
+
+static AVCodecContext *open_decoder(enum AVCodecID id, const AVCodecParameters *par)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+
+	codec = avcodec_find_decoder(id);
+	if (!codec)
+		pexit("avcodec_find_decoder failed");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+	if (par && avcodec_parameters_to_context(avctx, par) < 0)
+		pexit("avcodec_parameters_to_context failed");
+	avctx->thread_count = 1;
+	if (avcodec_open2(avctx, codec, NULL) < 0)
+		pexit("avcodec_open2 failed");
+	return avctx;
+}
+
+static void encode_frame(sweep *s, sweep_job *job, AVCodecContext *enc,
+			 AVCodecContext *dec, AVFrame *frame, AVPacket *pkt,
+			 AVFifoBuffer *fifo)
+{
+	const gaze_log *g = &s->gaze[job->clip];
+	AVFrameSideData *sd;
+	AVFrame *ref;
+	float *descr;
+	int64_t t;
+	int n = FFMIN(job->frames, g->n - 1);
+
+	if (frame->format != AV_PIX_FMT_YUV420P)
+		pexit("clips have to be yuv420p");
+
+	ref = av_frame_clone(frame);
+	if (!ref)
+		pexit("av_frame_clone failed");
+	/* frame number for the gaze lookup when scoring */
+	ref->opaque = (void *)(intptr_t)job->frames;
+	if (av_fifo_space(fifo) < (int)sizeof(ref) &&
+	    av_fifo_grow(fifo, av_fifo_size(fifo)) < 0)
+		pexit("av_fifo_grow failed");
+	av_fifo_generic_write(fifo, &ref, sizeof(ref), NULL);
+
+	if (job->delta > 0) {
+		sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR,
+					    4 * sizeof(float));
+		if (!sd)
+			pexit("side data allocation failed");
+		descr = (float *) sd->data;
+		descr[0] = g->x[n];
+		descr[1] = g->y[n];
+		descr[2] = job->sigma;
+		descr[3] = job->delta;
+	}
+	frame->pict_type = 0; //keep undefined to prevent warnings
+
+	t = av_gettime_relative();
+	if (avcodec_send_frame(enc, frame) < 0)
+		pexit("avcodec_send_frame failed");
+	job->encode_time += (av_gettime_relative() - t) / 1e6;
+	drain_encoder(enc, dec, pkt, job);
+	job->frames++;
+}
+
+static void run_job(sweep *s, sweep_job *job)
+{
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *src_dec, *enc, *dec;
+	AVStream *st;
+	AVPacket *pkt, *out_pkt;
+	AVFrame *frame, *out;
+	AVFifoBuffer *fifo;
+	AVRational fps;
+	score sc = { 0 };
+	int index;
+	int eof = 0;
+	int64_t t;
+
+	if (avformat_open_input(&fctx, s->clips[job->clip], NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+	st = fctx->streams[index];
+	fps = st->avg_frame_rate.num ? st->avg_frame_rate : st->r_frame_rate;
+
+	src_dec = open_decoder(st->codecpar->codec_id, st->codecpar);
+	enc = open_encoder(src_dec, st->time_base, fps, job->crf);
+	dec = open_decoder(AV_CODEC_ID_H264, NULL);
+
+	pkt = av_packet_alloc();
+	out_pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	out = av_frame_alloc();
+	fifo = av_fifo_alloc(16 * sizeof(AVFrame *));
+	if (!pkt || !out_pkt || !frame || !out || !fifo)
+		pexit("allocation failed");
+
+	while (!eof) {
+		if (s->max_frames && job->frames >= s->max_frames) {
+			eof = 1;
+		} else if (av_read_frame(fctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(src_dec, NULL);
+		} else if (pkt->stream_index == index) {
+			if (avcodec_send_packet(src_dec, pkt) < 0)
+				pexit("avcodec_send_packet failed");
+		}
+		av_packet_unref(pkt);
+
+		while ((!s->max_frames || job->frames < s->max_frames) &&
+		       avcodec_receive_frame(src_dec, frame) == 0) {
+			encode_frame(s, job, enc, dec, frame, out_pkt, fifo);
+			av_frame_unref(frame);
+			drain_decoder(dec, out, fifo, &sc, &s->gaze[job->clip], s->fov);
+		}
+	}
+
+	/* flush encoder, then the decoder of its output */
+	t = av_gettime_relative();
+	avcodec_send_frame(enc, NULL);
+	job->encode_time += (av_gettime_relative() - t) / 1e6;
+	drain_encoder(enc, dec, out_pkt, job);
+	avcodec_send_packet(dec, NULL);
+	drain_decoder(dec, out, fifo, &sc, &s->gaze[job->clip], s->fov);
+
+	job->seconds = job->frames * av_q2d(av_inv_q(fps));
+	job->psnr = psnr(sc.sse, sc.n);
+	job->ew_psnr = psnr(sc.wsse, sc.wsum);
+
+	while (av_fifo_size(fifo) >= (int)sizeof(frame)) {
+		av_fifo_generic_read(fifo, &frame, sizeof(frame), NULL);
+		av_frame_free(&frame);
+	}
+	av_fifo_freep(&fifo);
+	av_frame_free(&frame);
+	av_frame_free(&out);
+	av_packet_free(&pkt);
+	av_packet_free(&out_pkt);
+	avcodec_free_context(&src_dec);
+	avcodec_free_context(&enc);
+	avcodec_free_context(&dec);
+	avformat_close_input(&fctx);
+}
+
+static int sweep_thread(void *ptr)
+{
+	sweep *s = (sweep *) ptr;
+	int i;
+
+	while ((i = SDL_AtomicAdd(&s->next, 1)) < s->nb_jobs) {
+		run_job(s, &s->jobs[i]);
+		fprintf(stderr, "%s crf %d delta %g sigma %g: %d frames done\n",
+			s->clips[s->jobs[i].clip], s->jobs[i].crf,
+			s->jobs[i].delta, s->jobs[i].sigma, s->jobs[i].frames);
+	}
+	return 0;
+}
+
+/*
+ * Summarize one (delta, sigma) on one clip against the reference jobs of
+ * that clip. Jobs are laid out as [clip][crf][reference, grid...].
+ */
+static void report(sweep *s, int clip, int nc, int per_crf, int g,
+		   double *bd_ew, double *bd_psnr, double *time_ratio)
+{
+	double rr[MAX_GRID], rt[MAX_GRID], qr[MAX_GRID], qt[MAX_GRID];
+	double pr[MAX_GRID], pt[MAX_GRID];
+	double tr = 0, tt = 0;
+	int c;
+
+	for (c = 0; c < nc; c++) {
+		sweep_job *ref = &s->jobs[(clip * nc + c) * per_crf];
+		sweep_job *test = ref + 1 + g;
+
+		rr[c] = ref->bytes * 8 / ref->seconds;
+		rt[c] = test->bytes * 8 / test->seconds;
+		qr[c] = ref->ew_psnr;
+		qt[c] = test->ew_psnr;
+		pr[c] = ref->psnr;
+		pt[c] = test->psnr;
+		tr += ref->encode_time;
+		tt += test->encode_time;
+	}
+	*bd_ew = bd_rate(rr, qr, rt, qt, nc);
+	*bd_psnr = bd_rate(rr, pr, rt, pt, nc);
+	*time_ratio = tr > 0 ? tt / tr : NAN;
+}
+
+int main(int argc, char **argv)
+{
+	float crf[MAX_GRID] = { 18, 23, 28, 33 };
+	float delta[MAX_GRID] = { 6, 12, 18, 24 };
+	float sigma[MAX_GRID] = { 0.05, 0.1, 0.2 };
+	int nc = 4, nd = 4, ns = 3;
+	int nb_threads = SDL_GetCPUCount();
+	char *points = NULL;
+	char **gazelogs;
+	SDL_Thread **threads;
+	params *lim;
+	sweep s = { 0 };
+	int nb_clips, per_crf;
+	int opt, i, c, d, g;
+	FILE *fp;
+
+	s.fov = 40;
+
+	while ((opt = getopt(argc, argv, "j:n:c:d:s:f:p:")) != -1) {
+		switch (opt) {
+		case 'j':
+			nb_threads = atoi(optarg);
+			break;
+		case 'n':
+			s.max_frames = atoi(optarg);
+			break;
+		case 'c':
+			nc = parse_list(optarg, crf);
+			break;
+		case 'd':
+			nd = parse_list(optarg, delta);
+			break;
+		case 's':
+			ns = parse_list(optarg, sigma);
+			break;
+		case 'f':
+			s.fov = strtof(optarg, NULL);
+			break;
+		case 'p':
+			points = optarg;
+			break;
+		default:
+			display_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || nb_threads < 1 || !nc || !nd || !ns || s.fov <= 0) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the grid has to stay within what the encoder accepts */
+	lim = params_limit_init(LIBX264);
+	for (d = 0; d < nd; d++)
+		if (delta[d] <= lim->delta_min || delta[d] > lim->delta_max)
+			pexit("delta outside of the codec's limits");
+	for (i = 0; i < ns; i++)
+		if (sigma[i] <= lim->std_min || sigma[i] > lim->std_max)
+			pexit("sigma outside of the codec's limits");
+	free(lim);
+
+	s.clips = parse_lines(argv[optind]);
+	gazelogs = parse_lines(argv[optind + 1]);
+	for (nb_clips = 0; s.clips[nb_clips]; nb_clips++)
+		if (!gazelogs[nb_clips])
+			pexit("fewer gaze logs than clips");
+
+	s.gaze = malloc(nb_clips * sizeof(gaze_log));
+	if (!s.gaze)
+		pexit("malloc failed");
+	for (i = 0; i < nb_clips; i++)
+		read_gaze_log(&s.gaze[i], gazelogs[i]);
+
+	per_crf = 1 + nd * ns;
+	s.nb_jobs = nb_clips * nc * per_crf;
+	s.jobs = calloc(s.nb_jobs, sizeof(sweep_job));
+	if (!s.jobs)
+		pexit("calloc failed");
+	for (i = 0; i < s.nb_jobs; i++) {
+		sweep_job *job = &s.jobs[i];
+
+		g = i % per_crf - 1;
+		job->clip = i / (nc * per_crf);
+		job->crf = crf[i / per_crf % nc];
+		job->delta = g < 0 ? 0 : delta[g / ns];
+		job->sigma = g < 0 ? 0 : sigma[g % ns];
+	}
+
+	threads = malloc(nb_threads * sizeof(SDL_Thread *));
+	if (!threads)
+		pexit("malloc failed");
+	for (i = 0; i < nb_threads; i++)
+		threads[i] = SDL_CreateThread(sweep_thread, "sweep", &s);
+	for (i = 0; i < nb_threads; i++)
+		SDL_WaitThread(threads[i], NULL);
+
+	if (points) {
+		fp = fopen(points, "w");
+		if (!fp)
+			pexit("fopen failed");
+		fprintf(fp, "clip,crf,delta,sigma,frames,kbps,psnr,ew_psnr,encode_ms\n");
+		for (i = 0; i < s.nb_jobs; i++) {
+			sweep_job *job = &s.jobs[i];
+
+			fprintf(fp, "%s,%d,%g,%g,%d,%.1f,%.3f,%.3f,%.2f\n",
+				s.clips[job->clip], job->crf, job->delta, job->sigma,
+				job->frames, job->bytes * 8 / job->seconds / 1000,
+				job->psnr, job->ew_psnr,
+				job->encode_time * 1000 / job->frames);
+		}
+		fclose(fp);
+	}
+
+	/* BD-rates per clip, then their mean over all clips */
+	printf("clip,delta,sigma,bd_rate_ew_psnr,bd_rate_psnr,encode_time_ratio\n");
+	for (g = 0; g < nd * ns; g++) {
+		double sum_ew = 0, sum_psnr = 0, sum_time = 0;
+
+		for (c = 0; c < nb_clips; c++) {
+			double ew, ps, tr;
+
+			report(&s, c, nc, per_crf, g, &ew, &ps, &tr);
+			printf("%s,%g,%g,%.2f,%.2f,%.3f\n", s.clips[c],
+			       delta[g / ns], sigma[g % ns], ew, ps, tr);
+			sum_ew += ew;
+			sum_psnr += ps;
+			sum_time += tr;
+		}
+		printf("all,%g,%g,%.2f,%.2f,%.3f\n", delta[g / ns], sigma[g % ns],
+		       sum_ew / nb_clips, sum_psnr / nb_clips, sum_time / nb_clips);
+	}
+
+	for (i = 0; i < nb_clips; i++) {
+		free(s.gaze[i].x);
+		free(s.gaze[i].y);
+	}
+	free(s.gaze);
+	free(s.jobs);
+	free(threads);
+	free_lines(&s.clips);
+	free_lines(&gazelogs);
+	return EXIT_SUCCESS;
+}
@@ -15,9 +15,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "autotune.h"
 #include "io.h"
 #include "codec.h"
 #include "pexit.h"
+#include "probe.h"
 #include "window.h"
 
 #include <inttypes.h>
@@ -35,6 +37,8 @@
 #include "iViewXAPI.h"
 #endif
 
+#define RTP_START_RATE 4000000
+
 rdr_ctx *rc;
 dec_ctx *src_dc, *fov_dc;
 rep_enc_ctx *ec;
@@ -51,6 +55,8 @@ int main(int argc, char **argv)
 	char **xcoords, **ycoords, **qoffsets, **sigmas;
 	SDL_Thread *reader, *src_decoder, *encoder, *writer;
 	const int queue_capacity = 32;
+	enc_tuning tuning;
+	int rtp;
 
 	if (argc != 7) {
 		display_usage(argv[0]);
@@ -68,8 +74,20 @@ int main(int argc, char **argv)
 	printf(argv[1]);
 	rc = reader_init(argv[1], queue_capacity);
 	src_dc = source_decoder_init(rc, queue_capacity);
-	ec = replicate_encoder_init(LIBX264, src_dc, xcoords, ycoords, qoffsets, sigmas);
-	wt = writer_init(argv[2], ec->packets, rc, src_dc->avctx);
+	if (autotune(LIBX264, src_dc->avctx->width, src_dc->avctx->height,
+		     src_dc->frame_rate, &tuning) >= 0)
+		set_encoder_tuning(&tuning);
+	/* over RTP, the congestion controller caps the encoder's rate */
+	rtp = !strncmp(argv[2], "rtp://", 6);
+	ec = replicate_encoder_init(LIBX264, src_dc, xcoords, ycoords, qoffsets, sigmas,
+	                            rtp ? RTP_START_RATE : 0);
+	wt = writer_init(argv[2], ec->packets, rc, ec->avctx);
+	if (rtp) {
+		wt->target_rate = &ec->max_rate;
+		/* clients align their clocks and report glass-to-glass latencies */
+		if (probe_serve(PROBE_PORT) < 0)
+			perror("cannot serve the latency probe");
+	}
 
 	reader = SDL_CreateThread(reader_thread, "reader", rc);
 	src_decoder = SDL_CreateThread(decoder_thread, "src_decoder", src_dc);
@@ -80,7 +98,7 @@ int main(int argc, char **argv)
 	SDL_WaitThread(src_decoder, NULL);
 	SDL_WaitThread(encoder, NULL);
 	SDL_WaitThread(writer, NULL);
-
+	probe_report(stdout);
 
 	return EXIT_SUCCESS;
 }
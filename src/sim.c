@@ -0,0 +1,581 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The realtime pipeline on a virtual clock, for latency measurements that
+ * do not depend on the scheduler or on a live gaze source.
+ *
+ * All stages run in one thread, one after the other. Each stage is timed
+ * and its cost advances the virtual time of that stage only, as if it ran
+ * in a thread of its own: it starts a frame once the frame arrived and it
+ * finished the previous one, and like the queues of length 1 between the
+ * encoder, the foveated decoder, the post-filter and the window, it cannot
+ * pass on a frame before the next stage took the previous one. Source
+ * frames are released at their presentation time, the encoder foveates at
+ * the gaze sample of the log at the virtual time it starts a frame, and the
+ * window shows frame n at the pts of frame n past the time the first frame
+ * was ready plus the window's initial delay, or once it is ready if late.
+ *
+ * The timeline, one line per frame in virtual us, goes to stdout, latency
+ * percentiles and mean stage costs to stderr.
+ */
+
+#include "codec.h"
+#include "filter.h"
+#include "io.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* as in frame_refresh, the first frame is shown this late */
+#define DISPLAY_DELAY 100000
+
+enum {
+	SOURCE, //demuxing and decoding
+	ENCODER, //foveation, pre-filter and encoding
+	FOV_DECODER,
+	POSTFILTER,
+	DISPLAY,
+	STAGES,
+};
+
+static const char *stage_names[STAGES] = {
+	"source", "encoder", "fov_decoder", "postfilter", "display",
+};
+
+typedef struct sample {
+	int64_t t; //in us
+	float x, y; //relative to the frame
+	int valid;
+} sample;
+
+typedef struct stage {
+	int64_t free; //virtual time it finished the last frame
+	int64_t start; //virtual time it started the last frame
+	int64_t cost; //measured, summed up
+	int calls;
+} stage;
+
+typedef struct timeline {
+	int64_t release; //pts relative to the first frame
+	int64_t gaze; //virtual time of the gaze sample foveated at
+	int64_t done[STAGES]; //virtual time each stage passed the frame on
+	int bytes;
+} timeline;
+
+typedef struct sim {
+	sample *samples;
+	int nb_samples;
+	int next; //first sample past the virtual time
+	float gx, gy; //last valid sample
+	int64_t gt;
+	float crf, delta, sigma;
+	const char *encoder;
+	const char *postfilter;
+	int max_frames;
+	int cpu_time; //time stages by the cpu time of this thread
+	AVCodecContext *enc, *dec;
+	flt_ctx *pre, *post;
+	stage stages[STAGES];
+	timeline *frames;
+	int nb_frames; //released by the source
+	int nb_encoded, nb_decoded, nb_shown;
+	int size;
+	int64_t display_start; //virtual time pts 0 is shown at
+	AVRational tb;
+} sim;
+
+void display_usage(char *progname)
+{
+	printf("simulate the realtime pipeline on a virtual clock\n");
+	printf("usage:\n$ %s [-e encoder] [-c crf] [-d delta] [-s sigma] [-p postfilter] "
+	       "[-n frames] [-u] clip gazelog\n", progname);
+	printf("gaze logs hold t,x,y,valid[,...] lines, t in us and x, y relative "
+	       "to the frame\n");
+	printf("-u times stages by cpu instead of wall-clock time, -p \"\" skips the "
+	       "post-filter\n");
+}
+
+static void read_samples(sim *s, const char *path)
+{
+	char **lines, **l;
+	int size = 0;
+
+	lines = parse_lines(path);
+	for (l = lines; *l; l++)
+		size++;
+	s->samples = malloc(size * sizeof(sample));
+	if (size && !s->samples)
+		pexit("malloc failed");
+
+	/* headers are skipped */
+	s->nb_samples = 0;
+	for (l = lines; *l; l++) {
+		sample *smp = &s->samples[s->nb_samples];
+		long long t;
+
+		if (sscanf(*l, "%lld,%f,%f,%d", &t, &smp->x, &smp->y, &smp->valid) == 4) {
+			smp->t = t;
+			s->nb_samples++;
+		}
+	}
+	if (!s->nb_samples)
+		pexit("gaze log without samples");
+	free_lines(&lines);
+}
+
+static int64_t clock_us(const sim *s)
+{
+	struct timespec ts;
+
+	if (!s->cpu_time)
+		return av_gettime_relative();
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Run a frame through stage st in virtual time: it arrives at ready and took
+ * cost. Returns when it is passed on.
+ */
+static int64_t advance(sim *s, int st, int64_t ready, int64_t cost)
+{
+	stage *sg = &s->stages[st];
+	int next = st + 1;
+
+	if (next == POSTFILTER && !s->post)
+		next = DISPLAY;
+
+	sg->start = FFMAX(ready, sg->free);
+	sg->free = sg->start + cost;
+	sg->cost += cost;
+	sg->calls++;
+	/* the queue to the next stage holds one frame, the source's is long */
+	if (st != SOURCE && next < STAGES && s->stages[next].calls)
+		sg->free = FFMAX(sg->free, s->stages[next].start);
+	return sg->free;
+}
+
+static timeline *frame_at(sim *s, int n)
+{
+	if (n >= s->size) {
+		s->size = 2 * n + 64;
+		s->frames = realloc(s->frames, s->size * sizeof(timeline));
+		if (!s->frames)
+			pexit("realloc failed");
+	}
+	return &s->frames[n];
+}
+
+/* the last valid sample up to virtual time t */
+static void gaze_at(sim *s, int64_t t)
+{
+	while (s->next < s->nb_samples && s->samples[s->next].t - s->samples[0].t <= t) {
+		sample *smp = &s->samples[s->next++];
+
+		if (smp->valid) {
+			s->gx = smp->x;
+			s->gy = smp->y;
+			s->gt = smp->t - s->samples[0].t;
+		}
+	}
+}
+
+static AVCodecContext *open_encoder(sim *s, const AVCodecContext *src, AVRational fps)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+	AVDictionary *options = NULL;
+	char buf[16];
+
+	codec = avcodec_find_encoder_by_name(s->encoder);
+	if (!codec)
+		pexit("encoder not found");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+
+	if (!strcmp(s->encoder, "libx264")) {
+		set_codec_options(&options, LIBX264);
+		snprintf(buf, sizeof(buf), "%g", s->crf);
+		av_dict_set(&options, "crf", buf, 0);
+	} else {
+		/* mpegvideo encoders, the crf is their fixed quantizer */
+		avctx->flags |= AV_CODEC_FLAG_QSCALE;
+		avctx->global_quality = s->crf * FF_QP2LAMBDA;
+		av_dict_set(&options, "fovea", "1", 0);
+	}
+
+	/* pts are frame numbers */
+	avctx->time_base	= av_inv_q(fps);
+	avctx->framerate	= fps;
+	avctx->pix_fmt		= AV_PIX_FMT_YUV420P;
+	avctx->width		= src->width;
+	avctx->height		= src->height;
+	avctx->thread_count	= 1;
+
+	if (avcodec_open2(avctx, codec, &options) < 0)
+		pexit("avcodec_open2 failed");
+	av_dict_free(&options);
+	return avctx;
+}
+
+static AVCodecContext *open_decoder(enum AVCodecID id, const AVCodecParameters *par)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+
+	codec = avcodec_find_decoder(id);
+	if (!codec)
+		pexit("avcodec_find_decoder failed");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+	if (par && avcodec_parameters_to_context(avctx, par) < 0)
+		pexit("avcodec_parameters_to_context failed");
+	avctx->thread_count = 1;
+	if (avcodec_open2(avctx, codec, NULL) < 0)
+		pexit("avcodec_open2 failed");
+	return avctx;
+}
+
+static void show(sim *s, AVFrame *frame, int64_t ready)
+{
+	timeline *tl = &s->frames[s->nb_shown];
+	int64_t start, cost, due;
+
+	if (s->post) {
+		start = clock_us(s);
+		frame = prefilter_frame(s->post, frame);
+		cost = clock_us(s) - start;
+		ready = advance(s, POSTFILTER, ready, cost);
+	}
+	tl->done[POSTFILTER] = ready;
+
+	/* frame_refresh takes the frame, then waits for its pts past the first */
+	if (!s->nb_shown)
+		s->display_start = ready + DISPLAY_DELAY - tl->release;
+	start = FFMAX(ready, s->stages[DISPLAY].free);
+	due = s->display_start + tl->release;
+	tl->done[DISPLAY] = advance(s, DISPLAY, ready, FFMAX(due - start, 0));
+	s->nb_shown++;
+	av_frame_free(&frame);
+}
+
+static void decode(sim *s, AVPacket *pkt, int64_t ready)
+{
+	AVFrame *frame;
+	int64_t start, done;
+	int n = 0;
+
+	start = clock_us(s);
+	if (avcodec_send_packet(s->dec, pkt) < 0)
+		pexit("avcodec_send_packet failed");
+	for (;;) {
+		frame = av_frame_alloc();
+		if (!frame)
+			pexit("av_frame_alloc failed");
+		if (avcodec_receive_frame(s->dec, frame) < 0) {
+			av_frame_free(&frame);
+			break;
+		}
+		if (s->nb_decoded >= s->nb_encoded)
+			pexit("decoder returned more frames than were encoded");
+		done = advance(s, FOV_DECODER, ready, clock_us(s) - start);
+		s->frames[s->nb_decoded++].done[FOV_DECODER] = done;
+		show(s, frame, done);
+		n++;
+		start = clock_us(s);
+	}
+	/* a packet without a frame keeps the decoder busy all the same */
+	if (!n)
+		advance(s, FOV_DECODER, ready, clock_us(s) - start);
+}
+
+/* packets leave the encoder as soon as they are ready */
+static void drain(sim *s, AVPacket *pkt, int64_t ready, int64_t start)
+{
+	int64_t done;
+	int n = 0;
+
+	while (avcodec_receive_packet(s->enc, pkt) == 0) {
+		done = advance(s, ENCODER, ready, clock_us(s) - start);
+		if (pkt->pts >= 0 && pkt->pts < s->nb_encoded) {
+			s->frames[pkt->pts].bytes = pkt->size;
+			s->frames[pkt->pts].done[ENCODER] = done;
+		}
+		decode(s, pkt, done);
+		av_packet_unref(pkt);
+		n++;
+		start = clock_us(s);
+	}
+	if (!n)
+		advance(s, ENCODER, ready, clock_us(s) - start);
+}
+
+static void encode(sim *s, AVFrame *frame, AVPacket *pkt)
+{
+	timeline *tl = &s->frames[s->nb_encoded];
+	AVFrameSideData *sd;
+	float *descr;
+	int64_t start;
+
+	/* the encoder looks at the gaze when it takes the frame */
+	gaze_at(s, FFMAX(tl->done[SOURCE], s->stages[ENCODER].free));
+	tl->gaze = s->gt;
+
+	start = clock_us(s);
+	sd = av_frame_new_side_data(frame, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, 5 * sizeof(float));
+	if (!sd)
+		pexit("side data allocation failed");
+	descr = (float *) sd->data;
+	descr[0] = s->gx;
+	descr[1] = s->gy;
+	descr[2] = s->sigma;
+	descr[3] = s->delta;
+	descr[4] = 0;
+	frame = prefilter_frame(s->pre, frame);
+	frame->pict_type = 0; //keep undefined to prevent warnings
+	frame->pts = s->nb_encoded++;
+	frame->quality = s->enc->global_quality;
+	if (avcodec_send_frame(s->enc, frame) < 0)
+		pexit("avcodec_send_frame failed");
+	av_frame_free(&frame);
+
+	/* delayed packets of earlier frames leave with this one */
+	drain(s, pkt, tl->done[SOURCE], start);
+}
+
+static void flush(sim *s, AVPacket *pkt)
+{
+	avcodec_send_frame(s->enc, NULL);
+	drain(s, pkt, s->stages[ENCODER].free, clock_us(s));
+	decode(s, NULL, s->stages[FOV_DECODER].free);
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_distribution(const char *name, int64_t *v, int n)
+{
+	double sum = 0;
+	int i;
+
+	qsort(v, n, sizeof(*v), cmp_int64);
+	for (i = 0; i < n; i++)
+		sum += v[i];
+	fprintf(stderr, "%s,%.2f,%.2f,%.2f,%.2f,%.2f\n", name, sum / n / 1000,
+		v[n / 2] / 1000.0, v[n * 95 / 100] / 1000.0, v[n * 99 / 100] / 1000.0,
+		v[n - 1] / 1000.0);
+}
+
+static void report(sim *s)
+{
+	int64_t *latency, *ready, *gaze;
+	timeline *tl;
+	int i, st, late = 0;
+
+	printf("frame,release,gaze,source,encoder,fov_decoder,postfilter,displayed,bytes\n");
+	for (i = 0; i < s->nb_shown; i++) {
+		tl = &s->frames[i];
+		printf("%d,%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
+		       ",%" PRId64 ",%d\n", i, tl->release, tl->gaze, tl->done[SOURCE],
+		       tl->done[ENCODER], tl->done[FOV_DECODER], tl->done[POSTFILTER],
+		       tl->done[DISPLAY], tl->bytes);
+	}
+
+	latency = malloc(s->nb_shown * sizeof(int64_t));
+	ready = malloc(s->nb_shown * sizeof(int64_t));
+	gaze = malloc(s->nb_shown * sizeof(int64_t));
+	if (!latency || !ready || !gaze)
+		pexit("malloc failed");
+	for (i = 0; i < s->nb_shown; i++) {
+		tl = &s->frames[i];
+		latency[i] = tl->done[DISPLAY] - tl->release;
+		ready[i] = tl->done[POSTFILTER] - tl->release;
+		gaze[i] = tl->done[DISPLAY] - tl->gaze;
+		late += tl->done[DISPLAY] > s->display_start + tl->release;
+	}
+	/* displays are paced by the pts, processing shows in the ready times */
+	fprintf(stderr, "latency,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+	print_distribution("release_to_display", latency, s->nb_shown);
+	print_distribution("release_to_ready", ready, s->nb_shown);
+	print_distribution("gaze_to_display", gaze, s->nb_shown);
+	fprintf(stderr, "late frames: %d of %d\n", late, s->nb_shown);
+	free(latency);
+	free(ready);
+	free(gaze);
+
+	fprintf(stderr, "stage,calls,mean_cost_ms\n");
+	for (st = 0; st < DISPLAY; st++)
+		if (s->stages[st].calls)
+			fprintf(stderr, "%s,%d,%.3f\n", stage_names[st], s->stages[st].calls,
+				s->stages[st].cost / 1000.0 / s->stages[st].calls);
+}
+
+int main(int argc, char **argv)
+{
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *src_dec;
+	AVStream *avst;
+	AVPacket *pkt, *out_pkt;
+	AVFrame *frame;
+	AVRational fps;
+	timeline *tl;
+	sim s = { 0 };
+	int64_t start, cost = 0, pts, first = AV_NOPTS_VALUE;
+	int index, opt, eof = 0;
+
+	s.encoder = "libx264";
+	s.postfilter = "fovupconv,fovdeblock";
+	s.crf = 23;
+	s.delta = 12;
+	s.sigma = 0.1;
+	s.gx = 0.5;
+	s.gy = 0.5;
+
+	while ((opt = getopt(argc, argv, "e:c:d:s:p:n:u")) != -1) {
+		switch (opt) {
+		case 'e':
+			s.encoder = optarg;
+			break;
+		case 'c':
+			s.crf = strtof(optarg, NULL);
+			break;
+		case 'd':
+			s.delta = strtof(optarg, NULL);
+			break;
+		case 's':
+			s.sigma = strtof(optarg, NULL);
+			break;
+		case 'p':
+			s.postfilter = optarg;
+			break;
+		case 'n':
+			s.max_frames = atoi(optarg);
+			break;
+		case 'u':
+			s.cpu_time = 1;
+			break;
+		default:
+			display_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || s.sigma <= 0 || s.crf <= 0) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	read_samples(&s, argv[optind + 1]);
+
+	if (avformat_open_input(&fctx, argv[optind], NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+	avst = fctx->streams[index];
+	fps = avst->avg_frame_rate.num ? avst->avg_frame_rate : avst->r_frame_rate;
+	s.tb = avst->time_base;
+
+	src_dec = open_decoder(avst->codecpar->codec_id, avst->codecpar);
+	s.enc = open_encoder(&s, src_dec, fps);
+	s.dec = open_decoder(s.enc->codec_id, NULL);
+	/* single threaded like the codecs, the costs add up per frame */
+	s.pre = prefilter_init("fovchroma", 1);
+	if (*s.postfilter)
+		s.post = prefilter_init(s.postfilter, 1);
+
+	pkt = av_packet_alloc();
+	out_pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	if (!pkt || !out_pkt || !frame)
+		pexit("allocation failed");
+
+	while (!eof) {
+		start = clock_us(&s);
+		if (s.max_frames && s.nb_frames >= s.max_frames) {
+			eof = 1;
+		} else if (av_read_frame(fctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(src_dec, NULL);
+		} else if (pkt->stream_index == index) {
+			if (avcodec_send_packet(src_dec, pkt) < 0)
+				pexit("avcodec_send_packet failed");
+		}
+		av_packet_unref(pkt);
+		cost += clock_us(&s) - start;
+
+		for (;;) {
+			if (s.max_frames && s.nb_frames >= s.max_frames)
+				break;
+			start = clock_us(&s);
+			if (avcodec_receive_frame(src_dec, frame) < 0)
+				break;
+			cost += clock_us(&s) - start;
+			if (frame->format != AV_PIX_FMT_YUV420P)
+				pexit("clips have to be yuv420p");
+
+			/* released at its pts, a source without them at the frame rate */
+			pts = frame->best_effort_timestamp;
+			if (pts == AV_NOPTS_VALUE)
+				pts = av_rescale_q(s.nb_frames, av_inv_q(fps), s.tb);
+			if (first == AV_NOPTS_VALUE)
+				first = pts;
+			tl = frame_at(&s, s.nb_frames++);
+			memset(tl, 0, sizeof(*tl));
+			tl->release = av_rescale_q(pts - first, s.tb, AV_TIME_BASE_Q);
+			tl->done[SOURCE] = advance(&s, SOURCE, tl->release, cost);
+			cost = 0;
+
+			encode(&s, frame, out_pkt);
+			frame = av_frame_alloc();
+			if (!frame)
+				pexit("av_frame_alloc failed");
+		}
+	}
+	flush(&s, out_pkt);
+	if (!s.nb_shown)
+		pexit("no frames");
+	report(&s);
+
+	avcodec_free_context(&s.enc);
+	avcodec_free_context(&s.dec);
+	postfilter_free(&s.pre);
+	if (s.post)
+		postfilter_free(&s.post);
+	av_frame_free(&frame);
+	av_packet_free(&pkt);
+	av_packet_free(&out_pkt);
+	avcodec_free_context(&src_dec);
+	avformat_close_input(&fctx);
+	free(s.samples);
+	free(s.frames);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2020 Oliver Wiedemann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline evaluation of saccade and blink suppression.
+ *
+ * A clip is encoded twice along a gaze sample log, as written by the
+ * eyetracking build: once following the gaze, once with the frames shown
+ * during saccades and blinks at minimal cost and the fovea at the predicted
+ * landing point of decelerating saccades. Frame n is shown at the time of
+ * the first sample plus n frame durations. Reported are the bitrates, the
+ * share of suppressed frames and the eccentricity-weighted PSNR of the
+ * frames that are actually seen, i.e. not suppressed, in both encodes.
+ */
+
+#include "codec.h"
+#include "gazeevent.h"
+#include "io.h"
+#include "pexit.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/fifo.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* as in rdsweep: errors at eccentricity e are weighted by E2 / (E2 + e) */
+#define E2 2.3
+
+typedef struct sample {
+	int64_t t; //in us
+	float x, y; //relative to the frame
+	int valid;
+} sample;
+
+typedef struct stream {
+	AVCodecContext *enc;
+	AVCodecContext *dec;
+	AVFifoBuffer *refs; //source frames in coding order, opaque is the frame number
+	int64_t bytes;
+	double wsse, wsum;
+} stream;
+
+typedef struct eval {
+	sample *samples;
+	int nb_samples;
+	int next; //first sample not yet classified
+	gaze_classifier gc;
+	float fov; //diagonal field of view of the frame in degrees
+	float crf, delta, sigma;
+	const char *encoder;
+	int max_frames;
+	/* per frame, where the viewer looks and whether it is suppressed */
+	float *gx, *gy;
+	uint8_t *suppressed;
+	int frames, nb_suppressed, size;
+	stream ref, test;
+} eval;
+
+void display_usage(char *progname)
+{
+	printf("evaluate the bitrate saved by saccade and blink suppression\n");
+	printf("usage:\n$ %s [-e encoder] [-c crf] [-d delta] [-s sigma] [-f fov] "
+	       "[-n frames] clip gazelog\n", progname);
+	printf("gaze logs hold t,x,y,valid[,...] lines, t in us and x, y relative "
+	       "to the frame\n");
+}
+
+static void read_samples(eval *e, const char *path)
+{
+	char **lines, **l;
+	int size = 0;
+
+	lines = parse_lines(path);
+	for (l = lines; *l; l++)
+		size++;
+	e->samples = malloc(size * sizeof(sample));
+	if (size && !e->samples)
+		pexit("malloc failed");
+
+	/* headers are skipped */
+	e->nb_samples = 0;
+	for (l = lines; *l; l++) {
+		sample *s = &e->samples[e->nb_samples];
+		long long t;
+
+		if (sscanf(*l, "%lld,%f,%f,%d", &t, &s->x, &s->y, &s->valid) == 4) {
+			s->t = t;
+			e->nb_samples++;
+		}
+	}
+	if (!e->nb_samples)
+		pexit("gaze log without samples");
+	free_lines(&lines);
+}
+
+static AVCodecContext *open_encoder(eval *e, const AVCodecContext *src,
+				    AVRational tb, AVRational fps)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+	AVDictionary *options = NULL;
+	char buf[16];
+
+	codec = avcodec_find_encoder_by_name(e->encoder);
+	if (!codec)
+		pexit("encoder not found");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+
+	if (!strcmp(e->encoder, "libx264")) {
+		set_codec_options(&options, LIBX264);
+		snprintf(buf, sizeof(buf), "%g", e->crf);
+		av_dict_set(&options, "crf", buf, 0);
+	} else {
+		/* mpegvideo encoders, the crf is their fixed quantizer */
+		avctx->flags |= AV_CODEC_FLAG_QSCALE;
+		avctx->global_quality = e->crf * FF_QP2LAMBDA;
+		av_dict_set(&options, "fovea", "1", 0);
+	}
+
+	avctx->time_base	= tb;
+	avctx->framerate	= fps;
+	avctx->pix_fmt		= AV_PIX_FMT_YUV420P;
+	avctx->width		= src->width;
+	avctx->height		= src->height;
+	avctx->thread_count	= 1;
+
+	if (avcodec_open2(avctx, codec, &options) < 0)
+		pexit("avcodec_open2 failed");
+	av_dict_free(&options);
+	return avctx;
+}
+
+static AVCodecContext *open_decoder(enum AVCodecID id, const AVCodecParameters *par)
+{
+	AVCodecContext *avctx;
+	AVCodec *codec;
+
+	codec = avcodec_find_decoder(id);
+	if (!codec)
+		pexit("avcodec_find_decoder failed");
+	avctx = avcodec_alloc_context3(codec);
+	if (!avctx)
+		pexit("avcodec_alloc_context3 failed");
+	if (par && avcodec_parameters_to_context(avctx, par) < 0)
+		pexit("avcodec_parameters_to_context failed");
+	avctx->thread_count = 1;
+	if (avcodec_open2(avctx, codec, NULL) < 0)
+		pexit("avcodec_open2 failed");
+	return avctx;
+}
+
+/* classify the samples up to the time frame n is shown */
+static void classify(eval *e, int n, AVRational fps, int width, int height)
+{
+	int64_t t = e->samples[0].t + av_rescale(n, 1000000LL * fps.den, fps.num);
+	double x, y;
+
+	while (e->next < e->nb_samples && e->samples[e->next].t <= t) {
+		sample *s = &e->samples[e->next++];
+
+		gaze_classify(&e->gc, s->t, s->x * width, s->y * height, s->valid);
+	}
+	gaze_target(&e->gc, &x, &y);
+	if (n >= e->size) {
+		e->size = 2 * n + 64;
+		e->gx = realloc(e->gx, e->size * sizeof(float));
+		e->gy = realloc(e->gy, e->size * sizeof(float));
+		e->suppressed = realloc(e->suppressed, e->size);
+		if (!e->gx || !e->gy || !e->suppressed)
+			pexit("realloc failed");
+	}
+	e->gx[n] = x / width;
+	e->gy[n] = y / height;
+	e->suppressed[n] = gaze_suppressed(&e->gc);
+	e->nb_suppressed += e->suppressed[n];
+}
+
+static void score_frame(eval *e, stream *st, const AVFrame *ref, const AVFrame *dist, int n)
+{
+	float diag = sqrtf(ref->width * ref->width + ref->height * ref->height);
+	float deg_per_px = e->fov / diag;
+	float gx = e->gx[n] * ref->width, gy = e->gy[n] * ref->height;
+	int x, y;
+
+	if (e->suppressed[n])
+		return;
+	for (y = 0; y < ref->height; y++) {
+		const uint8_t *a = ref->data[0] + y * ref->linesize[0];
+		const uint8_t *b = dist->data[0] + y * dist->linesize[0];
+		float dy2 = (y - gy) * (y - gy);
+
+		for (x = 0; x < ref->width; x++) {
+			float w = E2 / (E2 + deg_per_px * sqrtf((x - gx) * (x - gx) + dy2));
+			int d = a[x] - b[x];
+
+			st->wsse += w * d * d;
+			st->wsum += w;
+		}
+	}
+}
+
+static void drain(eval *e, stream *st, AVPacket *pkt, AVFrame *out)
+{
+	AVFrame *ref;
+
+	while (avcodec_receive_packet(st->enc, pkt) == 0) {
+		st->bytes += pkt->size;
+		if (avcodec_send_packet(st->dec, pkt) < 0)
+			pexit("avcodec_send_packet failed");
+		av_packet_unref(pkt);
+	}
+	while (avcodec_receive_frame(st->dec, out) == 0) {
+		if (av_fifo_size(st->refs) < (int)sizeof(ref))
+			pexit("decoder returned more frames than were encoded");
+		av_fifo_generic_read(st->refs, &ref, sizeof(ref), NULL);
+		score_frame(e, st, ref, out, (int)(intptr_t)ref->opaque);
+		av_frame_free(&ref);
+		av_frame_unref(out);
+	}
+}
+
+static void encode(eval *e, stream *st, AVFrame *frame, int suppress,
+		   AVPacket *pkt, AVFrame *out)
+{
+	AVFrameSideData *sd;
+	AVFrame *in, *ref;
+	float *descr;
+	int n = e->frames;
+
+	in = av_frame_clone(frame);
+	ref = av_frame_clone(frame);
+	if (!in || !ref)
+		pexit("av_frame_clone failed");
+	ref->opaque = (void *)(intptr_t)n;
+	if (av_fifo_space(st->refs) < (int)sizeof(ref) &&
+	    av_fifo_grow(st->refs, av_fifo_size(st->refs)) < 0)
+		pexit("av_fifo_grow failed");
+	av_fifo_generic_write(st->refs, &ref, sizeof(ref), NULL);
+
+	/* the same descriptors foveation_descriptor creates */
+	sd = av_frame_new_side_data(in, AV_FRAME_DATA_FOVEATION_DESCRIPTOR, 5 * sizeof(float));
+	if (!sd)
+		pexit("side data allocation failed");
+	descr = (float *) sd->data;
+	if (suppress && e->suppressed[n]) {
+		descr[0] = -1;
+		descr[1] = -1;
+		descr[2] = SUPPRESS_SIGMA;
+		descr[3] = fminf(e->delta + SUPPRESS_QP, 51);
+		descr[4] = SUPPRESS_PERIOD;
+	} else {
+		descr[0] = e->gx[n];
+		descr[1] = e->gy[n];
+		descr[2] = e->sigma;
+		descr[3] = e->delta;
+		descr[4] = 0;
+	}
+	in->pict_type = 0; //keep undefined to prevent warnings
+	in->pts = n;
+	in->quality = st->enc->global_quality;
+
+	if (avcodec_send_frame(st->enc, in) < 0)
+		pexit("avcodec_send_frame failed");
+	av_frame_free(&in);
+	drain(e, st, pkt, out);
+}
+
+static void flush(eval *e, stream *st, AVPacket *pkt, AVFrame *out)
+{
+	AVFrame *ref;
+
+	avcodec_send_frame(st->enc, NULL);
+	drain(e, st, pkt, out);
+	avcodec_send_packet(st->dec, NULL);
+	drain(e, st, pkt, out);
+	while (av_fifo_size(st->refs) >= (int)sizeof(ref)) {
+		av_fifo_generic_read(st->refs, &ref, sizeof(ref), NULL);
+		av_frame_free(&ref);
+	}
+}
+
+static void open_stream(eval *e, stream *st, const AVCodecContext *src,
+			AVRational tb, AVRational fps)
+{
+	st->enc = open_encoder(e, src, tb, fps);
+	st->dec = open_decoder(st->enc->codec_id, NULL);
+	st->refs = av_fifo_alloc(16 * sizeof(AVFrame *));
+	if (!st->refs)
+		pexit("av_fifo_alloc failed");
+}
+
+static void close_stream(stream *st)
+{
+	avcodec_free_context(&st->enc);
+	avcodec_free_context(&st->dec);
+	av_fifo_freep(&st->refs);
+}
+
+static double psnr(double sse, double n)
+{
+	if (sse <= 0)
+		return 100;
+	return 10 * log10(255.0 * 255.0 * n / sse);
+}
+
+int main(int argc, char **argv)
+{
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *src_dec;
+	AVStream *avst;
+	AVPacket *pkt, *out_pkt;
+	AVFrame *frame, *out;
+	AVRational fps;
+	eval e = { 0 };
+	double seconds, ref_kbps, test_kbps;
+	int index, opt, eof = 0;
+
+	e.encoder = "libx264";
+	e.crf = 23;
+	e.delta = 12;
+	e.sigma = 0.1;
+	e.fov = 40;
+
+	while ((opt = getopt(argc, argv, "e:c:d:s:f:n:")) != -1) {
+		switch (opt) {
+		case 'e':
+			e.encoder = optarg;
+			break;
+		case 'c':
+			e.crf = strtof(optarg, NULL);
+			break;
+		case 'd':
+			e.delta = strtof(optarg, NULL);
+			break;
+		case 's':
+			e.sigma = strtof(optarg, NULL);
+			break;
+		case 'f':
+			e.fov = strtof(optarg, NULL);
+			break;
+		case 'n':
+			e.max_frames = atoi(optarg);
+			break;
+		default:
+			display_usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || e.fov <= 0 || e.sigma <= 0 || e.crf <= 0) {
+		display_usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	read_samples(&e, argv[optind + 1]);
+
+	if (avformat_open_input(&fctx, argv[optind], NULL, NULL) < 0)
+		pexit("avformat_open_input failed");
+	if (avformat_find_stream_info(fctx, NULL) < 0)
+		pexit("avformat_find_stream_info failed");
+	index = av_find_best_stream(fctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (index < 0)
+		pexit("no video stream");
+	avst = fctx->streams[index];
+	fps = avst->avg_frame_rate.num ? avst->avg_frame_rate : avst->r_frame_rate;
+
+	src_dec = open_decoder(avst->codecpar->codec_id, avst->codecpar);
+	open_stream(&e, &e.ref, src_dec, avst->time_base, fps);
+	open_stream(&e, &e.test, src_dec, avst->time_base, fps);
+	/* gaze in pixels, the field of view spans the frame diagonal */
+	gaze_classifier_init(&e.gc, sqrt(src_dec->width * src_dec->width +
+					 src_dec->height * src_dec->height) / e.fov);
+
+	pkt = av_packet_alloc();
+	out_pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	out = av_frame_alloc();
+	if (!pkt || !out_pkt || !frame || !out)
+		pexit("allocation failed");
+
+	while (!eof) {
+		if (e.max_frames && e.frames >= e.max_frames) {
+			eof = 1;
+		} else if (av_read_frame(fctx, pkt) < 0) {
+			eof = 1;
+			avcodec_send_packet(src_dec, NULL);
+		} else if (pkt->stream_index == index) {
+			if (avcodec_send_packet(src_dec, pkt) < 0)
+				pexit("avcodec_send_packet failed");
+		}
+		av_packet_unref(pkt);
+
+		while ((!e.max_frames || e.frames < e.max_frames) &&
+		       avcodec_receive_frame(src_dec, frame) == 0) {
+			if (frame->format != AV_PIX_FMT_YUV420P)
+				pexit("clips have to be yuv420p");
+			classify(&e, e.frames, fps, frame->width, frame->height);
+			encode(&e, &e.ref, frame, 0, out_pkt, out);
+			encode(&e, &e.test, frame, 1, out_pkt, out);
+			av_frame_unref(frame);
+			e.frames++;
+		}
+	}
+	flush(&e, &e.ref, out_pkt, out);
+	flush(&e, &e.test, out_pkt, out);
+	if (!e.frames)
+		pexit("no frames");
+
+	seconds = e.frames * av_q2d(av_inv_q(fps));
+	ref_kbps = e.ref.bytes * 8 / seconds / 1000;
+	test_kbps = e.test.bytes * 8 / seconds / 1000;
+	printf("frames,suppressed,ref_kbps,suppressed_kbps,saved,ref_ew_psnr,suppressed_ew_psnr\n");
+	printf("%d,%.1f%%,%.1f,%.1f,%.2f%%,%.3f,%.3f\n", e.frames,
+	       100.0 * e.nb_suppressed / e.frames, ref_kbps, test_kbps,
+	       100 * (1 - test_kbps / ref_kbps),
+	       psnr(e.ref.wsse, e.ref.wsum), psnr(e.test.wsse, e.test.wsum));
+
+	close_stream(&e.ref);
+	close_stream(&e.test);
+	av_frame_free(&frame);
+	av_frame_free(&out);
+	av_packet_free(&pkt);
+	av_packet_free(&out_pkt);
+	avcodec_free_context(&src_dec);
+	avformat_close_input(&fctx);
+	free(e.samples);
+	free(e.gx);
+	free(e.gy);
+	free(e.suppressed);
+	return EXIT_SUCCESS;
+}
@@ -16,7 +16,9 @@
  */
 
 #include "window.h"
+#include "metrics.h"
 #include "pexit.h"
+#include "probe.h"
 #include <inttypes.h>
 
 win_ctx *window_init()
@@ -168,8 +170,10 @@ static int queue_flusher(void *p)
 	SDL_UnlockMutex(w->queue_mutex);
 	SDL_CondSignal(w->queue_cond);
 
-	while ((f = queue_extract(frames)))
+	while ((f = queue_extract(frames))) {
 		av_frame_free(&f);
+		metrics_count(METRIC_DROPPED);
+	}
 
 	while ((t = queue_extract(timestamps)))
 		free(t);
@@ -227,6 +231,7 @@ int frame_refresh(win_ctx *wc)
 
 	if (wc->abort) {
 		SDL_RenderPresent(ren);
+		metrics_count(METRIC_DROPPED);
 		flusher = SDL_CreateThread(queue_flusher, "flusher", wc);
 		SDL_DetachThread(flusher);
 		return 1;
@@ -256,12 +261,16 @@ int frame_refresh(win_ctx *wc)
 
 	if (uremaining > 0)
 		av_usleep(uremaining);
+	else
+		metrics_count(METRIC_LATE);
 	/*
 	else
 		pexit("presentation lag");
 	*/
 
 	SDL_RenderPresent(ren);
+	probe_presented(f);
+	metrics_frame(PERF_REFRESH);
 	av_frame_free(&f);
 	free(enc_time);
 	return 0;